@@ -0,0 +1,203 @@
+/*
+ * Playback reference for echo cancellation
+ *
+ * Every sample written to the speaker is mixed down to mono, resampled to the
+ * AFE rate and put on a timeline counted in microphone samples. The feed task
+ * takes the reference for each microphone frame from that timeline and clears
+ * what it took, so time when nothing played reads as silence.
+ *
+ * Writes that come in while the feed is ahead restart at the feed's position.
+ * Writes that come in faster than real time, while the I2S DMA buffers fill
+ * at the start of a sound, run ahead of the feed by as much as is queued in
+ * front of the speaker. That is the delay the sound has before it reaches the
+ * microphones, so the reference lines up with the echo without tuning.
+ *
+ * Both sides run on every I2S write and every AFE frame, so the lock is only
+ * held to copy in or out, in at most two spans around the end of the buffer.
+ */
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "aec_ref.h"
+
+static const char *TAG = "aec_ref";
+
+#define AEC_REF_CHUNK       128
+
+static struct {
+    portMUX_TYPE lock;          /* guards everything below, held for a few memcpy at most */
+    int16_t *buf;               /* timeline, in PSRAM */
+    size_t capacity;
+    uint32_t rpos;              /* next sample the feed reads */
+    uint32_t wpos;              /* next sample a write lands on */
+    /* Format of the speaker PCM and the resampler's state in it */
+    uint32_t format;            /* bumped by every format change, a write in the old one stops */
+    uint32_t in_rate;
+    uint32_t bits;
+    uint32_t channels;
+    uint32_t acc;               /* how far the current input frame is past the last output, see aec_ref_write */
+    int32_t prev;               /* last input frame, mono */
+} s_ref = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+    .in_rate = AEC_REF_RATE,
+    .bits = 16,
+    .channels = 2,
+};
+
+esp_err_t aec_ref_init(size_t capacity)
+{
+    if (s_ref.buf) {
+        /* Kept when speech recognition restarts */
+        return ESP_OK;
+    }
+    ESP_RETURN_ON_FALSE(capacity > 0, ESP_ERR_INVALID_ARG, TAG, "invalid capacity");
+
+    int16_t *buf = heap_caps_calloc(capacity, sizeof(int16_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    ESP_RETURN_ON_FALSE(NULL != buf, ESP_ERR_NO_MEM, TAG, "Failed create reference buffer");
+
+    portENTER_CRITICAL(&s_ref.lock);
+    s_ref.capacity = capacity;
+    s_ref.rpos = 0;
+    s_ref.wpos = 0;
+    s_ref.buf = buf;
+    portEXIT_CRITICAL(&s_ref.lock);
+    return ESP_OK;
+}
+
+void aec_ref_set_format(uint32_t rate, uint32_t bits, uint32_t channels)
+{
+    portENTER_CRITICAL(&s_ref.lock);
+    s_ref.format++;
+    s_ref.in_rate = rate ? rate : AEC_REF_RATE;
+    s_ref.bits = bits;
+    s_ref.channels = channels ? channels : 1;
+    s_ref.acc = 0;
+    s_ref.prev = 0;
+    portEXIT_CRITICAL(&s_ref.lock);
+}
+
+/* Appends resampled reference in `format`, drops what does not fit in front of the feed. False once the format changed. */
+static bool aec_ref_push(const int16_t *ref, size_t n, uint32_t format)
+{
+    portENTER_CRITICAL(&s_ref.lock);
+    if (format != s_ref.format) {
+        portEXIT_CRITICAL(&s_ref.lock);
+        return false;
+    }
+    if ((int32_t)(s_ref.wpos - s_ref.rpos) < 0) {
+        s_ref.wpos = s_ref.rpos;
+    }
+    size_t room = s_ref.capacity - (s_ref.wpos - s_ref.rpos);
+    n = n < room ? n : room;
+    size_t start = s_ref.wpos % s_ref.capacity;
+    size_t first = n < s_ref.capacity - start ? n : s_ref.capacity - start;
+    memcpy(s_ref.buf + start, ref, first * sizeof(int16_t));
+    memcpy(s_ref.buf, ref + first, (n - first) * sizeof(int16_t));
+    s_ref.wpos += n;
+    portEXIT_CRITICAL(&s_ref.lock);
+    return true;
+}
+
+void aec_ref_write(const void *pcm, size_t len)
+{
+    if (NULL == s_ref.buf) {
+        return;
+    }
+
+    /* The resampler runs on a copy, set_format() may come from another task meanwhile */
+    portENTER_CRITICAL(&s_ref.lock);
+    uint32_t format = s_ref.format;
+    uint32_t bits = s_ref.bits;
+    uint32_t channels = s_ref.channels;
+    uint32_t in_rate = s_ref.in_rate;
+    uint32_t acc = s_ref.acc;
+    int32_t prev = s_ref.prev;
+    portEXIT_CRITICAL(&s_ref.lock);
+    if (16 != bits) {
+        return;
+    }
+
+    const int16_t *in = pcm;
+    size_t frames = len / (channels * sizeof(int16_t));
+    int16_t out[AEC_REF_CHUNK];
+    size_t n = 0;
+
+    /*
+     * Linear interpolation between input frames. `acc` counts in units of
+     * 1 / (in_rate * AEC_REF_RATE) s: an input frame is AEC_REF_RATE of them,
+     * an output sample in_rate. After an output is due, `acc` is how far the
+     * current frame lies past it, always less than one input frame.
+     */
+    for (size_t f = 0; f < frames; f++) {
+        int32_t x = in[f * channels];
+        if (2 == channels) {
+            x = (x + in[f * channels + 1]) / 2;
+        }
+        acc += AEC_REF_RATE;
+        while (acc >= in_rate) {
+            acc -= in_rate;
+            out[n++] = x + (prev - x) * (int32_t)acc / AEC_REF_RATE;
+            if (AEC_REF_CHUNK == n) {
+                if (!aec_ref_push(out, n, format)) {
+                    return;
+                }
+                n = 0;
+            }
+        }
+        prev = x;
+    }
+    if (n && !aec_ref_push(out, n, format)) {
+        return;
+    }
+
+    portENTER_CRITICAL(&s_ref.lock);
+    if (format == s_ref.format) {
+        s_ref.acc = acc;
+        s_ref.prev = prev;
+    }
+    portEXIT_CRITICAL(&s_ref.lock);
+}
+
+void aec_ref_feed(int16_t *frame, const int16_t *mic, size_t mic_num, size_t samples)
+{
+    size_t channels = mic_num + 1;
+    int16_t chunk[AEC_REF_CHUNK];
+
+    /* Reference taken out in chunks, the frame is built from them outside the lock in one pass */
+    for (size_t done = 0; done < samples;) {
+        size_t n = samples - done < AEC_REF_CHUNK ? samples - done : AEC_REF_CHUNK;
+
+        if (NULL == s_ref.buf) {
+            memset(chunk, 0, n * sizeof(int16_t));
+        } else {
+            portENTER_CRITICAL(&s_ref.lock);
+            size_t start = s_ref.rpos % s_ref.capacity;
+            size_t first = n < s_ref.capacity - start ? n : s_ref.capacity - start;
+            memcpy(chunk, s_ref.buf + start, first * sizeof(int16_t));
+            memcpy(chunk + first, s_ref.buf, (n - first) * sizeof(int16_t));
+            memset(s_ref.buf + start, 0, first * sizeof(int16_t));
+            memset(s_ref.buf, 0, (n - first) * sizeof(int16_t));
+            s_ref.rpos += n;
+            portEXIT_CRITICAL(&s_ref.lock);
+        }
+
+        const int16_t *in = mic + done * mic_num;
+        int16_t *out = frame + done * channels;
+        if (2 == mic_num) {
+            for (size_t i = 0; i < n; i++, in += 2, out += 3) {
+                out[0] = in[0];
+                out[1] = in[1];
+                out[2] = chunk[i];
+            }
+        } else {
+            for (size_t i = 0; i < n; i++, in += mic_num, out += channels) {
+                memcpy(out, in, mic_num * sizeof(int16_t));
+                out[mic_num] = chunk[i];
+            }
+        }
+        done += n;
+    }
+}
@@ -0,0 +1,50 @@
+/*
+ * Playback reference for echo cancellation
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Rate of the reference, the one the AFE runs at */
+#define AEC_REF_RATE            16000
+
+/**
+ * @brief Start keeping a reference of what the speaker plays, `capacity` samples at AEC_REF_RATE
+ *
+ * Until this is called writes are ignored. Calling it again keeps the buffer there is.
+ */
+esp_err_t aec_ref_init(size_t capacity);
+
+/**
+ * @brief Format of the PCM written to the speaker from now on
+ *
+ * Only 16-bit samples are kept, other widths leave the reference silent.
+ */
+void aec_ref_set_format(uint32_t rate, uint32_t bits, uint32_t channels);
+
+/**
+ * @brief Keep a copy of PCM that was just written to the speaker, from any task
+ */
+void aec_ref_write(const void *pcm, size_t len);
+
+/**
+ * @brief Build the AFE input for the next `samples` microphone samples: the microphones, then the reference
+ *
+ * Called by the feed task once per microphone frame, which is the clock the
+ * reference is kept against. Silence where nothing played.
+ *
+ * @param frame Gets `mic_num` + 1 channels per sample, the AFE's "MMR" layout for two microphones
+ * @param mic The microphone frame as captured, `mic_num` channels per sample
+ */
+void aec_ref_feed(int16_t *frame, const int16_t *mic, size_t mic_num, size_t samples);
+
+#ifdef __cplusplus
+}
+#endif
@@ -5,10 +5,13 @@
  */
 
 #include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/event_groups.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_task_wdt.h"
 #include "esp_check.h"
 #include "esp_err.h"
@@ -25,22 +28,51 @@
 #include "file_iterator.h"
 #include "app_ui_ctrl.h"
 #include "app_wifi.h"
+#include "audio_enc.h"
+#include "audio_resample.h"
+#include "audio_arena.h"
+#include "audio_cue.h"
+#include "audio_playback.h"
+#include "turn_queue.h"
+#include "gemini.h"
+#include "turn_trace.h"
+#include "sr_cmd.h"
 
 static const char *TAG = "app_audio";
 
-#if !CONFIG_BSP_BOARD_ESP32_S3_BOX_Lite
-static bool mute_flag = true;
-#endif
-bool record_flag = false;
-uint32_t record_total_len = 0;
-uint32_t file_total_len = 0;
-static uint8_t *record_audio_buffer = NULL;
-uint8_t *audio_rx_buffer = NULL;
+/* Upload the recording to Gemini while it is being captured */
+#define AUDIO_UPLOAD_PIPELINED  (CONFIG_GEMINI_PIPELINED_UPLOAD && DEBUG_SAVE_PCM)
+#define AUDIO_UPLOAD_POLL_MS    50
+/* How often a turn waiting on a lock checks whether it was given up on */
+#define AUDIO_TURN_POLL_MS      100
+/* How long the wake word waits for the turn it talked over to let go of the Gemini client, then of the recording */
+#define AUDIO_TURN_ABORT_WAIT_MS    300
+#define AUDIO_TURN_ARENA_WAIT_MS    1000
+/* How long a task waits for room in the SR event queue before it says so and waits again */
+#define AUDIO_EVENT_POST_MS     500
+/* Recorder requests, sent as task notification bits */
+#define AUDIO_RECORD_START      BIT0
+#define AUDIO_RECORD_STOP       BIT1
+#define AUDIO_RECORD_POLL_MS    20
+#define AUDIO_CAPTURE_RATE      16000
+#define AUDIO_RECORD_RATE       CONFIG_AUDIO_UPLOAD_SAMPLE_RATE
+/* Recordings grow by 32 KB of PSRAM at a time */
+#define AUDIO_RECORD_SEGMENT    (4 * AUDIO_ENC_BLOCK_SAMPLES)
+#define AUDIO_OFFLINE_TEXT      "No Wi-Fi. I'll answer once I'm back online."
+#define AUDIO_OFFLINE_PANEL_MS  2000
+/* Cues of every turn, preloaded */
+#define AUDIO_WAKE_CUE          "/spiffs/echo_en_wake.wav"
+#define AUDIO_OK_CUE            "/spiffs/echo_en_ok.wav"
+#define AUDIO_WAIT_CUE          "/spiffs/waitPlease.mp3"
+
 audio_play_finish_cb_t audio_play_finish_cb = NULL;
+static audio_command_cb_t audio_command_cb = NULL;
 
 extern sr_data_t *g_sr_data;
-extern esp_err_t start_openai(uint8_t *audio, int audio_len);
-extern int Cache_WriteBack_Addr(uint32_t addr, uint32_t size);
+extern gemini_client_t *g_gemini_client;
+extern esp_err_t start_openai(const uint8_t *upload, size_t upload_len, const char *mime_type);
+extern esp_err_t start_openai_upload(const char *mime_type);
+extern esp_err_t finish_openai_upload(void);
 
 /* main function */
 void mute_btn_handler(void *handle, void *arg)
@@ -48,12 +80,17 @@ void mute_btn_handler(void *handle, void *arg)
 #if !CONFIG_BSP_BOARD_ESP32_S3_BOX_Lite
     button_event_t event = (button_event_t)arg;
 
+    /* On the esp_timer task, which must not block */
     if (BUTTON_PRESS_DOWN == event) {
         esp_rom_printf(DRAM_STR("Audio Mute On\r\n"));
-        mute_flag = true;
+        if (ESP_OK != app_sr_post_event(SR_EVENT_MUTE, 0)) {
+            ESP_LOGE(TAG, "SR handler busy, mute dropped");
+        }
     } else {
         esp_rom_printf(DRAM_STR("Audio Mute Off\r\n"));
-        mute_flag = false;
+        if (ESP_OK != app_sr_post_event(SR_EVENT_UNMUTE, 0)) {
+            ESP_LOGE(TAG, "SR handler busy, unmute dropped");
+        }
     }
 #endif
 }
@@ -63,7 +100,7 @@ static esp_err_t audio_mute_function(AUDIO_PLAYER_MUTE_SETTING setting)
     bsp_codec_mute_set(setting == AUDIO_PLAYER_MUTE ? true : false);
     // restore the voice volume upon unmuting
     if (setting == AUDIO_PLAYER_UNMUTE) {
-        bsp_codec_volume_set(CONFIG_VOLUME_LEVEL, NULL);
+        bsp_codec_volume_set(audio_playback_volume(), NULL);
     }
     return ESP_OK;
 }
@@ -75,7 +112,7 @@ static esp_err_t audio_codec_set_fs(uint32_t rate, uint32_t bits_cfg, i2s_slot_m
 
     bsp_codec_mute_set(true);
     bsp_codec_mute_set(false);
-    bsp_codec_volume_set(CONFIG_VOLUME_LEVEL, NULL);
+    bsp_codec_volume_set(audio_playback_volume(), NULL);
     vTaskDelay(pdMS_TO_TICKS(50));
 
     return ret;
@@ -87,6 +124,7 @@ static void audio_player_cb(audio_player_cb_ctx_t *ctx)
     case AUDIO_PLAYER_CALLBACK_EVENT_IDLE:
         ESP_LOGI(TAG, "Player IDLE");
         bsp_codec_set_fs(16000, 16, 2);
+        audio_playback_player_idle();
         if (audio_play_finish_cb) {
             audio_play_finish_cb();
         }
@@ -96,6 +134,7 @@ static void audio_player_cb(audio_player_cb_ctx_t *ctx)
         break;
     case AUDIO_PLAYER_CALLBACK_EVENT_PLAYING:
         ESP_LOGI(TAG, "Player PLAYING");
+        turn_trace_mark(TURN_PHASE_PLAYBACK);
         break;
     case AUDIO_PLAYER_CALLBACK_EVENT_PAUSE:
         ESP_LOGI(TAG, "Player PAUSE");
@@ -108,21 +147,144 @@ static void audio_player_cb(audio_player_cb_ctx_t *ctx)
     }
 }
 
-void audio_record_init()
+/* Recorder state, see audio_record_task() */
+static struct {
+    TaskHandle_t task;
+    SemaphoreHandle_t ack;
+    uint32_t start_seq;     /* ring frame of the fetch the wake word was detected in, set before AUDIO_RECORD_START */
+    uint32_t first_seq;     /* ring frame the recording begins with, set by the recorder */
+    audio_resample_t *resample;     /* to AUDIO_RECORD_RATE, NULL when recording at the capture rate */
+    audio_arena_t *arena;   /* mono samples at AUDIO_RECORD_RATE, appended by the recorder only */
+    int16_t *pcm;           /* one frame on its way into the arena */
+    bool full;
+} s_record;
+
+void audio_record_save(const int16_t *frame, int samples, int channels)
 {
-    /* Create file if record to SD card enabled*/
 #if DEBUG_SAVE_PCM
-    record_audio_buffer = heap_caps_calloc(1, FILE_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-    assert(record_audio_buffer);
-    printf("successfully created record_audio_buffer with a size: %zu\n", FILE_SIZE);
-    audio_rx_buffer = heap_caps_calloc(1, MAX_FILE_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-    assert(audio_rx_buffer);
-    printf("audio_rx_buffer with a size: %zu\n", MAX_FILE_SIZE);
+    size_t n = samples;
+    if (s_record.resample) {
+        n = audio_resample_process(s_record.resample, frame, samples, channels, s_record.pcm);
+    } else {
+        for (int i = 0; i < samples; i++) {
+            s_record.pcm[i] = frame[i * channels + 0];
+        }
+    }
+    /* The uploader reads the samples once it sees the new length */
+    if (audio_arena_write(s_record.arena, s_record.pcm, n) < n && !s_record.full) {
+        ESP_LOGW(TAG, "recording full, the rest of the turn is not kept");
+        s_record.full = true;
+    }
+#endif
+}
+
+/*
+ * Recorder task: the only writer of the recording arena.
+ * It copies microphone frames from the feed ring while a recording is open,
+ * so the feed task never touches recording state. sr_handler_task opens and
+ * closes recordings with task notifications and waits for the acknowledgement.
+ */
+
+static void audio_record_task(void *arg)
+{
+    audio_ring_t *ring = g_sr_data->audio_ring;
+    int channels = audio_ring_channels(ring);
+    int samples = audio_ring_frame_size(ring) / (channels * sizeof(int16_t));
+    audio_ring_reader_t reader;
+    bool recording = false;
+
+    int16_t *frame = heap_caps_malloc(audio_ring_frame_size(ring), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(frame);
+#if AUDIO_RECORD_RATE != AUDIO_CAPTURE_RATE
+    ESP_ERROR_CHECK(audio_resample_create(AUDIO_CAPTURE_RATE, AUDIO_RECORD_RATE, 1, &s_record.resample));
 #endif
+    s_record.pcm = heap_caps_malloc((samples + 2) * sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(s_record.pcm);
 
-    if (record_audio_buffer == NULL || audio_rx_buffer == NULL) {
-        printf("Error: Failed to allocate memory for buffers\n");
-        return; // Return or handle the error condition appropriately
+    while (true) {
+        uint32_t request = 0;
+        /* Idle until a recording starts, then poll the ring about once per frame */
+        xTaskNotifyWait(0, UINT32_MAX, &request, recording ? pdMS_TO_TICKS(AUDIO_RECORD_POLL_MS) : portMAX_DELAY);
+
+        if (request & AUDIO_RECORD_START) {
+            /* Begin with the pre-roll, but not with frames the feed never wrote */
+            uint32_t preroll = g_sr_data->preroll_frames;
+            s_record.first_seq = s_record.start_seq > preroll ? s_record.start_seq - preroll : 0;
+            audio_ring_reader_init(&reader, s_record.first_seq);
+            if (s_record.resample) {
+                audio_resample_reset(s_record.resample);
+            }
+            audio_arena_release(s_record.arena);
+            s_record.full = false;
+            recording = true;
+            xSemaphoreGive(s_record.ack);
+        }
+        if (!recording) {
+            if (request & AUDIO_RECORD_STOP) {
+                xSemaphoreGive(s_record.ack);
+            }
+            continue;
+        }
+
+        /* On stop, everything the feed delivered until now still belongs to the recording */
+        uint32_t stop = audio_ring_head(ring);
+        while ((!(request & AUDIO_RECORD_STOP) || (int32_t)(stop - reader.next) > 0)
+                && ESP_OK == audio_ring_read(ring, &reader, frame, NULL)) {
+            audio_record_save(frame, samples, channels);
+        }
+        if (request & AUDIO_RECORD_STOP) {
+            if (reader.dropped) {
+                ESP_LOGW(TAG, "recorder fell behind, %" PRIu32 " frames lost", reader.dropped);
+            }
+            recording = false;
+            xSemaphoreGive(s_record.ack);
+        }
+    }
+}
+
+/* Sends a request to the recorder and waits until it has been carried out */
+static void audio_record_request(uint32_t request)
+{
+    if (NULL == s_record.task) {
+        return;
+    }
+    xTaskNotify(s_record.task, request, eSetBits);
+    xSemaphoreTake(s_record.ack, portMAX_DELAY);
+}
+
+static void audio_offline_init(void);
+static void audio_turn_init(void);
+
+/* For events the state machine can't do without: waits for room as long as the handler is busy, until SR stops */
+static void audio_post_event(const sr_event_t *event)
+{
+    while (ESP_ERR_TIMEOUT == app_sr_post(event, pdMS_TO_TICKS(AUDIO_EVENT_POST_MS))) {
+        ESP_LOGW(TAG, "SR handler busy, still waiting to post %s", sr_fsm_event_name(event->type));
+    }
+}
+
+static void audio_playback_idle(void)
+{
+    sr_event_t event = {
+        .type = SR_EVENT_PLAY_DONE,
+    };
+    audio_post_event(&event);
+}
+
+void audio_record_init()
+{
+    /* Segments are only taken from PSRAM while a turn is recorded */
+    ESP_ERROR_CHECK(audio_arena_create(AUDIO_RECORD_SEGMENT, CONFIG_AUDIO_RECORD_MAX_S * AUDIO_RECORD_RATE, &s_record.arena));
+
+    s_record.ack = xSemaphoreCreateBinary();
+    assert(s_record.ack);
+    BaseType_t ret_val = xTaskCreatePinnedToCore(&audio_record_task, "Record Task", 4 * 1024, NULL, 5, &s_record.task, 0);
+    assert(pdPASS == ret_val);
+
+    /* Only what every turn plays, the other files in spiffs/ are played from flash */
+    static const char *const cues[] = { AUDIO_WAKE_CUE, AUDIO_OK_CUE, AUDIO_WAIT_CUE };
+    if (ESP_OK != audio_cue_load(cues, sizeof(cues) / sizeof(cues[0]))) {
+        ESP_LOGW(TAG, "some cues are played from flash");
     }
 
     file_iterator_instance_t *file_iterator = file_iterator_new(BSP_SPIFFS_MOUNT_POINT);
@@ -135,210 +297,756 @@ void audio_record_init()
                                    };
     ESP_ERROR_CHECK(audio_player_new(config));
     audio_player_callback_register(audio_player_cb, NULL);
+    ESP_ERROR_CHECK(audio_playback_init());
+    audio_playback_register_idle_cb(audio_playback_idle);
+    audio_offline_init();
+    audio_turn_init();
 }
 
-void audio_record_save(int16_t *audio_buffer, int audio_chunksize)
+void audio_register_play_finish_cb(audio_play_finish_cb_t cb)
 {
-#if DEBUG_SAVE_PCM
-    if (record_flag) {
-        uint16_t *record_buff = (uint16_t *)(record_audio_buffer + sizeof(wav_header_t));
-        record_buff += record_total_len;
-        for (int i = 0; i < (audio_chunksize - 1); i++) {
-            if (record_total_len < (MAX_FILE_SIZE - sizeof(wav_header_t)) / 2) {
-#if PCM_ONE_CHANNEL
-                record_buff[ i * 1 + 0] = audio_buffer[i * 3 + 0];
-                record_total_len += 1;
-#else
-                record_buff[ i * 2 + 0] = audio_buffer[i * 3 + 0];
-                record_buff[ i * 2 + 1] = audio_buffer[i * 3 + 1];
-                record_total_len += 2;
-#endif
-            }
-        }
-    }
-#endif
+    audio_play_finish_cb = cb;
 }
 
-void audio_register_play_finish_cb(audio_play_finish_cb_t cb)
+void audio_register_command_cb(audio_command_cb_t cb)
 {
-    audio_play_finish_cb = cb;
+    audio_command_cb = cb;
 }
 
-static void audio_record_start()
+/* Opens a recording at ring frame `seq`, plus the pre-roll before it */
+static void audio_record_start(uint32_t seq)
 {
 #if DEBUG_SAVE_PCM
     ESP_LOGI(TAG, "### record Start");
-    audio_player_stop();
-
-    record_flag = true;
-    record_total_len = 0;
-    file_total_len = sizeof(wav_header_t);
+    /* Whatever played from the last turn was flushed by the detect task already */
+    s_record.start_seq = seq;
+    audio_record_request(AUDIO_RECORD_START);
 #endif
 }
 
-static esp_err_t audio_record_stop()
+/* `samples` gets the number of recorded 16-bit samples, may be NULL */
+static esp_err_t audio_record_stop(uint32_t *samples)
 {
-    esp_err_t ret = ESP_OK;
 #if DEBUG_SAVE_PCM
-    record_flag = false;
-#if PCM_ONE_CHANNEL
-    record_total_len *= 1;
-#else
-    record_total_len *= 2;
-#endif
-    file_total_len += record_total_len;
+    audio_record_request(AUDIO_RECORD_STOP);
+    uint32_t recorded = audio_arena_len(s_record.arena);
+    if (samples) {
+        *samples = recorded;
+    }
+    turn_trace_mark(TURN_PHASE_RECORD_STOP);
     ESP_LOGI(TAG, "### record Stop, %" PRIu32 " %" PRIu32 "K", \
-             record_total_len, \
-             record_total_len / 1024);
-
-    FILE *fp = fopen("/spiffs/echo_en_wake.wav", "r");
-    ESP_GOTO_ON_FALSE(NULL != fp, ESP_FAIL, err, TAG, "Failed create record file");
+             recorded * (uint32_t)sizeof(int16_t), \
+             recorded * (uint32_t)sizeof(int16_t) / 1024);
+#endif
+    return ESP_OK;
+}
 
-    wav_header_t wav_head;
-    int len = fread(&wav_head, 1, sizeof(wav_header_t), fp);
-    ESP_GOTO_ON_FALSE(len > 0, ESP_FAIL, err, TAG, "Failed create record file");
+/*
+ * Gets the part [begin, end) of a recording of `recorded` samples worth
+ * uploading. Returns false, with the whole recording, while no speech was heard.
+ */
+static bool audio_record_window(uint32_t recorded, uint32_t *begin, uint32_t *end)
+{
+    *begin = 0;
+    *end = recorded;
+#if CONFIG_AUDIO_TRIM_SILENCE
+    vad_trim_t speech;
+    uint32_t first, last;
+    if (ESP_OK != app_sr_get_speech(&speech) || !vad_trim_window(&speech, &first, &last)) {
+        return false;
+    }
 
-    wav_head.SampleRate = 16000;
-#if PCM_ONE_CHANNEL
-    wav_head.NumChannels = 1;
-#else
-    wav_head.NumChannels = 2;
+    /* Ring frames to recorded samples, frames from before the recording count as its start */
+    audio_ring_t *ring = g_sr_data->audio_ring;
+    uint32_t frame = audio_ring_frame_size(ring) / (audio_ring_channels(ring) * sizeof(int16_t))
+                     * AUDIO_RECORD_RATE / AUDIO_CAPTURE_RATE;
+    uint32_t frames = recorded / frame + 1;
+    if ((int32_t)(first - s_record.first_seq) > 0) {
+        first -= s_record.first_seq;
+        *begin = first < frames ? MIN(first * frame, recorded) : recorded;
+    }
+    if (UINT32_MAX != last && (int32_t)(last - s_record.first_seq) > 0) {
+        last -= s_record.first_seq;
+        *end = last < frames ? MIN(last * frame, recorded) : recorded;
+    }
+    if (*end <= *begin) {
+        *begin = 0;
+        *end = recorded;
+        return false;
+    }
 #endif
-    wav_head.BitsPerSample = 16;
-    wav_head.ChunkSize = file_total_len - 8;
-    wav_head.ByteRate = wav_head.SampleRate * wav_head.BitsPerSample * wav_head.NumChannels / 8;
-    wav_head.Subchunk2ID[0] = 'd';
-    wav_head.Subchunk2ID[1] = 'a';
-    wav_head.Subchunk2ID[2] = 't';
-    wav_head.Subchunk2ID[3] = 'a';
-    wav_head.Subchunk2Size = record_total_len;
-    memcpy((void *)record_audio_buffer, &wav_head, sizeof(wav_header_t));
-    Cache_WriteBack_Addr((uint32_t)record_audio_buffer, record_total_len);
+    return true;
+}
 
-#endif
-err:
-    if (fp) {
-        fclose(fp);
+typedef struct {
+    uint32_t begin;
+    int16_t *scratch;
+} audio_record_reader_t;
+
+static const int16_t *audio_record_read(size_t index, size_t samples, void *user_ctx)
+{
+    audio_record_reader_t *reader = user_ctx;
+    return audio_arena_read(s_record.arena, reader->begin + index, samples, reader->scratch);
+}
+
+/*
+ * Encodes the part of a finished recording worth uploading, with the default
+ * codec or as WAV if that fails. Release the result with audio_enc_release().
+ */
+static esp_err_t audio_record_encode(uint32_t samples, const audio_enc_t **enc, uint8_t **out, size_t *out_len)
+{
+    esp_err_t ret = ESP_OK;
+    uint32_t end;
+    audio_record_reader_t reader = {
+        .scratch = heap_caps_malloc(AUDIO_ENC_BLOCK_SAMPLES * sizeof(int16_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT),
+    };
+    ESP_RETURN_ON_FALSE(NULL != reader.scratch, ESP_ERR_NO_MEM, TAG, "scratch malloc failed");
+
+    audio_record_window(samples, &reader.begin, &end);
+    if (end - reader.begin < samples) {
+        ESP_LOGI(TAG, "speech is samples %" PRIu32 "-%" PRIu32 " of %" PRIu32, reader.begin, end, samples);
+    }
+    turn_trace_mark(TURN_PHASE_WAV_DONE);
+
+    *enc = audio_enc_get_default();
+    ret = audio_enc_encode(*enc, AUDIO_RECORD_RATE, end - reader.begin, audio_record_read, &reader, out, out_len);
+    if (ESP_OK != ret) {
+        ESP_LOGW(TAG, "%s encode failed, uploading wav", (*enc)->name);
+        *enc = audio_enc_get(AUDIO_ENC_WAV);
+        ret = audio_enc_encode(*enc, AUDIO_RECORD_RATE, end - reader.begin, audio_record_read, &reader, out, out_len);
     }
+    turn_trace_mark(TURN_PHASE_ENCODE_DONE);
+    free(reader.scratch);
     return ret;
 }
 
-esp_err_t audio_play_task(void *filepath)
+#if AUDIO_UPLOAD_PIPELINED
+/*
+ * Uploader task started at the wake word. It encodes every full block of the
+ * recording as soon as the feed task has written it and sends it as one HTTP
+ * chunk, so only the last block is left to upload once the child stops talking.
+ */
+static struct {
+    TaskHandle_t task;
+    SemaphoreHandle_t done;
+    volatile bool stop;
+    volatile bool cancel;
+    volatile uint32_t total;    /* samples recorded, valid once stop is set */
+    esp_err_t result;
+} s_upload;
+
+static void audio_upload_task(void *arg)
 {
-    FILE *fp = NULL;
-    struct stat file_stat;
+    const audio_enc_t *enc = audio_enc_get_default();
+    size_t out_size = enc->block_max(AUDIO_ENC_BLOCK_SAMPLES);
+    uint32_t sent = 0;
+    uint32_t begin = 0;
+    uint32_t end = 0;
+    uint32_t offset = 0;        /* first sample sent, index 0 of the stream */
+    bool started = false;
+    bool notified = false;      /* audio_upload_stop() has notified the task */
+    size_t len = 0;
     esp_err_t ret = ESP_OK;
 
-    const size_t chunk_size = 4096;
-    uint8_t *buffer = malloc(chunk_size);
-    ESP_GOTO_ON_FALSE(NULL != buffer, ESP_FAIL, EXIT, TAG, "buffer malloc failed");
+    uint8_t *out = heap_caps_malloc(out_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    int16_t *scratch = heap_caps_malloc(AUDIO_ENC_BLOCK_SAMPLES * sizeof(int16_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    ESP_GOTO_ON_FALSE(NULL != out && NULL != scratch, ESP_ERR_NO_MEM, exit, TAG, "upload buffer malloc failed");
+    ESP_GOTO_ON_ERROR(start_openai_upload(enc->mime_type), exit, TAG, "upload start failed");
+
+    /* Length unknown yet, the stream header says so */
+    len = enc->header(AUDIO_RECORD_RATE, 0, out);
+    ret = gemini_upload_write(g_gemini_client, out, len);
+    while (ESP_OK == ret) {
+        if (s_upload.cancel) {
+            ret = ESP_ERR_INVALID_STATE;
+            break;
+        }
+        bool stop = s_upload.stop;
+        uint32_t recorded = stop ? s_upload.total : audio_arena_len(s_record.arena);
+        /* Leading silence is skipped, trailing silence held back until speech resumes or the turn ends */
+        bool known = audio_record_window(recorded, &begin, &end);
+        if (!started && ((known && begin < recorded) || stop)) {
+            offset = sent = begin;
+            started = true;
+        }
+        uint32_t pending = started && end > sent ? end - sent : 0;
+        if (pending >= AUDIO_ENC_BLOCK_SAMPLES || (stop && pending > 0)) {
+            size_t n = pending > AUDIO_ENC_BLOCK_SAMPLES ? AUDIO_ENC_BLOCK_SAMPLES : pending;
+            const int16_t *pcm = audio_arena_read(s_record.arena, sent, n, scratch);
+            ret = enc->block(pcm, n, sent - offset, out, out_size, &len);
+            if (ESP_OK == ret) {
+                ret = gemini_upload_write(g_gemini_client, out, len);
+            }
+            sent += n;
+            continue;
+        }
+        if (stop) {
+            turn_trace_mark(TURN_PHASE_ENCODE_DONE);
+            break;
+        }
+        notified |= ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(AUDIO_UPLOAD_POLL_MS)) > 0;
+    }
+    if (ESP_OK != ret) {
+        gemini_upload_abort(g_gemini_client);
+    }
+
+exit:
+    ESP_LOGI(TAG, "upload task done, %" PRIu32 " samples: %s", sent - offset, esp_err_to_name(ret));
+    free(out);
+    free(scratch);
+    /* The stopper notifies this task, so it may only go once that notification has arrived */
+    while (!notified) {
+        notified = ulTaskNotifyTake(pdTRUE, portMAX_DELAY) > 0;
+    }
+    s_upload.result = ret;
+    xSemaphoreGive(s_upload.done);
+    vTaskDelete(NULL);
+}
 
-    ESP_GOTO_ON_FALSE(-1 != stat(filepath, &file_stat), ESP_FAIL, EXIT, TAG, "Failed to stat file");
+/* Waits for the uploader to exit; with `cancel` the request is dropped, otherwise its body is completed */
+static esp_err_t audio_upload_stop(uint32_t total, bool cancel)
+{
+    if (NULL == s_upload.task) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_upload.total = total;
+    s_upload.cancel = cancel;
+    s_upload.stop = true;
+    xTaskNotifyGive(s_upload.task);
+    xSemaphoreTake(s_upload.done, portMAX_DELAY);
+    s_upload.task = NULL;
+    return s_upload.result;
+}
 
-    fp = fopen(filepath, "r");
-    ESP_GOTO_ON_FALSE(NULL != fp, ESP_FAIL, EXIT, TAG, "Failed create record file");
+static void audio_upload_start(void)
+{
+    if (s_upload.task) {
+        audio_upload_stop(0, true);
+    }
+    if (NULL == s_upload.done) {
+        s_upload.done = xSemaphoreCreateBinary();
+        if (NULL == s_upload.done) {
+            ESP_LOGE(TAG, "Failed create upload semaphore");
+            return;
+        }
+    }
 
-    wav_header_t wav_head;
-    int len = fread(&wav_head, 1, sizeof(wav_header_t), fp);
-    ESP_GOTO_ON_FALSE(len > 0, ESP_FAIL, EXIT, TAG, "Read wav header failed");
+    s_upload.stop = false;
+    s_upload.cancel = false;
+    s_upload.result = ESP_FAIL;
+    if (pdPASS != xTaskCreatePinnedToCore(&audio_upload_task, "Upload Task", 8 * 1024, NULL, 4, &s_upload.task, 0)) {
+        ESP_LOGE(TAG, "Failed create upload task");
+        s_upload.task = NULL;
+    }
+}
+#endif
 
-    if (NULL == strstr((char *)wav_head.Subchunk1ID, "fmt") &&
-            NULL == strstr((char *)wav_head.Subchunk2ID, "data")) {
-        ESP_LOGI(TAG, "PCM format");
-        fseek(fp, 0, SEEK_SET);
-        wav_head.SampleRate = 16000;
-        wav_head.NumChannels = 2;
-        wav_head.BitsPerSample = 16;
+/*
+ * Turns asked while offline. They wait in PSRAM and a task sends them in
+ * order after the station got an IP address, one at a time and only while
+ * the link holds: a send that fails because the link went down again puts
+ * the turn back and waits for the next address.
+ */
+static struct {
+    TaskHandle_t task;
+    SemaphoreHandle_t mutex;    /* guards queue */
+    SemaphoreHandle_t query;    /* one Gemini query at a time, held by the handler for a whole turn */
+    turn_queue_t queue;
+} s_offline;
+
+static void audio_offline_kick(void)
+{
+    if (s_offline.task) {
+        xTaskNotifyGive(s_offline.task);
     }
+}
 
-    ESP_LOGI(TAG, "frame_rate= %" PRIi32 ", ch=%d, width=%d", wav_head.SampleRate, wav_head.NumChannels, wav_head.BitsPerSample);
-    bsp_codec_set_fs(wav_head.SampleRate, wav_head.BitsPerSample, I2S_SLOT_MODE_STEREO);
+static void audio_offline_push(uint8_t *upload, size_t upload_len, const char *mime_type)
+{
+    xSemaphoreTake(s_offline.mutex, portMAX_DELAY);
+    size_t dropped = turn_queue_push(&s_offline.queue, upload, upload_len, mime_type);
+    size_t queued = turn_queue_len(&s_offline.queue);
+    xSemaphoreGive(s_offline.mutex);
+    ESP_LOGW(TAG, "offline, %u turns queued, %u dropped", (unsigned)queued, (unsigned)dropped);
 
-    bsp_codec_mute_set(true);
-    bsp_codec_mute_set(false);
-    bsp_codec_volume_set(CONFIG_VOLUME_LEVEL, NULL);
+    ui_ctrl_label_show_text(UI_CTRL_LABEL_LISTEN_SPEAK, AUDIO_OFFLINE_TEXT);
+    ui_ctrl_show_panel(UI_CTRL_PANEL_SLEEP, AUDIO_OFFLINE_PANEL_MS);
+    /* The link may be back already */
+    audio_offline_kick();
+}
 
-    size_t cnt, total_cnt = 0;
-    do {
-        /* Read file in chunks into the scratch buffer */
-        len = fread(buffer, 1, chunk_size, fp);
-        if (len <= 0) {
-            break;
-        } else if (len > 0) {
-            bsp_i2s_write(buffer, len, &cnt, portMAX_DELAY);
-            total_cnt += cnt;
+static bool audio_offline_link_up(void *ctx)
+{
+    return WIFI_STATUS_CONNECTED_OK == wifi_connected_already();
+}
+
+static bool audio_offline_send(const turn_queue_item_t *item, void *ctx)
+{
+    /* A turn in progress goes first */
+    xSemaphoreTake(s_offline.query, portMAX_DELAY);
+    ESP_LOGI(TAG, "sending queued turn %" PRIu32, item->id);
+    esp_err_t ret = start_openai(item->data, item->len, item->mime_type);
+    xSemaphoreGive(s_offline.query);
+    return ESP_OK == ret || audio_offline_link_up(ctx);
+}
+
+static void audio_offline_lock(void *ctx)
+{
+    xSemaphoreTake(s_offline.mutex, portMAX_DELAY);
+}
+
+static void audio_offline_unlock(void *ctx)
+{
+    xSemaphoreGive(s_offline.mutex);
+}
+
+static void audio_offline_task(void *arg)
+{
+    static const turn_queue_link_t link = {
+        .link_up = audio_offline_link_up,
+        .send = audio_offline_send,
+        .lock = audio_offline_lock,
+        .unlock = audio_offline_unlock,
+    };
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        turn_queue_drain(&s_offline.queue, &link);
+    }
+}
+
+static void audio_offline_net_cb(bool connected)
+{
+    sr_event_t event = {
+        .type = connected ? SR_EVENT_NET_UP : SR_EVENT_NET_DOWN,
+    };
+    audio_post_event(&event);
+}
+
+static void audio_offline_init(void)
+{
+    turn_queue_init(&s_offline.queue, CONFIG_OFFLINE_TURN_QUEUE_LEN, CONFIG_OFFLINE_TURN_QUEUE_KB * 1024, audio_enc_release);
+    s_offline.mutex = xSemaphoreCreateMutex();
+    s_offline.query = xSemaphoreCreateBinary();
+    assert(s_offline.mutex && s_offline.query);
+    xSemaphoreGive(s_offline.query);
+    BaseType_t ret_val = xTaskCreatePinnedToCore(&audio_offline_task, "Offline Task", 4 * 1024, NULL, 3, &s_offline.task, 0);
+    assert(pdPASS == ret_val);
+    /* The SR handler kicks the queue once it saw the link come back */
+    app_wifi_register_connected_cb(audio_offline_net_cb);
+    /* The link may have changed before the callback was in place */
+    audio_offline_net_cb(WIFI_STATUS_CONNECTED_OK == wifi_connected_already());
+}
+
+/*
+ * Turn task: carries a finished turn to its answer off the SR handler, which
+ * stays free for the wake word meanwhile. It completes the pipelined upload
+ * or encodes the recording and sends it (or queues it offline), shows the
+ * reply and posts SR_EVENT_REPLIED with the turn's number.
+ *
+ * The handler hands over the recording, the upload and the query lock with
+ * the turn. When the child talks over it, audio_turn_abort() gives up on
+ * the turn: the Gemini client is cancelled and the task drops the turn at its
+ * next step. The new turn only waits until the recording is no longer read.
+ */
+typedef struct {
+    uint32_t turn;              /* sr_fsm_t.turn */
+    uint32_t samples;
+    bool online;
+    bool query_locked;          /* holds s_offline.query, its upload may be running */
+} audio_turn_job_t;
+
+static struct {
+    TaskHandle_t task;
+    SemaphoreHandle_t arena;    /* held by whoever may read the recording */
+    portMUX_TYPE lock;          /* guards the fields below */
+    audio_turn_job_t job;
+    bool pending;               /* job waits for the task */
+    bool running;
+    bool querying;              /* the running turn holds s_offline.query, the Gemini client is its own */
+    bool cancel;                /* the running turn was given up on */
+} s_turn = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+static bool audio_turn_cancelled(void)
+{
+    portENTER_CRITICAL(&s_turn.lock);
+    bool cancel = s_turn.cancel;
+    portEXIT_CRITICAL(&s_turn.lock);
+    return cancel;
+}
+
+/*
+ * Takes the recording back after it was given up for a network wait. False
+ * once the turn was given up on, the recording belongs to the next one then.
+ */
+static bool audio_turn_arena_take(void)
+{
+    while (pdTRUE != xSemaphoreTake(s_turn.arena, pdMS_TO_TICKS(AUDIO_TURN_POLL_MS))) {
+        if (audio_turn_cancelled()) {
+            return false;
+        }
+    }
+    if (audio_turn_cancelled()) {
+        xSemaphoreGive(s_turn.arena);
+        return false;
+    }
+    return true;
+}
+
+/* Waits for a queued turn that is being sent right now, unless this one is given up on meanwhile */
+static bool audio_turn_query_lock(void)
+{
+    portENTER_CRITICAL(&s_turn.lock);
+    bool querying = s_turn.querying;
+    portEXIT_CRITICAL(&s_turn.lock);
+    while (!querying && pdTRUE != xSemaphoreTake(s_offline.query, pdMS_TO_TICKS(AUDIO_TURN_POLL_MS))) {
+        if (audio_turn_cancelled()) {
+            return false;
         }
-    } while (1);
+    }
+    portENTER_CRITICAL(&s_turn.lock);
+    s_turn.querying = true;
+    gemini_cancel(g_gemini_client, s_turn.cancel);
+    portEXIT_CRITICAL(&s_turn.lock);
+    return true;
+}
 
-EXIT:
-    if (fp) {
-        fclose(fp);
+/* Sends an encoded turn, or queues it when there is no link to send it over */
+static void audio_turn_send(const audio_enc_t *enc, uint8_t *upload, size_t upload_len, bool online)
+{
+    esp_err_t ret = ESP_ERR_INVALID_STATE;
+    if (online && audio_turn_query_lock()) {
+        ret = start_openai(upload, upload_len, enc->mime_type);
     }
-    if (buffer) {
-        free(buffer);
+    if (audio_turn_cancelled()) {
+        audio_enc_release(upload);
+        return;
     }
-    return ret;
+    /* Never sent, or the link went down while it was */
+    if (ESP_OK != ret && (!online || WIFI_STATUS_CONNECTED_OK != wifi_connected_already())) {
+        audio_offline_push(upload, upload_len, enc->mime_type);
+        turn_trace_end("queued");
+        return;
+    }
+    audio_enc_release(upload);
+    turn_trace_end(ESP_OK == ret ? "ok" : "error");
 }
 
-void sr_handler_task(void *pvParam)
+/* Called with the recording held, gives it back. A turn given up on ends without a trace, the next one has it. */
+static void audio_turn_run(const audio_turn_job_t *job)
 {
-#if !CONFIG_BSP_BOARD_ESP32_S3_BOX_Lite
-    static bool mute_state = false;
-    mute_flag = gpio_get_level(BSP_BUTTON_MUTE_IO);
-    printf("sr handle task, mute:%d\n", mute_flag);
+    const audio_enc_t *enc = NULL;
+    uint8_t *upload = NULL;
+    size_t upload_len = 0;
+
+#if AUDIO_UPLOAD_PIPELINED
+    if (job->query_locked) {
+        /* An upload started before the link went down is dropped, and so is one given up on */
+        esp_err_t ret = audio_upload_stop(job->samples, !job->online || audio_turn_cancelled());
+        if (ESP_OK == ret) {
+            /* Only needed again if the query has to be sent as a whole */
+            xSemaphoreGive(s_turn.arena);
+            audio_turn_query_lock();
+            ret = finish_openai_upload();
+            if (audio_turn_cancelled()) {
+                return;
+            }
+            if (ESP_OK == ret || ESP_ERR_INVALID_RESPONSE == ret) {
+                turn_trace_end(ESP_OK == ret ? "ok" : "error");
+                if (audio_turn_arena_take()) {
+                    audio_arena_release(s_record.arena);
+                    xSemaphoreGive(s_turn.arena);
+                }
+                return;
+            }
+            if (!audio_turn_arena_take()) {
+                return;
+            }
+        }
+        if (ESP_ERR_INVALID_STATE != ret) {
+            ESP_LOGW(TAG, "pipelined upload failed (%s), sending the recording", esp_err_to_name(ret));
+        }
+    }
 #endif
+    esp_err_t ret = audio_turn_cancelled() ? ESP_ERR_INVALID_STATE
+                    : audio_record_encode(job->samples, &enc, &upload, &upload_len);
+    audio_arena_release(s_record.arena);
+    xSemaphoreGive(s_turn.arena);
+    if (ESP_OK != ret) {
+        if (!audio_turn_cancelled()) {
+            turn_trace_end("error");
+        }
+        return;
+    }
+    audio_turn_send(enc, upload, upload_len, job->online);
+}
 
+static void audio_turn_task(void *arg)
+{
     while (true) {
-        if (NEED_DELETE && xEventGroupGetBits(g_sr_data->event_group)) {
-            xEventGroupSetBits(g_sr_data->event_group, HANDLE_DELETED);
-            vTaskDelete(NULL);
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        portENTER_CRITICAL(&s_turn.lock);
+        audio_turn_job_t job = s_turn.job;
+        bool found = s_turn.pending;
+        s_turn.pending = false;
+        s_turn.running = found;
+        s_turn.querying = found && job.query_locked;
+        s_turn.cancel = false;
+        portEXIT_CRITICAL(&s_turn.lock);
+        if (!found) {
+            /* Given up on before it started, the handler took it back */
+            continue;
         }
 
-        sr_result_t result = {
-            .wakenet_mode = WAKENET_NO_DETECT,
-            .state = ESP_MN_STATE_DETECTING,
+        audio_turn_run(&job);
+
+        portENTER_CRITICAL(&s_turn.lock);
+        bool querying = s_turn.querying;
+        bool cancel = s_turn.cancel;
+        s_turn.running = false;
+        s_turn.querying = false;
+        if (querying) {
+            gemini_cancel(g_gemini_client, false);
+        }
+        portEXIT_CRITICAL(&s_turn.lock);
+        if (querying) {
+            xSemaphoreGive(s_offline.query);
+        }
+        ESP_LOGI(TAG, "turn %" PRIu32 " %s", job.turn, cancel ? "given up on" : "done");
+        /* Even when given up on, the state machine knows the reply is too late */
+        sr_event_t event = {
+            .type = SR_EVENT_REPLIED,
+            .turn = job.turn,
         };
+        audio_post_event(&event);
+    }
+}
 
-        app_sr_get_result(&result, pdMS_TO_TICKS(1 * 1000));
+/* Hands a finished turn to the turn task, along with the recording, its upload and the query lock */
+static void audio_turn_submit(const audio_turn_job_t *job)
+{
+    portENTER_CRITICAL(&s_turn.lock);
+    s_turn.job = *job;
+    s_turn.pending = true;
+    portEXIT_CRITICAL(&s_turn.lock);
+    xTaskNotifyGive(s_turn.task);
+}
 
-#if !CONFIG_BSP_BOARD_ESP32_S3_BOX_Lite
-        if (mute_state != mute_flag) {
-            mute_state = mute_flag;
-            if (false == mute_state) {
-                bsp_codec_set_fs(16000, 16, 2);
-            }
+/*
+ * Gives up on the turn being sent. One the task did not start yet comes back
+ * to the handler and is dropped here. Returns true with s_offline.query held
+ * for the next turn, so its upload can stream: the query lock of a dropped
+ * turn is kept, a running one gets a moment to let go of the Gemini client.
+ */
+static bool audio_turn_abort(void)
+{
+    portENTER_CRITICAL(&s_turn.lock);
+    audio_turn_job_t job = s_turn.job;
+    bool pending = s_turn.pending;
+    bool querying = false;
+    s_turn.pending = false;
+    if (s_turn.running) {
+        s_turn.cancel = true;
+        querying = s_turn.querying;
+        if (querying) {
+            gemini_cancel(g_gemini_client, true);
         }
-#endif
-        if (ESP_MN_STATE_TIMEOUT == result.state) {
-            ESP_LOGI(TAG, "ESP_MN_STATE_TIMEOUT");
-            audio_record_stop();
-            FILE *fp = fopen("/spiffs/waitPlease.mp3", "r");
-            if (fp) {
-                audio_player_play(fp);
-            }
-            if (WIFI_STATUS_CONNECTED_OK == wifi_connected_already()) {
-                start_openai((uint8_t *)record_audio_buffer, record_total_len);
-            }
-            continue;
+    }
+    portEXIT_CRITICAL(&s_turn.lock);
+    turn_trace_mark(TURN_PHASE_BARGE_IN);
+
+    if (pending) {
+#if AUDIO_UPLOAD_PIPELINED
+        if (job.query_locked) {
+            audio_upload_stop(0, true);
         }
+#endif
+        audio_arena_release(s_record.arena);
+        xSemaphoreGive(s_turn.arena);
+        return job.query_locked;
+    }
+    /* A read blocked in the socket outlasts this, the new turn then sends its recording as a whole */
+    return querying && pdTRUE == xSemaphoreTake(s_offline.query, pdMS_TO_TICKS(AUDIO_TURN_ABORT_WAIT_MS));
+}
 
-        if (WAKENET_DETECTED == result.wakenet_mode) {
-            audio_record_start();
+static void audio_turn_init(void)
+{
+    s_turn.arena = xSemaphoreCreateBinary();
+    assert(s_turn.arena);
+    xSemaphoreGive(s_turn.arena);
+    BaseType_t ret_val = xTaskCreatePinnedToCore(&audio_turn_task, "Turn Task", 6 * 1024, NULL, 4, &s_turn.task, 0);
+    assert(pdPASS == ret_val);
+}
 
-            // UI show listen
-            ui_ctrl_guide_jump();
-            ui_ctrl_show_panel(UI_CTRL_PANEL_LISTEN, 0);
+/*
+ * SR handler: sleeps until an event arrives on the queue of app_sr, feeds it
+ * to the state machine in sr_fsm.c and carries out the actions it returns.
+ * A finished turn goes to the turn task, which answers with SR_EVENT_REPLIED;
+ * the handler only waits at the next wake word until the recording is free.
+ */
+static struct {
+    sr_fsm_t fsm;
+    bool query_locked;          /* this turn holds s_offline.query */
+    bool recording;             /* this turn holds s_turn.arena */
+} s_handler;
 
-            audio_play_task("/spiffs/echo_en_wake.wav");
-            continue;
+static void sr_handler_query_unlock(void)
+{
+    if (s_handler.query_locked) {
+        xSemaphoreGive(s_offline.query);
+        s_handler.query_locked = false;
+    }
+}
+
+static void sr_handler_turn_cancel(void)
+{
+    audio_record_stop(NULL);
+#if AUDIO_UPLOAD_PIPELINED
+    audio_upload_stop(0, true);
+#endif
+    if (s_handler.recording) {
+        audio_arena_release(s_record.arena);
+        s_handler.recording = false;
+        xSemaphoreGive(s_turn.arena);
+    }
+    sr_handler_query_unlock();
+}
+
+/* False if the turn can't be recorded, the last one is still reading the recording */
+static bool sr_handler_turn_start(uint32_t audio_seq, bool upload)
+{
+    /* Stuck in a socket write, a turn given up on holds it until the write times out */
+    s_handler.recording = pdTRUE == xSemaphoreTake(s_turn.arena, pdMS_TO_TICKS(AUDIO_TURN_ARENA_WAIT_MS));
+    if (!s_handler.recording) {
+        ESP_LOGE(TAG, "last turn still reads the recording, this one is dropped");
+        turn_trace_end("busy");
+        return false;
+    }
+    /* A turn waiting for a queued one to be sent can not stream its upload */
+    if (!s_handler.query_locked) {
+        s_handler.query_locked = pdTRUE == xSemaphoreTake(s_offline.query, 0);
+    }
+    audio_record_start(audio_seq);
+#if AUDIO_UPLOAD_PIPELINED
+    if (upload && s_handler.query_locked) {
+        audio_upload_start();
+    }
+#endif
+
+    // UI show listen
+    ui_ctrl_guide_jump();
+    ui_ctrl_show_panel(UI_CTRL_PANEL_LISTEN, 0);
+
+    audio_playback_play(AUDIO_WAKE_CUE, AUDIO_PLAYBACK_PRIO_HIGH, NULL, NULL);
+    return true;
+}
+
+/* Stops recording the turn the child finished and hands it to the turn task, which queues it when `online` is false */
+static void sr_handler_turn_finish(bool online)
+{
+    audio_turn_job_t job = {
+        .turn = s_handler.fsm.turn,
+        .online = online,
+        .query_locked = s_handler.query_locked,
+    };
+
+    audio_record_stop(&job.samples);
+    audio_playback_play(AUDIO_WAIT_CUE, AUDIO_PLAYBACK_PRIO_LOW, NULL, NULL);
+    s_handler.query_locked = false;
+    s_handler.recording = false;
+    audio_turn_submit(&job);
+}
+
+static void sr_handler_command(int command_id)
+{
+    ESP_LOGI(TAG, "command %s", sr_cmd_name(command_id));
+    turn_trace_end("command");
+    /* Playback was already flushed at the wake word, which is all "stop" needs */
+#if CONFIG_SR_COMMANDS
+    if (SR_CMD_LOUDER == command_id || SR_CMD_QUIETER == command_id) {
+        int step = SR_CMD_LOUDER == command_id ? CONFIG_SR_CMD_VOLUME_STEP : -CONFIG_SR_CMD_VOLUME_STEP;
+        ESP_LOGI(TAG, "volume %d", audio_playback_volume_step(step));
+    }
+#endif
+    if (audio_command_cb) {
+        audio_command_cb(command_id);
+    }
+    audio_playback_play(AUDIO_OK_CUE, AUDIO_PLAYBACK_PRIO_HIGH, NULL, NULL);
+}
+
+static void sr_handler_dispatch(const sr_event_t *event)
+{
+    sr_state_t from = s_handler.fsm.state;
+    uint32_t actions = sr_fsm_handle(&s_handler.fsm, event);
+
+    if (from != s_handler.fsm.state) {
+        ESP_LOGI(TAG, "%s: %s -> %s", sr_fsm_event_name(event->type),
+                 sr_fsm_state_name(from), sr_fsm_state_name(s_handler.fsm.state));
+    } else {
+        ESP_LOGD(TAG, "%s in %s", sr_fsm_event_name(event->type), sr_fsm_state_name(from));
+    }
+
+    if (actions & SR_ACTION_TURN_CANCEL) {
+        sr_handler_turn_cancel();
+        if (SR_EVENT_MUTE == event->type) {
+            turn_trace_end("muted");
+        } else if (SR_EVENT_NO_SPEECH == event->type) {
+            turn_trace_end("no_speech");
         }
+    }
+    if (actions & SR_ACTION_TURN_ABORT) {
+        s_handler.query_locked |= audio_turn_abort();
+    }
+    if ((actions & SR_ACTION_TURN_START) && !sr_handler_turn_start(event->audio_seq, actions & SR_ACTION_UPLOAD_START)) {
+        /* Ends the turn like one nobody spoke in, the endpointer's verdict on it is ignored */
+        sr_event_t next = {
+            .type = SR_EVENT_NO_SPEECH,
+        };
+        sr_handler_dispatch(&next);
+    }
+    if (actions & (SR_ACTION_TURN_SEND | SR_ACTION_TURN_QUEUE)) {
+        sr_handler_turn_finish(actions & SR_ACTION_TURN_SEND);
+    }
+    /* The speaker went quiet before the answer came, its idle event was ignored */
+    if (SR_STATE_UPLOADING == from && SR_STATE_REPLYING == s_handler.fsm.state && !audio_playback_busy()) {
+        sr_event_t next = {
+            .type = SR_EVENT_PLAY_DONE,
+        };
+        sr_handler_dispatch(&next);
+    }
+    if (actions & SR_ACTION_COMMAND) {
+        sr_handler_command(event->command_id);
+    }
+    if (actions & SR_ACTION_CODEC_RESTORE) {
+        bsp_codec_set_fs(16000, 16, 2);
+    }
+    if (actions & SR_ACTION_OFFLINE_KICK) {
+        audio_offline_kick();
+    }
+    if (actions & SR_ACTION_SLEEP) {
+        ui_ctrl_show_panel(UI_CTRL_PANEL_SLEEP, 0);
+    }
+    if (actions & SR_ACTION_EXIT) {
+        xEventGroupSetBits(g_sr_data->event_group, HANDLE_DELETED);
+        vTaskDelete(NULL);
+    }
+}
 
-        if (ESP_MN_STATE_DETECTED & result.state) {
-            ESP_LOGI(TAG, "STOP:%d", result.command_id);
-            audio_record_stop();
-            audio_play_task("/spiffs/echo_en_ok.wav");
-            //How to stop the transmission, when start_openai begins.
-            continue;
+void sr_handler_task(void *pvParam)
+{
+    bool muted = false;
+#if !CONFIG_BSP_BOARD_ESP32_S3_BOX_Lite
+    muted = gpio_get_level(BSP_BUTTON_MUTE_IO);
+#endif
+    sr_fsm_init(&s_handler.fsm, WIFI_STATUS_CONNECTED_OK == wifi_connected_already(), muted);
+    printf("sr handle task, mute:%d\n", muted);
+
+    while (true) {
+        sr_event_t event;
+        if (ESP_OK == app_sr_get_event(&event, portMAX_DELAY)) {
+            sr_handler_dispatch(&event);
         }
     }
     vTaskDelete(NULL);
@@ -7,9 +7,6 @@
 #pragma once
 
 #define DEBUG_SAVE_PCM      (1)
-#define PCM_ONE_CHANNEL     (1)
-#define FILE_SIZE (256000)
-#define MAX_FILE_SIZE       (1*1024*1024)
 #define RECORD_NAME         "/spiffs/record.wav"
 
 typedef struct {
@@ -32,18 +29,21 @@ typedef struct {
 } wav_header_t;
 
 typedef void (*audio_play_finish_cb_t)(void);
+/* `command_id` is an sr_cmd_t */
+typedef void (*audio_command_cb_t)(int command_id);
 
 void sr_handler_task(void *pvParam);
 
-/**
- * @brief The buffer to hold the recorded audio.
- */
-extern uint8_t *audio_rx_buffer;
-
-esp_err_t audio_play_task(void *filepath);
-
 void audio_record_init();
 
-void audio_record_save(int16_t *audio_buffer, int audio_chunksize);
+/**
+ * @brief Append channel 0 of one interleaved microphone frame to the open recording, recorder task only
+ */
+void audio_record_save(const int16_t *frame, int samples, int channels);
 
 void audio_register_play_finish_cb(audio_play_finish_cb_t cb);
+
+/**
+ * @brief Called from the SR handler task for every command recognized on the device, after the volume was changed
+ */
+void audio_register_command_cb(audio_command_cb_t cb);
@@ -15,6 +15,7 @@
 #include "esp_check.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "app_sr.h"
 #include "esp_mn_speech_commands.h"
 #include "esp_process_sdkconfig.h"
@@ -28,7 +29,11 @@
 #include "bsp/esp-bsp.h"
 #include "bsp_board.h"
 #include "app_audio.h"
-#include "app_wifi.h"
+#include "audio_playback.h"
+#include "aec_ref.h"
+#include "turn_trace.h"
+#include "endpoint.h"
+#include "sr_cmd.h"
 
 static const char *TAG = "app_sr";
 
@@ -39,9 +44,21 @@ static bool manul_detect_flag = false;
 sr_data_t *g_sr_data = NULL;
 
 #define I2S_CHANNEL_NUM      2
-
-extern bool record_flag;
-extern uint32_t record_total_len;
+#define I2S_SAMPLES_PER_MS   16
+#if CONFIG_SR_AEC
+/* The microphones, then what the speaker played: the AFE's "MMR" layout */
+#define AFE_CHANNEL_NUM      (I2S_CHANNEL_NUM + 1)
+/* Playback reference kept ahead of the feed, much more than the I2S DMA queues */
+#define AEC_REF_SAMPLES      (AEC_REF_RATE / 2)
+#else
+#define AFE_CHANNEL_NUM      I2S_CHANNEL_NUM
+#endif
+/* About one second of microphone frames on top of the pre-roll, enough slack for the slowest consumer */
+#define AUDIO_RING_FRAMES    32
+/* Feed frames the AFE can hold between feed and fetch, its default ring of 50 chunks and some slack */
+#define AFE_FETCH_MAX_LAG    64
+/* Events wait here while the handler sends a turn */
+#define SR_EVENT_QUEUE_LEN   8
 
 static void audio_feed_task(void *arg)
 {
@@ -49,13 +66,21 @@ static void audio_feed_task(void *arg)
     size_t bytes_read = 0;
     esp_afe_sr_data_t *afe_data = (esp_afe_sr_data_t *) arg;
     int audio_chunksize = afe_handle->get_feed_chunksize(afe_data);
-    int feed_channel = 3;
+    int feed_channel = AFE_CHANNEL_NUM;
     ESP_LOGI(TAG, "audio_chunksize=%d, feed_channel=%d", audio_chunksize, feed_channel);
 
     /* Allocate audio buffer and check for result */
     int16_t *audio_buffer = heap_caps_malloc(audio_chunksize * sizeof(int16_t) * feed_channel, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
     assert(audio_buffer);
     g_sr_data->afe_in_buffer = audio_buffer;
+#if CONFIG_SR_AEC
+    int16_t *mic_buffer = heap_caps_malloc(audio_chunksize * sizeof(int16_t) * I2S_CHANNEL_NUM, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    assert(mic_buffer);
+    g_sr_data->mic_buffer = mic_buffer;
+#else
+    /* Without a reference the I2S frame is the AFE input as is */
+    int16_t *mic_buffer = audio_buffer;
+#endif
 
     while (true) {
         if (g_sr_data->event_group && xEventGroupGetBits(g_sr_data->event_group)) {
@@ -64,86 +89,173 @@ static void audio_feed_task(void *arg)
         }
 
         /* Read audio data from I2S bus */
-        bsp_i2s_read((char *)audio_buffer, audio_chunksize * I2S_CHANNEL_NUM * sizeof(int16_t), &bytes_read, portMAX_DELAY);
+        bsp_i2s_read((char *)mic_buffer, audio_chunksize * I2S_CHANNEL_NUM * sizeof(int16_t), &bytes_read, portMAX_DELAY);
+        /* Hand the frame to the recorder and other consumers, never blocks */
+        audio_ring_push(g_sr_data->audio_ring, mic_buffer, esp_timer_get_time());
 
-        /* Channel Adjust */
-        for (int  i = audio_chunksize - 1; i >= 0; i--) {
-            audio_buffer[i * 3 + 2] = 0;
-            audio_buffer[i * 3 + 1] = audio_buffer[i * 2 + 1];
-            audio_buffer[i * 3 + 0] = audio_buffer[i * 2 + 0];
-        }
+#if CONFIG_SR_AEC
+        /* One pass over the frame, see test/host/bench_afe_feed.c for what it costs */
+        aec_ref_feed(audio_buffer, mic_buffer, I2S_CHANNEL_NUM, audio_chunksize);
+#endif
 
-        /* Checking if WIFI is connected */
-        if (WIFI_STATUS_CONNECTED_OK == wifi_connected_already()) {
+        /* Always, the wake word still works while Wi-Fi reconnects and turns are queued */
+        afe_handle->feed(afe_data, audio_buffer);
+    }
+}
 
-            /* Feed samples of an audio stream to the AFE_SR */
-            afe_handle->feed(afe_data, audio_buffer);
-        }
-        audio_record_save(audio_buffer, audio_chunksize);
+/* The speech window is read by the recorder and the uploader while the detect task updates it */
+static void sr_speech_reset(void)
+{
+    portENTER_CRITICAL(&g_sr_data->speech_lock);
+    vad_trim_reset(&g_sr_data->speech, g_sr_data->speech_margin);
+    portEXIT_CRITICAL(&g_sr_data->speech_lock);
+}
+
+/* Never blocks, the detect task must keep fetching */
+static void sr_event_send(const sr_event_t *event)
+{
+    if (pdTRUE != xQueueSend(g_sr_data->event_que, event, 0)) {
+        ESP_LOGW(TAG, "event queue full, %s dropped", sr_fsm_event_name(event->type));
     }
 }
 
+/*
+ * Feed ring frame the audio of a fetch started in. The AFE hands audio out a
+ * few chunks after it was fed, so by then the ring head is ahead of it by the
+ * pipeline's depth; counting the samples fetched carries the feed's numbering
+ * through instead. `fetched` is the count before this fetch.
+ */
+static uint32_t sr_fetch_seq(uint64_t *fetched, int feed_chunksize)
+{
+    uint32_t head = audio_ring_head(g_sr_data->audio_ring);
+    uint32_t seq = *fetched / feed_chunksize;
+
+    /* Never ahead of the feed, and only behind by what the AFE can hold unless it dropped input */
+    if ((int32_t)(head - seq) < 0 || head - seq > AFE_FETCH_MAX_LAG) {
+        ESP_LOGW(TAG, "fetch at frame %" PRIu32 ", feed at %" PRIu32 ", resynced", seq, head);
+        seq = head;
+        *fetched = (uint64_t)head * feed_chunksize;
+    }
+    return seq;
+}
+
+static void sr_speech_update(bool speech, uint32_t pos)
+{
+    portENTER_CRITICAL(&g_sr_data->speech_lock);
+    vad_trim_update(&g_sr_data->speech, speech, pos);
+    portEXIT_CRITICAL(&g_sr_data->speech_lock);
+}
+
 static void audio_detect_task(void *arg)
 {
     ESP_LOGI(TAG, "Detection task");
-    static afe_vad_state_t local_state;
-    static uint8_t frame_keep = 0;
+    static const endpoint_config_t endpoint_cfg = {
+        .min_speech_ms = CONFIG_ENDPOINT_MIN_SPEECH_MS,
+        .short_utterance_ms = CONFIG_ENDPOINT_SHORT_UTTERANCE_MS,
+        .short_hangover_ms = CONFIG_ENDPOINT_SHORT_HANGOVER_MS,
+        .long_hangover_ms = CONFIG_ENDPOINT_LONG_HANGOVER_MS,
+        .early_cut_ms = CONFIG_ENDPOINT_EARLY_CUT_MS,
+        .early_cut_db = CONFIG_ENDPOINT_EARLY_CUT_DB,
+        .max_utterance_ms = CONFIG_ENDPOINT_MAX_UTTERANCE_MS,
+        .no_speech_ms = CONFIG_ENDPOINT_NO_SPEECH_MS,
+    };
+    endpoint_t endpoint;
 
     bool detect_flag = false;
+    bool command_flag = false;      /* MultiNet still listens for a command this turn */
     esp_afe_sr_data_t *afe_data = arg;
+    int fetch_chunksize = afe_handle->get_fetch_chunksize(afe_data);
+    int feed_chunksize = afe_handle->get_feed_chunksize(afe_data);
+    uint32_t frame_ms = fetch_chunksize / I2S_SAMPLES_PER_MS;
+    uint64_t fetched = 0;           /* samples out of the AFE, the feed's in the same order */
+
+    if (g_sr_data->model_data && g_sr_data->multinet->get_samp_chunksize(g_sr_data->model_data) != fetch_chunksize) {
+        ESP_LOGE(TAG, "MultiNet chunk %d != AFE chunk %d, commands disabled",
+                 g_sr_data->multinet->get_samp_chunksize(g_sr_data->model_data), fetch_chunksize);
+        g_sr_data->cmd_num = 0;
+    }
 
     while (true) {
         if (NEED_DELETE && xEventGroupGetBits(g_sr_data->event_group)) {
             xEventGroupSetBits(g_sr_data->event_group, DETECT_DELETED);
-            vTaskDelete(g_sr_data->handle_task);
             vTaskDelete(NULL);
         }
         afe_fetch_result_t *res = afe_handle->fetch(afe_data);
         if (!res || res->ret_value == ESP_FAIL) {
             continue;
         }
+        uint32_t fetch_seq = sr_fetch_seq(&fetched, feed_chunksize);
+        fetched += fetch_chunksize;
         if (res->wakeup_state == WAKENET_DETECTED) {
             ESP_LOGI(TAG,  "wakeword detected");
-            sr_result_t result = {
-                .wakenet_mode = WAKENET_DETECTED,
-                .state = ESP_MN_STATE_DETECTING,
-                .command_id = 0,
+            turn_trace_begin();
+            /* Barge-in: whatever is playing stops now, not once the handler gets to the event */
+            audio_playback_flush();
+            sr_speech_reset();
+            sr_event_t event = {
+                .type = SR_EVENT_WAKE,
+                .audio_seq = fetch_seq,
             };
-            xQueueSend(g_sr_data->result_que, &result, 0);
+            sr_event_send(&event);
         } else if (res->wakeup_state == WAKENET_CHANNEL_VERIFIED || manul_detect_flag) {
             detect_flag = true;
             if (manul_detect_flag) {
                 manul_detect_flag = false;
-                sr_result_t result = {
-                    .wakenet_mode = WAKENET_DETECTED,
-                    .state = ESP_MN_STATE_DETECTING,
-                    .command_id = 0,
+                turn_trace_begin();
+                audio_playback_flush();
+                sr_speech_reset();
+                sr_event_t event = {
+                    .type = SR_EVENT_WAKE,
+                    .audio_seq = fetch_seq,
                 };
-                xQueueSend(g_sr_data->result_que, &result, 0);
+                sr_event_send(&event);
+            }
+            endpoint_reset(&endpoint, &endpoint_cfg);
+            command_flag = g_sr_data->cmd_num > 0;
+            if (command_flag) {
+                g_sr_data->multinet->clean(g_sr_data->model_data);
             }
-            frame_keep = 0;
             g_sr_data->afe_handle->disable_wakenet(afe_data);
             ESP_LOGI(TAG,  "AFE_FETCH_CHANNEL_VERIFIED, channel index: %d\n", res->trigger_channel_id);
         }
 
-        if (true == detect_flag) {
-
-            if (local_state != res->vad_state) {
-                local_state = res->vad_state;
-                frame_keep = 0;
-            } else {
-                frame_keep++;
+        if (true == detect_flag && command_flag) {
+            esp_mn_state_t mn_state = g_sr_data->multinet->detect(g_sr_data->model_data, res->data);
+            if (ESP_MN_STATE_DETECTED == mn_state) {
+                esp_mn_results_t *mn_result = g_sr_data->multinet->get_results(g_sr_data->model_data);
+                sr_event_t event = {
+                    .type = SR_EVENT_COMMAND,
+                    .command_id = mn_result->command_id[0],
+                };
+                ESP_LOGI(TAG, "command: %s (prob %.2f)", sr_cmd_name(event.command_id), mn_result->prob[0]);
+                sr_event_send(&event);
+                g_sr_data->afe_handle->enable_wakenet(afe_data);
+                detect_flag = false;
+                command_flag = false;
+                continue;
+            }
+            if (ESP_MN_STATE_TIMEOUT == mn_state) {
+                /* Longer than any command, the question goes to Gemini when the endpointer ends it */
+                command_flag = false;
             }
+        }
 
-            if ((100 == frame_keep) && (AFE_VAD_SILENCE == res->vad_state)) {
-                sr_result_t result = {
-                    .wakenet_mode = WAKENET_NO_DETECT,
-                    .state = ESP_MN_STATE_TIMEOUT,
-                    .command_id = 0,
+        if (true == detect_flag) {
+            sr_speech_update(AFE_VAD_SPEECH == res->vad_state, fetch_seq);
+
+            endpoint_reason_t reason = endpoint_update(&endpoint, AFE_VAD_SPEECH == res->vad_state,
+                                                       res->data, res->data_size / sizeof(int16_t), frame_ms);
+            if (ENDPOINT_NONE != reason) {
+                /* Nothing worth sending, the handler drops the turn */
+                sr_event_t event = {
+                    .type = ENDPOINT_NO_SPEECH == reason ? SR_EVENT_NO_SPEECH : SR_EVENT_END_OF_SPEECH,
                 };
-                xQueueSend(g_sr_data->result_que, &result, 0);
+                ESP_LOGI(TAG, "end of utterance: %s", endpoint_reason_name(reason));
+                turn_trace_endpoint(endpoint_reason_name(reason));
+                sr_event_send(&event);
                 g_sr_data->afe_handle->enable_wakenet(afe_data);
                 detect_flag = false;
+                command_flag = false;
                 continue;
             }
         }
@@ -164,11 +276,32 @@ esp_err_t app_sr_set_language(sr_language_t new_lang)
     }
     ESP_LOGI(TAG, "Set language %s", SR_LANG_EN == g_sr_data->lang ? "EN" : "CN");
     if (g_sr_data->model_data) {
+        esp_mn_commands_free();
         g_sr_data->multinet->destroy(g_sr_data->model_data);
+        g_sr_data->model_data = NULL;
+        g_sr_data->cmd_num = 0;
     }
     char *wn_name = esp_srmodel_filter(models, ESP_WN_PREFIX, "");
     ESP_LOGI(TAG, "load wakenet:%s", wn_name);
     g_sr_data->afe_handle->set_wakenet(g_sr_data->afe_data, wn_name);
+
+#if CONFIG_SR_COMMANDS
+    /* The command table is English, other languages only have the wake word */
+    char *mn_name = SR_LANG_EN == g_sr_data->lang ? esp_srmodel_filter(models, ESP_MN_PREFIX, ESP_MN_ENGLISH) : NULL;
+    if (NULL == mn_name) {
+        ESP_LOGW(TAG, "no command model, every query goes to Gemini");
+        return ESP_OK;
+    }
+    ESP_LOGI(TAG, "load multinet:%s", mn_name);
+    g_sr_data->multinet = esp_mn_handle_from_name(mn_name);
+    g_sr_data->model_data = g_sr_data->multinet->create(mn_name, CONFIG_SR_CMD_WINDOW_MS);
+    ESP_RETURN_ON_FALSE(NULL != g_sr_data->model_data, ESP_ERR_NO_MEM, TAG, "Failed create multinet");
+
+    int count = 0;
+    ESP_RETURN_ON_ERROR(sr_cmd_load(g_sr_data->multinet, g_sr_data->model_data, &count), TAG, "Failed load commands");
+    g_sr_data->cmd_num = count;
+    ESP_LOGI(TAG, "%d command phrases", count);
+#endif
     return ESP_OK;
 }
 
@@ -180,8 +313,8 @@ esp_err_t app_sr_start(bool record_en)
     g_sr_data = heap_caps_calloc(1, sizeof(sr_data_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
     ESP_RETURN_ON_FALSE(NULL != g_sr_data, ESP_ERR_NO_MEM, TAG, "Failed create sr data");
 
-    g_sr_data->result_que = xQueueCreate(3, sizeof(sr_result_t));
-    ESP_GOTO_ON_FALSE(NULL != g_sr_data->result_que, ESP_ERR_NO_MEM, err, TAG, "Failed create result queue");
+    g_sr_data->event_que = xQueueCreate(SR_EVENT_QUEUE_LEN, sizeof(sr_event_t));
+    ESP_GOTO_ON_FALSE(NULL != g_sr_data->event_que, ESP_ERR_NO_MEM, err, TAG, "Failed create event queue");
 
     g_sr_data->event_group = xEventGroupCreate();
     ESP_GOTO_ON_FALSE(NULL != g_sr_data->event_group, ESP_ERR_NO_MEM, err, TAG, "Failed create event_group");
@@ -192,7 +325,19 @@ esp_err_t app_sr_start(bool record_en)
     afe_config_t afe_config = AFE_CONFIG_DEFAULT();
 
     afe_config.wakenet_model_name = esp_srmodel_filter(models, ESP_WN_PREFIX, NULL);
+#if CONFIG_SR_AEC
+    /* Two microphones and a copy of what the speaker plays, so the child can be heard over it */
+    ret = aec_ref_init(AEC_REF_SAMPLES);
+    ESP_GOTO_ON_FALSE(ESP_OK == ret, ESP_ERR_NO_MEM, err, TAG, "Failed create playback reference");
+    afe_config.aec_init = true;
+    afe_config.pcm_config.ref_num = 1;
+#else
+    /* Two microphones and no playback reference, exactly what the codec delivers */
     afe_config.aec_init = false;
+    afe_config.pcm_config.ref_num = 0;
+#endif
+    afe_config.pcm_config.total_ch_num = AFE_CHANNEL_NUM;
+    afe_config.pcm_config.mic_num = I2S_CHANNEL_NUM;
 
     esp_afe_sr_data_t *afe_data = afe_handle->create_from_config(&afe_config);
     g_sr_data->afe_handle = afe_handle;
@@ -202,6 +347,14 @@ esp_err_t app_sr_start(bool record_en)
     ret = app_sr_set_language(SR_LANG_EN);
     ESP_GOTO_ON_FALSE(ESP_OK == ret, ESP_FAIL, err, TAG,  "Failed to set language");
 
+    int feed_chunksize = afe_handle->get_feed_chunksize(afe_data);
+    g_sr_data->preroll_frames = (CONFIG_AUDIO_PREROLL_MS * I2S_SAMPLES_PER_MS + feed_chunksize - 1) / feed_chunksize;
+    g_sr_data->speech_margin = (CONFIG_AUDIO_TRIM_MARGIN_MS * I2S_SAMPLES_PER_MS + feed_chunksize - 1) / feed_chunksize;
+    portMUX_INITIALIZE(&g_sr_data->speech_lock);
+    vad_trim_reset(&g_sr_data->speech, g_sr_data->speech_margin);
+    ret = audio_ring_create(AUDIO_RING_FRAMES + g_sr_data->preroll_frames, feed_chunksize, I2S_CHANNEL_NUM, &g_sr_data->audio_ring);
+    ESP_GOTO_ON_FALSE(ESP_OK == ret, ESP_ERR_NO_MEM, err, TAG,  "Failed create audio ring");
+
     ret_val = xTaskCreatePinnedToCore(&audio_feed_task, "Feed Task", 8 * 1024, (void *)afe_data, 5, &g_sr_data->feed_task, 0);
     ESP_GOTO_ON_FALSE(pdPASS == ret_val, ESP_FAIL, err, TAG,  "Failed create audio feed task");
 
@@ -223,11 +376,20 @@ esp_err_t app_sr_stop(void)
 {
     ESP_RETURN_ON_FALSE(NULL != g_sr_data, ESP_ERR_INVALID_STATE, TAG, "SR is not running");
     xEventGroupSetBits(g_sr_data->event_group, NEED_DELETE);
+    /* The handler only wakes up for events, it may be waiting a moment for the last turn first */
+    if (g_sr_data->handle_task) {
+        sr_event_t event = {
+            .type = SR_EVENT_EXIT,
+        };
+        xQueueSend(g_sr_data->event_que, &event, portMAX_DELAY);
+    } else {
+        xEventGroupSetBits(g_sr_data->event_group, HANDLE_DELETED);
+    }
     xEventGroupWaitBits(g_sr_data->event_group, NEED_DELETE | FEED_DELETED | DETECT_DELETED | HANDLE_DELETED, 1, 1, portMAX_DELAY);
 
-    if (g_sr_data->result_que) {
-        vQueueDelete(g_sr_data->result_que);
-        g_sr_data->result_que = NULL;
+    if (g_sr_data->event_que) {
+        vQueueDelete(g_sr_data->event_que);
+        g_sr_data->event_que = NULL;
     }
 
     if (g_sr_data->event_group) {
@@ -241,6 +403,7 @@ esp_err_t app_sr_stop(void)
     }
 
     if (g_sr_data->model_data) {
+        esp_mn_commands_free();
         g_sr_data->multinet->destroy(g_sr_data->model_data);
     }
 
@@ -252,20 +415,39 @@ esp_err_t app_sr_stop(void)
         heap_caps_free(g_sr_data->afe_in_buffer);
     }
 
+    if (g_sr_data->mic_buffer) {
+        heap_caps_free(g_sr_data->mic_buffer);
+    }
+
     if (g_sr_data->afe_out_buffer) {
         heap_caps_free(g_sr_data->afe_out_buffer);
     }
 
+    audio_ring_delete(g_sr_data->audio_ring);
+
     heap_caps_free(g_sr_data);
     g_sr_data = NULL;
     return ESP_OK;
 }
 
-esp_err_t app_sr_get_result(sr_result_t *result, TickType_t xTicksToWait)
+esp_err_t app_sr_get_event(sr_event_t *event, TickType_t xTicksToWait)
 {
     ESP_RETURN_ON_FALSE(NULL != g_sr_data, ESP_ERR_INVALID_STATE, TAG, "SR is not running");
-    xQueueReceive(g_sr_data->result_que, result, xTicksToWait);
-    return ESP_OK;
+    return pdTRUE == xQueueReceive(g_sr_data->event_que, event, xTicksToWait) ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+esp_err_t app_sr_post(const sr_event_t *event, TickType_t xTicksToWait)
+{
+    ESP_RETURN_ON_FALSE(NULL != g_sr_data && NULL != g_sr_data->event_que, ESP_ERR_INVALID_STATE, TAG, "SR is not running");
+    return pdTRUE == xQueueSend(g_sr_data->event_que, event, xTicksToWait) ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+esp_err_t app_sr_post_event(sr_event_type_t type, TickType_t xTicksToWait)
+{
+    sr_event_t event = {
+        .type = type,
+    };
+    return app_sr_post(&event, xTicksToWait);
 }
 
 esp_err_t app_sr_start_once(void)
@@ -274,3 +456,12 @@ esp_err_t app_sr_start_once(void)
     manul_detect_flag = true;
     return ESP_OK;
 }
+
+esp_err_t app_sr_get_speech(vad_trim_t *speech)
+{
+    ESP_RETURN_ON_FALSE(NULL != g_sr_data, ESP_ERR_INVALID_STATE, TAG, "SR is not running");
+    portENTER_CRITICAL(&g_sr_data->speech_lock);
+    *speech = g_sr_data->speech;
+    portEXIT_CRITICAL(&g_sr_data->speech_lock);
+    return ESP_OK;
+}
@@ -15,6 +15,9 @@
 #include "esp_err.h"
 #include "esp_afe_sr_models.h"
 #include "esp_mn_models.h"
+#include "audio_ring.h"
+#include "vad_trim.h"
+#include "sr_fsm.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -34,12 +37,6 @@ extern "C" {
 #endif
 #endif
 
-typedef struct {
-    wakenet_state_t wakenet_mode;
-    esp_mn_state_t state;
-    int command_id;
-} sr_result_t;
-
 typedef enum {
     SR_LANG_EN,
     SR_LANG_CN,
@@ -54,12 +51,18 @@ typedef struct {
     const esp_afe_sr_iface_t *afe_handle;
     esp_afe_sr_data_t *afe_data;
     int16_t *afe_in_buffer;
+    int16_t *mic_buffer;        /* I2S frame when the AFE input also carries the playback reference */
     int16_t *afe_out_buffer;
+    audio_ring_t *audio_ring;   /* microphone frames as read from I2S, for the recorder and other consumers */
+    uint32_t preroll_frames;    /* frames before the wake word a recording starts with */
+    vad_trim_t speech;          /* speech window of the current turn in ring frames, under speech_lock */
+    uint32_t speech_margin;     /* frames kept around speech */
+    portMUX_TYPE speech_lock;
     uint8_t cmd_num;
     TaskHandle_t feed_task;
     TaskHandle_t detect_task;
     TaskHandle_t handle_task;
-    QueueHandle_t result_que;
+    QueueHandle_t event_que;    /* sr_event_t for the handler task */
     EventGroupHandle_t event_group;
     FILE *fp;
     bool b_record_en;
@@ -67,9 +70,34 @@ typedef struct {
 
 esp_err_t app_sr_start(bool record_en);
 esp_err_t app_sr_stop(void);
-esp_err_t app_sr_get_result(sr_result_t *result, TickType_t xTicksToWait);
 esp_err_t app_sr_start_once(void);
 
+/**
+ * @brief Wait for the next event of the SR handler
+ *
+ * @return ESP_ERR_TIMEOUT when nothing came within `xTicksToWait`
+ */
+esp_err_t app_sr_get_event(sr_event_t *event, TickType_t xTicksToWait);
+
+/**
+ * @brief Send an event without data to the SR handler, from any task
+ *
+ * @return ESP_ERR_TIMEOUT when the queue had no room within `xTicksToWait`
+ */
+esp_err_t app_sr_post_event(sr_event_type_t type, TickType_t xTicksToWait);
+
+/**
+ * @brief Send an event with its data to the SR handler, from any task
+ *
+ * @return ESP_ERR_TIMEOUT when the queue had no room within `xTicksToWait`
+ */
+esp_err_t app_sr_post(const sr_event_t *event, TickType_t xTicksToWait);
+
+/**
+ * @brief Copy the speech window of the current turn, positions are audio_ring frames
+ */
+esp_err_t app_sr_get_speech(vad_trim_t *speech);
+
 #ifdef __cplusplus
 }
 #endif
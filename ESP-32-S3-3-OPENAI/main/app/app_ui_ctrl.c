@@ -9,6 +9,7 @@
 #include "app_ui_ctrl.h"
 #include "app_wifi.h"
 #include "bsp/esp-bsp.h"
+#include "turn_trace.h"
 
 #include "ui_helpers.h"
 #include "ui.h"
@@ -172,6 +173,7 @@ static void reply_content_show_text(const char *text)
     ESP_LOGI(TAG, "decode:[%d, %d] %s\r\n", j, strlen(decode), decode);
 
     lv_label_set_text(ui_LabelReplyContent, decode);
+    turn_trace_mark(TURN_PHASE_FIRST_PAINT);
     content_height = lv_obj_get_self_height(ui_LabelReplyContent);
     lv_obj_scroll_to_y(ui_ContainerReplyContent, 0, LV_ANIM_OFF);
     reply_content_get = true;
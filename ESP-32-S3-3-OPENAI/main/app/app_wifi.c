@@ -65,6 +65,7 @@ static bool s_reconnect = true;
 
 static bool wifi_connected = false;
 static QueueHandle_t wifi_event_queue = NULL;
+static app_wifi_connected_cb_t wifi_connected_cb = NULL;
 
 scan_info_t scan_info_result = {
     .scan_done = WIFI_SCAN_IDLE,
@@ -86,6 +87,11 @@ WiFi_Connect_Status wifi_connected_already(void)
     return status;
 }
 
+void app_wifi_register_connected_cb(app_wifi_connected_cb_t cb)
+{
+    wifi_connected_cb = cb;
+}
+
 esp_err_t app_wifi_get_wifi_ssid(char *ssid, size_t len)
 {
     wifi_config_t wifi_cfg;
@@ -163,12 +169,18 @@ static void event_handler(void *arg, esp_event_base_t event_base,
         xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
         xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
         wifi_connected = false;
+        if (wifi_connected_cb) {
+            wifi_connected_cb(false);
+        }
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t *event = (ip_event_got_ip_t *) event_data;
         ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
         s_retry_num = 0;
         wifi_connected = true;
         xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+        if (wifi_connected_cb) {
+            wifi_connected_cb(true);
+        }
     }
 }
 
@@ -38,6 +38,9 @@ typedef enum {
     NET_EVENT_MAX,
 } net_event_t;
 
+/* `connected` is true when the station got an IP address, false when it lost the AP */
+typedef void (*app_wifi_connected_cb_t)(bool connected);
+
 typedef enum {
     WIFI_STATUS_CONNECTING,
     WIFI_STATUS_CONNECTED_OK,
@@ -50,6 +53,11 @@ esp_err_t send_network_event(net_event_t event);
 WiFi_Connect_Status wifi_connected_already(void);
 esp_err_t app_wifi_get_wifi_ssid(char *ssid, size_t len);
 
+/**
+ * @brief Called from the event loop every time the station got an IP address or was disconnected
+ */
+void app_wifi_register_connected_cb(app_wifi_connected_cb_t cb);
+
 void app_network_start(void);
 
 bool app_wifi_lock(uint32_t timeout_ms);
@@ -0,0 +1,113 @@
+/*
+ * Segmented PSRAM store for the samples of one recording
+ *
+ * A recording grows in fixed segments up to a cap instead of living in one
+ * worst-case buffer that is held forever. Segments are returned to the heap
+ * after every turn, and because they never move, readers can encode and
+ * upload straight from them while the recorder keeps appending.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "audio_arena.h"
+
+static const char *TAG = "audio_arena";
+
+struct audio_arena {
+    size_t segment_samples;
+    size_t segments;        /* entries of `segment` */
+    size_t len;             /* written by the writer only, read with acquire ordering */
+    int16_t *segment[];     /* NULL until the recording reaches it */
+};
+
+esp_err_t audio_arena_create(size_t segment_samples, size_t max_samples, audio_arena_t **ret_arena)
+{
+    ESP_RETURN_ON_FALSE(segment_samples && max_samples && ret_arena, ESP_ERR_INVALID_ARG, TAG, "invalid args");
+
+    size_t segments = (max_samples + segment_samples - 1) / segment_samples;
+    audio_arena_t *arena = heap_caps_calloc(1, sizeof(audio_arena_t) + segments * sizeof(int16_t *),
+                                            MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    ESP_RETURN_ON_FALSE(NULL != arena, ESP_ERR_NO_MEM, TAG, "arena malloc failed");
+    arena->segment_samples = segment_samples;
+    arena->segments = segments;
+
+    ESP_LOGI(TAG, "up to %u segments of %u KB", (unsigned)segments,
+             (unsigned)(segment_samples * sizeof(int16_t) / 1024));
+    *ret_arena = arena;
+    return ESP_OK;
+}
+
+void audio_arena_delete(audio_arena_t *arena)
+{
+    if (arena) {
+        audio_arena_release(arena);
+        heap_caps_free(arena);
+    }
+}
+
+size_t audio_arena_write(audio_arena_t *arena, const int16_t *samples, size_t count)
+{
+    size_t len = arena->len;
+    size_t written = 0;
+
+    while (written < count) {
+        size_t seg = len / arena->segment_samples;
+        size_t off = len % arena->segment_samples;
+        if (seg >= arena->segments) {
+            break;
+        }
+        if (NULL == arena->segment[seg]) {
+            arena->segment[seg] = heap_caps_malloc(arena->segment_samples * sizeof(int16_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+            if (NULL == arena->segment[seg]) {
+                ESP_LOGE(TAG, "segment %u malloc failed", (unsigned)seg);
+                break;
+            }
+        }
+        size_t n = arena->segment_samples - off;
+        if (n > count - written) {
+            n = count - written;
+        }
+        memcpy(arena->segment[seg] + off, samples + written, n * sizeof(int16_t));
+        written += n;
+        len += n;
+    }
+    /* Readers that see the new length also see the samples and the segment pointers */
+    __atomic_store_n(&arena->len, len, __ATOMIC_RELEASE);
+    return written;
+}
+
+void audio_arena_release(audio_arena_t *arena)
+{
+    __atomic_store_n(&arena->len, 0, __ATOMIC_RELEASE);
+    for (size_t i = 0; i < arena->segments && arena->segment[i]; i++) {
+        heap_caps_free(arena->segment[i]);
+        arena->segment[i] = NULL;
+    }
+}
+
+size_t audio_arena_len(const audio_arena_t *arena)
+{
+    return __atomic_load_n(&arena->len, __ATOMIC_ACQUIRE);
+}
+
+const int16_t *audio_arena_read(const audio_arena_t *arena, size_t index, size_t count, int16_t *scratch)
+{
+    size_t seg = index / arena->segment_samples;
+    size_t off = index % arena->segment_samples;
+
+    if (off + count <= arena->segment_samples) {
+        return arena->segment[seg] + off;
+    }
+    for (size_t copied = 0; copied < count; seg++, off = 0) {
+        size_t n = arena->segment_samples - off;
+        if (n > count - copied) {
+            n = count - copied;
+        }
+        memcpy(scratch + copied, arena->segment[seg] + off, n * sizeof(int16_t));
+        copied += n;
+    }
+    return scratch;
+}
@@ -0,0 +1,56 @@
+/*
+ * Segmented PSRAM store for the samples of one recording
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct audio_arena audio_arena_t;
+
+/**
+ * @brief Create an empty arena, segments are only allocated as samples arrive
+ *
+ * @param segment_samples Samples per PSRAM segment
+ * @param max_samples Cap of the recording, rounded up to whole segments
+ * @param[out] ret_arena The new arena
+ */
+esp_err_t audio_arena_create(size_t segment_samples, size_t max_samples, audio_arena_t **ret_arena);
+
+void audio_arena_delete(audio_arena_t *arena);
+
+/**
+ * @brief Append samples, from the single writer
+ *
+ * New segments are allocated on the way. The length is published once the
+ * samples are in place, so readers may run on other tasks.
+ *
+ * @return Samples appended, fewer than `count` once the cap is reached or PSRAM runs out
+ */
+size_t audio_arena_write(audio_arena_t *arena, const int16_t *samples, size_t count);
+
+/**
+ * @brief Free every segment and start over empty, no reader may still use the arena
+ */
+void audio_arena_release(audio_arena_t *arena);
+
+/** Samples written so far */
+size_t audio_arena_len(const audio_arena_t *arena);
+
+/**
+ * @brief Get `count` contiguous samples starting at `index`, which must have been written
+ *
+ * Runs inside one segment are returned in place; runs across a segment border
+ * are copied to `scratch`, which must hold `count` samples.
+ */
+const int16_t *audio_arena_read(const audio_arena_t *arena, size_t index, size_t count, int16_t *scratch);
+
+#ifdef __cplusplus
+}
+#endif
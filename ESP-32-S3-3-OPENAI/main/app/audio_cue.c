@@ -0,0 +1,274 @@
+/*
+ * UI audio cues preloaded from SPIFFS
+ *
+ * The cues played on every turn are read once at boot, the rest of spiffs/
+ * stays on flash and costs no PSRAM. WAV and MP3 cues are decoded and
+ * converted to the format the codec already runs at, so playing one is a
+ * plain I2S write straight from PSRAM, with no filesystem access, header
+ * parsing or decoding on the way. An MP3 that fails to decode keeps its
+ * compressed bytes and is handed to the audio player as an in-memory stream.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "mp3dec.h"
+#include "audio_resample.h"
+#include "audio_cue.h"
+
+static const char *TAG = "audio_cue";
+
+#define AUDIO_CUE_MAX           16
+/* Largest MP3 frame, MPEG-1 layer III, in samples per channel */
+#define AUDIO_CUE_MP3_FRAME     1152
+
+static audio_cue_t s_cues[AUDIO_CUE_MAX];
+static size_t s_cue_count;
+
+static const char *audio_cue_basename(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+static uint32_t le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t le16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static bool audio_cue_is_mp3(const uint8_t *file, size_t len)
+{
+    /* An ID3 tag or an MPEG frame sync, whatever the file is called */
+    return len >= 3 && (0 == memcmp(file, "ID3", 3) || (0xFF == file[0] && 0xE0 == (file[1] & 0xE0)));
+}
+
+/*
+ * Converts interleaved 16-bit PCM to AUDIO_CUE_RATE / AUDIO_CUE_CHANNELS. The
+ * result is `in` itself when it is in that format already, otherwise a new
+ * PSRAM buffer.
+ */
+static esp_err_t audio_cue_convert(const int16_t *in, size_t frames, uint16_t channels, uint32_t rate,
+                                   const uint8_t **pcm, size_t *pcm_len)
+{
+    ESP_RETURN_ON_FALSE(1 == channels || 2 == channels, ESP_ERR_NOT_SUPPORTED, TAG, "%u channels", channels);
+    if (AUDIO_CUE_RATE == rate && AUDIO_CUE_CHANNELS == channels) {
+        *pcm = (const uint8_t *)in;
+        *pcm_len = frames * channels * sizeof(int16_t);
+        return ESP_OK;
+    }
+
+    audio_resample_t *rs = NULL;
+    if (AUDIO_CUE_RATE != rate) {
+        ESP_RETURN_ON_ERROR(audio_resample_create(rate, AUDIO_CUE_RATE, channels, &rs), TAG, "no resampler");
+    }
+    size_t out_frames = rs ? audio_resample_out_max(rs, frames) : frames;
+    int16_t *out = heap_caps_malloc(out_frames * AUDIO_CUE_CHANNELS * sizeof(int16_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (NULL == out) {
+        audio_resample_delete(rs);
+        ESP_LOGE(TAG, "pcm malloc failed");
+        return ESP_ERR_NO_MEM;
+    }
+    if (rs) {
+        out_frames = audio_resample_process(rs, in, frames, channels, out);
+        audio_resample_delete(rs);
+    } else {
+        memcpy(out, in, frames * channels * sizeof(int16_t));
+    }
+    /* Mono to both channels, from the end so nothing is overwritten before it is read */
+    for (size_t i = out_frames; 1 == channels && i-- > 0;) {
+        out[2 * i + 1] = out[2 * i] = out[i];
+    }
+    *pcm = (const uint8_t *)out;
+    *pcm_len = out_frames * AUDIO_CUE_CHANNELS * sizeof(int16_t);
+    return ESP_OK;
+}
+
+/* Decodes a RIFF WAV file, the result may point into `file` */
+static esp_err_t audio_cue_wav(const uint8_t *file, size_t len, const uint8_t **pcm, size_t *pcm_len)
+{
+    ESP_RETURN_ON_FALSE(len >= 12 && 0 == memcmp(file, "RIFF", 4) && 0 == memcmp(file + 8, "WAVE", 4),
+                        ESP_ERR_NOT_SUPPORTED, TAG, "not a wav file");
+
+    const uint8_t *fmt = NULL;
+    const uint8_t *data = NULL;
+    size_t data_len = 0;
+    /* Chunks are walked rather than assumed at fixed offsets, the echo cues carry a LIST chunk */
+    for (size_t pos = 12; pos + 8 <= len;) {
+        uint32_t size = le32(file + pos + 4);
+        if (0 == memcmp(file + pos, "fmt ", 4) && size >= 16) {
+            fmt = file + pos + 8;
+        } else if (0 == memcmp(file + pos, "data", 4)) {
+            data = file + pos + 8;
+            data_len = MIN(size, len - pos - 8);
+            break;
+        }
+        pos += 8 + size + (size & 1);
+    }
+    ESP_RETURN_ON_FALSE(fmt && data, ESP_ERR_NOT_SUPPORTED, TAG, "no fmt or data chunk");
+
+    uint16_t format = le16(fmt);
+    uint16_t channels = le16(fmt + 2);
+    uint32_t rate = le32(fmt + 4);
+    uint16_t bits = le16(fmt + 14);
+    ESP_RETURN_ON_FALSE(1 == format && 16 == bits && channels, ESP_ERR_NOT_SUPPORTED, TAG, "only 16-bit PCM is supported");
+    return audio_cue_convert((const int16_t *)data, data_len / (channels * sizeof(int16_t)), channels, rate, pcm, pcm_len);
+}
+
+/* Decodes a whole MP3 file, the result is always a new buffer */
+static esp_err_t audio_cue_mp3(const uint8_t *file, size_t len, const uint8_t **pcm, size_t *pcm_len)
+{
+    esp_err_t ret = ESP_OK;
+    int16_t *out = NULL;
+    size_t frames = 0;
+    size_t capacity = 0;
+    MP3FrameInfo info = { 0 };
+
+    HMP3Decoder decoder = MP3InitDecoder();
+    ESP_RETURN_ON_FALSE(NULL != decoder, ESP_ERR_NO_MEM, TAG, "mp3 decoder init failed");
+
+    /* An ID3v2 tag may hold bytes that look like a frame sync, skip it by its size */
+    size_t pos = 0;
+    if (len >= 10 && 0 == memcmp(file, "ID3", 3)) {
+        pos = 10 + ((file[6] & 0x7F) << 21 | (file[7] & 0x7F) << 14 | (file[8] & 0x7F) << 7 | (file[9] & 0x7F));
+    }
+    while (pos < len) {
+        int sync = MP3FindSyncWord((unsigned char *)file + pos, len - pos);
+        if (sync < 0) {
+            break;
+        }
+        pos += sync;
+        /* Room for one more frame, a 16 kHz cue grows in steps of a second */
+        if ((frames + AUDIO_CUE_MP3_FRAME) * 2 > capacity) {
+            capacity += 2 * AUDIO_CUE_RATE;
+            int16_t *grown = heap_caps_realloc(out, capacity * sizeof(int16_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+            ESP_GOTO_ON_FALSE(NULL != grown, ESP_ERR_NO_MEM, err, TAG, "pcm malloc failed");
+            out = grown;
+        }
+
+        unsigned char *in = (unsigned char *)file + pos;
+        int left = len - pos;
+        int rc = MP3Decode(decoder, &in, &left, out + frames * (info.nChans ? info.nChans : 2), 0);
+        if (ERR_MP3_INDATA_UNDERFLOW == rc) {
+            break;
+        }
+        pos = len - left;
+        if (ERR_MP3_MAINDATA_UNDERFLOW == rc) {
+            continue;
+        }
+        ESP_GOTO_ON_FALSE(ERR_MP3_NONE == rc, ESP_FAIL, err, TAG, "mp3 decode error %d", rc);
+        MP3GetLastFrameInfo(decoder, &info);
+        frames += info.outputSamps / info.nChans;
+    }
+    ESP_GOTO_ON_FALSE(frames > 0, ESP_ERR_NOT_SUPPORTED, err, TAG, "no mp3 frames");
+
+    ESP_GOTO_ON_ERROR(audio_cue_convert(out, frames, info.nChans, info.samprate, pcm, pcm_len), err, TAG, "convert failed");
+    if (*pcm != (const uint8_t *)out) {
+        heap_caps_free(out);
+    }
+    MP3FreeDecoder(decoder);
+    return ESP_OK;
+
+err:
+    heap_caps_free(out);
+    MP3FreeDecoder(decoder);
+    return ret;
+}
+
+static esp_err_t audio_cue_load_file(const char *path, audio_cue_t *cue)
+{
+    esp_err_t ret = ESP_OK;
+    struct stat st;
+    uint8_t *file = NULL;
+    FILE *fp = NULL;
+
+    ESP_RETURN_ON_FALSE(0 == stat(path, &st) && st.st_size > 0, ESP_ERR_NOT_FOUND, TAG, "%s: stat failed", path);
+    file = heap_caps_malloc(st.st_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    ESP_GOTO_ON_FALSE(NULL != file, ESP_ERR_NO_MEM, err, TAG, "%s: malloc failed", path);
+    fp = fopen(path, "rb");
+    ESP_GOTO_ON_FALSE(NULL != fp, ESP_FAIL, err, TAG, "%s: open failed", path);
+    ESP_GOTO_ON_FALSE((size_t)st.st_size == fread(file, 1, st.st_size, fp), ESP_FAIL, err, TAG, "%s: read failed", path);
+    fclose(fp);
+    fp = NULL;
+
+    cue->format = AUDIO_CUE_PCM;
+    if (audio_cue_is_mp3(file, st.st_size)) {
+        if (ESP_OK != audio_cue_mp3(file, st.st_size, &cue->data, &cue->len)) {
+            ESP_LOGW(TAG, "%s: kept compressed", path);
+            cue->format = AUDIO_CUE_MP3;
+            cue->data = file;
+            cue->len = st.st_size;
+            return ESP_OK;
+        }
+    } else {
+        ESP_GOTO_ON_ERROR(audio_cue_wav(file, st.st_size, &cue->data, &cue->len), err, TAG, "%s: skipped", path);
+    }
+    if (cue->data < file || cue->data >= file + st.st_size) {
+        heap_caps_free(file);
+    }
+    return ESP_OK;
+
+err:
+    if (fp) {
+        fclose(fp);
+    }
+    heap_caps_free(file);
+    return ret;
+}
+
+esp_err_t audio_cue_load(const char *const *paths, size_t count)
+{
+    ESP_RETURN_ON_FALSE(NULL != paths && s_cue_count + count <= AUDIO_CUE_MAX, ESP_ERR_INVALID_ARG, TAG, "invalid args");
+
+    esp_err_t ret = ESP_OK;
+    size_t bytes = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (audio_cue_find(paths[i])) {
+            continue;
+        }
+        audio_cue_t *cue = &s_cues[s_cue_count];
+        esp_err_t err = audio_cue_load_file(paths[i], cue);
+        if (ESP_OK != err) {
+            ret = err;
+            continue;
+        }
+        /* Points into the caller's path, which outlives the cues */
+        cue->name = audio_cue_basename(paths[i]);
+        ESP_LOGI(TAG, "%s: %u bytes of %s", cue->name, (unsigned)cue->len, AUDIO_CUE_PCM == cue->format ? "pcm" : "mp3");
+        bytes += cue->len;
+        s_cue_count++;
+    }
+
+    ESP_LOGI(TAG, "%u cues, %u KB of PSRAM", (unsigned)s_cue_count, (unsigned)(bytes / 1024));
+    return ret;
+}
+
+const audio_cue_t *audio_cue_find(const char *path)
+{
+    const char *name = audio_cue_basename(path);
+    for (size_t i = 0; i < s_cue_count; i++) {
+        if (0 == strcmp(s_cues[i].name, name)) {
+            return &s_cues[i];
+        }
+    }
+    return NULL;
+}
+
+FILE *audio_cue_fopen(const char *path)
+{
+    const audio_cue_t *cue = audio_cue_find(path);
+    if (cue && AUDIO_CUE_MP3 == cue->format) {
+        /* Opened read only, so dropping const is safe */
+        return fmemopen((void *)cue->data, cue->len, "rb");
+    }
+    return fopen(path, "rb");
+}
@@ -0,0 +1,61 @@
+/*
+ * UI audio cues preloaded from SPIFFS
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Format cues are decoded to, the one the codec runs at between replies */
+#define AUDIO_CUE_RATE          16000
+#define AUDIO_CUE_CHANNELS      2
+
+typedef enum {
+    AUDIO_CUE_PCM,              /* 16-bit AUDIO_CUE_CHANNELS interleaved at AUDIO_CUE_RATE */
+    AUDIO_CUE_MP3,              /* the file as stored when it could not be decoded, for the audio player */
+} audio_cue_format_t;
+
+typedef struct {
+    const char *name;           /* file name without the directory */
+    audio_cue_format_t format;
+    const uint8_t *data;        /* in PSRAM */
+    size_t len;
+} audio_cue_t;
+
+/**
+ * @brief Load the listed cues into PSRAM, decoded to PCM in the codec's format
+ *
+ * Only the cues played on every turn are worth their PSRAM, every other file
+ * is opened from the filesystem by audio_cue_fopen(). A cue that can not be
+ * read, or a WAV in a format that cannot be converted, is skipped and stays
+ * playable from the filesystem too. An MP3 that does not decode is kept
+ * compressed.
+ *
+ * @param paths Full paths, they must stay valid for as long as the cues are used
+ * @param count Number of paths
+ * @return ESP_OK if all of them were loaded, otherwise the error of the last one that was not
+ */
+esp_err_t audio_cue_load(const char *const *paths, size_t count);
+
+/**
+ * @brief Find a loaded cue by path or file name, NULL if it was not loaded
+ */
+const audio_cue_t *audio_cue_find(const char *path);
+
+/**
+ * @brief Open a cue for reading, from memory when it is loaded, otherwise from the filesystem
+ *
+ * The stream is what the audio player expects, the player closes it when done.
+ */
+FILE *audio_cue_fopen(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
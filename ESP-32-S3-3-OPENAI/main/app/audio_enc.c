@@ -0,0 +1,492 @@
+/*
+ * Upload codecs for recorded voice queries
+ *
+ * Every codec is a stream header plus independently encoded blocks, so the
+ * same code serves whole recordings and uploads that start while the child
+ * is still speaking.
+ *
+ * WAV is sent as recorded, mu-law halves it, and FLAC is a small
+ * fixed-predictor encoder (orders 0-4, partitioned Rice residuals) which is
+ * lossless and typically takes speech to about half of the PCM size.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "app_audio.h"
+#include "audio_enc.h"
+
+static const char *TAG = "audio_enc";
+
+#define FLAC_BLOCK_SIZE         4096
+#define FLAC_MAX_FIXED_ORDER    4
+#define FLAC_MAX_PARTITION      4
+#define FLAC_MAX_RICE_PARAM     14
+#define FLAC_FRAME_OVERHEAD     24
+
+/* data_len 0 marks a stream of unknown length */
+static void wav_header_fill(wav_header_t *head, int16_t format, int16_t bits, uint32_t sample_rate, size_t data_len)
+{
+    memcpy(head->ChunkID, "RIFF", 4);
+    head->ChunkSize = data_len ? (int32_t)(data_len + sizeof(wav_header_t) - 8) : (int32_t)-1;
+    memcpy(head->Format, "WAVE", 4);
+    memcpy(head->Subchunk1ID, "fmt ", 4);
+    head->Subchunk1Size = 16;
+    head->AudioFormat = format;
+    head->NumChannels = 1;
+    head->SampleRate = sample_rate;
+    head->ByteRate = sample_rate * bits / 8;
+    head->BlockAlign = bits / 8;
+    head->BitsPerSample = bits;
+    memcpy(head->Subchunk2ID, "data", 4);
+    head->Subchunk2Size = data_len ? (int32_t)data_len : (int32_t)-1;
+}
+
+/* WAV: PCM as recorded */
+
+static size_t wav_header(uint32_t sample_rate, size_t samples, uint8_t *out)
+{
+    wav_header_t head;
+    wav_header_fill(&head, 1, 16, sample_rate, samples * sizeof(int16_t));
+    memcpy(out, &head, sizeof(head));
+    return sizeof(head);
+}
+
+static size_t wav_block_max(size_t samples)
+{
+    return samples * sizeof(int16_t);
+}
+
+static esp_err_t wav_block(const int16_t *pcm, size_t samples, uint32_t index,
+                           uint8_t *out, size_t out_size, size_t *out_len)
+{
+    ESP_RETURN_ON_FALSE(out_size >= wav_block_max(samples), ESP_ERR_INVALID_SIZE, TAG, "wav buffer too small");
+    memmove(out, pcm, samples * sizeof(int16_t));
+    *out_len = wav_block_max(samples);
+    return ESP_OK;
+}
+
+/* mu-law: G.711 8-bit companding */
+
+static uint8_t ulaw_from_pcm(int16_t sample)
+{
+    const int bias = 0x84;
+    const int clip = 32635;
+    int pcm = sample;
+    uint8_t sign = 0;
+
+    if (pcm < 0) {
+        pcm = -pcm;
+        sign = 0x80;
+    }
+    if (pcm > clip) {
+        pcm = clip;
+    }
+    pcm += bias;
+
+    int exponent = 7;
+    for (int mask = 0x4000; !(pcm & mask) && exponent > 0; mask >>= 1) {
+        exponent--;
+    }
+    int mantissa = (pcm >> (exponent + 3)) & 0x0F;
+    return ~(sign | (exponent << 4) | mantissa);
+}
+
+/*
+ * Non-PCM WAV: the fmt chunk carries cbSize (18 bytes) and a fact chunk
+ * gives the number of samples, which strict decoders require
+ */
+#define ULAW_HEADER_SIZE        58
+
+static uint8_t *put_le(uint8_t *p, uint32_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++) {
+        *p++ = (value >> (8 * i)) & 0xFF;
+    }
+    return p;
+}
+
+static size_t ulaw_header(uint32_t sample_rate, size_t samples, uint8_t *out)
+{
+    /* Like the PCM header, all lengths are 0xFFFFFFFF while the stream length is unknown */
+    uint32_t data_len = samples ? (uint32_t)samples : UINT32_MAX;
+    uint8_t *p = out;
+
+    memcpy(p, "RIFF", 4);
+    p = put_le(p + 4, samples ? (uint32_t)(samples + ULAW_HEADER_SIZE - 8) : UINT32_MAX, 4);
+    memcpy(p, "WAVEfmt ", 8);
+    p = put_le(p + 8, 18, 4);
+    p = put_le(p, 7, 2);                    /* WAVE_FORMAT_MULAW */
+    p = put_le(p, 1, 2);                    /* mono */
+    p = put_le(p, sample_rate, 4);
+    p = put_le(p, sample_rate, 4);          /* one byte per sample */
+    p = put_le(p, 1, 2);
+    p = put_le(p, 8, 2);
+    p = put_le(p, 0, 2);                    /* cbSize, no extra format bytes */
+    memcpy(p, "fact", 4);
+    p = put_le(p + 4, 4, 4);
+    p = put_le(p, data_len, 4);
+    memcpy(p, "data", 4);
+    p = put_le(p + 4, data_len, 4);
+    return p - out;
+}
+
+static size_t ulaw_block_max(size_t samples)
+{
+    return samples;
+}
+
+static esp_err_t ulaw_block(const int16_t *pcm, size_t samples, uint32_t index,
+                            uint8_t *out, size_t out_size, size_t *out_len)
+{
+    ESP_RETURN_ON_FALSE(out_size >= ulaw_block_max(samples), ESP_ERR_INVALID_SIZE, TAG, "ulaw buffer too small");
+    for (size_t i = 0; i < samples; i++) {
+        int16_t s = pcm[i];
+        out[i] = ulaw_from_pcm(s);
+    }
+    *out_len = samples;
+    return ESP_OK;
+}
+
+/* FLAC */
+
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t pos;
+    uint32_t acc;
+    uint8_t bits;
+    bool overflow;
+} bit_writer_t;
+
+static void bw_put(bit_writer_t *bw, uint32_t value, uint8_t bits)
+{
+    while (bits) {
+        uint8_t n = bits > 8 ? 8 : bits;
+        bits -= n;
+        bw->acc = (bw->acc << n) | ((value >> bits) & ((1U << n) - 1));
+        bw->bits += n;
+        while (bw->bits >= 8) {
+            bw->bits -= 8;
+            if (bw->pos < bw->size) {
+                bw->buf[bw->pos++] = (bw->acc >> bw->bits) & 0xFF;
+            } else {
+                bw->overflow = true;
+            }
+        }
+    }
+}
+
+static void bw_put_unary(bit_writer_t *bw, uint32_t zeros)
+{
+    while (zeros >= 16) {
+        bw_put(bw, 0, 16);
+        zeros -= 16;
+    }
+    bw_put(bw, 1, zeros + 1);
+}
+
+static void bw_align(bit_writer_t *bw)
+{
+    if (bw->bits) {
+        bw_put(bw, 0, 8 - bw->bits);
+    }
+}
+
+static uint8_t flac_crc8(const uint8_t *data, size_t len)
+{
+    uint8_t crc = 0;
+    while (len--) {
+        crc ^= *data++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+static uint16_t flac_crc16(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0;
+    while (len--) {
+        crc ^= (uint16_t)(*data++) << 8;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+static inline int32_t fixed_residual(const int16_t *x, size_t i, int order)
+{
+    switch (order) {
+    case 0:
+        return x[i];
+    case 1:
+        return x[i] - x[i - 1];
+    case 2:
+        return x[i] - 2 * x[i - 1] + x[i - 2];
+    case 3:
+        return x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3];
+    default:
+        return x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4];
+    }
+}
+
+static inline uint32_t zigzag(int32_t r)
+{
+    return ((uint32_t)r << 1) ^ (uint32_t)(r >> 31);
+}
+
+static uint8_t rice_param(uint64_t sum, size_t count)
+{
+    uint8_t k = 0;
+    while (k < FLAC_MAX_RICE_PARAM && ((uint64_t)count << (k + 1)) < sum) {
+        k++;
+    }
+    return k;
+}
+
+/* Estimated residual bits for a partition order, using the per-partition Rice parameter */
+static uint64_t rice_cost(const int16_t *x, size_t n, int order, int porder)
+{
+    size_t psize = n >> porder;
+    uint64_t bits = 6;
+    size_t i = order;
+    for (int p = 0; p < (1 << porder); p++) {
+        size_t end = (p + 1) * psize;
+        size_t count = end - i;
+        uint64_t sum = 0;
+        for (size_t j = i; j < end; j++) {
+            sum += zigzag(fixed_residual(x, j, order));
+        }
+        uint8_t k = rice_param(sum, count);
+        bits += 4 + count * (k + 1) + (sum >> k);
+        i = end;
+    }
+    return bits;
+}
+
+static void flac_write_subframe(bit_writer_t *bw, const int16_t *x, size_t n)
+{
+    int best_order = -1;
+    int best_porder = 0;
+    uint64_t best_bits = (uint64_t)n * 16;  /* verbatim */
+
+    for (int order = 0; order <= FLAC_MAX_FIXED_ORDER && (size_t)order < n; order++) {
+        for (int porder = 0; porder <= FLAC_MAX_PARTITION; porder++) {
+            if ((n & ((1 << porder) - 1)) || (n >> porder) <= (size_t)order) {
+                break;
+            }
+            uint64_t bits = order * 16 + rice_cost(x, n, order, porder);
+            if (bits < best_bits) {
+                best_bits = bits;
+                best_order = order;
+                best_porder = porder;
+            }
+        }
+    }
+
+    if (best_order < 0) {
+        bw_put(bw, 0x02, 8);    /* verbatim, no wasted bits */
+        for (size_t i = 0; i < n; i++) {
+            bw_put(bw, (uint16_t)x[i], 16);
+        }
+        return;
+    }
+
+    bw_put(bw, (0x08 | best_order) << 1, 8);    /* fixed predictor, no wasted bits */
+    for (int i = 0; i < best_order; i++) {
+        bw_put(bw, (uint16_t)x[i], 16);
+    }
+    bw_put(bw, 0, 2);                           /* Rice coding, 4-bit parameters */
+    bw_put(bw, best_porder, 4);
+
+    size_t psize = n >> best_porder;
+    size_t i = best_order;
+    for (int p = 0; p < (1 << best_porder); p++) {
+        size_t end = (p + 1) * psize;
+        uint64_t sum = 0;
+        for (size_t j = i; j < end; j++) {
+            sum += zigzag(fixed_residual(x, j, best_order));
+        }
+        uint8_t k = rice_param(sum, end - i);
+        bw_put(bw, k, 4);
+        for (; i < end; i++) {
+            uint32_t u = zigzag(fixed_residual(x, i, best_order));
+            bw_put_unary(bw, u >> k);
+            bw_put(bw, u & ((1U << k) - 1), k);
+        }
+    }
+}
+
+static void flac_write_utf8(bit_writer_t *bw, uint32_t value)
+{
+    if (value < 0x80) {
+        bw_put(bw, value, 8);
+        return;
+    }
+    int extra = value < 0x800 ? 1 : value < 0x10000 ? 2 : value < 0x200000 ? 3 : value < 0x4000000 ? 4 : 5;
+    uint8_t lead = (0xFF00 >> (extra + 1)) & 0xFF;
+    bw_put(bw, lead | (value >> (6 * extra)), 8);
+    while (extra--) {
+        bw_put(bw, 0x80 | ((value >> (6 * extra)) & 0x3F), 8);
+    }
+}
+
+static size_t flac_header(uint32_t sample_rate, size_t samples, uint8_t *out)
+{
+    bit_writer_t bw = { .buf = out, .size = AUDIO_ENC_HEADER_MAX };
+
+    /* Stream marker and the STREAMINFO block, flagged as the last metadata block */
+    bw_put(&bw, 'f', 8);
+    bw_put(&bw, 'L', 8);
+    bw_put(&bw, 'a', 8);
+    bw_put(&bw, 'C', 8);
+    bw_put(&bw, 0x80, 8);
+    bw_put(&bw, 34, 24);
+    bw_put(&bw, FLAC_BLOCK_SIZE, 16);
+    bw_put(&bw, FLAC_BLOCK_SIZE, 16);
+    bw_put(&bw, 0, 24);                         /* min/max frame size unknown */
+    bw_put(&bw, 0, 24);
+    bw_put(&bw, sample_rate, 20);
+    bw_put(&bw, 0, 3);                          /* mono */
+    bw_put(&bw, 15, 5);                         /* 16 bits per sample */
+    bw_put(&bw, 0, 4);                          /* total samples, 36 bits, 0 when streaming */
+    bw_put(&bw, samples, 32);
+    for (int i = 0; i < 4; i++) {
+        bw_put(&bw, 0, 32);                     /* MD5 not computed */
+    }
+    return bw.pos;
+}
+
+static size_t flac_block_max(size_t samples)
+{
+    size_t frames = (samples + FLAC_BLOCK_SIZE - 1) / FLAC_BLOCK_SIZE;
+    return frames * FLAC_FRAME_OVERHEAD + samples * sizeof(int16_t);
+}
+
+/* One frame per FLAC_BLOCK_SIZE samples; only the last block of a stream may be shorter */
+static esp_err_t flac_block(const int16_t *pcm, size_t samples, uint32_t index,
+                            uint8_t *out, size_t out_size, size_t *out_len)
+{
+    bit_writer_t bw = { .buf = out, .size = out_size };
+    uint32_t frame_num = index / FLAC_BLOCK_SIZE;
+
+    for (size_t start = 0; start < samples; start += FLAC_BLOCK_SIZE, frame_num++) {
+        size_t n = samples - start < FLAC_BLOCK_SIZE ? samples - start : FLAC_BLOCK_SIZE;
+        size_t frame_start = bw.pos;
+
+        bw_put(&bw, 0xFFF8, 16);                /* sync, fixed block size */
+        bw_put(&bw, n == FLAC_BLOCK_SIZE ? 0x0C : 0x07, 4);
+        bw_put(&bw, 0x0, 4);                    /* sample rate from STREAMINFO */
+        bw_put(&bw, 0x0, 4);                    /* mono */
+        bw_put(&bw, 0x4, 3);                    /* 16 bits per sample */
+        bw_put(&bw, 0, 1);
+        flac_write_utf8(&bw, frame_num);
+        if (n != FLAC_BLOCK_SIZE) {
+            bw_put(&bw, n - 1, 16);
+        }
+        if (bw.overflow) {
+            break;
+        }
+        bw_put(&bw, flac_crc8(out + frame_start, bw.pos - frame_start), 8);
+
+        flac_write_subframe(&bw, pcm + start, n);
+        bw_align(&bw);
+        if (bw.overflow) {
+            break;
+        }
+        bw_put(&bw, flac_crc16(out + frame_start, bw.pos - frame_start), 16);
+    }
+
+    ESP_RETURN_ON_FALSE(!bw.overflow, ESP_ERR_INVALID_SIZE, TAG, "flac buffer too small");
+    *out_len = bw.pos;
+    return ESP_OK;
+}
+
+static const audio_enc_t s_codecs[AUDIO_ENC_MAX] = {
+    [AUDIO_ENC_WAV] = {
+        .type = AUDIO_ENC_WAV,
+        .name = "wav",
+        .mime_type = "audio/wav",
+        .header = wav_header,
+        .block_max = wav_block_max,
+        .block = wav_block,
+    },
+    [AUDIO_ENC_ULAW] = {
+        .type = AUDIO_ENC_ULAW,
+        .name = "mu-law",
+        .mime_type = "audio/wav",
+        .header = ulaw_header,
+        .block_max = ulaw_block_max,
+        .block = ulaw_block,
+    },
+    [AUDIO_ENC_FLAC] = {
+        .type = AUDIO_ENC_FLAC,
+        .name = "flac",
+        .mime_type = "audio/flac",
+        .header = flac_header,
+        .block_max = flac_block_max,
+        .block = flac_block,
+    },
+};
+
+const audio_enc_t *audio_enc_get(audio_enc_type_t type)
+{
+    return type < AUDIO_ENC_MAX ? &s_codecs[type] : NULL;
+}
+
+const audio_enc_t *audio_enc_get_default(void)
+{
+#if CONFIG_AUDIO_UPLOAD_CODEC_FLAC
+    return audio_enc_get(AUDIO_ENC_FLAC);
+#elif CONFIG_AUDIO_UPLOAD_CODEC_ULAW
+    return audio_enc_get(AUDIO_ENC_ULAW);
+#else
+    return audio_enc_get(AUDIO_ENC_WAV);
+#endif
+}
+
+esp_err_t audio_enc_encode(const audio_enc_t *enc, uint32_t sample_rate, size_t samples,
+                           audio_enc_read_cb_t read, void *user_ctx, uint8_t **out, size_t *out_len)
+{
+    ESP_RETURN_ON_FALSE(enc && read && out && out_len, ESP_ERR_INVALID_ARG, TAG, "invalid args");
+
+    size_t blocks = (samples + AUDIO_ENC_BLOCK_SAMPLES - 1) / AUDIO_ENC_BLOCK_SAMPLES;
+    size_t size = AUDIO_ENC_HEADER_MAX + blocks * enc->block_max(AUDIO_ENC_BLOCK_SAMPLES);
+    uint8_t *dst = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    ESP_RETURN_ON_FALSE(NULL != dst, ESP_ERR_NO_MEM, TAG, "encode buffer malloc failed");
+
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = ESP_OK;
+    size_t len = enc->header(sample_rate, samples, dst);
+    for (size_t index = 0; index < samples && ESP_OK == ret; index += AUDIO_ENC_BLOCK_SAMPLES) {
+        size_t n = samples - index < AUDIO_ENC_BLOCK_SAMPLES ? samples - index : AUDIO_ENC_BLOCK_SAMPLES;
+        size_t block_len = 0;
+        ret = enc->block(read(index, n, user_ctx), n, index, dst + len, size - len, &block_len);
+        len += block_len;
+    }
+    if (ESP_OK != ret) {
+        audio_enc_release(dst);
+        return ret;
+    }
+    *out = dst;
+    *out_len = len;
+
+    size_t pcm_len = sizeof(wav_header_t) + samples * sizeof(int16_t);
+    ESP_LOGI(TAG, "%s: %u -> %u bytes (%u%%) in %d ms", enc->name, (unsigned)pcm_len, (unsigned)len,
+             (unsigned)(len * 100 / pcm_len), (int)((esp_timer_get_time() - start) / 1000));
+    return ESP_OK;
+}
+
+void audio_enc_release(uint8_t *out)
+{
+    if (out) {
+        heap_caps_free(out);
+    }
+}
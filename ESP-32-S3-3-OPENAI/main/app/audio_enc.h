@@ -0,0 +1,82 @@
+/*
+ * Upload codecs for recorded voice queries
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    AUDIO_ENC_WAV = 0,      /* 16-bit PCM WAV, sent as recorded */
+    AUDIO_ENC_ULAW,         /* 8-bit G.711 mu-law WAV */
+    AUDIO_ENC_FLAC,         /* lossless FLAC */
+    AUDIO_ENC_MAX,
+} audio_enc_type_t;
+
+/** Largest stream header of any codec */
+#define AUDIO_ENC_HEADER_MAX    58
+/** Samples per block when streaming, every block but the last must have this size */
+#define AUDIO_ENC_BLOCK_SAMPLES 4096
+
+typedef struct {
+    audio_enc_type_t type;
+    const char *name;
+    const char *mime_type;
+    /* Write the stream header (at most AUDIO_ENC_HEADER_MAX bytes), samples is 0 if unknown */
+    size_t (*header)(uint32_t sample_rate, size_t samples, uint8_t *out);
+    /* Worst-case encoded size of `samples` samples */
+    size_t (*block_max)(size_t samples);
+    /* Encode samples starting at sample `index` of the stream */
+    esp_err_t (*block)(const int16_t *pcm, size_t samples, uint32_t index,
+                       uint8_t *out, size_t out_size, size_t *out_len);
+} audio_enc_t;
+
+/**
+ * @brief Get a codec by type, NULL if it is not available
+ */
+const audio_enc_t *audio_enc_get(audio_enc_type_t type);
+
+/**
+ * @brief Get the codec selected by CONFIG_AUDIO_UPLOAD_CODEC
+ */
+const audio_enc_t *audio_enc_get_default(void);
+
+/**
+ * @brief Get `samples` contiguous samples of the input starting at sample `index`
+ *
+ * The pointer only has to stay valid until the next call.
+ */
+typedef const int16_t *(*audio_enc_read_cb_t)(size_t index, size_t samples, void *user_ctx);
+
+/**
+ * @brief Encode a mono 16-bit recording into one stream in a new PSRAM buffer
+ *
+ * The input is read in blocks of AUDIO_ENC_BLOCK_SAMPLES, so it does not have
+ * to be contiguous. Release the result with audio_enc_release().
+ *
+ * @param enc Codec to use
+ * @param sample_rate Sample rate of the recording
+ * @param samples Number of samples
+ * @param read Supplies the samples
+ * @param user_ctx Passed to `read`
+ * @param[out] out Encoded data
+ * @param[out] out_len Length of the encoded data
+ */
+esp_err_t audio_enc_encode(const audio_enc_t *enc, uint32_t sample_rate, size_t samples,
+                           audio_enc_read_cb_t read, void *user_ctx, uint8_t **out, size_t *out_len);
+
+/**
+ * @brief Free the output of audio_enc_encode()
+ */
+void audio_enc_release(uint8_t *out);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,288 @@
+/*
+ * Playback queue for cues and audio streams
+ *
+ * The speech recognition handler must never wait for the speaker, so every
+ * sound goes through a queue served by its own task. Requests are kept in
+ * priority order; one of higher priority than the sound playing cuts it
+ * short. Preloaded PCM cues are written to I2S in short chunks so they can be
+ * stopped quickly, streams are decoded by the audio player while this task
+ * waits for it to go idle.
+ */
+
+#include <string.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_check.h"
+#include "bsp_board.h"
+#include "audio_player.h"
+#include "audio_cue.h"
+#include "audio_playback.h"
+#include "turn_trace.h"
+
+static const char *TAG = "audio_playback";
+
+#define AUDIO_PLAYBACK_QUEUE_LEN    8
+#define AUDIO_PLAYBACK_PATH_LEN     48
+/* 16 ms of cue audio, the longest a preempted cue keeps playing */
+#define AUDIO_PLAYBACK_CHUNK        (AUDIO_CUE_RATE / 1000 * 16 * AUDIO_CUE_CHANNELS * sizeof(int16_t))
+#define AUDIO_PLAYBACK_POLL_MS      20
+#define AUDIO_PLAYBACK_STOP_MS      500
+
+typedef struct {
+    char path[AUDIO_PLAYBACK_PATH_LEN];
+    FILE *fp;                   /* a stream to decode, or NULL to play `path` */
+    audio_playback_prio_t prio;
+    uint32_t generation;        /* requests from before the last flush are dropped */
+    audio_playback_done_cb_t cb;
+    void *user_ctx;
+} audio_playback_req_t;
+
+static struct {
+    TaskHandle_t task;
+    SemaphoreHandle_t idle;     /* given by the audio player callback */
+    portMUX_TYPE lock;
+    audio_playback_req_t queue[AUDIO_PLAYBACK_QUEUE_LEN];   /* highest priority first */
+    size_t count;
+    uint32_t generation;
+    bool playing;
+    audio_playback_prio_t playing_prio;
+    volatile bool abort;        /* stop the request playing */
+    volatile int volume;        /* speaker volume, 1-100 */
+    audio_playback_idle_cb_t idle_cb;
+} s_playback = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+    .volume = CONFIG_VOLUME_LEVEL,
+};
+
+static esp_err_t audio_playback_push(const audio_playback_req_t *req)
+{
+    esp_err_t ret = ESP_OK;
+
+    portENTER_CRITICAL(&s_playback.lock);
+    if (s_playback.count < AUDIO_PLAYBACK_QUEUE_LEN) {
+        size_t i = s_playback.count++;
+        /* Behind everything of the same or a higher priority */
+        for (; i > 0 && s_playback.queue[i - 1].prio < req->prio; i--) {
+            s_playback.queue[i] = s_playback.queue[i - 1];
+        }
+        s_playback.queue[i] = *req;
+        s_playback.queue[i].generation = s_playback.generation;
+        if (s_playback.playing && req->prio > s_playback.playing_prio) {
+            s_playback.abort = true;
+        }
+    } else {
+        ret = ESP_ERR_NO_MEM;
+    }
+    portEXIT_CRITICAL(&s_playback.lock);
+
+    if (ESP_OK == ret) {
+        xTaskNotifyGive(s_playback.task);
+    }
+    return ret;
+}
+
+/* Takes the next request, false if there is none; `stale` is set when it was flushed */
+static bool audio_playback_pop(audio_playback_req_t *req, bool *stale)
+{
+    bool found = false;
+
+    portENTER_CRITICAL(&s_playback.lock);
+    if (s_playback.count) {
+        *req = s_playback.queue[0];
+        s_playback.count--;
+        memmove(&s_playback.queue[0], &s_playback.queue[1], s_playback.count * sizeof(audio_playback_req_t));
+        *stale = req->generation != s_playback.generation;
+        s_playback.playing = !*stale;
+        s_playback.playing_prio = req->prio;
+        s_playback.abort = false;
+        found = true;
+    } else {
+        s_playback.playing = false;
+    }
+    portEXIT_CRITICAL(&s_playback.lock);
+    return found;
+}
+
+static esp_err_t audio_playback_cue(const audio_cue_t *cue)
+{
+    size_t cnt = 0;
+
+    bsp_codec_set_fs(AUDIO_CUE_RATE, 16, I2S_SLOT_MODE_STEREO);
+    bsp_codec_mute_set(true);
+    bsp_codec_mute_set(false);
+    bsp_codec_volume_set(s_playback.volume, NULL);
+
+    for (size_t pos = 0; pos < cue->len; pos += cnt) {
+        if (s_playback.abort) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        size_t n = MIN(AUDIO_PLAYBACK_CHUNK, cue->len - pos);
+        ESP_RETURN_ON_ERROR(bsp_i2s_write((void *)(cue->data + pos), n, &cnt, portMAX_DELAY), TAG, "i2s write failed");
+    }
+    return ESP_OK;
+}
+
+/* Hands the stream to the audio player, which closes it, and waits until it is done */
+static esp_err_t audio_playback_stream(FILE *fp)
+{
+    xSemaphoreTake(s_playback.idle, 0);
+    ESP_RETURN_ON_ERROR(audio_player_play(fp), TAG, "player start failed");
+
+    while (pdTRUE != xSemaphoreTake(s_playback.idle, pdMS_TO_TICKS(AUDIO_PLAYBACK_POLL_MS))) {
+        if (s_playback.abort) {
+            audio_player_stop();
+            /* Its idle event must not be mistaken for the end of the next stream */
+            xSemaphoreTake(s_playback.idle, pdMS_TO_TICKS(AUDIO_PLAYBACK_STOP_MS));
+            return ESP_ERR_INVALID_STATE;
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t audio_playback_run(audio_playback_req_t *req)
+{
+    FILE *fp = req->fp;
+    if (NULL == fp) {
+        const audio_cue_t *cue = audio_cue_find(req->path);
+        if (cue && AUDIO_CUE_PCM == cue->format) {
+            return audio_playback_cue(cue);
+        }
+        fp = audio_cue_fopen(req->path);
+        ESP_RETURN_ON_FALSE(NULL != fp, ESP_ERR_NOT_FOUND, TAG, "open %s failed", req->path);
+    }
+    return audio_playback_stream(fp);
+}
+
+static void audio_playback_task(void *arg)
+{
+    audio_playback_req_t req;
+    bool stale = false;
+    bool played = false;
+
+    while (true) {
+        if (!audio_playback_pop(&req, &stale)) {
+            /* Once per run of requests, after audio_playback_busy() turned false */
+            if (played && s_playback.idle_cb) {
+                s_playback.idle_cb();
+            }
+            played = false;
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        played = true;
+        esp_err_t ret = ESP_ERR_INVALID_STATE;
+        if (!stale) {
+            ret = audio_playback_run(&req);
+            if (ESP_ERR_INVALID_STATE == ret && req.generation != s_playback.generation) {
+                /* Flushed while playing, the wake word barged in */
+                turn_trace_mark(TURN_PHASE_BARGE_IN);
+            }
+        } else if (req.fp) {
+            fclose(req.fp);
+        }
+        ESP_LOGD(TAG, "%s: %s", req.fp ? "stream" : req.path, esp_err_to_name(ret));
+        if (req.cb) {
+            req.cb(ret, req.user_ctx);
+        }
+    }
+}
+
+esp_err_t audio_playback_init(void)
+{
+    ESP_RETURN_ON_FALSE(NULL == s_playback.task, ESP_ERR_INVALID_STATE, TAG, "already started");
+    s_playback.idle = xSemaphoreCreateBinary();
+    ESP_RETURN_ON_FALSE(NULL != s_playback.idle, ESP_ERR_NO_MEM, TAG, "Failed create idle semaphore");
+    if (pdPASS != xTaskCreatePinnedToCore(&audio_playback_task, "Playback Task", 4 * 1024, NULL, 5, &s_playback.task, 0)) {
+        vSemaphoreDelete(s_playback.idle);
+        s_playback.idle = NULL;
+        s_playback.task = NULL;
+        ESP_LOGE(TAG, "Failed create playback task");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t audio_playback_play(const char *path, audio_playback_prio_t prio, audio_playback_done_cb_t cb, void *user_ctx)
+{
+    ESP_RETURN_ON_FALSE(NULL != path && strlen(path) < AUDIO_PLAYBACK_PATH_LEN, ESP_ERR_INVALID_ARG, TAG, "invalid path");
+    ESP_RETURN_ON_FALSE(NULL != s_playback.task, ESP_ERR_INVALID_STATE, TAG, "not started");
+
+    audio_playback_req_t req = {
+        .prio = prio,
+        .cb = cb,
+        .user_ctx = user_ctx,
+    };
+    strcpy(req.path, path);
+    ESP_RETURN_ON_ERROR(audio_playback_push(&req), TAG, "queue full, %s dropped", path);
+    return ESP_OK;
+}
+
+esp_err_t audio_playback_play_stream(FILE *fp, audio_playback_prio_t prio, audio_playback_done_cb_t cb, void *user_ctx)
+{
+    ESP_RETURN_ON_FALSE(NULL != fp, ESP_ERR_INVALID_ARG, TAG, "invalid stream");
+
+    esp_err_t ret = ESP_ERR_INVALID_STATE;
+    if (s_playback.task) {
+        audio_playback_req_t req = {
+            .fp = fp,
+            .prio = prio,
+            .cb = cb,
+            .user_ctx = user_ctx,
+        };
+        ret = audio_playback_push(&req);
+    }
+    if (ESP_OK != ret) {
+        ESP_LOGE(TAG, "stream dropped: %s", esp_err_to_name(ret));
+        fclose(fp);
+    }
+    return ret;
+}
+
+void audio_playback_flush(void)
+{
+    portENTER_CRITICAL(&s_playback.lock);
+    s_playback.generation++;
+    s_playback.abort = s_playback.playing;
+    portEXIT_CRITICAL(&s_playback.lock);
+    /* Let the task drop what was queued, and call its callbacks */
+    if (s_playback.task) {
+        xTaskNotifyGive(s_playback.task);
+    }
+}
+
+void audio_playback_player_idle(void)
+{
+    if (s_playback.idle) {
+        xSemaphoreGive(s_playback.idle);
+    }
+}
+
+bool audio_playback_busy(void)
+{
+    portENTER_CRITICAL(&s_playback.lock);
+    bool busy = s_playback.playing || s_playback.count;
+    portEXIT_CRITICAL(&s_playback.lock);
+    return busy;
+}
+
+void audio_playback_register_idle_cb(audio_playback_idle_cb_t cb)
+{
+    s_playback.idle_cb = cb;
+}
+
+int audio_playback_volume(void)
+{
+    return s_playback.volume;
+}
+
+int audio_playback_volume_step(int delta)
+{
+    int volume = s_playback.volume + delta;
+    volume = MIN(MAX(volume, 1), 100);
+    s_playback.volume = volume;
+    bsp_codec_volume_set(volume, NULL);
+    return volume;
+}
@@ -0,0 +1,88 @@
+/*
+ * Playback queue for cues and audio streams
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Higher priorities play first and cut a lower one short */
+typedef enum {
+    AUDIO_PLAYBACK_PRIO_LOW,    /* background, like the "please wait" prompt */
+    AUDIO_PLAYBACK_PRIO_NORMAL, /* replies */
+    AUDIO_PLAYBACK_PRIO_HIGH,   /* acknowledgements the child waits for */
+} audio_playback_prio_t;
+
+/**
+ * @brief Called from the playback task once a request is over
+ *
+ * @param result ESP_OK when it played to the end, ESP_ERR_INVALID_STATE when
+ *               it was preempted or flushed, another error when it could not play
+ */
+typedef void (*audio_playback_done_cb_t)(esp_err_t result, void *user_ctx);
+
+/**
+ * @brief Called from the playback task when the last queued request is over
+ */
+typedef void (*audio_playback_idle_cb_t)(void);
+
+/**
+ * @brief Start the playback task, after the audio player was created
+ */
+esp_err_t audio_playback_init(void);
+
+/**
+ * @brief Queue a cue by path, preloaded cues play from memory, anything else from the filesystem
+ *
+ * Returns right away. A request of higher priority than the one playing
+ * stops it; requests of the same priority play in order.
+ *
+ * @param cb Optional completion callback
+ */
+esp_err_t audio_playback_play(const char *path, audio_playback_prio_t prio, audio_playback_done_cb_t cb, void *user_ctx);
+
+/**
+ * @brief Queue a stream for the audio player to decode, like an MP3 reply
+ *
+ * The stream is closed once it has played or was dropped, also on failure.
+ */
+esp_err_t audio_playback_play_stream(FILE *fp, audio_playback_prio_t prio, audio_playback_done_cb_t cb, void *user_ctx);
+
+/**
+ * @brief Drop every queued request and stop the one playing, without waiting
+ */
+void audio_playback_flush(void);
+
+/**
+ * @brief The audio player went idle, from its event callback
+ */
+void audio_playback_player_idle(void);
+
+/**
+ * @brief Something is playing or queued
+ */
+bool audio_playback_busy(void);
+
+void audio_playback_register_idle_cb(audio_playback_idle_cb_t cb);
+
+/**
+ * @brief Speaker volume every sound is played at, 1-100, CONFIG_VOLUME_LEVEL at boot
+ */
+int audio_playback_volume(void);
+
+/**
+ * @brief Change the speaker volume by `delta`, right away and for everything played later
+ *
+ * @return The new volume, kept within 1-100
+ */
+int audio_playback_volume_step(int delta);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,187 @@
+/*
+ * Fixed-point polyphase resampler for recorded audio
+ *
+ * Conceptually the input is upsampled by `up` (zeros stuffed in between),
+ * low-pass filtered at the lower of the two Nyquist frequencies and then
+ * decimated by `down`. Only the filter taps that meet non-zero input and
+ * outputs that are kept get computed: each output uses one of the `up`
+ * polyphase branches of `taps` fixed-point taps.
+ *
+ * The filter is flat to 0.9 of the lower Nyquist frequency and stops from
+ * 1.1 of it, so what aliases only lands above the pass band. The branches get
+ * longer the more the rate drops, which is what keeps that band this narrow.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "audio_resample.h"
+
+static const char *TAG = "audio_resample";
+
+#define RESAMPLE_MAX_UP         16
+#define RESAMPLE_MAX_TAPS       192
+/* Transition band around the lower Nyquist frequency, as a fraction of it */
+#define RESAMPLE_TRANSITION     0.2f
+/* A Blackman window's transition is this many input samples over the filter length, stop band about -74 dB */
+#define RESAMPLE_BLACKMAN_WIDTH 5.5f
+
+struct audio_resample {
+    uint16_t up;
+    uint16_t down;
+    uint16_t phase;         /* branch of the next output, outputs are due while phase < up */
+    uint16_t pos;           /* oldest sample of the delay line window */
+    uint16_t taps;          /* per branch */
+    uint8_t shift;          /* fraction bits of the taps, 15 unless that could overflow the accumulator */
+    uint8_t channels;
+    int16_t *coef;          /* `up` branches, each reversed so it lines up with the delay line */
+    int16_t *delay;         /* per channel the last taps twice, so every window is contiguous */
+};
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/*
+ * Windowed-sinc prototype at up * in_rate, cut off at the lower Nyquist
+ * frequency and split into branches with a DC gain of exactly 1.0. Returns
+ * the largest sum of |taps| of a branch.
+ */
+static int32_t audio_resample_design(audio_resample_t *rs, uint32_t in_rate, uint32_t out_rate)
+{
+    const int len = rs->up * rs->taps;
+    const float center = (len - 1) / 2.0f;
+    const float fc = (in_rate < out_rate ? in_rate : out_rate) / 2.0f / (rs->up * in_rate);
+    const int32_t one = 1 << rs->shift;
+    int32_t gain = 0;
+
+    for (int phase = 0; phase < rs->up; phase++) {
+        int16_t *c = rs->coef + phase * rs->taps;
+        int32_t sum = 0;
+        int32_t abs_sum = 0;
+        int peak = 0;
+
+        for (int j = 0; j < rs->taps; j++) {
+            int i = phase + (rs->taps - 1 - j) * rs->up;
+            float x = i - center;
+            float sinc = x == 0 ? 1.0f : sinf(2 * M_PI * fc * x) / (2 * M_PI * fc * x);
+            float blackman = 0.42f - 0.5f * cosf(2 * M_PI * i / (len - 1)) + 0.08f * cosf(4 * M_PI * i / (len - 1));
+            float h = 2 * fc * rs->up * sinc * blackman;
+            c[j] = lrintf(h * one);
+            sum += c[j];
+            if (abs(c[j]) > abs(c[peak])) {
+                peak = j;
+            }
+        }
+        /* Rounding error goes to the largest tap, silence in stays silence and DC keeps its level */
+        c[peak] += one - sum;
+        for (int j = 0; j < rs->taps; j++) {
+            abs_sum += abs(c[j]);
+        }
+        gain = abs_sum > gain ? abs_sum : gain;
+    }
+    return gain;
+}
+
+esp_err_t audio_resample_create(uint32_t in_rate, uint32_t out_rate, uint8_t channels, audio_resample_t **ret_rs)
+{
+    ESP_RETURN_ON_FALSE(in_rate && out_rate && channels && ret_rs, ESP_ERR_INVALID_ARG, TAG, "invalid args");
+    uint32_t div = gcd(in_rate, out_rate);
+    ESP_RETURN_ON_FALSE(out_rate / div <= RESAMPLE_MAX_UP && in_rate / div <= UINT16_MAX, ESP_ERR_NOT_SUPPORTED,
+                        TAG, "%" PRIu32 " to %" PRIu32 " Hz is not supported", in_rate, out_rate);
+
+    audio_resample_t *rs = heap_caps_calloc(1, sizeof(audio_resample_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    ESP_RETURN_ON_FALSE(NULL != rs, ESP_ERR_NO_MEM, TAG, "resampler malloc failed");
+    rs->up = out_rate / div;
+    rs->down = in_rate / div;
+    rs->channels = channels;
+    float taps = RESAMPLE_BLACKMAN_WIDTH * in_rate / (RESAMPLE_TRANSITION * (in_rate < out_rate ? in_rate : out_rate) / 2);
+    rs->taps = taps < RESAMPLE_MAX_TAPS ? ceilf(taps) : RESAMPLE_MAX_TAPS;
+    rs->coef = heap_caps_malloc(rs->up * rs->taps * sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    rs->delay = heap_caps_malloc(channels * 2 * rs->taps * sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (NULL == rs->coef || NULL == rs->delay) {
+        audio_resample_delete(rs);
+        ESP_LOGE(TAG, "filter malloc failed");
+        return ESP_ERR_NO_MEM;
+    }
+
+    /*
+     * Full scale input times the taps must fit the 32-bit accumulator. The
+     * ripples of long filters add up to more than 2.0, those get Q14 taps.
+     */
+    for (rs->shift = 15; audio_resample_design(rs, in_rate, out_rate) >= 65536; rs->shift--) {
+        if (rs->shift <= 13) {
+            audio_resample_delete(rs);
+            ESP_LOGE(TAG, "filter gain too high");
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+    }
+    audio_resample_reset(rs);
+    ESP_LOGI(TAG, "%" PRIu32 " -> %" PRIu32 " Hz, %u/%u, %u Q%u taps per branch", in_rate, out_rate, rs->up,
+             rs->down, rs->taps, rs->shift);
+    *ret_rs = rs;
+    return ESP_OK;
+}
+
+void audio_resample_delete(audio_resample_t *rs)
+{
+    if (rs) {
+        heap_caps_free(rs->coef);
+        heap_caps_free(rs->delay);
+        heap_caps_free(rs);
+    }
+}
+
+void audio_resample_reset(audio_resample_t *rs)
+{
+    memset(rs->delay, 0, rs->channels * 2 * rs->taps * sizeof(int16_t));
+    rs->phase = 0;
+    rs->pos = 0;
+}
+
+size_t audio_resample_out_max(const audio_resample_t *rs, size_t in_frames)
+{
+    return (in_frames * rs->up + rs->down - 1) / rs->down + 1;
+}
+
+size_t audio_resample_process(audio_resample_t *rs, const int16_t *in, size_t in_frames, uint8_t in_channels, int16_t *out)
+{
+    size_t n = 0;
+
+    for (size_t i = 0; i < in_frames; i++) {
+        /* The newest sample goes to pos and pos + taps, the window then starts right after it */
+        for (int ch = 0; ch < rs->channels; ch++) {
+            int16_t *d = rs->delay + ch * 2 * rs->taps;
+            d[rs->pos] = d[rs->pos + rs->taps] = in[i * in_channels + ch];
+        }
+        uint16_t start = rs->pos + 1;
+        rs->pos = start % rs->taps;
+
+        for (; rs->phase < rs->up; rs->phase += rs->down) {
+            const int16_t *c = rs->coef + rs->phase * rs->taps;
+            for (int ch = 0; ch < rs->channels; ch++) {
+                const int16_t *x = rs->delay + ch * 2 * rs->taps + start;
+                /* |taps| sum to under 65536 (checked at create), the 32-bit accumulator cannot overflow */
+                int32_t acc = 1 << (rs->shift - 1);
+                for (int j = 0; j < rs->taps; j++) {
+                    acc += c[j] * x[j];
+                }
+                acc >>= rs->shift;
+                out[n * rs->channels + ch] = acc > INT16_MAX ? INT16_MAX : acc < INT16_MIN ? INT16_MIN : acc;
+            }
+            n++;
+        }
+        rs->phase -= rs->up;
+    }
+    return n;
+}
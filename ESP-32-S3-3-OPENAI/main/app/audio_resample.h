@@ -0,0 +1,52 @@
+/*
+ * Fixed-point polyphase resampler for recorded audio
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct audio_resample audio_resample_t;
+
+/**
+ * @brief Create a resampler from `in_rate` to `out_rate`
+ *
+ * The rates must reduce to a ratio with small terms, like 16000 to 8000 or 12000.
+ *
+ * @param channels Channels produced, interleaved
+ * @param[out] ret_rs The new resampler
+ */
+esp_err_t audio_resample_create(uint32_t in_rate, uint32_t out_rate, uint8_t channels, audio_resample_t **ret_rs);
+
+void audio_resample_delete(audio_resample_t *rs);
+
+/**
+ * @brief Forget the filter history, at the start of a new stream
+ */
+void audio_resample_reset(audio_resample_t *rs);
+
+/**
+ * @brief Most frames audio_resample_process() can produce from `in_frames`
+ */
+size_t audio_resample_out_max(const audio_resample_t *rs, size_t in_frames);
+
+/**
+ * @brief Resample the first channels of an interleaved block
+ *
+ * @param in Input frames
+ * @param in_frames Number of input frames
+ * @param in_channels Interleaved channels of the input, at least the resampler's channels
+ * @param[out] out Room for audio_resample_out_max() frames
+ * @return Frames written to `out`
+ */
+size_t audio_resample_process(audio_resample_t *rs, const int16_t *in, size_t in_frames, uint8_t in_channels, int16_t *out);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,138 @@
+/*
+ * Lock-free ring of timestamped audio frames from the I2S feed
+ *
+ * One producer (the feed task) and any number of readers, each with its own
+ * position. The producer never waits for readers: it fills the slot of the
+ * next sequence number and then publishes the new head. A reader copies a
+ * frame out and checks afterwards that the producer has not started to
+ * overwrite that slot in the meantime, dropping the frame if it has.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "audio_ring.h"
+
+static const char *TAG = "audio_ring";
+
+typedef struct {
+    int64_t timestamp_us;
+    int16_t data[];
+} audio_ring_slot_t;
+
+struct audio_ring {
+    uint8_t *slots;
+    size_t capacity;
+    size_t frame_size;
+    size_t slot_size;
+    uint8_t channels;
+    uint32_t head;          /* written by the producer only, read with acquire ordering */
+};
+
+static inline audio_ring_slot_t *audio_ring_slot(const audio_ring_t *ring, uint32_t seq)
+{
+    return (audio_ring_slot_t *)(ring->slots + (seq % ring->capacity) * ring->slot_size);
+}
+
+esp_err_t audio_ring_create(size_t frames, size_t frame_samples, uint8_t channels, audio_ring_t **ret_ring)
+{
+    ESP_RETURN_ON_FALSE(frames >= 2 && frame_samples && channels && ret_ring, ESP_ERR_INVALID_ARG, TAG, "invalid args");
+
+    audio_ring_t *ring = heap_caps_calloc(1, sizeof(audio_ring_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    ESP_RETURN_ON_FALSE(NULL != ring, ESP_ERR_NO_MEM, TAG, "ring malloc failed");
+    ring->capacity = frames;
+    ring->channels = channels;
+    ring->frame_size = frame_samples * channels * sizeof(int16_t);
+    ring->slot_size = (sizeof(audio_ring_slot_t) + ring->frame_size + 7) & ~7;
+    ring->slots = heap_caps_malloc(frames * ring->slot_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (NULL == ring->slots) {
+        heap_caps_free(ring);
+        ESP_LOGE(TAG, "slots malloc failed");
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "%u frames of %u bytes", (unsigned)frames, (unsigned)ring->frame_size);
+    *ret_ring = ring;
+    return ESP_OK;
+}
+
+void audio_ring_delete(audio_ring_t *ring)
+{
+    if (ring) {
+        heap_caps_free(ring->slots);
+        heap_caps_free(ring);
+    }
+}
+
+size_t audio_ring_frame_size(const audio_ring_t *ring)
+{
+    return ring->frame_size;
+}
+
+uint8_t audio_ring_channels(const audio_ring_t *ring)
+{
+    return ring->channels;
+}
+
+size_t audio_ring_capacity(const audio_ring_t *ring)
+{
+    return ring->capacity;
+}
+
+void audio_ring_push(audio_ring_t *ring, const int16_t *frame, int64_t timestamp_us)
+{
+    uint32_t head = ring->head;
+    audio_ring_slot_t *slot = audio_ring_slot(ring, head);
+
+    /* The last published head must be visible before this slot starts to change */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    slot->timestamp_us = timestamp_us;
+    memcpy(slot->data, frame, ring->frame_size);
+    /* Readers that see the new head also see the frame */
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+uint32_t audio_ring_head(const audio_ring_t *ring)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
+
+void audio_ring_reader_init(audio_ring_reader_t *reader, uint32_t seq)
+{
+    reader->next = seq;
+    reader->dropped = 0;
+}
+
+esp_err_t audio_ring_read(audio_ring_t *ring, audio_ring_reader_t *reader, int16_t *frame, int64_t *timestamp_us)
+{
+    uint32_t head = audio_ring_head(ring);
+
+    while ((int32_t)(head - reader->next) > 0) {
+        /* The slot of head - capacity may be being overwritten already */
+        if (head - reader->next >= ring->capacity) {
+            uint32_t oldest = head - ring->capacity + 1;
+            reader->dropped += oldest - reader->next;
+            reader->next = oldest;
+        }
+
+        const audio_ring_slot_t *slot = audio_ring_slot(ring, reader->next);
+        int64_t timestamp = slot->timestamp_us;
+        memcpy(frame, slot->data, ring->frame_size);
+
+        /* Copy first, then make sure the producer has not reached this slot again */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        head = audio_ring_head(ring);
+        if (head - reader->next < ring->capacity) {
+            reader->next++;
+            if (timestamp_us) {
+                *timestamp_us = timestamp;
+            }
+            return ESP_OK;
+        }
+        reader->dropped++;
+        reader->next++;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
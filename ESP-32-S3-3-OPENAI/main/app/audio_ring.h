@@ -0,0 +1,73 @@
+/*
+ * Lock-free ring of timestamped audio frames from the I2S feed
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct audio_ring audio_ring_t;
+
+/* Position of one consumer, every consumer owns its reader */
+typedef struct {
+    uint32_t next;          /* sequence number of the next frame to read */
+    uint32_t dropped;       /* frames overwritten before they were read */
+} audio_ring_reader_t;
+
+/**
+ * @brief Create a ring in PSRAM
+ *
+ * @param frames Number of frames the ring holds, readers that fall further behind lose frames
+ * @param frame_samples Samples per channel in one frame
+ * @param channels Interleaved channels per frame
+ * @param[out] ret_ring The new ring
+ */
+esp_err_t audio_ring_create(size_t frames, size_t frame_samples, uint8_t channels, audio_ring_t **ret_ring);
+
+void audio_ring_delete(audio_ring_t *ring);
+
+/** Bytes of one frame, the size of the buffer audio_ring_read() fills */
+size_t audio_ring_frame_size(const audio_ring_t *ring);
+
+/** Interleaved channels of a frame */
+uint8_t audio_ring_channels(const audio_ring_t *ring);
+
+/** Number of frames the ring holds */
+size_t audio_ring_capacity(const audio_ring_t *ring);
+
+/**
+ * @brief Append a frame, only from the single producer
+ *
+ * Never blocks and takes no lock: the oldest frame is overwritten, readers
+ * that still needed it notice and count it as dropped.
+ */
+void audio_ring_push(audio_ring_t *ring, const int16_t *frame, int64_t timestamp_us);
+
+/** Sequence number the next pushed frame will get */
+uint32_t audio_ring_head(const audio_ring_t *ring);
+
+/**
+ * @brief Start reading at frame `seq`
+ *
+ * Older frames than the ring still holds are skipped on the first read.
+ */
+void audio_ring_reader_init(audio_ring_reader_t *reader, uint32_t seq);
+
+/**
+ * @brief Copy the reader's next frame, from any task
+ *
+ * @param[out] frame audio_ring_frame_size() bytes
+ * @param[out] timestamp_us esp_timer time the frame was captured, may be NULL
+ * @return ESP_OK, or ESP_ERR_NOT_FOUND if the reader has caught up with the producer
+ */
+esp_err_t audio_ring_read(audio_ring_t *ring, audio_ring_reader_t *reader, int16_t *frame, int64_t *timestamp_us);
+
+#ifdef __cplusplus
+}
+#endif
@@ -5,6 +5,7 @@
 #include "bsp_board.h"
 #include "esp_log.h"
 #include "esp_check.h"
+#include "aec_ref.h"
 
 static const char *TAG = "bsp_compat";
 
@@ -63,6 +64,8 @@ esp_err_t bsp_i2s_write(void *src, size_t size, size_t *bytes_written, TickType_
     }
     int ret = esp_codec_dev_write(play_handle, src, size);
     if (ret == ESP_CODEC_DEV_OK) {
+        /* Everything the speaker plays passes here, the echo canceller gets a copy */
+        aec_ref_write(src, size);
         if (bytes_written) *bytes_written = size;
         return ESP_OK;
     }
@@ -82,6 +85,7 @@ esp_err_t bsp_codec_set_fs(uint32_t rate, uint32_t bits_cfg, i2s_slot_mode_t ch)
         .channel = (ch == I2S_SLOT_MODE_STEREO) ? 2 : 1,
     };
     
+    aec_ref_set_format(fs.sample_rate, fs.bits_per_sample, fs.channel);
     // We must close and re-open to change FS in some codec drivers, 
     // but esp_codec_dev_open usually handles it.
     return esp_codec_dev_open(play_handle, &fs) == ESP_CODEC_DEV_OK ? ESP_OK : ESP_FAIL;
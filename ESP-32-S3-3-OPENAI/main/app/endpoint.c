@@ -0,0 +1,89 @@
+/*
+ * End-of-utterance detector for voice queries
+ *
+ * A turn ends after a stretch of silence that follows speech. Short
+ * utterances ("what is a dog?") get a short hangover so the answer starts
+ * quickly, longer ones a longer hangover because children pause mid-sentence.
+ * When the room goes clearly quieter than the child was speaking, silence is
+ * trusted sooner still. A length cap and a no-speech timeout bound the turn.
+ */
+
+#include <math.h>
+#include <string.h>
+#include "endpoint.h"
+
+/* Level of a frame with no signal at all */
+#define ENDPOINT_FLOOR_DB       0.0f
+
+static float endpoint_level_db(const int16_t *pcm, size_t samples)
+{
+    if (!pcm || !samples) {
+        return ENDPOINT_FLOOR_DB;
+    }
+    int64_t energy = 0;
+    for (size_t i = 0; i < samples; i++) {
+        energy += (int32_t)pcm[i] * pcm[i];
+    }
+    float mean = (float)energy / samples;
+    return mean > 1.0f ? 10.0f * log10f(mean) : ENDPOINT_FLOOR_DB;
+}
+
+void endpoint_reset(endpoint_t *ep, const endpoint_config_t *cfg)
+{
+    memset(ep, 0, sizeof(*ep));
+    ep->cfg = *cfg;
+}
+
+endpoint_reason_t endpoint_update(endpoint_t *ep, bool speech, const int16_t *pcm, size_t samples, uint32_t frame_ms)
+{
+    const endpoint_config_t *cfg = &ep->cfg;
+    float level = endpoint_level_db(pcm, samples);
+
+    ep->elapsed_ms += frame_ms;
+    if (speech) {
+        /* Running average, the first frames weigh more so the level settles quickly */
+        uint32_t frames = ep->speech_ms / frame_ms + 1;
+        ep->speech_db += (level - ep->speech_db) / (frames < 8 ? frames : 8);
+        ep->speech_ms += frame_ms;
+        ep->silence_ms = 0;
+        ep->quiet_ms = 0;
+    } else {
+        ep->silence_ms += frame_ms;
+        if (level < ep->speech_db - cfg->early_cut_db) {
+            ep->quiet_ms += frame_ms;
+        } else {
+            ep->quiet_ms = 0;
+        }
+    }
+
+    if (ep->elapsed_ms >= cfg->max_utterance_ms) {
+        return ENDPOINT_MAX_LENGTH;
+    }
+    if (ep->speech_ms < cfg->min_speech_ms) {
+        return ep->elapsed_ms >= cfg->no_speech_ms ? ENDPOINT_NO_SPEECH : ENDPOINT_NONE;
+    }
+    if (speech) {
+        return ENDPOINT_NONE;
+    }
+    if (cfg->early_cut_ms && ep->quiet_ms >= cfg->early_cut_ms) {
+        return ENDPOINT_EARLY_CUT;
+    }
+    uint32_t hangover = ep->speech_ms < cfg->short_utterance_ms ? cfg->short_hangover_ms : cfg->long_hangover_ms;
+    return ep->silence_ms >= hangover ? ENDPOINT_HANGOVER : ENDPOINT_NONE;
+}
+
+const char *endpoint_reason_name(endpoint_reason_t reason)
+{
+    switch (reason) {
+    case ENDPOINT_HANGOVER:
+        return "hangover";
+    case ENDPOINT_EARLY_CUT:
+        return "early_cut";
+    case ENDPOINT_MAX_LENGTH:
+        return "max_length";
+    case ENDPOINT_NO_SPEECH:
+        return "no_speech";
+    default:
+        return "none";
+    }
+}
@@ -0,0 +1,68 @@
+/*
+ * End-of-utterance detector for voice queries
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Why the endpointer ended a turn */
+typedef enum {
+    ENDPOINT_NONE = 0,          /* still listening */
+    ENDPOINT_HANGOVER,          /* silence after speech lasted the hangover */
+    ENDPOINT_EARLY_CUT,         /* silence far below the speech level, shorter hangover */
+    ENDPOINT_MAX_LENGTH,        /* the utterance reached its longest allowed length */
+    ENDPOINT_NO_SPEECH,         /* nobody spoke after the wake word */
+} endpoint_reason_t;
+
+typedef struct {
+    uint32_t min_speech_ms;     /* speech needed before the turn counts as started */
+    uint32_t short_utterance_ms; /* utterances shorter than this use the short hangover */
+    uint32_t short_hangover_ms;
+    uint32_t long_hangover_ms;
+    uint32_t early_cut_ms;      /* hangover once the level dropped by early_cut_db, 0 to disable */
+    uint32_t early_cut_db;
+    uint32_t max_utterance_ms;  /* from the start of listening */
+    uint32_t no_speech_ms;
+} endpoint_config_t;
+
+/* Only depends on the C library, the same code runs on a host against recorded VAD traces */
+typedef struct {
+    endpoint_config_t cfg;
+    uint32_t elapsed_ms;        /* since listening started */
+    uint32_t speech_ms;         /* total speech so far */
+    uint32_t silence_ms;        /* current run of silence */
+    uint32_t quiet_ms;          /* current run of silence below the early cut level */
+    float speech_db;            /* average level of speech frames */
+} endpoint_t;
+
+/**
+ * @brief Start listening for a new utterance
+ */
+void endpoint_reset(endpoint_t *ep, const endpoint_config_t *cfg);
+
+/**
+ * @brief Feed one frame of processed audio and its VAD decision
+ *
+ * @param speech The VAD reported speech for this frame
+ * @param pcm Mono samples of the frame, for the energy based early cut
+ * @param samples Number of samples
+ * @param frame_ms Duration of the frame
+ * @return ENDPOINT_NONE while the turn goes on, otherwise why it is over
+ */
+endpoint_reason_t endpoint_update(endpoint_t *ep, bool speech, const int16_t *pcm, size_t samples, uint32_t frame_ms);
+
+/**
+ * @brief Short name of a reason, for logs
+ */
+const char *endpoint_reason_name(endpoint_reason_t reason);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,132 +1,1088 @@
 #include <string.h>
+#include <strings.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include "esp_log.h"
+#include "esp_check.h"
 #include "esp_http_client.h"
 #include "esp_crt_bundle.h"
-#include "cJSON.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
 #include "gemini.h"
+#include "gemini_parser.h"
+#include "turn_trace.h"
 #include "mbedtls/base64.h"
 
 static const char *TAG = "gemini_client";
-static char *g_api_key = NULL;
 
-esp_err_t gemini_init(const char *api_key) {
-    if (g_api_key) free(g_api_key);
-    
-    // Trim potential whitespace
-    const char *start = api_key;
-    while (*start == ' ') start++;
-    char *trimmed = strdup(start);
-    char *end = trimmed + strlen(trimmed) - 1;
-    while (end > trimmed && (*end == ' ' || *end == '\n' || *end == '\r')) {
-        *end = '\0';
-        end--;
+// Using v1beta for gemini-2.5-flash (which shows usage in your dashboard)
+#define GEMINI_URL              CONFIG_GEMINI_SERVER_URL "/v1beta/models/gemini-2.5-flash:generateContent"
+#define GEMINI_URL_STREAM       CONFIG_GEMINI_SERVER_URL "/v1beta/models/gemini-2.5-flash:streamGenerateContent?alt=sse"
+#define GEMINI_SYSTEM_PROMPT    "You are a friendly companion for a child. Listen and reply briefly."
+/* Raw bytes per base64 chunk, must be a multiple of 3 so no padding is emitted mid-stream */
+#define GEMINI_B64_CHUNK_IN     (3 * 512)
+#define GEMINI_B64_CHUNK_OUT    ((GEMINI_B64_CHUNK_IN / 3) * 4)
+/* "%04x\r\n" in front of every chunk of a chunked upload, "\r\n" after it */
+#define GEMINI_CHUNK_HEAD       6
+#define GEMINI_BODY_BUF_SIZE    (GEMINI_CHUNK_HEAD + GEMINI_B64_CHUNK_OUT + 2)
+#define GEMINI_RX_CHUNK         512
+#define GEMINI_TIMEOUT_MS       30000
+/* Retries: backoff grows from base to max, an attempt needs at least GEMINI_MIN_ATTEMPT_MS of budget */
+#define GEMINI_RETRY_BASE_MS    500
+#define GEMINI_RETRY_MAX_MS     4000
+#define GEMINI_MIN_ATTEMPT_MS   2000
+/* How often a wait checks whether gemini_cancel() was called */
+#define GEMINI_CANCEL_POLL_MS   100
+/* Requests that can be uploading at the same time, each needs its own body buffer */
+#define GEMINI_MAX_REQUESTS     (CONFIG_GEMINI_HEDGE_DELAY_MS ? 2 : 1)
+
+/*
+ * The request body is identical to what cJSON_PrintUnformatted produces for
+ * {"contents":[{"parts":[{"text":...},{"inline_data":{"mime_type":...,"data":...}}]}]}
+ * Base64 never needs JSON escaping, so the audio is streamed between a fixed prefix and suffix.
+ */
+static const char BODY_PREFIX[] = "{\"contents\":[{\"parts\":[{\"text\":\"" GEMINI_SYSTEM_PROMPT "\"},"
+                                  "{\"inline_data\":{\"mime_type\":\"";
+static const char BODY_DATA[] = "\",\"data\":\"";
+static const char BODY_SUFFIX[] = "\"}}]}]}";
+
+/*
+ * Request body writer. Audio may arrive in pieces of any size: bytes that do
+ * not fill a base64 group are carried over to the next piece. With chunked
+ * transfer every write becomes one chunk, framed in place in `buf`.
+ */
+typedef struct {
+    esp_http_client_handle_t http;
+    bool chunked;
+    const volatile bool *cancel; /* checked before every write, NULL if the body can't be cancelled */
+    uint8_t carry[3];
+    uint8_t carry_len;
+    size_t audio_len;
+    char *buf;                  /* GEMINI_BODY_BUF_SIZE, payload at GEMINI_CHUNK_HEAD */
+} gemini_body_t;
+
+/*
+ * Bump allocator for everything a turn produces, in PSRAM. Nothing is freed
+ * on its own, gemini_turn_end() rewinds it in one go.
+ */
+typedef struct {
+    char *base;
+    size_t size;
+    size_t used;
+    size_t peak;
+} gemini_arena_t;
+
+/*
+ * What the event handler learns about one connection. Every HTTP handle has
+ * its own, so the headers of a hedged request stay with its connection and
+ * are adopted along with it when it wins.
+ */
+typedef struct {
+    bool connected;
+    bool server_close;
+    int retry_after_ms;
+} gemini_conn_t;
+
+struct gemini_client {
+    char *api_key;
+    /* Long-lived HTTP client, the TCP/TLS connection is kept open between turns */
+    esp_http_client_handle_t http;
+    gemini_conn_t *conn;                /* of `http` */
+    char *body_buf[GEMINI_MAX_REQUESTS];
+    gemini_arena_t arena;
+    volatile bool cancel;               /* gemini_cancel(), from another task */
+    /* Request whose audio is uploaded with chunked transfer while it is still being recorded */
+    struct {
+        bool active;
+        gemini_body_t body;
+        gemini_text_cb_t partial_cb;
+        void *user_ctx;
+        int64_t t_start;
+    } upload;
+};
+
+/* All free space of the arena; only what gemini_arena_commit() keeps stays allocated */
+static char *gemini_arena_reserve(gemini_arena_t *arena, size_t *size)
+{
+    *size = arena->size - arena->used;
+    return arena->base + arena->used;
+}
+
+static void gemini_arena_commit(gemini_arena_t *arena, size_t size)
+{
+    arena->used += (size + 3) & ~3;
+    if (arena->used > arena->size) {
+        arena->used = arena->size;
+    }
+    if (arena->used > arena->peak) {
+        arena->peak = arena->used;
+    }
+}
+
+static size_t gemini_body_length(const char *mime_type, size_t audio_len)
+{
+    return (sizeof(BODY_PREFIX) - 1) + strlen(mime_type) + (sizeof(BODY_DATA) - 1)
+           + ((audio_len + 2) / 3) * 4 + (sizeof(BODY_SUFFIX) - 1);
+}
+
+static esp_err_t http_write_all(esp_http_client_handle_t http, const char *data, size_t len)
+{
+    while (len > 0) {
+        int wlen = esp_http_client_write(http, data, len);
+        if (wlen <= 0) {
+            ESP_LOGE(TAG, "HTTP write failed (%d)", wlen);
+            return ESP_FAIL;
+        }
+        data += wlen;
+        len -= wlen;
+    }
+    return ESP_OK;
+}
+
+/* `buf` is one of the client's preallocated GEMINI_BODY_BUF_SIZE buffers */
+static void gemini_body_init(gemini_body_t *body, esp_http_client_handle_t http, char *buf, bool chunked)
+{
+    memset(body, 0, sizeof(*body));
+    body->http = http;
+    body->buf = buf;
+    body->chunked = chunked;
+}
+
+/* Sends the `len` payload bytes staged in body->buf */
+static esp_err_t gemini_body_flush(gemini_body_t *body, size_t len)
+{
+    char *data = body->buf + GEMINI_CHUNK_HEAD;
+
+    if (0 == len) {
+        /* An empty chunk would end a chunked body */
+        return ESP_OK;
+    }
+    if (body->cancel && *body->cancel) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!body->chunked) {
+        return http_write_all(body->http, data, len);
+    }
+    char head[GEMINI_CHUNK_HEAD + 1];
+    snprintf(head, sizeof(head), "%04x\r\n", (unsigned)len);
+    memcpy(body->buf, head, GEMINI_CHUNK_HEAD);
+    memcpy(data + len, "\r\n", 2);
+    return http_write_all(body->http, body->buf, GEMINI_CHUNK_HEAD + len + 2);
+}
+
+static esp_err_t gemini_body_write(gemini_body_t *body, const char *text, size_t len)
+{
+    while (len > 0) {
+        size_t n = len > GEMINI_B64_CHUNK_OUT ? GEMINI_B64_CHUNK_OUT : len;
+        memcpy(body->buf + GEMINI_CHUNK_HEAD, text, n);
+        ESP_RETURN_ON_ERROR(gemini_body_flush(body, n), TAG, "write body failed");
+        text += n;
+        len -= n;
     }
-    g_api_key = trimmed;
-    ESP_LOGI(TAG, "Gemini initialized");
     return ESP_OK;
 }
 
-char* gemini_audio_query(uint8_t *audio, size_t len) {
-    if (!g_api_key || !audio) return NULL;
-
-    size_t total_len = len + 44; // Including WAV header
-
-    // 1. Base64 encode the audio
-    size_t out_len = 0;
-    mbedtls_base64_encode(NULL, 0, &out_len, audio, total_len);
-    char *b64_audio = malloc(out_len + 1);
-    if (!b64_audio) return NULL;
-    mbedtls_base64_encode((uint8_t*)b64_audio, out_len, &out_len, audio, total_len);
-    b64_audio[out_len] = '\0';
-
-    // 2. Build Multimodal JSON
-    cJSON *root = cJSON_CreateObject();
-    cJSON *contents = cJSON_CreateArray();
-    cJSON *content = cJSON_CreateObject();
-    cJSON *parts = cJSON_CreateArray();
-    
-    cJSON *part_text = cJSON_CreateObject();
-    cJSON_AddStringToObject(part_text, "text", "You are a friendly companion for a child. Listen and reply briefly.");
-    cJSON_AddItemToArray(parts, part_text);
-
-    cJSON *part_audio = cJSON_CreateObject();
-    cJSON *inline_data = cJSON_CreateObject();
-    cJSON_AddStringToObject(inline_data, "mime_type", "audio/wav");
-    cJSON_AddStringToObject(inline_data, "data", b64_audio);
-    cJSON_AddItemToObject(part_audio, "inline_data", inline_data);
-    cJSON_AddItemToArray(parts, part_audio);
-
-    cJSON_AddItemToObject(content, "parts", parts);
-    cJSON_AddItemToArray(contents, content);
-    cJSON_AddItemToObject(root, "contents", contents);
-
-    char *post_data = cJSON_PrintUnformatted(root);
-    cJSON_Delete(root);
-    free(b64_audio);
-
-    // 3. Send HTTP Request
-    char url[256];
-    // Using v1beta for gemini-2.5-flash (which shows usage in your dashboard)
-    snprintf(url, sizeof(url), "https://generativelanguage.googleapis.com/v1beta/models/gemini-2.5-flash:generateContent?key=%s", g_api_key);
-    
-    ESP_LOGI(TAG, "Querying Gemini (gemini-2.5-flash)...");
+static esp_err_t gemini_body_write_head(gemini_body_t *body, const char *mime_type)
+{
+    ESP_RETURN_ON_ERROR(gemini_body_write(body, BODY_PREFIX, sizeof(BODY_PREFIX) - 1), TAG, "write prefix failed");
+    ESP_RETURN_ON_ERROR(gemini_body_write(body, mime_type, strlen(mime_type)), TAG, "write mime type failed");
+    return gemini_body_write(body, BODY_DATA, sizeof(BODY_DATA) - 1);
+}
+
+/* Base64-encodes audio into the body, keeping a partial group for the next call */
+static esp_err_t gemini_body_write_audio(gemini_body_t *body, const uint8_t *audio, size_t len)
+{
+    char *out = body->buf + GEMINI_CHUNK_HEAD;
+    size_t b64_len = 0;
+
+    body->audio_len += len;
+    while (body->carry_len + len >= 3) {
+        size_t out_len = 0;
+        if (body->carry_len) {
+            size_t fill = 3 - body->carry_len;
+            memcpy(body->carry + body->carry_len, audio, fill);
+            audio += fill;
+            len -= fill;
+            body->carry_len = 0;
+            ESP_RETURN_ON_FALSE(0 == mbedtls_base64_encode((uint8_t *)out, GEMINI_B64_CHUNK_OUT + 1, &b64_len, body->carry, 3),
+                                ESP_FAIL, TAG, "base64 encode failed");
+            out_len = b64_len;
+        }
+
+        size_t in_len = len - len % 3;
+        size_t room = GEMINI_B64_CHUNK_IN - out_len / 4 * 3;
+        if (in_len > room) {
+            in_len = room;
+        }
+        if (in_len) {
+            ESP_RETURN_ON_FALSE(0 == mbedtls_base64_encode((uint8_t *)out + out_len, GEMINI_B64_CHUNK_OUT + 1 - out_len,
+                                                           &b64_len, audio, in_len),
+                                ESP_FAIL, TAG, "base64 encode failed");
+            out_len += b64_len;
+            audio += in_len;
+            len -= in_len;
+        }
+        ESP_RETURN_ON_ERROR(gemini_body_flush(body, out_len), TAG, "write audio failed");
+    }
+
+    memcpy(body->carry + body->carry_len, audio, len);
+    body->carry_len += len;
+    return ESP_OK;
+}
+
+/* Pads the last base64 group and closes the JSON (and the chunked body) */
+static esp_err_t gemini_body_write_tail(gemini_body_t *body)
+{
+    if (body->carry_len) {
+        size_t b64_len = 0;
+        ESP_RETURN_ON_FALSE(0 == mbedtls_base64_encode((uint8_t *)body->buf + GEMINI_CHUNK_HEAD, GEMINI_B64_CHUNK_OUT + 1,
+                                                       &b64_len, body->carry, body->carry_len),
+                            ESP_FAIL, TAG, "base64 encode failed");
+        body->carry_len = 0;
+        ESP_RETURN_ON_ERROR(gemini_body_flush(body, b64_len), TAG, "write audio failed");
+    }
+    ESP_RETURN_ON_ERROR(gemini_body_write(body, BODY_SUFFIX, sizeof(BODY_SUFFIX) - 1), TAG, "write suffix failed");
+    if (body->chunked) {
+        ESP_RETURN_ON_ERROR(http_write_all(body->http, "0\r\n\r\n", 5), TAG, "write last chunk failed");
+    }
+    turn_trace_mark(TURN_PHASE_UPLOAD_DONE);
+    return ESP_OK;
+}
 
+typedef struct {
+    char *text;
+    size_t len;
+    size_t cap;
+    bool truncated;
+    size_t notified;            /* text already reported to partial_cb */
+    gemini_text_cb_t partial_cb;
+    void *user_ctx;
+} gemini_reply_t;
+
+/* The reply is collected in the free space of the turn arena, up to CONFIG_GEMINI_MAX_REPLY_LEN */
+static void gemini_reply_init(gemini_reply_t *reply, gemini_arena_t *arena, gemini_text_cb_t partial_cb, void *user_ctx)
+{
+    memset(reply, 0, sizeof(*reply));
+    reply->text = gemini_arena_reserve(arena, &reply->cap);
+    if (reply->cap > CONFIG_GEMINI_MAX_REPLY_LEN) {
+        reply->cap = CONFIG_GEMINI_MAX_REPLY_LEN;
+    }
+    if (reply->cap) {
+        reply->text[0] = '\0';
+    } else {
+        reply->text = NULL;
+    }
+    reply->partial_cb = partial_cb;
+    reply->user_ctx = user_ctx;
+}
+
+static void gemini_reply_append(const char *text, size_t len, void *user_ctx)
+{
+    gemini_reply_t *reply = (gemini_reply_t *)user_ctx;
+
+    if (NULL == reply->text) {
+        if (!reply->truncated) {
+            ESP_LOGE(TAG, "Turn arena full, reply dropped");
+        }
+        reply->truncated = true;
+        return;
+    }
+
+    size_t room = reply->cap - reply->len - 1;
+    if (len > room) {
+        if (!reply->truncated) {
+            ESP_LOGW(TAG, "Reply exceeds %u bytes, truncating", (unsigned)reply->cap);
+        }
+        reply->truncated = true;
+        len = room;
+    }
+    memcpy(reply->text + reply->len, text, len);
+    reply->len += len;
+    reply->text[reply->len] = '\0';
+}
+
+/* Fires partial_cb with the text added by the server-sent event that just ended */
+static void gemini_reply_event(void *user_ctx)
+{
+    gemini_reply_t *reply = (gemini_reply_t *)user_ctx;
+
+    if (reply->partial_cb && reply->len > reply->notified) {
+        reply->partial_cb(reply->text + reply->notified, reply->len - reply->notified, reply->text, reply->user_ctx);
+        reply->notified = reply->len;
+    }
+}
+
+/*
+ * Reads the body until the end of the stream, handing every segment to the
+ * parser or SSE splitter. Once `cancel` is set nothing more is handed on.
+ */
+static esp_err_t gemini_read_response(esp_http_client_handle_t http, gemini_parser_t *parser, gemini_sse_t *sse,
+                                      const volatile bool *cancel)
+{
+    char rx[GEMINI_RX_CHUNK];
+    esp_err_t ret = ESP_OK;
+
+    while (true) {
+        int read_len = esp_http_client_read(http, rx, sizeof(rx));
+        if (*cancel) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        if (read_len > 0) {
+            ret = sse ? gemini_sse_feed(sse, rx, read_len) : gemini_parser_feed(parser, rx, read_len);
+            ESP_RETURN_ON_ERROR(ret, TAG, "Malformed JSON in response");
+        } else if (read_len == 0) {
+            break;
+        } else if (read_len == -ESP_ERR_HTTP_EAGAIN) {
+            ESP_LOGE(TAG, "Timed out reading response");
+            return ESP_ERR_TIMEOUT;
+        } else {
+            ESP_LOGE(TAG, "Read failed (%d)", read_len);
+            return ESP_FAIL;
+        }
+    }
+
+    ESP_RETURN_ON_FALSE(esp_http_client_is_complete_data_received(http), ESP_ERR_INVALID_SIZE, TAG, "Connection closed mid-response");
+    ret = sse ? gemini_sse_finish(sse) : gemini_parser_finish(parser);
+    turn_trace_mark(TURN_PHASE_PARSE_DONE);
+    return ret;
+}
+
+static esp_err_t gemini_http_event_handler(esp_http_client_event_t *evt)
+{
+    gemini_conn_t *conn = (gemini_conn_t *)evt->user_data;
+
+    if (HTTP_EVENT_ON_HEADER == evt->event_id && 0 == strcasecmp(evt->header_key, "Connection")
+            && 0 == strcasecmp(evt->header_value, "close")) {
+        conn->server_close = true;
+    } else if (HTTP_EVENT_ON_HEADER == evt->event_id && 0 == strcasecmp(evt->header_key, "Retry-After")) {
+        /* Only the delay-seconds form, an HTTP-date falls back to our own backoff */
+        conn->retry_after_ms = atoi(evt->header_value) * 1000;
+    } else if (HTTP_EVENT_ON_CONNECTED == evt->event_id) {
+        /* Resolving is part of esp_http_client's connect. The first connection of the turn to get there, hedged or not */
+        turn_trace_mark(TURN_PHASE_CONNECTED);
+    } else if (HTTP_EVENT_DISCONNECTED == evt->event_id) {
+        conn->connected = false;
+    }
+    return ESP_OK;
+}
+
+/* The key travels in a header, so the URLs are constants and the headers are set once per connection */
+static esp_http_client_handle_t gemini_http_new(gemini_client_t *client, const char *url, gemini_conn_t **ret_conn)
+{
+    gemini_conn_t *conn = calloc(1, sizeof(gemini_conn_t));
+    if (NULL == conn) {
+        return NULL;
+    }
     esp_http_client_config_t config = {
         .url = url,
         .method = HTTP_METHOD_POST,
-        .timeout_ms = 30000, 
+        .timeout_ms = GEMINI_TIMEOUT_MS,
         .buffer_size = 4096,
         .buffer_size_tx = 4096,
         .crt_bundle_attach = esp_crt_bundle_attach,
+        .event_handler = gemini_http_event_handler,
+        .user_data = conn,
+        .keep_alive_enable = true,
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        /* Resume the TLS session with the saved ticket when reconnecting */
+        .save_client_session = true,
+#endif
     };
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    esp_http_client_set_header(client, "Content-Type", "application/json");
+    esp_http_client_handle_t http = esp_http_client_init(&config);
+    if (NULL == http) {
+        free(conn);
+        return NULL;
+    }
+    esp_http_client_set_header(http, "Content-Type", "application/json");
+    esp_http_client_set_header(http, "x-goog-api-key", client->api_key);
+    *ret_conn = conn;
+    return http;
+}
+
+/* The handler may still run while the handle is cleaned up, so the context goes last */
+static void gemini_http_delete(esp_http_client_handle_t http, gemini_conn_t *conn)
+{
+    esp_http_client_cleanup(http);
+    free(conn);
+}
+
+static esp_http_client_handle_t gemini_http_get(gemini_client_t *client, bool stream)
+{
+    const char *url = stream ? GEMINI_URL_STREAM : GEMINI_URL;
+
+    if (client->http) {
+        /* Same host, so the connection survives the URL change */
+        esp_http_client_set_url(client->http, url);
+        return client->http;
+    }
+
+    client->http = gemini_http_new(client, url, &client->conn);
+    return client->http;
+}
+
+/*
+ * esp_http_client_open() sets Content-Length or Transfer-Encoding among the
+ * handle's headers and never takes the other one out. The kept-alive handle
+ * carries buffered and chunked requests alike, so the stale one goes first.
+ */
+static esp_err_t gemini_http_open(esp_http_client_handle_t http, int write_len)
+{
+    esp_http_client_delete_header(http, write_len < 0 ? "Content-Length" : "Transfer-Encoding");
+    return esp_http_client_open(http, write_len);
+}
+
+esp_err_t gemini_client_create(const char *api_key, gemini_client_t **ret_client)
+{
+    esp_err_t ret = ESP_OK;
+    ESP_RETURN_ON_FALSE(api_key && ret_client, ESP_ERR_INVALID_ARG, TAG, "invalid args");
+
+    gemini_client_t *client = calloc(1, sizeof(gemini_client_t));
+    ESP_RETURN_ON_FALSE(NULL != client, ESP_ERR_NO_MEM, TAG, "client malloc failed");
+
+    // Trim potential whitespace
+    const char *start = api_key;
+    while (*start == ' ') start++;
+    client->api_key = strdup(start);
+    ESP_GOTO_ON_FALSE(NULL != client->api_key, ESP_ERR_NO_MEM, err, TAG, "key malloc failed");
+    char *end = client->api_key + strlen(client->api_key) - 1;
+    while (end > client->api_key && (*end == ' ' || *end == '\n' || *end == '\r')) {
+        *end = '\0';
+        end--;
+    }
+
+    for (int i = 0; i < GEMINI_MAX_REQUESTS; i++) {
+        client->body_buf[i] = malloc(GEMINI_BODY_BUF_SIZE);
+        ESP_GOTO_ON_FALSE(NULL != client->body_buf[i], ESP_ERR_NO_MEM, err, TAG, "body buffer malloc failed");
+    }
+    client->arena.size = CONFIG_GEMINI_MAX_REPLY_LEN;
+    client->arena.base = heap_caps_malloc(client->arena.size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    ESP_GOTO_ON_FALSE(NULL != client->arena.base, ESP_ERR_NO_MEM, err, TAG, "turn arena malloc failed");
+
+    *ret_client = client;
+    ESP_LOGI(TAG, "Gemini initialized, server %s", CONFIG_GEMINI_SERVER_URL);
+    return ESP_OK;
+
+err:
+    gemini_client_delete(client);
+    return ret;
+}
+
+void gemini_client_delete(gemini_client_t *client)
+{
+    if (NULL == client) {
+        return;
+    }
+    gemini_upload_abort(client);
+    if (client->http) {
+        gemini_http_delete(client->http, client->conn);
+    }
+    for (int i = 0; i < GEMINI_MAX_REQUESTS; i++) {
+        free(client->body_buf[i]);
+    }
+    heap_caps_free(client->arena.base);
+    free(client->api_key);
+    free(client);
+}
+
+void gemini_turn_end(gemini_client_t *client)
+{
+    if (NULL == client) {
+        return;
+    }
+    ESP_LOGD(TAG, "Turn arena: %u of %u bytes used, peak %u", (unsigned)client->arena.used,
+             (unsigned)client->arena.size, (unsigned)client->arena.peak);
+    client->arena.used = 0;
+}
+
+/* One request on one connection, split so a hedged request can report when it no longer reads the audio */
+typedef struct {
+    esp_http_client_handle_t http;
+    gemini_conn_t *conn;
+    char *buf;
+    bool reused;
+    const volatile bool *cancel;
+    int64_t t_start;
+    int64_t t_open;
+    int64_t t_sent;
+} gemini_send_t;
+
+/* Opens (or reuses) the connection for a body of `body_len` bytes */
+static esp_err_t gemini_send_open(gemini_send_t *send, size_t body_len)
+{
+    send->t_start = esp_timer_get_time();
+    esp_err_t ret = gemini_http_open(send->http, body_len);
+    send->t_open = esp_timer_get_time();
+    return ret;
+}
+
+/* Uploads the body on an opened connection, closes it on failure */
+static esp_err_t gemini_send_write(gemini_send_t *send, const char *mime_type, const uint8_t *audio, size_t len)
+{
+    gemini_body_t body;
+
+    gemini_body_init(&body, send->http, send->buf, false);
+    body.cancel = send->cancel;
+    esp_err_t ret = gemini_body_write_head(&body, mime_type);
+    if (ret == ESP_OK) {
+        ret = gemini_body_write_audio(&body, audio, len);
+    }
+    if (ret == ESP_OK) {
+        ret = gemini_body_write_tail(&body);
+    }
+    send->t_sent = esp_timer_get_time();
+    if (ret != ESP_OK) {
+        esp_http_client_close(send->http);
+    }
+    return ret;
+}
+
+/* Opens (or reuses) the connection and uploads the body */
+static esp_err_t gemini_send_body(gemini_send_t *send, const char *mime_type, const uint8_t *audio, size_t len, size_t body_len)
+{
+    esp_err_t ret = gemini_send_open(send, body_len);
+    if (ret != ESP_OK) {
+        esp_http_client_close(send->http);
+        return ret;
+    }
+    return gemini_send_write(send, mime_type, audio, len);
+}
 
-    esp_err_t err = esp_http_client_open(client, strlen(post_data));
-    char *result_text = NULL;
+/* Waits for the response headers of a sent body */
+static esp_err_t gemini_send_finish(gemini_send_t *send)
+{
+    if (esp_http_client_fetch_headers(send->http) < 0) {
+        esp_http_client_close(send->http);
+        return ESP_FAIL;
+    }
+    int64_t t_headers = esp_timer_get_time();
+    turn_trace_mark(TURN_PHASE_FIRST_BYTE);
+
+    ESP_LOGI(TAG, "%s connection: connect %d ms, upload %d ms, first byte %d ms", send->reused ? "Reused" : "New",
+             (int)((send->t_open - send->t_start) / 1000), (int)((send->t_sent - send->t_open) / 1000),
+             (int)((t_headers - send->t_sent) / 1000));
+    return ESP_OK;
+}
+
+#if CONFIG_GEMINI_HEDGE_DELAY_MS
+/*
+ * Hedged request: if the first request has no response headers after
+ * CONFIG_GEMINI_HEDGE_DELAY_MS, the same body is sent on a second connection.
+ * Each request runs in its own task, the first to get headers wins and the
+ * other is cancelled. A loser still waiting on the server drops its own
+ * connection once it returns, so the race is freed by whoever leaves last.
+ * The audio and the body buffers are the caller's: a request only starts on
+ * the body if it was not cancelled while it connected, so the caller waits
+ * for one writing and never for one stuck connecting.
+ */
+#define GEMINI_RACE_DONE(i)     (1 << (i))      /* headers received or request failed */
+#define GEMINI_RACE_BODY(i)     (1 << (2 + (i)))  /* audio and body buffer no longer used */
+
+typedef struct gemini_race gemini_race_t;
+
+typedef struct {
+    gemini_race_t *race;
+    gemini_send_t send;
+    volatile bool cancel;       /* set under s_race_lock */
+    bool writing;               /* guarded by s_race_lock, reading the audio and the body buffer */
+    bool done;                  /* guarded by s_race_lock */
+    esp_err_t err;
+} gemini_racer_t;
+
+struct gemini_race {
+    EventGroupHandle_t events;
+    int refs;                   /* guarded by s_race_lock */
+    EventBits_t started;
+    const char *mime_type;
+    const uint8_t *audio;
+    size_t len;
+    size_t body_len;
+    gemini_racer_t racer[2];
+};
+
+static portMUX_TYPE s_race_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void gemini_race_put(gemini_race_t *race)
+{
+    portENTER_CRITICAL(&s_race_lock);
+    bool last = (0 == --race->refs);
+    portEXIT_CRITICAL(&s_race_lock);
+    if (last) {
+        vEventGroupDelete(race->events);
+        free(race);
+    }
+}
+
+static void gemini_race_task(void *arg)
+{
+    gemini_racer_t *racer = (gemini_racer_t *)arg;
+    gemini_race_t *race = racer->race;
+    int index = racer - race->racer;
+
+    racer->err = gemini_send_open(&racer->send, race->body_len);
+    portENTER_CRITICAL(&s_race_lock);
+    racer->writing = (ESP_OK == racer->err && !racer->cancel);
+    portEXIT_CRITICAL(&s_race_lock);
+    if (racer->writing) {
+        racer->err = gemini_send_write(&racer->send, race->mime_type, race->audio, race->len);
+        portENTER_CRITICAL(&s_race_lock);
+        racer->writing = false;
+        portEXIT_CRITICAL(&s_race_lock);
+    } else {
+        esp_http_client_close(racer->send.http);
+        racer->err = ESP_OK == racer->err ? ESP_ERR_INVALID_STATE : racer->err;
+    }
+    xEventGroupSetBits(race->events, GEMINI_RACE_BODY(index));
+    if (ESP_OK == racer->err) {
+        racer->err = gemini_send_finish(&racer->send);
+    }
+
+    portENTER_CRITICAL(&s_race_lock);
+    racer->done = true;
+    bool lost = racer->cancel;
+    portEXIT_CRITICAL(&s_race_lock);
+    if (lost) {
+        gemini_http_delete(racer->send.http, racer->send.conn);
+    }
+    xEventGroupSetBits(race->events, GEMINI_RACE_DONE(index));
+    gemini_race_put(race);
+    vTaskDelete(NULL);
+}
+
+static bool gemini_race_start(gemini_race_t *race, int index)
+{
+    portENTER_CRITICAL(&s_race_lock);
+    race->refs++;
+    portEXIT_CRITICAL(&s_race_lock);
+    if (pdPASS != xTaskCreatePinnedToCore(&gemini_race_task, "Gemini Request", 8 * 1024, &race->racer[index], 5, NULL, 0)) {
+        ESP_LOGE(TAG, "Failed create request task");
+        portENTER_CRITICAL(&s_race_lock);
+        race->refs--;
+        portEXIT_CRITICAL(&s_race_lock);
+        return false;
+    }
+    race->started |= GEMINI_RACE_DONE(index);
+    return true;
+}
+
+/* Runs the hedged request, on success client->http is the winning connection with its headers read */
+static esp_err_t gemini_race_run(gemini_client_t *client, gemini_race_t *race, bool stream, int timeout_ms)
+{
+    gemini_racer_t *primary = &race->racer[0];
+    gemini_racer_t *hedge = &race->racer[1];
+
+    ESP_RETURN_ON_FALSE(gemini_race_start(race, 0), ESP_ERR_NO_MEM, TAG, "request task failed");
+    EventBits_t seen = xEventGroupWaitBits(race->events, GEMINI_RACE_DONE(0), pdFALSE, pdTRUE,
+                                           pdMS_TO_TICKS(CONFIG_GEMINI_HEDGE_DELAY_MS));
+    if (!(seen & GEMINI_RACE_DONE(0)) && !client->cancel) {
+        ESP_LOGW(TAG, "No response after %d ms, hedging on a second connection", CONFIG_GEMINI_HEDGE_DELAY_MS);
+        hedge->send.http = gemini_http_new(client, stream ? GEMINI_URL_STREAM : GEMINI_URL, &hedge->send.conn);
+        if (hedge->send.http) {
+            esp_http_client_set_timeout_ms(hedge->send.http, timeout_ms);
+            if (!gemini_race_start(race, 1)) {
+                gemini_http_delete(hedge->send.http, hedge->send.conn);
+                hedge->send.http = NULL;
+            }
+        }
+    }
+
+    int winner = -1;
+    while (true) {
+        for (int i = 0; i < 2 && winner < 0; i++) {
+            if ((seen & GEMINI_RACE_DONE(i)) && ESP_OK == race->racer[i].err) {
+                winner = i;
+            }
+        }
+        if (winner >= 0 || (seen & race->started) == race->started || client->cancel) {
+            break;
+        }
+        seen |= xEventGroupWaitBits(race->events, race->started & ~seen, pdFALSE, pdFALSE,
+                                    pdMS_TO_TICKS(GEMINI_CANCEL_POLL_MS));
+    }
+
+    /* Whoever is still running gets cancelled and cleans up after itself */
+    bool primary_running = false;
+    for (int i = 0; i < 2; i++) {
+        gemini_racer_t *racer = &race->racer[i];
+        if (i == winner || !(race->started & GEMINI_RACE_DONE(i))) {
+            continue;
+        }
+        portENTER_CRITICAL(&s_race_lock);
+        bool done = racer->done;
+        racer->cancel = true;
+        portEXIT_CRITICAL(&s_race_lock);
+        if (done && racer != primary) {
+            gemini_http_delete(racer->send.http, racer->send.conn);
+        }
+        primary_running |= !done && racer == primary;
+    }
+
+    if (winner < 0 && primary_running) {
+        /* gemini_cancel() while the primary still waits, its connection is its own now */
+        client->http = NULL;
+        client->conn = NULL;
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (winner < 0) {
+        return primary->err;
+    }
+    if (winner == 1) {
+        ESP_LOGI(TAG, "Hedged request won");
+        portENTER_CRITICAL(&s_race_lock);
+        bool done = primary->done;
+        portEXIT_CRITICAL(&s_race_lock);
+        if (done) {
+            gemini_http_delete(primary->send.http, primary->send.conn);
+        }
+        /* Along with what its headers said: Retry-After, Connection: close */
+        client->http = hedge->send.http;
+        client->conn = hedge->send.conn;
+    }
+    return ESP_OK;
+}
+
+/*
+ * Returns once no request of the race reads the audio or a body buffer any
+ * more. Only one in the middle of the body is waited for: it is cancelled by
+ * now and stops after the write in progress, which the handle's timeout, the
+ * budget left for the attempt, bounds. One still connecting never starts on
+ * the body and is left behind.
+ */
+static void gemini_race_release(gemini_race_t *race)
+{
+    EventBits_t writing = 0;
+    for (int i = 0; i < 2; i++) {
+        if (!(race->started & GEMINI_RACE_DONE(i))) {
+            continue;
+        }
+        portENTER_CRITICAL(&s_race_lock);
+        if (race->racer[i].writing) {
+            race->racer[i].cancel = true;
+            writing |= GEMINI_RACE_BODY(i);
+        }
+        portEXIT_CRITICAL(&s_race_lock);
+    }
+    if (writing) {
+        xEventGroupWaitBits(race->events, writing, pdFALSE, pdTRUE, portMAX_DELAY);
+    }
+    gemini_race_put(race);
+}
+#endif
+
+/* One attempt of a query; on success the response headers of client->http have been read */
+static esp_err_t gemini_attempt(gemini_client_t *client, bool stream, const char *mime_type, const uint8_t *audio,
+                                size_t len, size_t body_len, int timeout_ms)
+{
+    esp_http_client_handle_t http = gemini_http_get(client, stream);
+    ESP_RETURN_ON_FALSE(NULL != http, ESP_ERR_NO_MEM, TAG, "client init failed");
+    esp_http_client_set_timeout_ms(http, timeout_ms);
+
+    bool reused = client->conn->connected;
+    client->conn->server_close = false;
+    client->conn->retry_after_ms = 0;
+
+#if CONFIG_GEMINI_HEDGE_DELAY_MS
+    /* Not in the turn arena: a losing request may still hold the race after the turn ended */
+    gemini_race_t *race = calloc(1, sizeof(gemini_race_t));
+    ESP_RETURN_ON_FALSE(NULL != race, ESP_ERR_NO_MEM, TAG, "race malloc failed");
+    race->events = xEventGroupCreate();
+    if (NULL == race->events) {
+        free(race);
+        return ESP_ERR_NO_MEM;
+    }
+    race->refs = 1;
+    race->mime_type = mime_type;
+    race->audio = audio;
+    race->len = len;
+    race->body_len = body_len;
+    for (int i = 0; i < 2; i++) {
+        race->racer[i].race = race;
+        race->racer[i].send.buf = client->body_buf[i];
+        race->racer[i].send.cancel = &race->racer[i].cancel;
+    }
+    race->racer[0].send.http = http;
+    race->racer[0].send.conn = client->conn;
+    race->racer[0].send.reused = reused;
+    esp_err_t err = gemini_race_run(client, race, stream, timeout_ms);
+    gemini_race_release(race);
+#else
+    gemini_send_t send = {
+        .http = http,
+        .conn = client->conn,
+        .buf = client->body_buf[0],
+        .reused = reused,
+        .cancel = &client->cancel,
+    };
+    esp_err_t err = gemini_send_body(&send, mime_type, audio, len, body_len);
     if (err == ESP_OK) {
-        esp_http_client_write(client, post_data, strlen(post_data));
-        esp_http_client_fetch_headers(client);
-        int status = esp_http_client_get_status_code(client);
-        
-        char *response_buffer = malloc(8192);
-        int read_len = esp_http_client_read(client, response_buffer, 8191);
-        if (read_len > 0) {
-            response_buffer[read_len] = '\0';
-            ESP_LOGI(TAG, "HTTP Status: %d, Response: %s", status, response_buffer);
-
-            if (status == 200) {
-                cJSON *resp_root = cJSON_Parse(response_buffer);
-                if (resp_root) {
-                    cJSON *candidates = cJSON_GetObjectItem(resp_root, "candidates");
-                    if (cJSON_IsArray(candidates) && cJSON_GetArraySize(candidates) > 0) {
-                        cJSON *first_candidate = cJSON_GetArrayItem(candidates, 0);
-                        cJSON *content_obj = cJSON_GetObjectItem(first_candidate, "content");
-                        if (content_obj) {
-                            cJSON *parts_arr = cJSON_GetObjectItem(content_obj, "parts");
-                            if (cJSON_IsArray(parts_arr) && cJSON_GetArraySize(parts_arr) > 0) {
-                                cJSON *first_part = cJSON_GetArrayItem(parts_arr, 0);
-                                cJSON *text_obj = cJSON_GetObjectItem(first_part, "text");
-                                if (cJSON_IsString(text_obj)) {
-                                    result_text = strdup(text_obj->valuestring);
-                                }
-                            }
-                        }
-                    }
-                    cJSON_Delete(resp_root);
-                }
+        err = gemini_send_finish(&send);
+    }
+#endif
+
+    if (err != ESP_OK && reused && !client->cancel) {
+        /* The server may have dropped the idle connection, reconnect once */
+        ESP_LOGW(TAG, "Kept-alive connection lost, reconnecting");
+        client->conn->connected = false;
+        return gemini_attempt(client, stream, mime_type, audio, len, body_len, timeout_ms);
+    }
+    if (client->conn) {
+        client->conn->connected = (err == ESP_OK);
+    }
+    return err;
+}
+
+/* Reads the response of a sent request, returns the reply text (in the turn arena) or NULL */
+static const char *gemini_receive(gemini_client_t *client, bool stream, gemini_text_cb_t partial_cb, void *user_ctx)
+{
+    esp_http_client_handle_t http = client->http;
+    int64_t t_body = esp_timer_get_time();
+    int status = esp_http_client_get_status_code(http);
+
+    // Extract the reply text; errors are plain JSON even on the streaming endpoint
+    gemini_reply_t reply;
+    gemini_reply_init(&reply, &client->arena, partial_cb, user_ctx);
+    gemini_parser_t parser;
+    gemini_sse_t sse;
+    if (status == 200 && stream) {
+        gemini_sse_init(&sse, GEMINI_PARSER_PATH_TEXT, GEMINI_PARSER_PATH_TEXT_LEN, gemini_reply_append, gemini_reply_event, &reply);
+    } else if (status == 200) {
+        gemini_parser_init(&parser, GEMINI_PARSER_PATH_TEXT, GEMINI_PARSER_PATH_TEXT_LEN, gemini_reply_append, &reply);
+    } else {
+        gemini_parser_init(&parser, GEMINI_PARSER_PATH_ERROR, GEMINI_PARSER_PATH_ERROR_LEN, gemini_reply_append, &reply);
+    }
+
+    esp_err_t err = gemini_read_response(http, &parser, (status == 200 && stream) ? &sse : NULL, &client->cancel);
+    ESP_LOGI(TAG, "HTTP Status: %d, reply %u bytes%s in %d ms", status, (unsigned)reply.len,
+             reply.truncated ? " (truncated)" : "", (int)((esp_timer_get_time() - t_body) / 1000));
+    if (err != ESP_OK || client->conn->server_close) {
+        /* Unread data or a closing server, the connection can't carry the next request */
+        esp_http_client_close(http);
+        client->conn->connected = false;
+    }
+    if (client->cancel) {
+        ESP_LOGI(TAG, "Reply cancelled");
+        return NULL;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Response incomplete: %s", esp_err_to_name(err));
+    }
+
+    if (status == 200 && reply.len > 0) {
+        /* A truncated stream still yields the text received so far */
+        gemini_arena_commit(&client->arena, reply.len + 1);
+        return reply.text;
+    } else if (status != 200) {
+        /* Error text is left uncommitted, the next reply reuses the space */
+        ESP_LOGE(TAG, "Gemini error: %s", reply.len ? reply.text : "(no message)");
+    } else {
+        ESP_LOGE(TAG, "No reply text in response");
+    }
+    return NULL;
+}
+
+/* Statuses worth another attempt: rate limiting and transient server trouble */
+static bool gemini_status_retryable(int status)
+{
+    return status == 429 || status == 500 || status == 502 || status == 503 || status == 504;
+}
+
+/* Exponential backoff with equal jitter: half the step is fixed, half is random */
+static int gemini_backoff_ms(int attempt)
+{
+    int step = GEMINI_RETRY_BASE_MS << attempt;
+    if (step > GEMINI_RETRY_MAX_MS) {
+        step = GEMINI_RETRY_MAX_MS;
+    }
+    return step / 2 + esp_random() % (step / 2 + 1);
+}
+
+/* Sleeps `delay_ms`, or until the query is cancelled */
+static void gemini_wait(gemini_client_t *client, int delay_ms)
+{
+    while (delay_ms > 0 && !client->cancel) {
+        int step = delay_ms < GEMINI_CANCEL_POLL_MS ? delay_ms : GEMINI_CANCEL_POLL_MS;
+        vTaskDelay(pdMS_TO_TICKS(step));
+        delay_ms -= step;
+    }
+}
+
+static const char *gemini_request(gemini_client_t *client, const uint8_t *audio, size_t len, const char *mime_type,
+                                  gemini_text_cb_t partial_cb, void *user_ctx)
+{
+    if (!client || !audio || !mime_type) return NULL;
+
+    size_t body_len = gemini_body_length(mime_type, len);
+    bool stream = (NULL != partial_cb);
+    int64_t deadline = esp_timer_get_time() + (int64_t)CONFIG_GEMINI_TURN_BUDGET_MS * 1000;
+
+    ESP_LOGI(TAG, "Querying Gemini (gemini-2.5-flash%s), %s body %u bytes...", stream ? ", streaming" : "", mime_type, (unsigned)body_len);
+
+    for (int attempt = 0; attempt < CONFIG_GEMINI_MAX_ATTEMPTS; attempt++) {
+        int remaining_ms = (int)((deadline - esp_timer_get_time()) / 1000);
+        if (client->cancel) {
+            ESP_LOGI(TAG, "Query cancelled");
+            break;
+        }
+        if (remaining_ms < GEMINI_MIN_ATTEMPT_MS) {
+            ESP_LOGE(TAG, "Turn budget of %d ms exhausted", CONFIG_GEMINI_TURN_BUDGET_MS);
+            break;
+        }
+
+        // 1. Stream the JSON body, base64-encoding the audio chunk by chunk
+        int status = 0;
+        esp_err_t err = gemini_attempt(client, stream, mime_type, audio, len, body_len,
+                                       remaining_ms < GEMINI_TIMEOUT_MS ? remaining_ms : GEMINI_TIMEOUT_MS);
+        if (err == ESP_OK) {
+            status = esp_http_client_get_status_code(client->http);
+            if (!gemini_status_retryable(status)) {
+                // 2. Read the reply
+                return gemini_receive(client, stream, partial_cb, user_ctx);
             }
+            /* Drain (and log) the error body so the connection stays usable */
+            gemini_receive(client, stream, NULL, NULL);
         } else {
-             ESP_LOGE(TAG, "No body received. HTTP Status: %d", status);
+            ESP_LOGE(TAG, "HTTP POST failed: %s", esp_err_to_name(err));
         }
-        free(response_buffer);
-    } else {
-        ESP_LOGE(TAG, "HTTP POST failed: %s", esp_err_to_name(err));
+
+        if (attempt + 1 == CONFIG_GEMINI_MAX_ATTEMPTS || client->cancel) {
+            break;
+        }
+        int retry_after_ms = client->conn ? client->conn->retry_after_ms : 0;
+        int delay_ms = retry_after_ms > 0 ? retry_after_ms : gemini_backoff_ms(attempt);
+        if (esp_timer_get_time() + (int64_t)(delay_ms + GEMINI_MIN_ATTEMPT_MS) * 1000 > deadline) {
+            ESP_LOGE(TAG, "No time left in the turn budget to retry in %d ms", delay_ms);
+            break;
+        }
+        ESP_LOGW(TAG, "Attempt %d failed (%s, status %d), retrying in %d ms", attempt + 1, esp_err_to_name(err), status, delay_ms);
+        gemini_wait(client, delay_ms);
     }
+    return NULL;
+}
+
+const char *gemini_audio_query(gemini_client_t *client, const uint8_t *audio, size_t len, const char *mime_type)
+{
+    return gemini_request(client, audio, len, mime_type, NULL, NULL);
+}
 
-    free(post_data);
-    esp_http_client_cleanup(client);
-    return result_text;
+const char *gemini_audio_query_stream(gemini_client_t *client, const uint8_t *audio, size_t len, const char *mime_type,
+                                      gemini_text_cb_t partial_cb, void *user_ctx)
+{
+    if (!partial_cb) return NULL;
+    return gemini_request(client, audio, len, mime_type, partial_cb, user_ctx);
+}
+
+esp_err_t gemini_upload_begin(gemini_client_t *client, const char *mime_type, gemini_text_cb_t partial_cb, void *user_ctx)
+{
+    ESP_RETURN_ON_FALSE(client && mime_type, ESP_ERR_INVALID_ARG, TAG, "invalid args");
+    if (client->upload.active) {
+        gemini_upload_abort(client);
+    }
+
+    esp_http_client_handle_t http = gemini_http_get(client, NULL != partial_cb);
+    ESP_RETURN_ON_FALSE(NULL != http, ESP_FAIL, TAG, "client init failed");
+    esp_http_client_set_timeout_ms(http, GEMINI_TIMEOUT_MS);
+    gemini_body_init(&client->upload.body, http, client->body_buf[0], true);
+    client->upload.body.cancel = &client->cancel;
+
+    bool reused = client->conn->connected;
+    client->upload.t_start = esp_timer_get_time();
+    client->conn->server_close = false;
+    esp_err_t ret = gemini_http_open(http, -1);
+    if (ret != ESP_OK && reused) {
+        ESP_LOGW(TAG, "Kept-alive connection lost, reconnecting");
+        ret = gemini_http_open(http, -1);
+    }
+    if (ret == ESP_OK) {
+        ret = gemini_body_write_head(&client->upload.body, mime_type);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Upload start failed: %s", esp_err_to_name(ret));
+        esp_http_client_close(http);
+        client->conn->connected = false;
+        return ret;
+    }
+
+    client->upload.active = true;
+    client->upload.partial_cb = partial_cb;
+    client->upload.user_ctx = user_ctx;
+    ESP_LOGI(TAG, "%s connection: upload started in %d ms", reused ? "Reused" : "New",
+             (int)((esp_timer_get_time() - client->upload.t_start) / 1000));
+    return ESP_OK;
+}
+
+esp_err_t gemini_upload_write(gemini_client_t *client, const uint8_t *audio, size_t len)
+{
+    ESP_RETURN_ON_FALSE(client && client->upload.active, ESP_ERR_INVALID_STATE, TAG, "no upload in progress");
+    esp_err_t ret = gemini_body_write_audio(&client->upload.body, audio, len);
+    if (ret != ESP_OK) {
+        gemini_upload_abort(client);
+    }
+    return ret;
+}
+
+esp_err_t gemini_upload_finish(gemini_client_t *client, const char **reply)
+{
+    ESP_RETURN_ON_FALSE(reply, ESP_ERR_INVALID_ARG, TAG, "invalid args");
+    *reply = NULL;
+    ESP_RETURN_ON_FALSE(client && client->upload.active, ESP_ERR_INVALID_STATE, TAG, "no upload in progress");
+
+    esp_http_client_handle_t http = client->upload.body.http;
+    size_t audio_len = client->upload.body.audio_len;
+    int64_t t_end = esp_timer_get_time();
+    esp_err_t ret = gemini_body_write_tail(&client->upload.body);
+    int64_t t_sent = esp_timer_get_time();
+    if (ret == ESP_OK && esp_http_client_fetch_headers(http) < 0) {
+        ret = ESP_FAIL;
+    }
+    if (client->cancel) {
+        ret = ESP_ERR_INVALID_STATE;
+    }
+    int64_t t_headers = esp_timer_get_time();
+    if (ret == ESP_OK) {
+        turn_trace_mark(TURN_PHASE_FIRST_BYTE);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Upload failed: %s", esp_err_to_name(ret));
+        gemini_upload_abort(client);
+        return ret;
+    }
+    client->upload.active = false;
+    client->conn->connected = true;
+
+    ESP_LOGI(TAG, "Streamed %u audio bytes over %d ms, tail %d ms, first byte %d ms", (unsigned)audio_len,
+             (int)((t_end - client->upload.t_start) / 1000), (int)((t_sent - t_end) / 1000), (int)((t_headers - t_sent) / 1000));
+    int status = esp_http_client_get_status_code(http);
+    if (gemini_status_retryable(status)) {
+        /* Worth retrying, which only the buffered query can do with the whole recording */
+        gemini_receive(client, false, NULL, NULL);
+        return ESP_ERR_NOT_FINISHED;
+    }
+    *reply = gemini_receive(client, NULL != client->upload.partial_cb, client->upload.partial_cb, client->upload.user_ctx);
+    return ESP_OK;
+}
+
+void gemini_cancel(gemini_client_t *client, bool cancel)
+{
+    if (client) {
+        client->cancel = cancel;
+    }
+}
+
+bool gemini_cancelled(const gemini_client_t *client)
+{
+    return client && client->cancel;
+}
+
+void gemini_upload_abort(gemini_client_t *client)
+{
+    if (NULL == client || !client->upload.active) {
+        return;
+    }
+    /* The server got a partial body, only a new connection is usable */
+    esp_http_client_close(client->upload.body.http);
+    client->conn->connected = false;
+    client->upload.active = false;
 }
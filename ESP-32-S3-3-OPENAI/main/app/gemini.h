@@ -1,31 +1,127 @@
 #ifndef GEMINI_H
 #define GEMINI_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include "esp_err.h"
 
 /**
- * @brief Initialize Gemini API client
- * 
- * @param api_key The Gemini API key
+ * @brief Called while a streamed reply is being generated
+ *
+ * @param delta Text added since the previous call (not NUL terminated)
+ * @param delta_len Length of delta
+ * @param text The whole reply received so far (NUL terminated)
+ * @param user_ctx User context passed to gemini_audio_query_stream
+ */
+typedef void (*gemini_text_cb_t)(const char *delta, size_t delta_len, const char *text, void *user_ctx);
+
+/** Gemini API client: connection, request buffers and the memory of the current turn */
+typedef struct gemini_client gemini_client_t;
+
+/**
+ * @brief Create a Gemini API client
+ *
+ * All buffers a query needs are allocated here, so a turn does no heap
+ * allocation of its own (besides the race state when hedging is enabled).
+ *
+ * @param api_key The Gemini API key, sent in the x-goog-api-key header
+ * @param[out] ret_client The new client
  * @return esp_err_t ESP_OK if success
  */
-esp_err_t gemini_init(const char *api_key);
+esp_err_t gemini_client_create(const char *api_key, gemini_client_t **ret_client);
 
 /**
- * @brief Send a text query to Gemini and get a response
- * 
- * @param query The text to send
- * @return char* The response text (caller must free), or NULL on error
+ * @brief Close the connection and free the client
  */
-char* gemini_query(const char *query);
+void gemini_client_delete(gemini_client_t *client);
+
+/**
+ * @brief Release everything the current turn allocated, including reply texts
+ */
+void gemini_turn_end(gemini_client_t *client);
 
 /**
  * @brief Send audio data to Gemini and get a text response
- * 
- * @param audio Binary audio data (PCM/WAV)
+ *
+ * Failed connections and 429/5xx responses are retried with jittered backoff
+ * (or the server's Retry-After) while CONFIG_GEMINI_TURN_BUDGET_MS lasts.
+ *
+ * @param client Gemini client
+ * @param audio Encoded audio (a complete WAV/FLAC file)
  * @param len Length of audio data
- * @return char* The transcribed/responded text (caller must free)
+ * @param mime_type MIME type of the audio, e.g. "audio/wav"
+ * @return const char* The transcribed/responded text, valid until gemini_turn_end(), or NULL on error
+ */
+const char *gemini_audio_query(gemini_client_t *client, const uint8_t *audio, size_t len, const char *mime_type);
+
+/**
+ * @brief Send audio data to Gemini's streaming endpoint (streamGenerateContent, SSE)
+ *
+ * `partial_cb` is called from the calling task every time the server sends more text,
+ * so the reply can be displayed while the model is still generating.
+ *
+ * @param client Gemini client
+ * @param audio Encoded audio (a complete WAV/FLAC file)
+ * @param len Length of audio data
+ * @param mime_type MIME type of the audio, e.g. "audio/wav"
+ * @param partial_cb Callback for each text delta
+ * @param user_ctx User context for partial_cb
+ * @return const char* The full response text, valid until gemini_turn_end(), or NULL on error
+ */
+const char *gemini_audio_query_stream(gemini_client_t *client, const uint8_t *audio, size_t len, const char *mime_type,
+                                      gemini_text_cb_t partial_cb, void *user_ctx);
+
+/**
+ * @brief Start a request whose audio is uploaded while it is still being recorded
+ *
+ * The body is sent with chunked transfer encoding: feed the encoded audio with
+ * gemini_upload_write() as it becomes available, then read the reply with
+ * gemini_upload_finish(). Only one upload per client can be in progress, and its
+ * calls must not overlap with each other or with the other queries.
+ *
+ * @param client Gemini client
+ * @param mime_type MIME type of the audio stream, e.g. "audio/wav"
+ * @param partial_cb Callback for each text delta, NULL to use the non-streaming endpoint
+ * @param user_ctx User context for partial_cb
+ * @return esp_err_t ESP_OK if the request was opened
+ */
+esp_err_t gemini_upload_begin(gemini_client_t *client, const char *mime_type, gemini_text_cb_t partial_cb, void *user_ctx);
+
+/**
+ * @brief Append encoded audio to the upload, any length
+ *
+ * @return esp_err_t ESP_OK, otherwise the upload was aborted
+ */
+esp_err_t gemini_upload_write(gemini_client_t *client, const uint8_t *audio, size_t len);
+
+/**
+ * @brief Complete the body and read the reply
+ *
+ * @param client Gemini client
+ * @param[out] reply The response text, valid until gemini_turn_end(), NULL if there was none
+ * @return esp_err_t ESP_OK if the server answered, an error if the request could not
+ *         be delivered or got a retryable status (429, 5xx) and should be sent again as a whole
+ */
+esp_err_t gemini_upload_finish(gemini_client_t *client, const char **reply);
+
+/**
+ * @brief Drop the upload in progress, if any
+ */
+void gemini_upload_abort(gemini_client_t *client);
+
+/**
+ * @brief Make the query or upload in progress on another task give up, or allow the next one
+ *
+ * The client looks at the flag between body writes, response reads and
+ * retries, so the call in progress soon returns without a reply; a read
+ * blocked in the socket finishes first. Set until cleared with `cancel` false.
+ */
+void gemini_cancel(gemini_client_t *client, bool cancel);
+
+/**
+ * @brief Whether gemini_cancel() is in effect
  */
-char* gemini_audio_query(uint8_t *audio, size_t len);
+bool gemini_cancelled(const gemini_client_t *client);
 
 #endif // GEMINI_H
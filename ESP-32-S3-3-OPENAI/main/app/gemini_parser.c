@@ -0,0 +1,498 @@
+/*
+ * Incremental JSON text extractor for Gemini responses
+ *
+ * A byte-at-a-time JSON tokenizer that tracks only the container stack, so a
+ * reply of any length is parsed in constant memory and only the strings on
+ * the requested path are decoded and handed to the callback.
+ */
+
+#include <string.h>
+#include "gemini_parser.h"
+
+enum {
+    PARSER_VALUE = 0,       /* expecting any value */
+    PARSER_OBJ_KEY,         /* expecting a key or '}' */
+    PARSER_COLON,           /* expecting ':' */
+    PARSER_ARR_VALUE,       /* expecting a value or ']' */
+    PARSER_AFTER_VALUE,     /* expecting ',' or a closing bracket */
+    PARSER_STRING,
+    PARSER_STRING_ESC,
+    PARSER_STRING_HEX,
+    PARSER_LITERAL,
+    PARSER_DONE,
+    PARSER_ERROR,
+};
+
+const gemini_parser_path_t GEMINI_PARSER_PATH_TEXT[] = {
+    { .key = "candidates" },
+    { .key = NULL, .index = 0 },
+    { .key = "content" },
+    { .key = "parts" },
+    { .key = NULL, .index = -1 },
+    { .key = "text" },
+};
+const uint8_t GEMINI_PARSER_PATH_TEXT_LEN = sizeof(GEMINI_PARSER_PATH_TEXT) / sizeof(GEMINI_PARSER_PATH_TEXT[0]);
+
+const gemini_parser_path_t GEMINI_PARSER_PATH_ERROR[] = {
+    { .key = "error" },
+    { .key = "message" },
+};
+const uint8_t GEMINI_PARSER_PATH_ERROR_LEN = sizeof(GEMINI_PARSER_PATH_ERROR) / sizeof(GEMINI_PARSER_PATH_ERROR[0]);
+
+static inline bool is_ws(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static inline bool top_is_array(const gemini_parser_t *p)
+{
+    return p->depth && (p->array_mask & (1UL << (p->depth - 1)));
+}
+
+static void out_flush(gemini_parser_t *p)
+{
+    if (p->out_len && p->cb) {
+        p->cb(p->out, p->out_len, p->user_ctx);
+    }
+    p->out_len = 0;
+}
+
+static void out_byte(gemini_parser_t *p, char c)
+{
+    if (!p->emit) {
+        return;
+    }
+    p->out[p->out_len++] = c;
+    if (p->out_len == sizeof(p->out)) {
+        out_flush(p);
+    }
+}
+
+static void out_code_point(gemini_parser_t *p, uint32_t cp)
+{
+    if (cp < 0x80) {
+        out_byte(p, cp);
+    } else if (cp < 0x800) {
+        out_byte(p, 0xC0 | (cp >> 6));
+        out_byte(p, 0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out_byte(p, 0xE0 | (cp >> 12));
+        out_byte(p, 0x80 | ((cp >> 6) & 0x3F));
+        out_byte(p, 0x80 | (cp & 0x3F));
+    } else {
+        out_byte(p, 0xF0 | (cp >> 18));
+        out_byte(p, 0x80 | ((cp >> 12) & 0x3F));
+        out_byte(p, 0x80 | ((cp >> 6) & 0x3F));
+        out_byte(p, 0x80 | (cp & 0x3F));
+    }
+}
+
+/* Decoded character of a key or string value */
+static void string_char(gemini_parser_t *p, uint32_t cp)
+{
+    if (p->in_key) {
+        if (p->key_ok) {
+            const char *key = p->path[p->depth - 1].key;
+            if (cp < 0x80 && key[p->key_pos] == (char)cp) {
+                p->key_pos++;
+            } else {
+                p->key_ok = false;
+            }
+        }
+    } else {
+        out_code_point(p, cp);
+    }
+}
+
+/* Whether the value starting now is on the selected path */
+static bool value_selected(const gemini_parser_t *p)
+{
+    uint8_t d = p->depth;
+    if (p->matched != d) {
+        return false;
+    }
+    if (d == 0) {
+        return true;
+    }
+    const gemini_parser_path_t *step = &p->path[d - 1];
+    if (step->key) {
+        return !top_is_array(p) && p->key_match;
+    }
+    return top_is_array(p) && (step->index < 0 || step->index == p->index[d - 1]);
+}
+
+static void value_end(gemini_parser_t *p)
+{
+    p->state = p->depth ? PARSER_AFTER_VALUE : PARSER_DONE;
+}
+
+static bool push(gemini_parser_t *p, bool is_array)
+{
+    if (p->depth >= GEMINI_PARSER_MAX_DEPTH) {
+        return false;
+    }
+    bool selected = value_selected(p);
+    uint8_t d = p->depth;
+    if (is_array) {
+        p->array_mask |= (1UL << d);
+    } else {
+        p->array_mask &= ~(1UL << d);
+    }
+    p->index[d] = 0;
+    p->depth++;
+    if (selected && d < p->path_len && (NULL == p->path[d].key) == is_array) {
+        p->matched = p->depth;
+    }
+    p->state = is_array ? PARSER_ARR_VALUE : PARSER_OBJ_KEY;
+    return true;
+}
+
+static bool pop(gemini_parser_t *p, bool is_array)
+{
+    if (!p->depth || top_is_array(p) != is_array) {
+        return false;
+    }
+    p->depth--;
+    if (p->matched > p->depth) {
+        p->matched = p->depth;
+    }
+    value_end(p);
+    return true;
+}
+
+static void string_start(gemini_parser_t *p, bool is_key)
+{
+    p->in_key = is_key;
+    if (is_key) {
+        p->key_ok = (p->matched == p->depth) && p->depth <= p->path_len && NULL != p->path[p->depth - 1].key;
+        p->key_pos = 0;
+        p->key_match = false;
+    } else {
+        p->emit = value_selected(p) && p->depth == p->path_len;
+        p->found |= p->emit;
+    }
+    p->high_surrogate = 0;
+    p->state = PARSER_STRING;
+}
+
+static void string_end(gemini_parser_t *p)
+{
+    if (p->in_key) {
+        p->key_match = p->key_ok && '\0' == p->path[p->depth - 1].key[p->key_pos];
+        p->in_key = false;
+        p->state = PARSER_COLON;
+    } else {
+        p->emit = false;
+        value_end(p);
+    }
+}
+
+static void string_unicode(gemini_parser_t *p, uint32_t cp)
+{
+    if (cp >= 0xD800 && cp <= 0xDBFF) {
+        p->high_surrogate = cp;
+        return;
+    }
+    if (cp >= 0xDC00 && cp <= 0xDFFF && p->high_surrogate) {
+        cp = 0x10000 + ((p->high_surrogate - 0xD800) << 10) + (cp - 0xDC00);
+    }
+    p->high_surrogate = 0;
+    string_char(p, cp);
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/* Start of a value in PARSER_VALUE or PARSER_ARR_VALUE */
+static bool value_start(gemini_parser_t *p, char c)
+{
+    if (c == '{') {
+        return push(p, false);
+    } else if (c == '[') {
+        return push(p, true);
+    } else if (c == '"') {
+        string_start(p, false);
+        return true;
+    } else if (c == '-' || (c >= '0' && c <= '9') || c == 't' || c == 'f' || c == 'n') {
+        p->state = PARSER_LITERAL;
+        return true;
+    }
+    return false;
+}
+
+static bool parse_char(gemini_parser_t *p, char c)
+{
+    switch (p->state) {
+    case PARSER_VALUE:
+        return is_ws(c) || value_start(p, c);
+    case PARSER_ARR_VALUE:
+        if (is_ws(c)) {
+            return true;
+        }
+        return c == ']' ? pop(p, true) : value_start(p, c);
+    case PARSER_OBJ_KEY:
+        if (is_ws(c)) {
+            return true;
+        } else if (c == '"') {
+            string_start(p, true);
+            return true;
+        }
+        return c == '}' && pop(p, false);
+    case PARSER_COLON:
+        if (c == ':') {
+            p->state = PARSER_VALUE;
+            return true;
+        }
+        return is_ws(c);
+    case PARSER_AFTER_VALUE:
+        if (is_ws(c)) {
+            return true;
+        } else if (c == ',') {
+            if (top_is_array(p)) {
+                p->index[p->depth - 1]++;
+                p->state = PARSER_VALUE;
+            } else {
+                p->state = PARSER_OBJ_KEY;
+            }
+            return true;
+        } else if (c == '}' || c == ']') {
+            return pop(p, c == ']');
+        }
+        return false;
+    case PARSER_STRING:
+        if (c == '"') {
+            string_end(p);
+        } else if (c == '\\') {
+            p->state = PARSER_STRING_ESC;
+        } else if ((uint8_t)c < 0x20) {
+            return false;
+        } else if (p->in_key) {
+            string_char(p, (uint8_t)c);
+        } else {
+            /* Raw UTF-8 bytes are passed through untouched */
+            out_byte(p, c);
+        }
+        return true;
+    case PARSER_STRING_ESC:
+        p->state = PARSER_STRING;
+        switch (c) {
+        case '"':
+        case '\\':
+        case '/':
+            string_char(p, c);
+            break;
+        case 'b':
+            string_char(p, '\b');
+            break;
+        case 'f':
+            string_char(p, '\f');
+            break;
+        case 'n':
+            string_char(p, '\n');
+            break;
+        case 'r':
+            string_char(p, '\r');
+            break;
+        case 't':
+            string_char(p, '\t');
+            break;
+        case 'u':
+            p->code_point = 0;
+            p->hex_left = 4;
+            p->state = PARSER_STRING_HEX;
+            break;
+        default:
+            return false;
+        }
+        return true;
+    case PARSER_STRING_HEX: {
+        int v = hex_value(c);
+        if (v < 0) {
+            return false;
+        }
+        p->code_point = (p->code_point << 4) | v;
+        if (0 == --p->hex_left) {
+            p->state = PARSER_STRING;
+            string_unicode(p, p->code_point);
+        }
+        return true;
+    }
+    case PARSER_LITERAL:
+        if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '.' || c == '-' || c == '+' || c == 'E') {
+            return true;
+        }
+        value_end(p);
+        return p->state == PARSER_DONE ? is_ws(c) : parse_char(p, c);
+    case PARSER_DONE:
+        return is_ws(c);
+    default:
+        return false;
+    }
+}
+
+void gemini_parser_init(gemini_parser_t *parser, const gemini_parser_path_t *path, uint8_t path_len,
+                        gemini_parser_text_cb_t cb, void *user_ctx)
+{
+    memset(parser, 0, sizeof(gemini_parser_t));
+    parser->path = path;
+    parser->path_len = path_len;
+    parser->cb = cb;
+    parser->user_ctx = user_ctx;
+}
+
+void gemini_parser_reset(gemini_parser_t *parser)
+{
+    gemini_parser_init(parser, parser->path, parser->path_len, parser->cb, parser->user_ctx);
+}
+
+esp_err_t gemini_parser_feed(gemini_parser_t *parser, const char *data, size_t len)
+{
+    if (PARSER_ERROR == parser->state) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (!parse_char(parser, data[i])) {
+            parser->state = PARSER_ERROR;
+            parser->out_len = 0;
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+    }
+    out_flush(parser);
+    return ESP_OK;
+}
+
+esp_err_t gemini_parser_finish(gemini_parser_t *parser)
+{
+    out_flush(parser);
+    if (PARSER_LITERAL == parser->state && 0 == parser->depth) {
+        parser->state = PARSER_DONE;
+    }
+    return PARSER_DONE == parser->state ? ESP_OK : ESP_ERR_INVALID_RESPONSE;
+}
+
+bool gemini_parser_found(const gemini_parser_t *parser)
+{
+    return parser->found;
+}
+
+/* Server-sent events */
+
+enum {
+    SSE_LINE_START = 0,     /* matching the field name */
+    SSE_LINE_DATA_SPACE,    /* after "data:", one optional space */
+    SSE_LINE_DATA,          /* payload of a data line */
+    SSE_LINE_SKIP,          /* comment or a field other than data */
+};
+
+static const char SSE_DATA_FIELD[] = "data:";
+
+static esp_err_t sse_dispatch(gemini_sse_t *sse)
+{
+    if (!sse->has_data) {
+        return ESP_OK;
+    }
+    sse->has_data = false;
+    esp_err_t ret = gemini_parser_finish(&sse->json);
+    if (ESP_OK == ret && sse->event_cb) {
+        sse->event_cb(sse->json.user_ctx);
+    }
+    gemini_parser_reset(&sse->json);
+    return ret;
+}
+
+static esp_err_t sse_line_end(gemini_sse_t *sse)
+{
+    esp_err_t ret = ESP_OK;
+    if (SSE_LINE_START == sse->line_state && 0 == sse->field_pos) {
+        ret = sse_dispatch(sse);
+    } else if (SSE_LINE_DATA == sse->line_state || SSE_LINE_DATA_SPACE == sse->line_state) {
+        /* Multi-line payloads are joined with '\n', which is plain whitespace to JSON */
+        ret = gemini_parser_feed(&sse->json, "\n", 1);
+    }
+    sse->line_state = SSE_LINE_START;
+    sse->field_pos = 0;
+    return ret;
+}
+
+void gemini_sse_init(gemini_sse_t *sse, const gemini_parser_path_t *path, uint8_t path_len,
+                     gemini_parser_text_cb_t cb, gemini_sse_event_cb_t event_cb, void *user_ctx)
+{
+    memset(sse, 0, sizeof(gemini_sse_t));
+    gemini_parser_init(&sse->json, path, path_len, cb, user_ctx);
+    sse->event_cb = event_cb;
+}
+
+esp_err_t gemini_sse_feed(gemini_sse_t *sse, const char *data, size_t len)
+{
+    esp_err_t ret = ESP_OK;
+    size_t i = 0;
+
+    while (i < len && ESP_OK == ret) {
+        char c = data[i];
+
+        if (c == '\n' && sse->last_cr) {
+            /* Second half of a CRLF */
+            sse->last_cr = false;
+            i++;
+            continue;
+        }
+        sse->last_cr = (c == '\r');
+        if (c == '\r' || c == '\n') {
+            ret = sse_line_end(sse);
+            i++;
+            continue;
+        }
+
+        switch (sse->line_state) {
+        case SSE_LINE_START:
+            if (c == SSE_DATA_FIELD[sse->field_pos]) {
+                if (0 == SSE_DATA_FIELD[++sse->field_pos]) {
+                    sse->line_state = SSE_LINE_DATA_SPACE;
+                    sse->has_data = true;
+                }
+            } else {
+                sse->line_state = SSE_LINE_SKIP;
+            }
+            i++;
+            break;
+        case SSE_LINE_DATA_SPACE:
+            sse->line_state = SSE_LINE_DATA;
+            if (c == ' ') {
+                i++;
+            }
+            break;
+        case SSE_LINE_DATA: {
+            /* Hand the whole run up to the end of line to the JSON parser at once */
+            size_t end = i;
+            while (end < len && data[end] != '\r' && data[end] != '\n') {
+                end++;
+            }
+            ret = gemini_parser_feed(&sse->json, data + i, end - i);
+            i = end;
+            break;
+        }
+        default:
+            i++;
+            break;
+        }
+    }
+    return ret;
+}
+
+esp_err_t gemini_sse_finish(gemini_sse_t *sse)
+{
+    esp_err_t ret = ESP_OK;
+    if (SSE_LINE_START != sse->line_state || sse->field_pos) {
+        ret = sse_line_end(sse);
+    }
+    return ESP_OK == ret ? sse_dispatch(sse) : ret;
+}
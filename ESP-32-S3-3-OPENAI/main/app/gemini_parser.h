@@ -0,0 +1,141 @@
+/*
+ * Incremental JSON text extractor for Gemini responses
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GEMINI_PARSER_MAX_DEPTH     16
+#define GEMINI_PARSER_OUT_SIZE      64
+
+/**
+ * @brief One step of the JSON path to extract
+ *
+ * A step with a key selects that member of an object, a step without a key
+ * selects element `index` of an array (-1 selects every element).
+ */
+typedef struct {
+    const char *key;
+    int index;
+} gemini_parser_path_t;
+
+/**
+ * @brief Called with each decoded fragment of a selected string value
+ *
+ * Fragments are not NUL terminated and may split a UTF-8 sequence.
+ */
+typedef void (*gemini_parser_text_cb_t)(const char *text, size_t len, void *user_ctx);
+
+typedef struct {
+    const gemini_parser_path_t *path;
+    uint8_t path_len;
+    gemini_parser_text_cb_t cb;
+    void *user_ctx;
+
+    uint8_t state;
+    uint8_t depth;
+    uint8_t matched;
+    uint32_t array_mask;
+    int32_t index[GEMINI_PARSER_MAX_DEPTH];
+
+    bool in_key;
+    bool key_ok;
+    bool key_match;
+    uint8_t key_pos;
+    bool emit;
+    bool found;
+    uint32_t code_point;
+    uint8_t hex_left;
+    uint16_t high_surrogate;
+
+    char out[GEMINI_PARSER_OUT_SIZE];
+    size_t out_len;
+} gemini_parser_t;
+
+/**
+ * @brief Called after each complete server-sent event
+ */
+typedef void (*gemini_sse_event_cb_t)(void *user_ctx);
+
+/**
+ * @brief Server-sent event splitter feeding every `data:` payload into a JSON parser
+ */
+typedef struct {
+    gemini_parser_t json;
+    gemini_sse_event_cb_t event_cb;
+    uint8_t line_state;
+    uint8_t field_pos;
+    bool has_data;
+    bool last_cr;
+} gemini_sse_t;
+
+/** Path of the reply text: candidates[0].content.parts[*].text */
+extern const gemini_parser_path_t GEMINI_PARSER_PATH_TEXT[];
+extern const uint8_t GEMINI_PARSER_PATH_TEXT_LEN;
+
+/** Path of the error description: error.message */
+extern const gemini_parser_path_t GEMINI_PARSER_PATH_ERROR[];
+extern const uint8_t GEMINI_PARSER_PATH_ERROR_LEN;
+
+/**
+ * @brief Prepare a parser to extract the strings found at `path`
+ */
+void gemini_parser_init(gemini_parser_t *parser, const gemini_parser_path_t *path, uint8_t path_len,
+                        gemini_parser_text_cb_t cb, void *user_ctx);
+
+/**
+ * @brief Reset the parser for a new JSON document, keeping path and callback
+ */
+void gemini_parser_reset(gemini_parser_t *parser);
+
+/**
+ * @brief Feed the next slice of the document, split at any byte boundary
+ *
+ * @return ESP_OK, or ESP_ERR_INVALID_RESPONSE on malformed JSON
+ */
+esp_err_t gemini_parser_feed(gemini_parser_t *parser, const char *data, size_t len);
+
+/**
+ * @brief Flush pending text and check the document was complete
+ *
+ * @return ESP_OK if a full document was parsed, ESP_ERR_INVALID_RESPONSE otherwise
+ */
+esp_err_t gemini_parser_finish(gemini_parser_t *parser);
+
+/**
+ * @brief Whether any value matching the path was seen
+ */
+bool gemini_parser_found(const gemini_parser_t *parser);
+
+/**
+ * @brief Prepare an SSE stream whose events each carry one JSON document
+ *
+ * `cb` receives the text fragments found at `path`, `event_cb` fires once per
+ * event after its document was parsed. Both get `user_ctx`.
+ */
+void gemini_sse_init(gemini_sse_t *sse, const gemini_parser_path_t *path, uint8_t path_len,
+                     gemini_parser_text_cb_t cb, gemini_sse_event_cb_t event_cb, void *user_ctx);
+
+/**
+ * @brief Feed the next slice of the event stream, split at any byte boundary
+ *
+ * @return ESP_OK, or ESP_ERR_INVALID_RESPONSE if an event carried malformed JSON
+ */
+esp_err_t gemini_sse_feed(gemini_sse_t *sse, const char *data, size_t len);
+
+/**
+ * @brief Dispatch an event left unterminated at end of stream
+ */
+esp_err_t gemini_sse_finish(gemini_sse_t *sse);
+
+#ifdef __cplusplus
+}
+#endif
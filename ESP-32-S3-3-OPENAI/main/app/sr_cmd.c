@@ -0,0 +1,104 @@
+/*
+ * Control commands recognized on the device
+ *
+ * Short control phrases right after the wake word ("stop", "louder", ...) are
+ * answered by MultiNet in tens of milliseconds instead of a round trip to
+ * Gemini. The table is built from the configuration so phrases can be tuned
+ * per model without touching the code.
+ */
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_mn_speech_commands.h"
+#include "sdkconfig.h"
+#include "sr_cmd.h"
+
+static const char *const s_cmd_name[SR_CMD_MAX] = {
+    [SR_CMD_NONE] = "none",
+    [SR_CMD_STOP] = "stop",
+    [SR_CMD_LOUDER] = "louder",
+    [SR_CMD_QUIETER] = "quieter",
+    [SR_CMD_REPEAT] = "repeat",
+};
+
+#if CONFIG_SR_COMMANDS
+
+static const char *TAG = "sr_cmd";
+
+#define SR_CMD_PHRASES_LEN      128
+
+static const char *const s_cmd_phrases[SR_CMD_MAX] = {
+    [SR_CMD_STOP] = CONFIG_SR_CMD_STOP,
+    [SR_CMD_LOUDER] = CONFIG_SR_CMD_LOUDER,
+    [SR_CMD_QUIETER] = CONFIG_SR_CMD_QUIETER,
+    [SR_CMD_REPEAT] = CONFIG_SR_CMD_REPEAT,
+};
+
+/* Adds every ';' separated phrase of `cmd`, returns how many were added */
+static int sr_cmd_add(sr_cmd_t cmd)
+{
+    /* MultiNet keeps its own copy, the buffer only has to outlive the split */
+    char phrases[SR_CMD_PHRASES_LEN];
+    char *save = NULL;
+    int added = 0;
+
+    strlcpy(phrases, s_cmd_phrases[cmd], sizeof(phrases));
+    for (char *phrase = strtok_r(phrases, ";", &save); phrase; phrase = strtok_r(NULL, ";", &save)) {
+        while (' ' == *phrase) {
+            phrase++;
+        }
+        size_t len = strlen(phrase);
+        while (len && ' ' == phrase[len - 1]) {
+            phrase[--len] = '\0';
+        }
+        if (0 == len) {
+            continue;
+        }
+        if (ESP_OK == esp_mn_commands_add(cmd, phrase)) {
+            ESP_LOGI(TAG, "%s: \"%s\"", s_cmd_name[cmd], phrase);
+            added++;
+        } else {
+            ESP_LOGW(TAG, "%s: \"%s\" not added", s_cmd_name[cmd], phrase);
+        }
+    }
+    return added;
+}
+
+esp_err_t sr_cmd_load(const esp_mn_iface_t *multinet, model_iface_data_t *model_data, int *count)
+{
+    ESP_RETURN_ON_FALSE(NULL != multinet && NULL != model_data && NULL != count, ESP_ERR_INVALID_ARG, TAG, "invalid arg");
+
+    ESP_RETURN_ON_ERROR(esp_mn_commands_alloc((esp_mn_iface_t *)multinet, model_data), TAG, "Failed alloc commands");
+    esp_mn_commands_clear();
+
+    int added = 0;
+    for (int cmd = SR_CMD_NONE + 1; cmd < SR_CMD_MAX; cmd++) {
+        added += sr_cmd_add(cmd);
+    }
+
+    esp_mn_error_t *error = esp_mn_commands_update();
+    if (error) {
+        for (int i = 0; i < error->num; i++) {
+            ESP_LOGW(TAG, "rejected by the model: %s (%s)", error->phrases[i]->string,
+                     sr_cmd_name(error->phrases[i]->command_id));
+        }
+        added -= error->num;
+    }
+    *count = added;
+    return ESP_OK;
+}
+
+#else
+
+esp_err_t sr_cmd_load(const esp_mn_iface_t *multinet, model_iface_data_t *model_data, int *count)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif
+
+const char *sr_cmd_name(int cmd)
+{
+    return cmd >= 0 && cmd < SR_CMD_MAX && s_cmd_name[cmd] ? s_cmd_name[cmd] : "?";
+}
@@ -0,0 +1,40 @@
+/*
+ * Control commands recognized on the device
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include "esp_mn_iface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* MultiNet command ids, 0 means no command */
+typedef enum {
+    SR_CMD_NONE = 0,
+    SR_CMD_STOP,                /* stop talking, nothing else to do */
+    SR_CMD_LOUDER,
+    SR_CMD_QUIETER,
+    SR_CMD_REPEAT,              /* show the last reply again */
+    SR_CMD_MAX,
+} sr_cmd_t;
+
+/**
+ * @brief Load the command table from the configuration into MultiNet
+ *
+ * Every command takes the phrases of its CONFIG_SR_CMD_* option, separated by
+ * ';'. Phrases MultiNet rejects are logged and skipped.
+ *
+ * @param[out] count Phrases MultiNet accepted
+ * @return ESP_ERR_NOT_SUPPORTED when CONFIG_SR_COMMANDS is disabled
+ */
+esp_err_t sr_cmd_load(const esp_mn_iface_t *multinet, model_iface_data_t *model_data, int *count);
+
+/** Short name for logs, "?" for an unknown id */
+const char *sr_cmd_name(int cmd);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,140 @@
+/*
+ * States of a voice turn, driven by the events of the SR handler
+ *
+ * A turn starts at the wake word, records until the endpointer or a command
+ * ends it, waits for the answer and lasts until the speaker went quiet. The
+ * wake word starts a new turn in every state: the detect task already flushed
+ * the speaker, a turn still being recorded is dropped and one still waiting
+ * for its answer is given up on. Its reply may still come in afterwards, the
+ * turn number it carries tells it apart. Muting the microphones drops a turn
+ * being recorded too, there is nothing left to hear, and so does the
+ * endpointer giving up on a turn nobody spoke in.
+ *
+ * Nothing here blocks or touches hardware, the handler carries out the
+ * returned actions.
+ */
+
+#include "sr_fsm.h"
+
+void sr_fsm_init(sr_fsm_t *fsm, bool online, bool muted)
+{
+    fsm->state = SR_STATE_IDLE;
+    fsm->online = online;
+    fsm->muted = muted;
+    fsm->turn = 0;
+}
+
+uint32_t sr_fsm_handle(sr_fsm_t *fsm, const sr_event_t *event)
+{
+    bool listening = SR_STATE_LISTENING == fsm->state;
+    bool uploading = SR_STATE_UPLOADING == fsm->state;
+    uint32_t actions = 0;
+
+    switch (event->type) {
+    case SR_EVENT_WAKE:
+        actions = SR_ACTION_TURN_START | (listening ? SR_ACTION_TURN_CANCEL : 0) | (uploading ? SR_ACTION_TURN_ABORT : 0)
+                  | (fsm->online ? SR_ACTION_UPLOAD_START : 0);
+        fsm->state = SR_STATE_LISTENING;
+        break;
+    case SR_EVENT_END_OF_SPEECH:
+        if (listening) {
+            actions = fsm->online ? SR_ACTION_TURN_SEND : SR_ACTION_TURN_QUEUE;
+            fsm->state = SR_STATE_UPLOADING;
+            fsm->turn++;
+        }
+        break;
+    case SR_EVENT_NO_SPEECH:
+        if (listening) {
+            actions = SR_ACTION_TURN_CANCEL | SR_ACTION_SLEEP;
+            fsm->state = SR_STATE_IDLE;
+        }
+        break;
+    case SR_EVENT_COMMAND:
+        if (listening) {
+            actions = SR_ACTION_TURN_CANCEL | SR_ACTION_COMMAND;
+            fsm->state = SR_STATE_IDLE;
+        }
+        break;
+    case SR_EVENT_REPLIED:
+        if (uploading && event->turn == fsm->turn) {
+            fsm->state = SR_STATE_REPLYING;
+        }
+        break;
+    case SR_EVENT_PLAY_DONE:
+        if (SR_STATE_REPLYING == fsm->state) {
+            fsm->state = SR_STATE_IDLE;
+        }
+        break;
+    case SR_EVENT_MUTE:
+        fsm->muted = true;
+        if (listening) {
+            actions = SR_ACTION_TURN_CANCEL;
+            fsm->state = SR_STATE_IDLE;
+        }
+        break;
+    case SR_EVENT_UNMUTE:
+        actions = fsm->muted ? SR_ACTION_CODEC_RESTORE : 0;
+        fsm->muted = false;
+        break;
+    case SR_EVENT_NET_UP:
+        fsm->online = true;
+        actions = SR_ACTION_OFFLINE_KICK;
+        break;
+    case SR_EVENT_NET_DOWN:
+        fsm->online = false;
+        break;
+    case SR_EVENT_EXIT:
+        actions = SR_ACTION_EXIT | (listening ? SR_ACTION_TURN_CANCEL : 0) | (uploading ? SR_ACTION_TURN_ABORT : 0);
+        fsm->state = SR_STATE_IDLE;
+        break;
+    default:
+        break;
+    }
+    return actions;
+}
+
+const char *sr_fsm_state_name(sr_state_t state)
+{
+    switch (state) {
+    case SR_STATE_IDLE:
+        return "idle";
+    case SR_STATE_LISTENING:
+        return "listening";
+    case SR_STATE_UPLOADING:
+        return "uploading";
+    case SR_STATE_REPLYING:
+        return "replying";
+    default:
+        return "?";
+    }
+}
+
+const char *sr_fsm_event_name(sr_event_type_t event)
+{
+    switch (event) {
+    case SR_EVENT_WAKE:
+        return "wake";
+    case SR_EVENT_END_OF_SPEECH:
+        return "end_of_speech";
+    case SR_EVENT_NO_SPEECH:
+        return "no_speech";
+    case SR_EVENT_COMMAND:
+        return "command";
+    case SR_EVENT_REPLIED:
+        return "replied";
+    case SR_EVENT_PLAY_DONE:
+        return "play_done";
+    case SR_EVENT_MUTE:
+        return "mute";
+    case SR_EVENT_UNMUTE:
+        return "unmute";
+    case SR_EVENT_NET_UP:
+        return "net_up";
+    case SR_EVENT_NET_DOWN:
+        return "net_down";
+    case SR_EVENT_EXIT:
+        return "exit";
+    default:
+        return "?";
+    }
+}
@@ -0,0 +1,90 @@
+/*
+ * States of a voice turn, driven by the events of the SR handler
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    SR_STATE_IDLE = 0,          /* waiting for the wake word */
+    SR_STATE_LISTENING,         /* recording the question */
+    SR_STATE_UPLOADING,         /* question finished, waiting for the answer */
+    SR_STATE_REPLYING,          /* answer shown, the speaker is still busy */
+    SR_STATE_MAX,
+} sr_state_t;
+
+typedef enum {
+    SR_EVENT_WAKE = 0,          /* wake word, or the manual trigger */
+    SR_EVENT_END_OF_SPEECH,     /* the endpointer ended the question */
+    SR_EVENT_NO_SPEECH,         /* the endpointer gave up, nobody spoke after the wake word */
+    SR_EVENT_COMMAND,           /* MultiNet recognized a command */
+    SR_EVENT_REPLIED,           /* the turn was answered, queued or failed */
+    SR_EVENT_PLAY_DONE,         /* the playback queue ran empty */
+    SR_EVENT_MUTE,              /* microphones switched off */
+    SR_EVENT_UNMUTE,
+    SR_EVENT_NET_UP,            /* the station got an IP address */
+    SR_EVENT_NET_DOWN,
+    SR_EVENT_EXIT,              /* speech recognition stops */
+    SR_EVENT_MAX,
+} sr_event_type_t;
+
+/* What the handler has to do for an event, in this order */
+#define SR_ACTION_TURN_CANCEL       (1 << 0)    /* drop the recording and the upload of the turn */
+#define SR_ACTION_TURN_ABORT        (1 << 1)    /* give up on the turn being sent, its answer is not waited for */
+#define SR_ACTION_TURN_START        (1 << 2)    /* record from the wake word on */
+#define SR_ACTION_UPLOAD_START      (1 << 3)    /* upload the recording while it is captured */
+#define SR_ACTION_TURN_SEND         (1 << 4)    /* stop recording and send the turn */
+#define SR_ACTION_TURN_QUEUE        (1 << 5)    /* stop recording and keep the turn until the link is back */
+#define SR_ACTION_COMMAND           (1 << 6)    /* carry out the recognized command */
+#define SR_ACTION_CODEC_RESTORE     (1 << 7)    /* microphones back on, restore the codec format */
+#define SR_ACTION_OFFLINE_KICK      (1 << 8)    /* send the turns queued while offline */
+#define SR_ACTION_SLEEP             (1 << 9)    /* back to the sleep panel */
+#define SR_ACTION_EXIT              (1 << 10)
+
+/* Everything the SR handler reacts to comes through one queue */
+typedef struct {
+    sr_event_type_t type;
+    int command_id;         /* SR_EVENT_COMMAND: an sr_cmd_t */
+    uint32_t audio_seq;     /* SR_EVENT_WAKE: feed frame of the fetch the wake word was detected in, see sr_fetch_seq() */
+    uint32_t turn;          /* SR_EVENT_REPLIED: sr_fsm_t.turn of the turn that was sent */
+} sr_event_t;
+
+/* Only depends on the C library, the transitions can be run on a host */
+typedef struct {
+    sr_state_t state;
+    bool online;                /* last network state reported */
+    bool muted;                 /* last mute button state reported */
+    uint32_t turn;              /* counts the turns sent, a reply to an older one comes too late */
+} sr_fsm_t;
+
+/**
+ * @brief Start idle, with the network and mute state read at startup
+ */
+void sr_fsm_init(sr_fsm_t *fsm, bool online, bool muted);
+
+/**
+ * @brief Apply one event
+ *
+ * Events that mean nothing in the current state, like the end of speech
+ * while idle or the reply to a turn the child already talked over, leave it
+ * as it is.
+ *
+ * @return SR_ACTION_* bits for the handler to carry out
+ */
+uint32_t sr_fsm_handle(sr_fsm_t *fsm, const sr_event_t *event);
+
+/**
+ * @brief Short names, for logs
+ */
+const char *sr_fsm_state_name(sr_state_t state);
+const char *sr_fsm_event_name(sr_event_type_t event);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,208 @@
+/*
+ * Periodic CPU and stack profile of every task
+ *
+ * The run-time counters of all tasks are sampled with uxTaskGetSystemState()
+ * and differenced against the previous sample, which gives each task's share
+ * of a core over the interval. Per-core load is what the idle task of that
+ * core did not get. Snapshots are packed into a small binary frame (layout in
+ * task_profiler.h) and printed base64 encoded, one line each, so the feed,
+ * detect and handler tasks can be watched against TLS handshakes and LVGL
+ * without stopping the board.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_idf_version.h"
+#include "sdkconfig.h"
+#include "task_profiler.h"
+
+#if CONFIG_TASK_PROFILER
+
+static const char *TAG = "task_profiler";
+
+#define TASK_PROFILER_MAX_TASKS     40
+#define TASK_PROFILER_NAME_LEN      (configMAX_TASK_NAME_LEN - 1)
+#define TASK_PROFILER_HEADER_LEN    (12 + 2 * portNUM_PROCESSORS)
+#define TASK_PROFILER_ENTRY_LEN     (1 + TASK_PROFILER_NAME_LEN + 1 + 1 + 2 + 2)
+#define TASK_PROFILER_FRAME_LEN     (TASK_PROFILER_HEADER_LEN + TASK_PROFILER_MAX_TASKS * TASK_PROFILER_ENTRY_LEN)
+#define TASK_PROFILER_LINE_PREFIX   "TPROF:"
+#define TASK_PROFILER_LINE_LEN      (sizeof(TASK_PROFILER_LINE_PREFIX) + (TASK_PROFILER_FRAME_LEN + 2) / 3 * 4 + 1)
+
+/* 32 or 64 bit depending on CONFIG_FREERTOS_RUN_TIME_COUNTER_TYPE */
+typedef __typeof__(((TaskStatus_t *)0)->ulRunTimeCounter) task_profiler_count_t;
+
+typedef struct {
+    TaskHandle_t handle;
+    task_profiler_count_t run;
+} task_profiler_prev_t;
+
+/* Only the profiler task touches these, they are static to keep its stack small */
+static struct {
+    TaskStatus_t status[TASK_PROFILER_MAX_TASKS];
+    task_profiler_prev_t prev[TASK_PROFILER_MAX_TASKS];
+    size_t prev_count;
+    task_profiler_count_t prev_total;
+    bool primed;                /* the first sample only sets the baseline */
+    uint32_t seq;
+    uint8_t frame[TASK_PROFILER_FRAME_LEN];
+    char line[TASK_PROFILER_LINE_LEN];
+} s_prof;
+
+static uint8_t *task_profiler_put16(uint8_t *p, uint32_t v)
+{
+    v = v > UINT16_MAX ? UINT16_MAX : v;
+    *p++ = v & 0xff;
+    *p++ = v >> 8;
+    return p;
+}
+
+static uint8_t *task_profiler_put32(uint8_t *p, uint32_t v)
+{
+    p = task_profiler_put16(p, v & 0xffff);
+    return task_profiler_put16(p, v >> 16);
+}
+
+static size_t task_profiler_base64(const uint8_t *in, size_t len, char *out)
+{
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    char *p = out;
+
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = in[i] << 16;
+        v |= i + 1 < len ? in[i + 1] << 8 : 0;
+        v |= i + 2 < len ? in[i + 2] : 0;
+        *p++ = digits[(v >> 18) & 0x3f];
+        *p++ = digits[(v >> 12) & 0x3f];
+        *p++ = i + 1 < len ? digits[(v >> 6) & 0x3f] : '=';
+        *p++ = i + 2 < len ? digits[v & 0x3f] : '=';
+    }
+    return p - out;
+}
+
+static uint8_t task_profiler_core(TaskHandle_t handle)
+{
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+    BaseType_t core = xTaskGetCoreID(handle);
+#else
+    BaseType_t core = xTaskGetAffinity(handle);
+#endif
+    return core >= 0 && core < portNUM_PROCESSORS ? core : TASK_PROFILER_ANY_CORE;
+}
+
+/* Run time since the last sample; tasks created since then are charged what they ran, at most the window */
+static task_profiler_count_t task_profiler_delta(const TaskStatus_t *status, task_profiler_count_t window)
+{
+    for (size_t i = 0; i < s_prof.prev_count; i++) {
+        if (s_prof.prev[i].handle == status->xHandle) {
+            return status->ulRunTimeCounter - s_prof.prev[i].run;
+        }
+    }
+    return status->ulRunTimeCounter < window ? status->ulRunTimeCounter : window;
+}
+
+static uint32_t task_profiler_permille(task_profiler_count_t part, task_profiler_count_t whole)
+{
+    return whole ? (uint32_t)(((uint64_t)part * 1000 + whole / 2) / whole) : 0;
+}
+
+static void task_profiler_sample(void)
+{
+    task_profiler_count_t total = 0;
+    UBaseType_t count = uxTaskGetSystemState(s_prof.status, TASK_PROFILER_MAX_TASKS, &total);
+    if (0 == count) {
+        ESP_LOGW(TAG, "more than %d tasks, snapshot skipped", TASK_PROFILER_MAX_TASKS);
+        return;
+    }
+
+    task_profiler_count_t window = total - s_prof.prev_total;
+    task_profiler_count_t idle[portNUM_PROCESSORS] = { 0 };
+    uint8_t *p = s_prof.frame + TASK_PROFILER_HEADER_LEN;
+
+    for (UBaseType_t i = 0; i < count; i++) {
+        const TaskStatus_t *status = &s_prof.status[i];
+        task_profiler_count_t delta = task_profiler_delta(status, window);
+        uint8_t core = task_profiler_core(status->xHandle);
+        size_t name_len = strnlen(status->pcTaskName, TASK_PROFILER_NAME_LEN);
+
+        /* The idle tasks are pinned and named IDLE or IDLE<core> depending on the IDF version */
+        if (0 == strncmp(status->pcTaskName, "IDLE", 4) && TASK_PROFILER_ANY_CORE != core) {
+            idle[core] += delta;
+        }
+
+        *p++ = name_len;
+        memcpy(p, status->pcTaskName, name_len);
+        p += name_len;
+        *p++ = core;
+        *p++ = status->uxCurrentPriority;
+        p = task_profiler_put16(p, task_profiler_permille(delta, window));
+        p = task_profiler_put16(p, status->usStackHighWaterMark);
+    }
+
+    uint8_t *h = s_prof.frame;
+    *h++ = TASK_PROFILER_MAGIC;
+    *h++ = TASK_PROFILER_VERSION;
+    *h++ = portNUM_PROCESSORS;
+    *h++ = count;
+    h = task_profiler_put32(h, s_prof.seq);
+    h = task_profiler_put32(h, window);
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        uint32_t idle_permille = task_profiler_permille(idle[core], window);
+        h = task_profiler_put16(h, idle_permille < 1000 ? 1000 - idle_permille : 0);
+    }
+
+    for (UBaseType_t i = 0; i < count; i++) {
+        s_prof.prev[i].handle = s_prof.status[i].xHandle;
+        s_prof.prev[i].run = s_prof.status[i].ulRunTimeCounter;
+    }
+    s_prof.prev_count = count;
+    s_prof.prev_total = total;
+    if (!s_prof.primed) {
+        s_prof.primed = true;
+        return;
+    }
+
+    /* One write per line so other tasks' logs cannot split it */
+    size_t n = strlen(TASK_PROFILER_LINE_PREFIX);
+    memcpy(s_prof.line, TASK_PROFILER_LINE_PREFIX, n);
+    n += task_profiler_base64(s_prof.frame, p - s_prof.frame, s_prof.line + n);
+    s_prof.line[n++] = '\n';
+    s_prof.line[n] = '\0';
+    fputs(s_prof.line, stdout);
+    fflush(stdout);
+    s_prof.seq++;
+}
+
+static void task_profiler_task(void *arg)
+{
+    TickType_t last_wake = xTaskGetTickCount();
+
+    task_profiler_sample();
+    while (true) {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(CONFIG_TASK_PROFILER_INTERVAL_MS));
+        task_profiler_sample();
+    }
+}
+
+esp_err_t task_profiler_start(void)
+{
+    /* Low priority and unpinned, so it measures the others rather than competing with them */
+    if (pdPASS != xTaskCreate(&task_profiler_task, "Profiler Task", 3 * 1024, NULL, 1, NULL)) {
+        ESP_LOGE(TAG, "Failed create profiler task");
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "profiling every %d ms", CONFIG_TASK_PROFILER_INTERVAL_MS);
+    return ESP_OK;
+}
+
+#else
+
+esp_err_t task_profiler_start(void)
+{
+    return ESP_OK;
+}
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * Periodic CPU and stack profile of every task, streamed over the console
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Every CONFIG_TASK_PROFILER_INTERVAL_MS one snapshot is printed as a single
+ * line "TPROF:<base64>\n" so it survives next to the log and is easy to pick
+ * out of a capture. tools/task_profile.py decodes and plots it.
+ *
+ * Decoded snapshot, all fields little endian:
+ *
+ *   u8  magic         TASK_PROFILER_MAGIC
+ *   u8  version       TASK_PROFILER_VERSION
+ *   u8  cores
+ *   u8  tasks
+ *   u32 seq           increments every snapshot, gaps mean lost lines
+ *   u32 window_us     run time covered by this snapshot
+ *   u16 load[cores]   per-core load, 1/1000 of the window
+ *
+ * then `tasks` times:
+ *
+ *   u8  name_len, name_len bytes of name (no terminator)
+ *   u8  core          pinned core, 0xff if the task may run on any
+ *   u8  priority      current priority
+ *   u16 cpu           share of one core, 1/1000 of the window
+ *   u16 stack_free    stack high-water mark in bytes, saturates at 0xffff
+ */
+#define TASK_PROFILER_MAGIC     0x54
+#define TASK_PROFILER_VERSION   1
+#define TASK_PROFILER_ANY_CORE  0xff
+
+/**
+ * @brief Start the profiler task when CONFIG_TASK_PROFILER is enabled, does nothing otherwise
+ */
+esp_err_t task_profiler_start(void);
+
+#ifdef __cplusplus
+}
+#endif
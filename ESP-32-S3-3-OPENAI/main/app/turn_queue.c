@@ -0,0 +1,135 @@
+/*
+ * Bounded queue of voice queries recorded while offline
+ *
+ * Wake word detection keeps running while Wi-Fi reconnects, so a child can
+ * ask something the box cannot send yet. The encoded recording waits here
+ * until the link is back and is then delivered one turn at a time. Both the
+ * number of turns and their total size are capped, PSRAM is shared with the
+ * recorder.
+ */
+
+#include "turn_queue.h"
+
+static turn_queue_item_t *turn_queue_at(turn_queue_t *q, size_t i)
+{
+    return &q->item[(q->head + i) % TURN_QUEUE_MAX];
+}
+
+/* Removes the oldest turn and frees its data */
+static void turn_queue_drop(turn_queue_t *q)
+{
+    turn_queue_item_t item;
+    if (turn_queue_take(q, &item) && q->release) {
+        q->release(item.data);
+    }
+}
+
+void turn_queue_init(turn_queue_t *q, size_t max_items, size_t max_bytes, turn_queue_release_t release)
+{
+    q->head = 0;
+    q->count = 0;
+    q->bytes = 0;
+    q->max_items = max_items < TURN_QUEUE_MAX ? max_items : TURN_QUEUE_MAX;
+    q->max_bytes = max_bytes;
+    q->next_id = 0;
+    q->release = release;
+}
+
+size_t turn_queue_push(turn_queue_t *q, uint8_t *data, size_t len, const char *mime_type)
+{
+    if (0 == q->max_items || len > q->max_bytes) {
+        if (q->release) {
+            q->release(data);
+        }
+        return 1;
+    }
+
+    size_t dropped = 0;
+    while (q->count >= q->max_items || q->bytes + len > q->max_bytes) {
+        turn_queue_drop(q);
+        dropped++;
+    }
+    *turn_queue_at(q, q->count) = (turn_queue_item_t) {
+        .data = data,
+        .len = len,
+        .mime_type = mime_type,
+        .id = q->next_id++,
+    };
+    q->count++;
+    q->bytes += len;
+    return dropped;
+}
+
+bool turn_queue_take(turn_queue_t *q, turn_queue_item_t *item)
+{
+    if (0 == q->count) {
+        return false;
+    }
+    *item = *turn_queue_at(q, 0);
+    q->head = (q->head + 1) % TURN_QUEUE_MAX;
+    q->count--;
+    q->bytes -= item->len;
+    return true;
+}
+
+bool turn_queue_return(turn_queue_t *q, const turn_queue_item_t *item)
+{
+    if (q->count >= q->max_items || q->bytes + item->len > q->max_bytes) {
+        if (q->release) {
+            q->release(item->data);
+        }
+        return false;
+    }
+    q->head = (q->head + TURN_QUEUE_MAX - 1) % TURN_QUEUE_MAX;
+    *turn_queue_at(q, 0) = *item;
+    q->count++;
+    q->bytes += item->len;
+    return true;
+}
+
+size_t turn_queue_len(const turn_queue_t *q)
+{
+    return q->count;
+}
+
+static void turn_queue_lock(const turn_queue_link_t *link)
+{
+    if (link->lock) {
+        link->lock(link->ctx);
+    }
+}
+
+static void turn_queue_unlock(const turn_queue_link_t *link)
+{
+    if (link->unlock) {
+        link->unlock(link->ctx);
+    }
+}
+
+size_t turn_queue_drain(turn_queue_t *q, const turn_queue_link_t *link)
+{
+    turn_queue_item_t item;
+    size_t sent = 0;
+
+    while (link->link_up(link->ctx)) {
+        turn_queue_lock(link);
+        bool found = turn_queue_take(q, &item);
+        turn_queue_unlock(link);
+        if (!found) {
+            break;
+        }
+
+        if (!link->send(&item, link->ctx)) {
+            turn_queue_lock(link);
+            turn_queue_return(q, &item);
+            turn_queue_unlock(link);
+            break;
+        }
+        /* Answered, or refused by the server, which sending again would not change */
+        if (q->release) {
+            q->release(item.data);
+        }
+        sent++;
+    }
+    return sent;
+}
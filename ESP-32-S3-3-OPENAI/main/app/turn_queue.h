@@ -0,0 +1,99 @@
+/*
+ * Bounded queue of voice queries recorded while offline
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TURN_QUEUE_MAX          16
+
+typedef struct {
+    uint8_t *data;              /* encoded recording, owned by the queue while queued */
+    size_t len;
+    const char *mime_type;      /* static string of the codec */
+    uint32_t id;                /* order the turns were recorded in */
+} turn_queue_item_t;
+
+typedef void (*turn_queue_release_t)(uint8_t *data);
+
+/*
+ * Turns leave in the order they were recorded. When a new one does not fit
+ * the oldest are dropped, a child's latest question matters most. Nothing
+ * here depends on FreeRTOS, the caller serializes access (turn_queue_drain()
+ * through the lock callbacks it is given).
+ */
+typedef struct {
+    turn_queue_item_t item[TURN_QUEUE_MAX];
+    size_t head;
+    size_t count;
+    size_t bytes;
+    size_t max_items;
+    size_t max_bytes;
+    uint32_t next_id;
+    turn_queue_release_t release;
+} turn_queue_t;
+
+/**
+ * @brief Start empty, at most `max_items` (up to TURN_QUEUE_MAX) turns of `max_bytes` in total
+ *
+ * @param release Frees the data of dropped turns
+ */
+void turn_queue_init(turn_queue_t *q, size_t max_items, size_t max_bytes, turn_queue_release_t release);
+
+/**
+ * @brief Queue a turn, the queue owns `data` from now on even if it is dropped
+ *
+ * @return Number of turns dropped to make room, the new one included if it can never fit
+ */
+size_t turn_queue_push(turn_queue_t *q, uint8_t *data, size_t len, const char *mime_type);
+
+/**
+ * @brief Take the oldest turn out, the caller owns its data
+ *
+ * @return false if the queue is empty
+ */
+bool turn_queue_take(turn_queue_t *q, turn_queue_item_t *item);
+
+/**
+ * @brief Put a turn that could not be delivered back in front, or drop it if newer turns took its room
+ *
+ * @return false if it was dropped
+ */
+bool turn_queue_return(turn_queue_t *q, const turn_queue_item_t *item);
+
+/** Turns waiting */
+size_t turn_queue_len(const turn_queue_t *q);
+
+/* How turn_queue_drain() reaches the link and the caller's lock */
+typedef struct {
+    bool (*link_up)(void *ctx);
+    /* Deliver a turn; false if the link went down and it has to be sent again */
+    bool (*send)(const turn_queue_item_t *item, void *ctx);
+    /* Around every access to the queue, may be NULL */
+    void (*lock)(void *ctx);
+    void (*unlock)(void *ctx);
+    void *ctx;
+} turn_queue_link_t;
+
+/**
+ * @brief Deliver queued turns, oldest first and one at a time, for as long as the link is up
+ *
+ * A turn whose send failed because the link went down goes back in front and
+ * the drain stops until the caller runs it again, at the next address. The
+ * queue is only locked while a turn is taken out or put back, never during a
+ * send, so turns can be queued meanwhile.
+ *
+ * @return Number of turns delivered
+ */
+size_t turn_queue_drain(turn_queue_t *q, const turn_queue_link_t *link);
+
+#ifdef __cplusplus
+}
+#endif
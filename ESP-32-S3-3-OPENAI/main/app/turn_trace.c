@@ -0,0 +1,189 @@
+/*
+ * Per-phase latency trace of a voice turn
+ *
+ * Every module of the turn stamps its phase; the finished turn is logged as
+ * one line of millisecond offsets from the wake word. The last
+ * CONFIG_TURN_TRACE_WINDOW turns are kept relative to the end of speech,
+ * which is what the child actually waits through, for the p50/p95 summary.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "turn_trace.h"
+
+static const char *TAG = "turn_trace";
+
+#if CONFIG_TURN_TRACE
+
+#define TURN_TRACE_NONE     INT32_MIN
+
+static const char *const s_phase_name[TURN_PHASE_MAX] = {
+    [TURN_PHASE_WAKE] = "wake",
+    [TURN_PHASE_BARGE_IN] = "barge_in",
+    [TURN_PHASE_VAD_END] = "vad_end",
+    [TURN_PHASE_RECORD_STOP] = "rec_stop",
+    [TURN_PHASE_WAV_DONE] = "wav",
+    [TURN_PHASE_ENCODE_DONE] = "encode",
+    [TURN_PHASE_CONNECTED] = "connect",
+    [TURN_PHASE_UPLOAD_DONE] = "upload",
+    [TURN_PHASE_FIRST_BYTE] = "first_byte",
+    [TURN_PHASE_PARSE_DONE] = "parse",
+    [TURN_PHASE_FIRST_PAINT] = "paint",
+    [TURN_PHASE_PLAYBACK] = "play",
+};
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static turn_trace_t s_turn;
+static bool s_open = false;
+static uint32_t s_next_id = 0;
+
+/* Milliseconds from VAD end of the last turns, TURN_TRACE_NONE where a phase was not reached */
+static int32_t s_window[CONFIG_TURN_TRACE_WINDOW][TURN_PHASE_MAX];
+static uint32_t s_window_count = 0;
+
+void turn_trace_begin(void)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_lock);
+    memset(&s_turn, 0, sizeof(s_turn));
+    s_turn.id = ++s_next_id;
+    s_turn.stamp[TURN_PHASE_WAKE] = now;
+    s_open = true;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void turn_trace_mark(turn_phase_t phase)
+{
+    if (phase >= TURN_PHASE_MAX) {
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_lock);
+    if (s_open && 0 == s_turn.stamp[phase]) {
+        s_turn.stamp[phase] = now;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void turn_trace_endpoint(const char *reason)
+{
+    turn_trace_mark(TURN_PHASE_VAD_END);
+
+    portENTER_CRITICAL(&s_lock);
+    if (s_open && NULL == s_turn.endpoint) {
+        s_turn.endpoint = reason;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void turn_trace_end(const char *result)
+{
+    turn_trace_t turn;
+
+    portENTER_CRITICAL(&s_lock);
+    bool open = s_open;
+    turn = s_turn;
+    s_open = false;
+    portEXIT_CRITICAL(&s_lock);
+    if (!open) {
+        return;
+    }
+
+    char line[256];
+    int len = snprintf(line, sizeof(line), "turn #%u %s:", (unsigned)turn.id, result ? result : "?");
+    if (turn.endpoint) {
+        len += snprintf(line + len, sizeof(line) - len, " endpoint=%s", turn.endpoint);
+    }
+    for (int i = TURN_PHASE_WAKE + 1; i < TURN_PHASE_MAX && len < (int)sizeof(line); i++) {
+        if (turn.stamp[i]) {
+            len += snprintf(line + len, sizeof(line) - len, " %s=%d", s_phase_name[i],
+                            (int)((turn.stamp[i] - turn.stamp[TURN_PHASE_WAKE]) / 1000));
+        } else {
+            len += snprintf(line + len, sizeof(line) - len, " %s=-", s_phase_name[i]);
+        }
+    }
+    ESP_LOGI(TAG, "%s", line);
+
+    /* Turns without an end of speech (commands, aborts) say nothing about reply latency */
+    int64_t ref = turn.stamp[TURN_PHASE_VAD_END];
+    if (0 == ref) {
+        return;
+    }
+    int32_t *slot = s_window[s_window_count % CONFIG_TURN_TRACE_WINDOW];
+    for (int i = 0; i < TURN_PHASE_MAX; i++) {
+        /* Barge-in is about how fast playback stops, counted from the wake word */
+        int64_t from = TURN_PHASE_BARGE_IN == i ? turn.stamp[TURN_PHASE_WAKE] : ref;
+        slot[i] = turn.stamp[i] ? (int32_t)((turn.stamp[i] - from) / 1000) : TURN_TRACE_NONE;
+    }
+    s_window_count++;
+
+#if CONFIG_TURN_TRACE_SUMMARY_INTERVAL
+    if (0 == s_window_count % CONFIG_TURN_TRACE_SUMMARY_INTERVAL) {
+        turn_trace_print_summary();
+    }
+#endif
+}
+
+void turn_trace_print_summary(void)
+{
+    int32_t values[CONFIG_TURN_TRACE_WINDOW];
+    uint32_t turns = s_window_count < CONFIG_TURN_TRACE_WINDOW ? s_window_count : CONFIG_TURN_TRACE_WINDOW;
+
+    ESP_LOGI(TAG, "last %u turns, ms from end of speech, barge_in from the wake word (p50/p95):", (unsigned)turns);
+    for (int phase = 0; phase < TURN_PHASE_MAX; phase++) {
+        if (TURN_PHASE_VAD_END == phase) {
+            continue;
+        }
+        uint32_t n = 0;
+        for (uint32_t t = 0; t < turns; t++) {
+            int32_t v = s_window[t][phase];
+            if (TURN_TRACE_NONE == v) {
+                continue;
+            }
+            /* Insertion sort, the window is small */
+            uint32_t j = n++;
+            while (j > 0 && values[j - 1] > v) {
+                values[j] = values[j - 1];
+                j--;
+            }
+            values[j] = v;
+        }
+        if (n) {
+            ESP_LOGI(TAG, "  %-10s %6d %6d  (%u)", s_phase_name[phase], (int)values[(n - 1) / 2],
+                     (int)values[(n * 95 + 99) / 100 - 1], (unsigned)n);
+        }
+    }
+}
+
+#else
+
+void turn_trace_begin(void)
+{
+}
+
+void turn_trace_mark(turn_phase_t phase)
+{
+}
+
+void turn_trace_endpoint(const char *reason)
+{
+}
+
+void turn_trace_end(const char *result)
+{
+}
+
+void turn_trace_print_summary(void)
+{
+    ESP_LOGW(TAG, "turn tracing is disabled");
+}
+
+#endif
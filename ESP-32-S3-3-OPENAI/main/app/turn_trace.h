@@ -0,0 +1,74 @@
+/*
+ * Per-phase latency trace of a voice turn
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Phases of one turn, in the order they usually happen */
+typedef enum {
+    TURN_PHASE_WAKE = 0,        /* wake word detected */
+    TURN_PHASE_BARGE_IN,        /* a sound still playing, or a turn waiting for its answer, was stopped for the wake word */
+    TURN_PHASE_VAD_END,         /* endpointer declared end of speech */
+    TURN_PHASE_RECORD_STOP,     /* recording stopped */
+    TURN_PHASE_WAV_DONE,        /* part of the recording to upload is known */
+    TURN_PHASE_ENCODE_DONE,     /* upload codec finished the last block */
+    TURN_PHASE_CONNECTED,       /* DNS, TCP and TLS done (new connections only) */
+    TURN_PHASE_UPLOAD_DONE,     /* last byte of the request body written */
+    TURN_PHASE_FIRST_BYTE,      /* response headers received */
+    TURN_PHASE_PARSE_DONE,      /* reply fully read and parsed */
+    TURN_PHASE_FIRST_PAINT,     /* reply text first handed to the display */
+    TURN_PHASE_PLAYBACK,        /* first audio playback of the turn started */
+    TURN_PHASE_MAX,
+} turn_phase_t;
+
+/* Stamps of one turn, in microseconds from esp_timer_get_time(), 0 if not reached */
+typedef struct {
+    uint32_t id;
+    int64_t stamp[TURN_PHASE_MAX];
+    const char *endpoint;       /* why the endpointer ended speech, NULL if it did not */
+} turn_trace_t;
+
+/**
+ * @brief Start tracing a new turn, stamping TURN_PHASE_WAKE
+ *
+ * A turn still open is dropped without being reported.
+ */
+void turn_trace_begin(void);
+
+/**
+ * @brief Stamp a phase of the current turn, from any task
+ *
+ * Only the first stamp of a phase counts, so retries keep the earliest time.
+ * Does nothing when no turn is open.
+ */
+void turn_trace_mark(turn_phase_t phase);
+
+/**
+ * @brief Stamp TURN_PHASE_VAD_END and keep the endpointer's reason for the log
+ *
+ * @param reason Static string, e.g. "hangover"
+ */
+void turn_trace_endpoint(const char *reason);
+
+/**
+ * @brief Close the current turn, log it as one line and add it to the summary
+ *
+ * @param result Short outcome shown in the log, e.g. "ok", "error", "command"
+ */
+void turn_trace_end(const char *result);
+
+/**
+ * @brief Log p50/p95 of every phase over the last CONFIG_TURN_TRACE_WINDOW turns
+ */
+void turn_trace_print_summary(void);
+
+#ifdef __cplusplus
+}
+#endif
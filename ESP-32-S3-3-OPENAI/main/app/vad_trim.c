@@ -0,0 +1,47 @@
+/*
+ * Speech window of a recording from VAD state changes
+ *
+ * The endpointer only ends a turn after a long stretch of silence, and the
+ * recording starts before the child does, so both ends of every recording are
+ * mostly silence. Tracking where speech started and last stopped lets the
+ * uploader cut those off and still keep a margin for soft onsets and tails.
+ */
+
+#include "vad_trim.h"
+
+void vad_trim_reset(vad_trim_t *trim, uint32_t margin)
+{
+    trim->margin = margin;
+    trim->heard = false;
+    trim->speaking = false;
+    trim->first = 0;
+    trim->last = 0;
+}
+
+void vad_trim_update(vad_trim_t *trim, bool speech, uint32_t pos)
+{
+    if (speech) {
+        if (!trim->heard) {
+            trim->heard = true;
+            trim->first = pos;
+        }
+        trim->speaking = true;
+    } else if (trim->speaking) {
+        trim->speaking = false;
+        trim->last = pos;
+    }
+}
+
+bool vad_trim_window(const vad_trim_t *trim, uint32_t *begin, uint32_t *end)
+{
+    if (!trim->heard) {
+        return false;
+    }
+    *begin = trim->first > trim->margin ? trim->first - trim->margin : 0;
+    if (trim->speaking || trim->last > UINT32_MAX - trim->margin) {
+        *end = UINT32_MAX;
+    } else {
+        *end = trim->last + trim->margin;
+    }
+    return true;
+}
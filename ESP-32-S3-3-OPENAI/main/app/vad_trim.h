@@ -0,0 +1,48 @@
+/*
+ * Speech window of a recording from VAD state changes
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Positions are in any monotonic unit the caller chooses (the feed ring's
+ * frame sequence numbers on the device). Nothing here depends on FreeRTOS,
+ * so the logic builds and runs on a host as it is.
+ */
+typedef struct {
+    uint32_t margin;        /* kept before the first and after the last speech */
+    bool heard;             /* speech was seen since the last reset */
+    bool speaking;          /* the VAD currently reports speech */
+    uint32_t first;         /* position speech was first seen */
+    uint32_t last;          /* position the latest speech ended, valid if !speaking */
+} vad_trim_t;
+
+/**
+ * @brief Forget all speech, at the start of a turn
+ */
+void vad_trim_reset(vad_trim_t *trim, uint32_t margin);
+
+/**
+ * @brief Report the VAD state at `pos`, repeating an unchanged state is fine
+ */
+void vad_trim_update(vad_trim_t *trim, bool speech, uint32_t pos);
+
+/**
+ * @brief Get the window worth keeping, [first speech - margin, last speech + margin)
+ *
+ * @param[out] begin Start of the window, never below 0
+ * @param[out] end End of the window, UINT32_MAX while speech is still going on
+ * @return false if no speech was heard, the caller then keeps everything
+ */
+bool vad_trim_window(const vad_trim_t *trim, uint32_t *begin, uint32_t *end);
+
+#ifdef __cplusplus
+}
+#endif
@@ -8,6 +8,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/semphr.h"
 #include "esp_system.h"
 #include "esp_log.h"
 #include "esp_check.h"
@@ -24,6 +25,9 @@
 #include "app_wifi.h"
 #include "settings.h"
 #include "gemini.h"
+#include "turn_trace.h"
+#include "task_profiler.h"
+#include "sr_cmd.h"
 
 #define SCROLL_START_DELAY_S            (1.5)
 #define LISTEN_SPEAK_PANEL_DELAY_MS     2000
@@ -34,18 +38,63 @@
 
 static char *TAG = "app_main";
 static sys_param_t *sys_param = NULL;
+gemini_client_t *g_gemini_client = NULL;
+/* Copy of the last reply for the "repeat" command, the client reuses its buffer every turn */
+static char *s_last_reply = NULL;
+static SemaphoreHandle_t s_last_reply_lock = NULL;
+
+#if CONFIG_GEMINI_STREAM_REPLY
+/* Called for every text delta of a streamed reply, shows the reply while it is generated */
+static void reply_partial_cb(const char *delta, size_t delta_len, const char *text, void *user_ctx)
+{
+    bool *reply_shown = (bool *)user_ctx;
 
-/* program flow. This function is called in app_audio.c */
-esp_err_t start_openai(uint8_t *audio, int audio_len)
+    ui_ctrl_label_show_text(UI_CTRL_LABEL_REPLY_CONTENT, text);
+    if (!*reply_shown) {
+        ui_ctrl_label_show_text(UI_CTRL_LABEL_REPLY_QUESTION, "Voice Query");
+        ui_ctrl_show_panel(UI_CTRL_PANEL_REPLY, 0);
+        *reply_shown = true;
+    }
+}
+#endif
+
+static void keep_reply(const char *response)
 {
-    esp_err_t ret = ESP_OK;
-    char *response = NULL;
+    size_t len = strlen(response) + 1;
+
+    xSemaphoreTake(s_last_reply_lock, portMAX_DELAY);
+    char *copy = heap_caps_realloc(s_last_reply, len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (copy) {
+        memcpy(copy, response, len);
+        s_last_reply = copy;
+    } else {
+        ESP_LOGW(TAG, "reply not kept for repeat");
+    }
+    xSemaphoreGive(s_last_reply_lock);
+}
 
-    ui_ctrl_show_panel(UI_CTRL_PANEL_GET, 0);
+/* Commands recognized on the device, app_audio.c already handled the volume */
+static void command_cb(int command_id)
+{
+    if (SR_CMD_REPEAT != command_id) {
+        return;
+    }
+    xSemaphoreTake(s_last_reply_lock, portMAX_DELAY);
+    if (s_last_reply) {
+        ui_ctrl_label_show_text(UI_CTRL_LABEL_REPLY_CONTENT, s_last_reply);
+        ui_ctrl_show_panel(UI_CTRL_PANEL_REPLY, 0);
+        ui_ctrl_reply_set_audio_start_flag(true);
+        ui_ctrl_reply_set_audio_end_flag(true);
+    } else {
+        ESP_LOGI(TAG, "nothing to repeat");
+    }
+    xSemaphoreGive(s_last_reply_lock);
+}
 
-    // Gemini Multimodal Query (Transcription + Chat)
-    gemini_init(sys_param->gemini_key);
-    response = gemini_audio_query(audio, audio_len);
+/* Shows the reply of a voice query (or the failure) */
+static esp_err_t show_reply(const char *response, bool reply_shown)
+{
+    esp_err_t ret = ESP_OK;
 
     if (NULL == response) {
         ret = ESP_ERR_INVALID_RESPONSE;
@@ -56,25 +105,79 @@ esp_err_t start_openai(uint8_t *audio, int audio_len)
     }
 
     // UI display success
-    ui_ctrl_label_show_text(UI_CTRL_LABEL_REPLY_QUESTION, "Voice Query"); // Gemini doesn't return separate text transcription in this simple flow
     ui_ctrl_label_show_text(UI_CTRL_LABEL_LISTEN_SPEAK, response);
-    ui_ctrl_label_show_text(UI_CTRL_LABEL_REPLY_CONTENT, response);
-    ui_ctrl_show_panel(UI_CTRL_PANEL_REPLY, 0);
+    if (!reply_shown) {
+        ui_ctrl_label_show_text(UI_CTRL_LABEL_REPLY_QUESTION, "Voice Query"); // Gemini doesn't return separate text transcription in this simple flow
+        ui_ctrl_label_show_text(UI_CTRL_LABEL_REPLY_CONTENT, response);
+        ui_ctrl_show_panel(UI_CTRL_PANEL_REPLY, 0);
+    }
+
+    keep_reply(response);
 
-    // TODO: Implement Google TTS or Gemini Speech if desired. 
-    // For now, only text response is shown to fulfill "everything from gemini".
-    
     vTaskDelay(pdMS_TO_TICKS(SCROLL_START_DELAY_S * 1000));
-    ui_ctrl_reply_set_audio_start_flag(true);
-    ui_ctrl_reply_set_audio_end_flag(true);
+    /* Talked over meanwhile, the reply is not scrolled under the new turn */
+    if (!gemini_cancelled(g_gemini_client)) {
+        ui_ctrl_reply_set_audio_start_flag(true);
+        ui_ctrl_reply_set_audio_end_flag(true);
+    }
 
 err:
-    if (response) {
-        free(response);
-    }
     return ret;
 }
 
+/* program flow. This function is called in app_audio.c with the encoded recording */
+esp_err_t start_openai(const uint8_t *upload, size_t upload_len, const char *mime_type)
+{
+    const char *response = NULL;
+    bool reply_shown = false;
+    esp_err_t ret = ESP_OK;
+
+    ui_ctrl_show_panel(UI_CTRL_PANEL_GET, 0);
+
+    // Gemini Multimodal Query (Transcription + Chat)
+#if CONFIG_GEMINI_STREAM_REPLY
+    response = gemini_audio_query_stream(g_gemini_client, upload, upload_len, mime_type, reply_partial_cb, &reply_shown);
+#else
+    response = gemini_audio_query(g_gemini_client, upload, upload_len, mime_type);
+#endif
+
+    /* Given up on for a new turn, which owns the display now */
+    ret = gemini_cancelled(g_gemini_client) ? ESP_ERR_INVALID_STATE : show_reply(response, reply_shown);
+    gemini_turn_end(g_gemini_client);
+    return ret;
+}
+
+#if CONFIG_GEMINI_PIPELINED_UPLOAD
+static bool s_upload_reply_shown = false;
+
+/* Opens the Gemini request at the wake word, app_audio.c streams the recording into it */
+esp_err_t start_openai_upload(const char *mime_type)
+{
+    s_upload_reply_shown = false;
+#if CONFIG_GEMINI_STREAM_REPLY
+    return gemini_upload_begin(g_gemini_client, mime_type, reply_partial_cb, &s_upload_reply_shown);
+#else
+    return gemini_upload_begin(g_gemini_client, mime_type, NULL, NULL);
+#endif
+}
+
+/*
+ * Completes the streamed request once recording stopped. Returns an error other
+ * than ESP_ERR_INVALID_RESPONSE if the query has to be sent again with start_openai.
+ */
+esp_err_t finish_openai_upload(void)
+{
+    const char *response = NULL;
+    esp_err_t ret = ESP_OK;
+
+    ui_ctrl_show_panel(UI_CTRL_PANEL_GET, 0);
+    ESP_RETURN_ON_ERROR(gemini_upload_finish(g_gemini_client, &response), TAG, "upload not delivered");
+    ret = gemini_cancelled(g_gemini_client) ? ESP_ERR_INVALID_STATE : show_reply(response, s_upload_reply_shown);
+    gemini_turn_end(g_gemini_client);
+    return ret;
+}
+#endif
+
 /* play audio function */
 
 static void audio_play_finish_cb(void)
@@ -96,6 +199,9 @@ void app_main()
     ESP_ERROR_CHECK(ret);
     ESP_ERROR_CHECK(settings_read_parameter_from_nvs());
     sys_param = settings_get_parameter();
+    if (ESP_OK != gemini_client_create(sys_param->gemini_key, &g_gemini_client)) {
+        ESP_LOGE(TAG, "Gemini client create failed");
+    }
 
     bsp_spiffs_mount();
     bsp_i2c_init();
@@ -111,9 +217,17 @@ void app_main()
     ui_ctrl_init();
     app_network_start();
 
+    s_last_reply_lock = xSemaphoreCreateMutex();
+    ESP_ERROR_CHECK(NULL == s_last_reply_lock ? ESP_ERR_NO_MEM : ESP_OK);
+
     ESP_LOGI(TAG, "speech recognition start");
     app_sr_start(false);
     audio_register_play_finish_cb(audio_play_finish_cb);
+    audio_register_command_cb(command_cb);
+
+    if (ESP_OK != task_profiler_start()) {
+        ESP_LOGW(TAG, "task profiler not started");
+    }
 
     while (true) {
 
@@ -0,0 +1,127 @@
+/*
+ * What the feed task spends building each AFE frame from the I2S frame
+ *
+ *   test/host/build/bench_afe_feed -n 100000 -c 512
+ *
+ * With CONFIG_SR_AEC=n the I2S read lands in the AFE input, nothing to time.
+ * The default build adds the playback reference as a third channel through
+ * aec_ref_feed(), timed here with the speaker silent and playing. The loop
+ * the feed task ran before the AFE took the "MM" layout, which expanded every
+ * frame in place with an all-zero reference, is timed next to it as the
+ * baseline. These are host numbers, the ratio between them is the better guide
+ * to the device; each is printed with its share of the frame's real time.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "aec_ref.h"
+
+#define MICS        2
+
+/* The feed task before the "MM" layout: the I2S read landed in `frame`, expanded in place, backwards, zero reference */
+static void feed_expand(int16_t *frame, const int16_t *mic, size_t samples)
+{
+    for (int i = samples - 1; i >= 0; i--) {
+        frame[i * 3 + 2] = 0;
+        frame[i * 3 + 1] = frame[i * 2 + 1];
+        frame[i * 3 + 0] = frame[i * 2 + 0];
+    }
+}
+
+static void feed_aec(int16_t *frame, const int16_t *mic, size_t samples)
+{
+    aec_ref_feed(frame, mic, MICS, samples);
+}
+
+/* Keeps one frame of reference in front of the feed, as the player does while a reply plays */
+static void play_frame(const int16_t *pcm, size_t samples)
+{
+    aec_ref_write(pcm, samples * sizeof(int16_t));
+}
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Nanoseconds per frame, the best of a few runs */
+static double bench(void (*feed)(int16_t *, const int16_t *, size_t), int16_t *frame, const int16_t *mic,
+                    const int16_t *pcm, size_t samples, int frames)
+{
+    double best = 0;
+    for (int run = 0; run < 5; run++) {
+        int64_t spent = 0;
+        for (int i = 0; i < frames; i++) {
+            if (pcm) {
+                play_frame(pcm, samples);
+            }
+            int64_t t = now_ns();
+            feed(frame, mic, samples);
+            spent += now_ns() - t;
+        }
+        double ns = (double)spent / frames;
+        best = 0 == run || ns < best ? ns : best;
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    int frames = 20000;
+    size_t samples = 512;
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "n:c:h"))) {
+        switch (opt) {
+        case 'n':
+            frames = atoi(optarg);
+            break;
+        case 'c':
+            samples = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n frames] [-c samples per frame]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (frames <= 0 || 0 == samples) {
+        return 2;
+    }
+
+    int16_t *mic = malloc(samples * MICS * sizeof(int16_t));
+    int16_t *frame = malloc(samples * (MICS + 1) * sizeof(int16_t));
+    int16_t *pcm = malloc(samples * sizeof(int16_t));
+    for (size_t i = 0; i < samples * MICS; i++) {
+        mic[i] = rand();
+    }
+    for (size_t i = 0; i < samples; i++) {
+        pcm[i] = rand();
+    }
+    aec_ref_set_format(AEC_REF_RATE, 16, 1);
+    if (NULL == mic || NULL == frame || NULL == pcm || ESP_OK != aec_ref_init(AEC_REF_RATE / 2)) {
+        return 1;
+    }
+
+    double budget_ns = samples * 1e9 / AEC_REF_RATE;
+    double expand = bench(feed_expand, frame, mic, NULL, samples, frames);
+    double silent = bench(feed_aec, frame, mic, NULL, samples, frames);
+    double playing = bench(feed_aec, frame, mic, pcm, samples, frames);
+
+    printf("%d frames of %zu samples, %.1f ms each\n", frames, samples, budget_ns / 1e6);
+    printf("%-28s %8.0f ns/frame  %.4f%% of real time\n", "expand in place (old loop)", expand,
+           100 * expand / budget_ns);
+    printf("%-28s %8.0f ns/frame  %.4f%% of real time  %.2fx the old loop\n", "aec_ref_feed, silent", silent,
+           100 * silent / budget_ns, silent / expand);
+    printf("%-28s %8.0f ns/frame  %.4f%% of real time  %.2fx the old loop\n", "aec_ref_feed, playing", playing,
+           100 * playing / budget_ns, playing / expand);
+
+    free(mic);
+    free(frame);
+    free(pcm);
+    return 0;
+}
@@ -0,0 +1,310 @@
+/*
+ * N turns of gemini.c against a local server, over the POSIX esp_http_client
+ *
+ *   python tools/mock_gemini.py --latency-ms 300 --upload-kbps 1000 -- \
+ *       test/host/build/bench_gemini -n 20 -m mixed
+ *
+ * Every turn replays a WAV from spiffs/ at real-time pace, encoded with the
+ * upload codec, and sends it the way the device would (-m query: one buffered
+ * request once the child stopped talking, stream: the same with the reply
+ * streamed, upload: chunked, every block as soon as it was "recorded", mixed:
+ * upload and query taking turns on one connection). Latency counts from the
+ * end of speech, which for an upload is when its last block became
+ * available, so the modes show how much of the upload left that path.
+ * Throughput, the phases of the turn trace and peak memory are reported too.
+ * Exits non-zero if a turn failed, unless -k is given for runs with injected
+ * errors.
+ */
+
+#include <getopt.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "gemini.c"
+#include "audio_enc.h"
+#include "wav_file.h"
+
+typedef enum {
+    BENCH_QUERY,
+    BENCH_STREAM,
+    BENCH_UPLOAD,
+    BENCH_MIXED,
+} bench_mode_t;
+
+/* The recording a turn replays */
+typedef struct {
+    const audio_enc_t *enc;
+    const int16_t *pcm;
+    size_t samples;
+    uint32_t rate;
+    double speed;               /* pace, 1.0 is real time */
+    uint8_t *encoded;           /* whole stream, for the buffered modes */
+    size_t encoded_len;
+} bench_audio_t;
+
+typedef struct {
+    int64_t t_start;
+    int64_t t_speech_end;
+    int64_t t_first;            /* first reply text, 0 until then */
+    size_t peak_heap;
+} bench_turn_t;
+
+static size_t heap_in_use(void)
+{
+    return mallinfo2().uordblks;
+}
+
+static void bench_sample(bench_turn_t *turn)
+{
+    size_t used = heap_in_use();
+    if (used > turn->peak_heap) {
+        turn->peak_heap = used;
+    }
+}
+
+static void partial_cb(const char *delta, size_t delta_len, const char *text, void *user_ctx)
+{
+    bench_turn_t *turn = user_ctx;
+    if (0 == turn->t_first) {
+        turn->t_first = esp_timer_get_time();
+    }
+    bench_sample(turn);
+}
+
+/* When the first `samples` of the recording have been spoken */
+static int64_t bench_spoken_at(const bench_audio_t *audio, const bench_turn_t *turn, size_t samples)
+{
+    return turn->t_start + (int64_t)(samples * 1e6 / audio->rate / audio->speed);
+}
+
+static void bench_sleep_until(int64_t t)
+{
+    int64_t now = esp_timer_get_time();
+    if (t > now) {
+        usleep(t - now);
+    }
+}
+
+static const int16_t *bench_read(size_t index, size_t samples, void *user_ctx)
+{
+    return ((const bench_audio_t *)user_ctx)->pcm + index;
+}
+
+/* Encodes and writes every block once it was spoken, as the uploader task does */
+static esp_err_t bench_upload(gemini_client_t *client, const bench_audio_t *audio, bench_turn_t *turn)
+{
+    const audio_enc_t *enc = audio->enc;
+    size_t out_size = enc->block_max(AUDIO_ENC_BLOCK_SAMPLES);
+    uint8_t *out = malloc(out_size > AUDIO_ENC_HEADER_MAX ? out_size : AUDIO_ENC_HEADER_MAX);
+    size_t len = enc->header(audio->rate, 0, out);
+    esp_err_t ret = gemini_upload_write(client, out, len);
+
+    for (size_t pos = 0; ESP_OK == ret && pos < audio->samples; pos += AUDIO_ENC_BLOCK_SAMPLES) {
+        size_t n = audio->samples - pos < AUDIO_ENC_BLOCK_SAMPLES ? audio->samples - pos : AUDIO_ENC_BLOCK_SAMPLES;
+        bench_sleep_until(bench_spoken_at(audio, turn, pos + n));
+        if (pos + n == audio->samples) {
+            turn_trace_endpoint("bench");
+        }
+        ret = enc->block(audio->pcm + pos, n, pos, out, out_size, &len);
+        if (ESP_OK == ret) {
+            ret = gemini_upload_write(client, out, len);
+        }
+        bench_sample(turn);
+    }
+    free(out);
+    return ret;
+}
+
+static const char *bench_turn(gemini_client_t *client, bench_mode_t mode, const bench_audio_t *audio, bench_turn_t *turn)
+{
+    const char *mime_type = audio->enc->mime_type;
+    const char *reply = NULL;
+
+    turn->t_speech_end = bench_spoken_at(audio, turn, audio->samples);
+    switch (mode) {
+    case BENCH_QUERY:
+        bench_sleep_until(turn->t_speech_end);
+        turn_trace_endpoint("bench");
+        reply = gemini_audio_query(client, audio->encoded, audio->encoded_len, mime_type);
+        break;
+    case BENCH_STREAM:
+        bench_sleep_until(turn->t_speech_end);
+        turn_trace_endpoint("bench");
+        reply = gemini_audio_query_stream(client, audio->encoded, audio->encoded_len, mime_type, partial_cb, turn);
+        break;
+    case BENCH_UPLOAD:
+        if (ESP_OK != gemini_upload_begin(client, mime_type, partial_cb, turn)) {
+            break;
+        }
+        if (ESP_OK != bench_upload(client, audio, turn)) {
+            return NULL;
+        }
+        /* Retryable statuses leave it to the buffered query, as app_audio does */
+        if (ESP_ERR_NOT_FINISHED == gemini_upload_finish(client, &reply)) {
+            reply = gemini_audio_query_stream(client, audio->encoded, audio->encoded_len, mime_type, partial_cb, turn);
+        }
+        break;
+    case BENCH_MIXED:
+        /* Resolved to upload or query per turn */
+        break;
+    }
+    bench_sample(turn);
+    return reply;
+}
+
+static int compare_ms(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Nearest-rank percentile of sorted values */
+static double percentile(const double *sorted, int n, int p)
+{
+    int rank = (n * p + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void print_latency(const char *what, double *ms, int n)
+{
+    if (0 == n) {
+        return;
+    }
+    qsort(ms, n, sizeof(double), compare_ms);
+    printf("%-11s ms: p50 %7.1f  p90 %7.1f  p95 %7.1f  p99 %7.1f  max %7.1f\n", what, percentile(ms, n, 50),
+           percentile(ms, n, 90), percentile(ms, n, 95), percentile(ms, n, 99), ms[n - 1]);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-n turns] [-m query|stream|upload|mixed] [-w spiffs wav] [-s pace] [-k] [-v]\n"
+            "server: %s\n", name, CONFIG_GEMINI_SERVER_URL);
+}
+
+int main(int argc, char **argv)
+{
+    int turns = 100;
+    bench_mode_t mode = BENCH_STREAM;
+    const char *wav = "Hi.wav";
+    bench_audio_t audio = { .enc = audio_enc_get_default(), .speed = 1.0 };
+    bool keep_going = false;
+    esp_log_level_t level = ESP_LOG_WARN;
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "n:m:w:s:kvh"))) {
+        switch (opt) {
+        case 'n':
+            turns = atoi(optarg);
+            break;
+        case 'm':
+            mode = 0 == strcmp(optarg, "query") ? BENCH_QUERY : 0 == strcmp(optarg, "upload") ? BENCH_UPLOAD
+                   : 0 == strcmp(optarg, "mixed") ? BENCH_MIXED : BENCH_STREAM;
+            break;
+        case 'w':
+            wav = optarg;
+            break;
+        case 's':
+            audio.speed = atof(optarg);
+            break;
+        case 'k':
+            keep_going = true;
+            break;
+        case 'v':
+            level = ESP_LOG_INFO;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (turns <= 0 || audio.speed <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    int16_t *pcm = wav_load_mono(wav, &audio.rate, &audio.samples);
+    if (NULL == pcm || 0 == audio.samples) {
+        return 1;
+    }
+    audio.pcm = pcm;
+    if (ESP_OK != audio_enc_encode(audio.enc, audio.rate, audio.samples, bench_read, &audio, &audio.encoded,
+                                   &audio.encoded_len)) {
+        return 1;
+    }
+
+    static const char *const mode_name[] = { "query", "stream", "upload", "mixed" };
+    printf("%d turns, %s, %s: %.2f s at %" PRIu32 " Hz paced %.3gx, %s %zu bytes, against %s\n", turns,
+           mode_name[mode], wav, (double)audio.samples / audio.rate, audio.rate, audio.speed, audio.enc->name,
+           audio.encoded_len, CONFIG_GEMINI_SERVER_URL);
+    esp_log_level_set("*", level);
+
+    gemini_client_t *client = NULL;
+    if (ESP_OK != gemini_client_create("bench-key", &client)) {
+        return 1;
+    }
+
+    /* After the end of speech, by how the turn was sent: buffered or uploaded while speaking */
+    double *reply_ms[2] = { calloc(turns, sizeof(double)), calloc(turns, sizeof(double)) };
+    double *first_ms[2] = { calloc(turns, sizeof(double)), calloc(turns, sizeof(double)) };
+    int replies[2] = { 0 };
+    int firsts[2] = { 0 };
+    int ok = 0;
+    size_t reply_bytes = 0;
+    size_t peak_heap = heap_in_use();
+    size_t arena_peak = 0;
+    int64_t t_begin = esp_timer_get_time();
+
+    for (int i = 0; i < turns; i++) {
+        bench_turn_t turn = { .t_start = esp_timer_get_time() };
+        turn_trace_begin();
+        /* Mixed: every request follows one framed the other way */
+        bench_mode_t turn_mode = BENCH_MIXED == mode ? (i & 1 ? BENCH_QUERY : BENCH_UPLOAD) : mode;
+        int kind = BENCH_UPLOAD == turn_mode;
+        const char *reply = bench_turn(client, turn_mode, &audio, &turn);
+        int64_t t_end = esp_timer_get_time();
+        turn_trace_end(reply ? "ok" : "error");
+
+        if (reply) {
+            ok++;
+            reply_ms[kind][replies[kind]++] = (t_end - turn.t_speech_end) / 1000.0;
+            reply_bytes += strlen(reply);
+            if (turn.t_first) {
+                first_ms[kind][firsts[kind]++] = (turn.t_first - turn.t_speech_end) / 1000.0;
+            }
+        }
+        peak_heap = turn.peak_heap > peak_heap ? turn.peak_heap : peak_heap;
+        arena_peak = client->arena.peak > arena_peak ? client->arena.peak : arena_peak;
+        gemini_turn_end(client);
+    }
+    double seconds = (esp_timer_get_time() - t_begin) / 1e6;
+
+    size_t body_len = gemini_body_length(audio.enc->mime_type, audio.encoded_len);
+    printf("%d of %d turns ok in %.2f s: %.1f turns/s, request bodies %.2f MB/s, replies %.1f kB/s\n", ok, turns,
+           seconds, ok / seconds, ok * (double)body_len / seconds / 1e6, reply_bytes / seconds / 1e3);
+    printf("from the end of speech:\n");
+    print_latency("buffered", reply_ms[0], replies[0]);
+    print_latency(" first text", first_ms[0], firsts[0]);
+    print_latency("uploaded", reply_ms[1], replies[1]);
+    print_latency(" first text", first_ms[1], firsts[1]);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("peak memory: heap in use %zu bytes (sampled), turn arena %zu of %zu bytes, max RSS %ld kB\n",
+           peak_heap, arena_peak, client->arena.size, usage.ru_maxrss);
+
+    /* Phases from the end of speech, as the device logs them */
+    fflush(stdout);
+    esp_log_level_set("*", ESP_LOG_INFO);
+    turn_trace_print_summary();
+
+    gemini_client_delete(client);
+    for (int i = 0; i < 2; i++) {
+        free(reply_ms[i]);
+        free(first_ms[i]);
+    }
+    audio_enc_release(audio.encoded);
+    free(pcm);
+    return (ok == turns || keep_going) ? 0 : 1;
+}
@@ -0,0 +1,34 @@
+/*
+ * Checks for the host tests: a failed check is reported and the test goes on,
+ * HOST_TEST_EXIT() turns the count of failures into the exit status.
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+static int host_test_failures = 0;
+
+#define CHECK(cond) do {                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            host_test_failures++;                                           \
+        }                                                                   \
+    } while (0)
+
+#define CHECK_INT(actual, expected) do {                                    \
+        long long a_ = (long long)(actual);                                 \
+        long long e_ = (long long)(expected);                               \
+        if (a_ != e_) {                                                     \
+            fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n",           \
+                    __FILE__, __LINE__, #actual, a_, e_);                   \
+            host_test_failures++;                                           \
+        }                                                                   \
+    } while (0)
+
+#define HOST_TEST_EXIT() do {                                               \
+        if (host_test_failures) {                                           \
+            fprintf(stderr, "%d check(s) failed\n", host_test_failures);    \
+        }                                                                   \
+        return host_test_failures ? 1 : 0;                                  \
+    } while (0)
@@ -0,0 +1,9 @@
+/*
+ * Host stand-in for ESP-IDF's esp_crt_bundle.h, the host build only speaks plain HTTP
+ */
+
+#pragma once
+
+#include "esp_err.h"
+
+esp_err_t esp_crt_bundle_attach(void *conf);
@@ -0,0 +1,559 @@
+/*
+ * esp_http_client over POSIX sockets, for running gemini.c against a local
+ * server (tools/mock_gemini.py). HTTP/1.1, and HTTPS when built with
+ * HOST_HTTP_TLS (OpenSSL, the server's certificate is not checked and every
+ * connection is a full handshake). Keep-alive, request bodies with a length
+ * or chunked (framed by the caller, as on the device), responses with Content-Length, chunked or up to the close. Connection,
+ * header, finish and disconnect events are dispatched where esp_http_client
+ * dispatches them. As there, open() sets the body's framing header among the
+ * handle's headers, where it stays until it is deleted or overwritten.
+ */
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "esp_log.h"
+#include "esp_http_client.h"
+
+#ifndef HOST_HTTP_TLS
+#define HOST_HTTP_TLS   0
+#endif
+#if HOST_HTTP_TLS
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#endif
+
+static const char *TAG = "http_client";
+
+#define HTTP_MAX_HEADERS    8
+#define HTTP_LINE_MAX       1024
+#define HTTP_RX_BUF         4096
+
+struct esp_http_client {
+    esp_http_client_config_t config;
+    char host[128];
+    char port[8];
+    char path[256];
+    char *header_key[HTTP_MAX_HEADERS];
+    char *header_value[HTTP_MAX_HEADERS];
+    int timeout_ms;
+    int fd;                     /* -1 when not connected */
+    bool tls;                   /* https:// */
+#if HOST_HTTP_TLS
+    SSL_CTX *ssl_ctx;
+    SSL *ssl;
+#endif
+    /* Response */
+    int status;
+    bool chunked;
+    int64_t content_length;     /* -1 if the body runs to the close */
+    int64_t left;               /* of the body, or of the current chunk */
+    bool complete;
+    char rx[HTTP_RX_BUF];
+    size_t rx_pos;
+    size_t rx_len;
+};
+
+static void http_dispatch(esp_http_client_handle_t client, esp_http_client_event_id_t id, char *key, char *value)
+{
+    if (NULL == client->config.event_handler) {
+        return;
+    }
+    esp_http_client_event_t evt = {
+        .event_id = id,
+        .client = client,
+        .user_data = client->config.user_data,
+        .header_key = key,
+        .header_value = value,
+    };
+    client->config.event_handler(&evt);
+}
+
+static esp_err_t http_parse_url(esp_http_client_handle_t client, const char *url)
+{
+    const char *start = strstr(url, "://");
+    bool tls = NULL != start && 0 == strncasecmp(url, "https://", 8);
+    if (NULL == start || !(tls || 0 == strncasecmp(url, "http://", 7)) || (tls && !HOST_HTTP_TLS)) {
+        ESP_LOGE(TAG, "only http://%s on the host, got %s", HOST_HTTP_TLS ? " and https://" : "", url);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    start += 3;
+    size_t host_len = strcspn(start, ":/?");
+    if (0 == host_len || host_len >= sizeof(client->host)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    char host[sizeof(client->host)];
+    char port[sizeof(client->port)];
+    strcpy(port, tls ? "443" : "80");
+    memcpy(host, start, host_len);
+    host[host_len] = '\0';
+    const char *rest = start + host_len;
+    if (':' == *rest) {
+        size_t port_len = strcspn(rest + 1, "/?");
+        if (0 == port_len || port_len >= sizeof(port)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        memcpy(port, rest + 1, port_len);
+        port[port_len] = '\0';
+        rest += 1 + port_len;
+    }
+    if (strlen(rest) + 2 > sizeof(client->path)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* Another server, the open connection can't be kept */
+    if (client->fd >= 0 && (0 != strcmp(host, client->host) || 0 != strcmp(port, client->port) || tls != client->tls)) {
+        esp_http_client_close(client);
+    }
+    client->tls = tls;
+    strcpy(client->host, host);
+    strcpy(client->port, port);
+    snprintf(client->path, sizeof(client->path), "%s%s", '/' == *rest ? "" : "/", rest);
+    return ESP_OK;
+}
+
+static void http_set_timeout(int fd, int timeout_ms)
+{
+    struct timeval tv = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_usec = (timeout_ms % 1000) * 1000,
+    };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+#if HOST_HTTP_TLS
+static esp_err_t http_tls_connect(esp_http_client_handle_t client)
+{
+    if (NULL == client->ssl_ctx) {
+        client->ssl_ctx = SSL_CTX_new(TLS_client_method());
+        if (NULL == client->ssl_ctx) {
+            return ESP_ERR_NO_MEM;
+        }
+        /* The mock's certificate is self-signed, the device checks against its bundle */
+        SSL_CTX_set_verify(client->ssl_ctx, SSL_VERIFY_NONE, NULL);
+        /* OpenSSL writes without MSG_NOSIGNAL, a closed connection must fail the write instead */
+        signal(SIGPIPE, SIG_IGN);
+    }
+    client->ssl = SSL_new(client->ssl_ctx);
+    if (NULL == client->ssl) {
+        return ESP_ERR_NO_MEM;
+    }
+    SSL_set_fd(client->ssl, client->fd);
+    SSL_set_tlsext_host_name(client->ssl, client->host);
+    if (1 != SSL_connect(client->ssl)) {
+        ESP_LOGE(TAG, "TLS handshake with %s:%s failed: %s", client->host, client->port,
+                 ERR_reason_error_string(ERR_get_error()));
+        return ESP_ERR_HTTP_CONNECT;
+    }
+    return ESP_OK;
+}
+
+static void http_tls_close(esp_http_client_handle_t client)
+{
+    if (client->ssl) {
+        SSL_free(client->ssl);
+        client->ssl = NULL;
+    }
+}
+#else
+static esp_err_t http_tls_connect(esp_http_client_handle_t client)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+static void http_tls_close(esp_http_client_handle_t client)
+{
+}
+#endif
+
+/* Bytes sent, -1 on error */
+static ssize_t http_send(esp_http_client_handle_t client, const char *data, size_t len)
+{
+#if HOST_HTTP_TLS
+    if (client->ssl) {
+        int n = SSL_write(client->ssl, data, len);
+        return n > 0 ? n : -1;
+    }
+#endif
+    ssize_t n;
+    do {
+        n = send(client->fd, data, len, MSG_NOSIGNAL);
+    } while (n < 0 && EINTR == errno);
+    return n;
+}
+
+/* Bytes received, 0 at the close, -1 on error, -ESP_ERR_HTTP_EAGAIN on timeout */
+static int http_recv(esp_http_client_handle_t client, char *buf, size_t size)
+{
+#if HOST_HTTP_TLS
+    if (client->ssl) {
+        int n = SSL_read(client->ssl, buf, size);
+        if (n > 0) {
+            return n;
+        }
+        int err = SSL_get_error(client->ssl, n);
+        if (SSL_ERROR_ZERO_RETURN == err) {
+            return 0;
+        }
+        bool timeout = SSL_ERROR_WANT_READ == err || (SSL_ERROR_SYSCALL == err && (EAGAIN == errno || EWOULDBLOCK == errno));
+        return timeout ? -ESP_ERR_HTTP_EAGAIN : -1;
+    }
+#endif
+    ssize_t n;
+    do {
+        n = recv(client->fd, buf, size, 0);
+    } while (n < 0 && EINTR == errno);
+    if (n < 0) {
+        return (EAGAIN == errno || EWOULDBLOCK == errno) ? -ESP_ERR_HTTP_EAGAIN : -1;
+    }
+    return n;
+}
+
+static esp_err_t http_connect(esp_http_client_handle_t client)
+{
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *res = NULL;
+    if (0 != getaddrinfo(client->host, client->port, &hints, &res)) {
+        ESP_LOGE(TAG, "can't resolve %s", client->host);
+        return ESP_ERR_HTTP_CONNECT;
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && 0 != connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        ESP_LOGE(TAG, "can't connect to %s:%s: %s", client->host, client->port, strerror(errno));
+        return ESP_ERR_HTTP_CONNECT;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    http_set_timeout(fd, client->timeout_ms);
+    client->fd = fd;
+    if (client->tls && ESP_OK != http_tls_connect(client)) {
+        esp_http_client_close(client);
+        return ESP_ERR_HTTP_CONNECT;
+    }
+    /* As esp_http_client: after the handshake */
+    http_dispatch(client, HTTP_EVENT_ON_CONNECTED, NULL, NULL);
+    return ESP_OK;
+}
+
+static int http_send_all(esp_http_client_handle_t client, const char *data, size_t len)
+{
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t n = http_send(client, data + sent, len - sent);
+        if (n <= 0) {
+            ESP_LOGE(TAG, "send failed: %s", strerror(errno));
+            return -1;
+        }
+        sent += n;
+    }
+    return sent;
+}
+
+/* Refills the receive buffer: bytes read, 0 at the close, -1 on error, -ESP_ERR_HTTP_EAGAIN on timeout */
+static int http_fill(esp_http_client_handle_t client)
+{
+    if (client->rx_pos < client->rx_len) {
+        return client->rx_len - client->rx_pos;
+    }
+    int n = http_recv(client, client->rx, sizeof(client->rx));
+    if (n < 0) {
+        return n;
+    }
+    client->rx_pos = 0;
+    client->rx_len = n;
+    return n;
+}
+
+/* One header or chunk-size line without its CRLF, -1 if the connection ends first */
+static int http_read_line(esp_http_client_handle_t client, char *line, size_t size)
+{
+    size_t len = 0;
+    while (true) {
+        int n = http_fill(client);
+        if (n <= 0) {
+            return n < 0 ? n : -1;
+        }
+        char c = client->rx[client->rx_pos++];
+        if ('\n' == c) {
+            if (len > 0 && '\r' == line[len - 1]) {
+                len--;
+            }
+            line[len] = '\0';
+            return len;
+        }
+        if (len + 1 < size) {
+            line[len++] = c;
+        }
+    }
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+    esp_http_client_handle_t client = calloc(1, sizeof(struct esp_http_client));
+    if (NULL == client) {
+        return NULL;
+    }
+    client->config = *config;
+    client->fd = -1;
+    client->timeout_ms = config->timeout_ms ? config->timeout_ms : 5000;
+    if (ESP_OK != http_parse_url(client, config->url)) {
+        free(client);
+        return NULL;
+    }
+    return client;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char *url)
+{
+    return http_parse_url(client, url);
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value)
+{
+    int free_slot = -1;
+    for (int i = 0; i < HTTP_MAX_HEADERS; i++) {
+        if (client->header_key[i] && 0 == strcasecmp(client->header_key[i], key)) {
+            char *copy = strdup(value);
+            if (NULL == copy) {
+                return ESP_ERR_NO_MEM;
+            }
+            free(client->header_value[i]);
+            client->header_value[i] = copy;
+            return ESP_OK;
+        }
+        if (NULL == client->header_key[i] && free_slot < 0) {
+            free_slot = i;
+        }
+    }
+    if (free_slot < 0) {
+        return ESP_ERR_NO_MEM;
+    }
+    client->header_key[free_slot] = strdup(key);
+    client->header_value[free_slot] = strdup(value);
+    return client->header_key[free_slot] && client->header_value[free_slot] ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_http_client_delete_header(esp_http_client_handle_t client, const char *key)
+{
+    for (int i = 0; i < HTTP_MAX_HEADERS; i++) {
+        if (client->header_key[i] && 0 == strcasecmp(client->header_key[i], key)) {
+            free(client->header_key[i]);
+            free(client->header_value[i]);
+            client->header_key[i] = NULL;
+            client->header_value[i] = NULL;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_timeout_ms(esp_http_client_handle_t client, int timeout_ms)
+{
+    client->timeout_ms = timeout_ms;
+    if (client->fd >= 0) {
+        http_set_timeout(client->fd, timeout_ms);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len)
+{
+    if (client->fd < 0) {
+        esp_err_t ret = http_connect(client);
+        if (ESP_OK != ret) {
+            return ret;
+        }
+    }
+    client->rx_pos = client->rx_len = 0;
+    client->status = 0;
+    client->complete = false;
+
+    /* Like esp_http_client, which leaves the other framing header in place */
+    esp_err_t ret = ESP_OK;
+    if (write_len < 0) {
+        ret = esp_http_client_set_header(client, "Transfer-Encoding", "chunked");
+    } else {
+        char value[16];
+        snprintf(value, sizeof(value), "%d", write_len);
+        ret = esp_http_client_set_header(client, "Content-Length", value);
+    }
+    if (ESP_OK != ret) {
+        return ret;
+    }
+
+    char head[2048];
+    int len = snprintf(head, sizeof(head), "%s %s HTTP/1.1\r\nHost: %s:%s\r\nUser-Agent: ESP32 HTTP Client/1.0\r\n",
+                       HTTP_METHOD_POST == client->config.method ? "POST" : "GET", client->path, client->host, client->port);
+    for (int i = 0; i < HTTP_MAX_HEADERS; i++) {
+        if (client->header_key[i]) {
+            len += snprintf(head + len, sizeof(head) - len, "%s: %s\r\n", client->header_key[i], client->header_value[i]);
+        }
+    }
+    len += snprintf(head + len, sizeof(head) - len, "\r\n");
+    if (len >= (int)sizeof(head) || http_send_all(client, head, len) < 0) {
+        esp_http_client_close(client);
+        return ESP_ERR_HTTP_WRITE_DATA;
+    }
+    http_dispatch(client, HTTP_EVENT_HEADERS_SENT, NULL, NULL);
+    return ESP_OK;
+}
+
+int esp_http_client_write(esp_http_client_handle_t client, const char *buffer, int len)
+{
+    if (client->fd < 0) {
+        return -1;
+    }
+    return http_send_all(client, buffer, len);
+}
+
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client)
+{
+    char line[HTTP_LINE_MAX];
+
+    if (client->fd < 0 || http_read_line(client, line, sizeof(line)) < 0
+            || 1 != sscanf(line, "HTTP/%*d.%*d %d", &client->status)) {
+        ESP_LOGE(TAG, "no response status");
+        return ESP_FAIL;
+    }
+    client->chunked = false;
+    client->content_length = -1;
+    while (true) {
+        int len = http_read_line(client, line, sizeof(line));
+        if (len < 0) {
+            ESP_LOGE(TAG, "connection lost in the response headers");
+            return ESP_FAIL;
+        }
+        if (0 == len) {
+            break;
+        }
+        char *colon = strchr(line, ':');
+        if (NULL == colon) {
+            continue;
+        }
+        *colon = '\0';
+        char *value = colon + 1 + strspn(colon + 1, " \t");
+        if (0 == strcasecmp(line, "Content-Length")) {
+            client->content_length = strtoll(value, NULL, 10);
+        } else if (0 == strcasecmp(line, "Transfer-Encoding") && 0 == strcasecmp(value, "chunked")) {
+            client->chunked = true;
+        }
+        http_dispatch(client, HTTP_EVENT_ON_HEADER, line, value);
+    }
+    if (client->chunked) {
+        client->content_length = -1;
+        client->left = 0;
+    } else {
+        client->left = client->content_length;
+        client->complete = (0 == client->content_length);
+    }
+    /* As esp_http_client: 0 when the length is not known up front */
+    return client->content_length < 0 ? 0 : client->content_length;
+}
+
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len)
+{
+    char line[HTTP_LINE_MAX];
+
+    if (client->complete || client->fd < 0) {
+        return 0;
+    }
+    if (client->chunked && 0 == client->left) {
+        int n = http_read_line(client, line, sizeof(line));
+        if (0 == n) {
+            /* CRLF that ends the previous chunk */
+            n = http_read_line(client, line, sizeof(line));
+        }
+        if (n < 0) {
+            return n == -ESP_ERR_HTTP_EAGAIN ? n : 0;
+        }
+        client->left = strtoll(line, NULL, 16);
+        if (0 == client->left) {
+            while (http_read_line(client, line, sizeof(line)) > 0) {
+                /* trailers */
+            }
+            client->complete = true;
+            http_dispatch(client, HTTP_EVENT_ON_FINISH, NULL, NULL);
+            return 0;
+        }
+    }
+
+    int n = http_fill(client);
+    if (n <= 0) {
+        /* At the close: complete only if the body was meant to run to it */
+        client->complete = (0 == n && !client->chunked && client->content_length < 0);
+        return (n == -ESP_ERR_HTTP_EAGAIN) ? n : (n < 0 ? -1 : 0);
+    }
+    size_t take = n < len ? n : len;
+    if (client->left >= 0 && (int64_t)take > client->left && (client->chunked || client->content_length >= 0)) {
+        take = client->left;
+    }
+    memcpy(buffer, client->rx + client->rx_pos, take);
+    client->rx_pos += take;
+    if (client->chunked || client->content_length >= 0) {
+        client->left -= take;
+    }
+    if (!client->chunked && client->content_length >= 0 && 0 == client->left) {
+        client->complete = true;
+        http_dispatch(client, HTTP_EVENT_ON_FINISH, NULL, NULL);
+    }
+    return take;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+    return client->status;
+}
+
+bool esp_http_client_is_complete_data_received(esp_http_client_handle_t client)
+{
+    return client->complete;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client)
+{
+    if (client->fd >= 0) {
+        http_tls_close(client);
+        close(client->fd);
+        client->fd = -1;
+        client->rx_pos = client->rx_len = 0;
+        http_dispatch(client, HTTP_EVENT_DISCONNECTED, NULL, NULL);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    if (NULL == client) {
+        return ESP_FAIL;
+    }
+    esp_http_client_close(client);
+    for (int i = 0; i < HTTP_MAX_HEADERS; i++) {
+        free(client->header_key[i]);
+        free(client->header_value[i]);
+    }
+#if HOST_HTTP_TLS
+    SSL_CTX_free(client->ssl_ctx);
+#endif
+    free(client);
+    return ESP_OK;
+}
@@ -0,0 +1,9 @@
+/*
+ * Host stand-in for ESP-IDF's esp_random.h
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+uint32_t esp_random(void);
@@ -0,0 +1,12 @@
+/*
+ * Host stand-in for ESP-IDF's esp_timer.h
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief Microseconds of CLOCK_MONOTONIC
+ */
+int64_t esp_timer_get_time(void);
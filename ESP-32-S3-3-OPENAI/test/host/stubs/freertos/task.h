@@ -0,0 +1,17 @@
+/*
+ * Host stand-in for FreeRTOS task.h: a task is a detached thread
+ */
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void *);
+typedef void *TaskHandle_t;
+
+void vTaskDelay(TickType_t ticks);
+/* Stack size, priority and core are ignored */
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *ret_task, BaseType_t core);
+/* Only for the calling task, NULL */
+void vTaskDelete(TaskHandle_t task);
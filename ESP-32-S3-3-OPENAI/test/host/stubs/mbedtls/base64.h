@@ -0,0 +1,16 @@
+/*
+ * Host stand-in for mbedTLS's base64.h, same contract as the library
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#define MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL     -0x002A
+
+/**
+ * @brief Encode `slen` bytes, NUL terminated
+ *
+ * @return 0, or MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL with the needed size (NUL included) in `olen`
+ */
+int mbedtls_base64_encode(unsigned char *dst, size_t dlen, size_t *olen, const unsigned char *src, size_t slen);
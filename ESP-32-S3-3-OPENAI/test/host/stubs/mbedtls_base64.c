@@ -0,0 +1,41 @@
+/*
+ * Base64 encoder with the contract of mbedtls_base64_encode()
+ */
+
+#include <stdint.h>
+#include "mbedtls/base64.h"
+
+static const char s_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+int mbedtls_base64_encode(unsigned char *dst, size_t dlen, size_t *olen, const unsigned char *src, size_t slen)
+{
+    if (0 == slen) {
+        *olen = 0;
+        return 0;
+    }
+    size_t n = (slen + 2) / 3 * 4;
+    if (NULL == dst || dlen < n + 1) {
+        *olen = n + 1;
+        return MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL;
+    }
+
+    unsigned char *p = dst;
+    size_t i = 0;
+    for (; i + 3 <= slen; i += 3) {
+        uint32_t v = (uint32_t)src[i] << 16 | (uint32_t)src[i + 1] << 8 | src[i + 2];
+        *p++ = s_alphabet[(v >> 18) & 0x3F];
+        *p++ = s_alphabet[(v >> 12) & 0x3F];
+        *p++ = s_alphabet[(v >> 6) & 0x3F];
+        *p++ = s_alphabet[v & 0x3F];
+    }
+    if (i < slen) {
+        uint32_t v = (uint32_t)src[i] << 16 | (i + 1 < slen ? (uint32_t)src[i + 1] << 8 : 0);
+        *p++ = s_alphabet[(v >> 18) & 0x3F];
+        *p++ = s_alphabet[(v >> 12) & 0x3F];
+        *p++ = i + 1 < slen ? s_alphabet[(v >> 6) & 0x3F] : '=';
+        *p++ = '=';
+    }
+    *p = '\0';
+    *olen = n;
+    return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * Configuration of the host build: the defaults of main/Kconfig.projbuild
+ *
+ * A test or benchmark overrides any of them with a compile definition.
+ */
+
+#pragma once
+
+#ifndef CONFIG_GEMINI_MAX_REPLY_LEN
+#define CONFIG_GEMINI_MAX_REPLY_LEN             16384
+#endif
+#ifndef CONFIG_GEMINI_SERVER_URL
+#define CONFIG_GEMINI_SERVER_URL                "http://127.0.0.1:8080"
+#endif
+#ifndef CONFIG_GEMINI_STREAM_REPLY
+#define CONFIG_GEMINI_STREAM_REPLY              1
+#endif
+#ifndef CONFIG_GEMINI_TURN_BUDGET_MS
+#define CONFIG_GEMINI_TURN_BUDGET_MS            20000
+#endif
+#ifndef CONFIG_GEMINI_MAX_ATTEMPTS
+#define CONFIG_GEMINI_MAX_ATTEMPTS              3
+#endif
+#ifndef CONFIG_GEMINI_HEDGE_DELAY_MS
+#define CONFIG_GEMINI_HEDGE_DELAY_MS            0
+#endif
+#ifndef CONFIG_GEMINI_PIPELINED_UPLOAD
+#define CONFIG_GEMINI_PIPELINED_UPLOAD          1
+#endif
+#ifndef CONFIG_AUDIO_UPLOAD_CODEC_FLAC
+#define CONFIG_AUDIO_UPLOAD_CODEC_FLAC          1
+#endif
+#ifndef CONFIG_AUDIO_UPLOAD_SAMPLE_RATE
+#define CONFIG_AUDIO_UPLOAD_SAMPLE_RATE         16000
+#endif
+#ifndef CONFIG_AUDIO_RECORD_MAX_S
+#define CONFIG_AUDIO_RECORD_MAX_S               30
+#endif
+#ifndef CONFIG_AUDIO_PREROLL_MS
+#define CONFIG_AUDIO_PREROLL_MS                 500
+#endif
+#ifndef CONFIG_AUDIO_TRIM_SILENCE
+#define CONFIG_AUDIO_TRIM_SILENCE               1
+#endif
+#ifndef CONFIG_AUDIO_TRIM_MARGIN_MS
+#define CONFIG_AUDIO_TRIM_MARGIN_MS             400
+#endif
+#ifndef CONFIG_OFFLINE_TURN_QUEUE_LEN
+#define CONFIG_OFFLINE_TURN_QUEUE_LEN           4
+#endif
+#ifndef CONFIG_OFFLINE_TURN_QUEUE_KB
+#define CONFIG_OFFLINE_TURN_QUEUE_KB            1024
+#endif
+#ifndef CONFIG_TURN_TRACE
+#define CONFIG_TURN_TRACE                       1
+#endif
+#ifndef CONFIG_TURN_TRACE_WINDOW
+#define CONFIG_TURN_TRACE_WINDOW                32
+#endif
+#ifndef CONFIG_TURN_TRACE_SUMMARY_INTERVAL
+#define CONFIG_TURN_TRACE_SUMMARY_INTERVAL      0
+#endif
@@ -0,0 +1,251 @@
+/*
+ * The playback reference against the feed's clock: what was played comes out
+ * at the microphone sample it was written for, in the channel the AFE frame
+ * has for it next to the microphones, across the end of the buffer and with
+ * silence where nothing played. Then a writer, the feed and format changes from three threads, the
+ * way the player task, the feed task and bsp_codec_set_fs() run on the device.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host_test.h"
+#include "aec_ref.h"
+
+#define CAPACITY        1000
+#define MICS            2
+#define STRIDE          (MICS + 1)  /* the AFE frame: two microphones and the reference */
+
+static int16_t s_frame[2048 * STRIDE];
+static int16_t s_mic[2048 * MICS];
+
+/* Builds `samples` of AFE input into s_frame, the microphones carrying a pattern of their own */
+static void read_frame(size_t samples)
+{
+    for (size_t i = 0; i < samples * MICS; i++) {
+        s_mic[i] = -1 - (int16_t)(i % 1000);
+    }
+    aec_ref_feed(s_frame, s_mic, MICS, samples);
+}
+
+static int16_t ref_at(size_t i)
+{
+    return s_frame[i * STRIDE + MICS];
+}
+
+/* The microphone channels of s_frame are the captured ones, unchanged */
+static bool mics_intact(size_t samples)
+{
+    for (size_t i = 0; i < samples; i++) {
+        for (size_t c = 0; c < MICS; c++) {
+            if (s_frame[i * STRIDE + c] != s_mic[i * MICS + c]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void write_mono(int16_t first, size_t n)
+{
+    int16_t pcm[2048];
+    for (size_t i = 0; i < n; i++) {
+        pcm[i] = first + i;
+    }
+    aec_ref_write(pcm, n * sizeof(int16_t));
+}
+
+static void test_before_init(void)
+{
+    /* Nothing kept yet: silence, writes ignored */
+    write_mono(1, 10);
+    read_frame(10);
+    for (size_t i = 0; i < 10; i++) {
+        CHECK_INT(ref_at(i), 0);
+    }
+    CHECK(mics_intact(10));
+}
+
+static void test_alignment(void)
+{
+    aec_ref_set_format(AEC_REF_RATE, 16, 1);
+
+    /* Written ahead of the feed: read back in order, in the reference channel only */
+    write_mono(1, 300);
+    read_frame(200);
+    for (size_t i = 0; i < 200; i++) {
+        CHECK_INT(ref_at(i), 1 + i);
+    }
+    CHECK(mics_intact(200));
+    read_frame(200);
+    for (size_t i = 0; i < 100; i++) {
+        CHECK_INT(ref_at(i), 201 + i);
+    }
+    /* Nothing played after that */
+    for (size_t i = 100; i < 200; i++) {
+        CHECK_INT(ref_at(i), 0);
+    }
+
+    /* The feed moved on while nothing played: the next write starts where it is */
+    read_frame(50);
+    write_mono(1000, 10);
+    read_frame(10);
+    for (size_t i = 0; i < 10; i++) {
+        CHECK_INT(ref_at(i), 1000 + i);
+    }
+
+    /* What was read is cleared, a second lap of the buffer finds silence */
+    for (int lap = 0; lap < 2; lap++) {
+        read_frame(CAPACITY / 2);
+        for (size_t i = 0; i < CAPACITY / 2; i++) {
+            CHECK_INT(ref_at(i), 0);
+        }
+    }
+}
+
+static void test_wraparound(void)
+{
+    aec_ref_set_format(AEC_REF_RATE, 16, 1);
+
+    /* Sizes that don't divide the capacity, so copies in and out straddle its end */
+    int16_t next_write = 1;
+    int16_t next_read = 1;
+    for (int round = 0; round < 40; round++) {
+        size_t n = 173 + round * 7;
+        write_mono(next_write, n);
+        next_write += n;
+        read_frame(n);
+        for (size_t i = 0; i < n; i++) {
+            CHECK_INT(ref_at(i), next_read++);
+        }
+    }
+
+    /* More than fits in front of the feed: the rest is dropped */
+    write_mono(1, CAPACITY - 1);
+    write_mono(CAPACITY, 500);
+    read_frame(CAPACITY);
+    for (size_t i = 0; i < CAPACITY; i++) {
+        CHECK_INT(ref_at(i), 1 + i);
+    }
+    read_frame(500);
+    for (size_t i = 0; i < 500; i++) {
+        CHECK_INT(ref_at(i), 0);
+    }
+    CHECK(mics_intact(500));
+
+    /* Any number of microphones */
+    write_mono(7, 300);
+    int16_t mono[300];
+    for (size_t i = 0; i < 300; i++) {
+        mono[i] = -(int16_t)i;
+    }
+    aec_ref_feed(s_frame, mono, 1, 300);
+    for (size_t i = 0; i < 300; i++) {
+        CHECK_INT(s_frame[2 * i], -(int16_t)i);
+        CHECK_INT(s_frame[2 * i + 1], 7 + i);
+    }
+}
+
+static void test_format(void)
+{
+    /* 48 kHz stereo: mixed down, one sample in three */
+    aec_ref_set_format(48000, 16, 2);
+    int16_t pcm[600 * 2];
+    for (size_t f = 0; f < 600; f++) {
+        pcm[2 * f] = 3000;
+        pcm[2 * f + 1] = 1000;
+    }
+    aec_ref_write(pcm, sizeof(pcm));
+    read_frame(201);
+    /* The first output leans on the frame before the format change, silence */
+    for (size_t i = 1; i < 200; i++) {
+        CHECK_INT(ref_at(i), 2000);
+    }
+    CHECK_INT(ref_at(200), 0);
+
+    /* 24-bit playback isn't kept */
+    aec_ref_set_format(AEC_REF_RATE, 24, 2);
+    aec_ref_write(pcm, sizeof(pcm));
+    read_frame(200);
+    for (size_t i = 0; i < 200; i++) {
+        CHECK_INT(ref_at(i), 0);
+    }
+}
+
+#define THREAD_WRITES   20000
+#define THREAD_LEVEL    1234
+
+typedef struct {
+    volatile bool done;
+    uint32_t bad;
+    uint32_t heard;
+} thread_ctx_t;
+
+static void *writer_thread(void *arg)
+{
+    thread_ctx_t *ctx = arg;
+    int16_t pcm[96 * 2];
+    for (size_t i = 0; i < 96 * 2; i++) {
+        pcm[i] = THREAD_LEVEL;
+    }
+    for (int i = 0; i < THREAD_WRITES; i++) {
+        aec_ref_write(pcm, sizeof(pcm));
+    }
+    ctx->done = true;
+    return NULL;
+}
+
+static void *format_thread(void *arg)
+{
+    thread_ctx_t *ctx = arg;
+    for (int i = 0; !ctx->done; i++) {
+        aec_ref_set_format(i & 1 ? 48000 : AEC_REF_RATE, 16, 2);
+    }
+    return NULL;
+}
+
+static void *feed_thread(void *arg)
+{
+    thread_ctx_t *ctx = arg;
+    static int16_t frame[512 * STRIDE];
+    static int16_t mic[512 * MICS];
+    while (!ctx->done) {
+        aec_ref_feed(frame, mic, MICS, 512);
+        for (size_t i = 0; i < 512; i++) {
+            int16_t x = frame[i * STRIDE + MICS];
+            /* A constant level, or on its way up from the silence a format change starts from */
+            if (x < 0 || x > THREAD_LEVEL) {
+                ctx->bad++;
+            }
+            ctx->heard += THREAD_LEVEL == x;
+        }
+    }
+    return NULL;
+}
+
+static void test_threads(void)
+{
+    thread_ctx_t ctx = { 0 };
+    pthread_t writer, format, feed;
+    pthread_create(&feed, NULL, feed_thread, &ctx);
+    pthread_create(&format, NULL, format_thread, &ctx);
+    pthread_create(&writer, NULL, writer_thread, &ctx);
+    pthread_join(writer, NULL);
+    pthread_join(format, NULL);
+    pthread_join(feed, NULL);
+    CHECK_INT(ctx.bad, 0);
+    CHECK(ctx.heard > 0);
+}
+
+int main(void)
+{
+    test_before_init();
+    CHECK_INT(aec_ref_init(CAPACITY), ESP_OK);
+    CHECK_INT(aec_ref_init(5), ESP_OK);
+    test_alignment();
+    test_wraparound();
+    test_format();
+    test_threads();
+    HOST_TEST_EXIT();
+}
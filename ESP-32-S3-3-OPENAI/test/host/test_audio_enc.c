@@ -0,0 +1,249 @@
+/*
+ * Upload codecs on the speech cues in spiffs/: every codec must give back
+ * what it was fed (FLAC exactly, mu-law within its companding error), write
+ * a header strict decoders accept, and produce the same bytes whether a
+ * recording is encoded at once or streamed block by block.
+ *
+ * Also prints the size and host encode time of each codec per cue.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host_test.h"
+#include "wav_file.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "audio_enc.h"
+
+#define BENCH_ROUNDS    20
+
+static const int16_t *read_array(size_t index, size_t samples, void *user_ctx)
+{
+    return (const int16_t *)user_ctx + index;
+}
+
+/* FLAC decoder for what audio_enc writes: fixed predictors, Rice residuals, verbatim */
+
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+    size_t bit;
+} bit_reader_t;
+
+static uint32_t br_get(bit_reader_t *br, int bits)
+{
+    uint32_t v = 0;
+    while (bits--) {
+        size_t byte = br->bit / 8;
+        v = (v << 1) | (byte < br->len ? (br->data[byte] >> (7 - br->bit % 8)) & 1 : 0);
+        br->bit++;
+    }
+    return v;
+}
+
+static int32_t br_signed(bit_reader_t *br, int bits)
+{
+    uint32_t v = br_get(br, bits);
+    return (int32_t)(v << (32 - bits)) >> (32 - bits);
+}
+
+/* Decodes the frames after the stream header, returns the number of samples or -1 */
+static long flac_decode(const uint8_t *data, size_t len, int16_t *out, size_t max)
+{
+    bit_reader_t br = { .data = data, .len = len };
+    size_t total = 0;
+
+    while (br.bit / 8 < len) {
+        if (0xFFF8 != br_get(&br, 16)) {
+            return -1;
+        }
+        uint32_t bs_code = br_get(&br, 4);
+        br_get(&br, 4 + 4 + 3 + 1);
+        uint32_t lead = br_get(&br, 8);
+        for (uint32_t mask = 0x80; lead & mask && mask > 0x40; mask >>= 1) {
+            br_get(&br, 8);
+        }
+        size_t n = 0x0C == bs_code ? 4096 : 0x07 == bs_code ? br_get(&br, 16) + 1 : 0;
+        br_get(&br, 8);
+        if (!n || total + n > max) {
+            return -1;
+        }
+
+        int16_t *x = out + total;
+        uint32_t type = br_get(&br, 8);
+        if (0x02 == type) {
+            for (size_t i = 0; i < n; i++) {
+                x[i] = br_signed(&br, 16);
+            }
+        } else if ((type & 0xF0) == 0x10) {
+            int order = (type >> 1) & 0x07;
+            for (int i = 0; i < order; i++) {
+                x[i] = br_signed(&br, 16);
+            }
+            if (0 != br_get(&br, 2)) {
+                return -1;
+            }
+            int porder = br_get(&br, 4);
+            size_t psize = n >> porder;
+            size_t i = order;
+            for (int p = 0; p < (1 << porder); p++) {
+                int k = br_get(&br, 4);
+                for (; i < (p + 1) * psize; i++) {
+                    uint32_t q = 0;
+                    while (0 == br_get(&br, 1)) {
+                        q++;
+                    }
+                    uint32_t u = (q << k) | br_get(&br, k);
+                    int32_t r = (u >> 1) ^ -(int32_t)(u & 1);
+                    int32_t pred = 0;
+                    switch (order) {
+                    case 1:
+                        pred = x[i - 1];
+                        break;
+                    case 2:
+                        pred = 2 * x[i - 1] - x[i - 2];
+                        break;
+                    case 3:
+                        pred = 3 * x[i - 1] - 3 * x[i - 2] + x[i - 3];
+                        break;
+                    case 4:
+                        pred = 4 * x[i - 1] - 6 * x[i - 2] + 4 * x[i - 3] - x[i - 4];
+                        break;
+                    }
+                    x[i] = pred + r;
+                }
+            }
+        } else {
+            return -1;
+        }
+        br.bit = (br.bit + 7) / 8 * 8;
+        br_get(&br, 16);
+        total += n;
+    }
+    return total;
+}
+
+static int16_t ulaw_to_pcm(uint8_t u)
+{
+    u = ~u;
+    int t = ((u & 0x0F) << 3) + 0x84;
+    t <<= (u & 0x70) >> 4;
+    return (u & 0x80) ? 0x84 - t : t - 0x84;
+}
+
+static uint32_t le32(const uint8_t *p)
+{
+    return wav_le(p, 4);
+}
+
+/* Walks the RIFF chunks of a mu-law header as a strict decoder would */
+static void check_ulaw_header(const uint8_t *out, size_t len, uint32_t rate, size_t samples)
+{
+    CHECK(0 == memcmp(out, "RIFF", 4) && 0 == memcmp(out + 8, "WAVE", 4));
+    CHECK_INT(le32(out + 4), len - 8);
+    CHECK(0 == memcmp(out + 12, "fmt ", 4));
+    CHECK_INT(le32(out + 16), 18);
+    CHECK_INT(wav_le(out + 20, 2), 7);
+    CHECK_INT(wav_le(out + 22, 2), 1);
+    CHECK_INT(le32(out + 24), rate);
+    CHECK_INT(le32(out + 28), rate);
+    CHECK_INT(wav_le(out + 32, 2), 1);
+    CHECK_INT(wav_le(out + 34, 2), 8);
+    CHECK_INT(wav_le(out + 36, 2), 0);
+    CHECK(0 == memcmp(out + 38, "fact", 4));
+    CHECK_INT(le32(out + 42), 4);
+    CHECK_INT(le32(out + 46), samples);
+    CHECK(0 == memcmp(out + 50, "data", 4));
+    CHECK_INT(le32(out + 54), samples);
+}
+
+/* The same stream, written the way the pipelined uploader does */
+static void check_streamed(const audio_enc_t *enc, uint32_t rate, const int16_t *pcm, size_t samples,
+                           const uint8_t *whole, size_t whole_len)
+{
+    size_t out_size = enc->block_max(AUDIO_ENC_BLOCK_SAMPLES);
+    uint8_t *out = malloc(out_size);
+    size_t head = enc->header(rate, samples, out);
+    size_t pos = head;
+    bool same = true;
+
+    for (size_t i = 0; i < samples; i += AUDIO_ENC_BLOCK_SAMPLES) {
+        size_t n = samples - i < AUDIO_ENC_BLOCK_SAMPLES ? samples - i : AUDIO_ENC_BLOCK_SAMPLES;
+        size_t len = 0;
+        CHECK_INT(enc->block(pcm + i, n, i, out, out_size, &len), ESP_OK);
+        same &= pos + len <= whole_len && 0 == memcmp(whole + pos, out, len);
+        pos += len;
+    }
+    CHECK(same && pos == whole_len);
+    free(out);
+}
+
+static void bench_cue(const char *name)
+{
+    uint32_t rate = 0;
+    size_t samples = 0;
+    int16_t *pcm = wav_load_mono(name, &rate, &samples);
+    CHECK(NULL != pcm);
+    if (!pcm) {
+        return;
+    }
+    int16_t *decoded = malloc(samples * sizeof(int16_t) + 1);
+
+    for (int type = 0; type < AUDIO_ENC_MAX; type++) {
+        const audio_enc_t *enc = audio_enc_get(type);
+        uint8_t *out = NULL;
+        size_t out_len = 0;
+
+        int64_t start = esp_timer_get_time();
+        for (int round = 0; round < BENCH_ROUNDS; round++) {
+            audio_enc_release(out);
+            CHECK_INT(audio_enc_encode(enc, rate, samples, read_array, pcm, &out, &out_len), ESP_OK);
+        }
+        double us = (double)(esp_timer_get_time() - start) / BENCH_ROUNDS;
+        size_t pcm_len = 44 + samples * sizeof(int16_t);
+        printf("%-18s %-6s %7zu -> %7zu bytes (%3zu%%) %8.0f us, %6.0fx real time\n", name, enc->name, pcm_len,
+               out_len, out_len * 100 / pcm_len, us, samples * 1e6 / rate / us);
+
+        size_t head = enc->header(rate, samples, (uint8_t *)decoded);
+        switch (type) {
+        case AUDIO_ENC_WAV:
+            CHECK_INT(out_len, pcm_len);
+            CHECK(0 == memcmp(out + head, pcm, samples * sizeof(int16_t)));
+            break;
+        case AUDIO_ENC_ULAW: {
+            CHECK_INT(out_len, head + samples);
+            check_ulaw_header(out, out_len, rate, samples);
+            double signal = 0, noise = 0;
+            for (size_t i = 0; i < samples; i++) {
+                double e = ulaw_to_pcm(out[head + i]) - pcm[i];
+                signal += (double)pcm[i] * pcm[i];
+                noise += e * e;
+            }
+            double snr = 10 * log10(signal / (noise + 1));
+            CHECK(snr > 30);
+            break;
+        }
+        case AUDIO_ENC_FLAC:
+            CHECK(0 == memcmp(out, "fLaC", 4));
+            CHECK(out_len < pcm_len);
+            CHECK_INT(flac_decode(out + head, out_len - head, decoded, samples), samples);
+            CHECK(0 == memcmp(decoded, pcm, samples * sizeof(int16_t)));
+            break;
+        }
+        check_streamed(enc, rate, pcm, samples, out, out_len);
+        audio_enc_release(out);
+    }
+    free(decoded);
+    free(pcm);
+}
+
+int main(void)
+{
+    esp_log_level_set("*", ESP_LOG_WARN);
+    bench_cue("Hi.wav");
+    bench_cue("echo_en_end.wav");
+    bench_cue("echo_en_ok.wav");
+    bench_cue("echo_en_wake.wav");
+    HOST_TEST_EXIT();
+}
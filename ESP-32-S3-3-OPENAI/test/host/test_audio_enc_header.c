@@ -0,0 +1,150 @@
+/*
+ * Stream headers of the upload codecs, byte for byte
+ *
+ * The recording's WAV header is built in RAM, so nothing on the device reads
+ * a real file any more to check it against. Here it is: spiffs/Hi.wav is a
+ * canonical 44-byte mono PCM WAV, and re-encoding its samples as WAV must give
+ * back the file. (spiffs/input.wav, despite its name, is an MP3 stream.)
+ * The mu-law and FLAC headers, and the unknown-length forms the chunked upload
+ * sends, are compared with golden bytes written out by hand from the specs.
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host_test.h"
+#include "esp_log.h"
+#include "audio_enc.h"
+#include "app_audio.h"
+#include "wav_file.h"
+
+#define GOLDEN_RATE     16000
+#define GOLDEN_SAMPLES  16000
+
+static const uint8_t s_wav_golden[] = {
+    'R', 'I', 'F', 'F', 0x24, 0x7D, 0x00, 0x00, 'W', 'A', 'V', 'E',
+    'f', 'm', 't', ' ', 0x10, 0x00, 0x00, 0x00,
+    0x01, 0x00,                         /* PCM */
+    0x01, 0x00,                         /* mono */
+    0x80, 0x3E, 0x00, 0x00,             /* 16000 Hz */
+    0x00, 0x7D, 0x00, 0x00,             /* 32000 bytes/s */
+    0x02, 0x00, 0x10, 0x00,
+    'd', 'a', 't', 'a', 0x00, 0x7D, 0x00, 0x00,
+};
+
+static const uint8_t s_wav_stream_golden[] = {
+    'R', 'I', 'F', 'F', 0xFF, 0xFF, 0xFF, 0xFF, 'W', 'A', 'V', 'E',
+    'f', 'm', 't', ' ', 0x10, 0x00, 0x00, 0x00,
+    0x01, 0x00, 0x01, 0x00, 0x80, 0x3E, 0x00, 0x00, 0x00, 0x7D, 0x00, 0x00, 0x02, 0x00, 0x10, 0x00,
+    'd', 'a', 't', 'a', 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+static const uint8_t s_ulaw_golden[] = {
+    'R', 'I', 'F', 'F', 0xB2, 0x3E, 0x00, 0x00, 'W', 'A', 'V', 'E',
+    'f', 'm', 't', ' ', 0x12, 0x00, 0x00, 0x00,
+    0x07, 0x00,                         /* WAVE_FORMAT_MULAW */
+    0x01, 0x00,
+    0x80, 0x3E, 0x00, 0x00,
+    0x80, 0x3E, 0x00, 0x00,             /* one byte per sample */
+    0x01, 0x00, 0x08, 0x00,
+    0x00, 0x00,                         /* cbSize */
+    'f', 'a', 'c', 't', 0x04, 0x00, 0x00, 0x00, 0x80, 0x3E, 0x00, 0x00,
+    'd', 'a', 't', 'a', 0x80, 0x3E, 0x00, 0x00,
+};
+
+static const uint8_t s_ulaw_stream_golden[] = {
+    'R', 'I', 'F', 'F', 0xFF, 0xFF, 0xFF, 0xFF, 'W', 'A', 'V', 'E',
+    'f', 'm', 't', ' ', 0x12, 0x00, 0x00, 0x00,
+    0x07, 0x00, 0x01, 0x00, 0x80, 0x3E, 0x00, 0x00, 0x80, 0x3E, 0x00, 0x00, 0x01, 0x00, 0x08, 0x00, 0x00, 0x00,
+    'f', 'a', 'c', 't', 0x04, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF,
+    'd', 'a', 't', 'a', 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+static const uint8_t s_flac_golden[] = {
+    'f', 'L', 'a', 'C',
+    0x80, 0x00, 0x00, 0x22,             /* last metadata block, STREAMINFO, 34 bytes */
+    0x10, 0x00, 0x10, 0x00,             /* 4096-sample blocks */
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, /* frame sizes unknown */
+    0x03, 0xE8, 0x00,                   /* 16000 Hz (20 bits), mono (3 bits), 16 bits (5 bits) ... */
+    0xF0, 0x00, 0x00, 0x3E, 0x80,       /* ... and 16000 samples (36 bits) */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+static void check_header(audio_enc_type_t type, size_t samples, const uint8_t *golden, size_t golden_len)
+{
+    uint8_t out[AUDIO_ENC_HEADER_MAX + 8];
+    memset(out, 0xA5, sizeof(out));
+
+    size_t len = audio_enc_get(type)->header(GOLDEN_RATE, samples, out);
+    CHECK_INT(len, golden_len);
+    CHECK(len <= AUDIO_ENC_HEADER_MAX);
+    for (size_t i = 0; i < golden_len && i < len; i++) {
+        if (out[i] != golden[i]) {
+            fprintf(stderr, "%s header, %zu samples: byte %zu is 0x%02X, expected 0x%02X\n",
+                    audio_enc_get(type)->name, samples, i, out[i], golden[i]);
+            CHECK(out[i] == golden[i]);
+            break;
+        }
+    }
+    /* Nothing past the header */
+    CHECK(0xA5 == out[len]);
+}
+
+static const int16_t *read_pcm(size_t index, size_t samples, void *user_ctx)
+{
+    return (const int16_t *)user_ctx + index;
+}
+
+/* Hi.wav is what the WAV codec writes for its own samples */
+static void check_against_file(const char *name)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", SPIFFS_DIR, name);
+    FILE *fp = fopen(path, "rb");
+    CHECK(NULL != fp);
+    if (!fp) {
+        return;
+    }
+    uint8_t file[sizeof(wav_header_t)];
+    CHECK_INT(fread(file, 1, sizeof(file), fp), sizeof(file));
+    fclose(fp);
+
+    uint32_t rate = 0;
+    size_t samples = 0;
+    int16_t *pcm = wav_load_mono(name, &rate, &samples);
+    CHECK(NULL != pcm);
+    if (!pcm) {
+        return;
+    }
+    /* Canonical layout: fmt right after WAVE, data right after fmt */
+    CHECK_INT(wav_le(file + 22, 2), 1);
+    CHECK(0 == memcmp(file + 36, "data", 4));
+    CHECK_INT(wav_le(file + 40, 4), samples * sizeof(int16_t));
+
+    uint8_t *out = NULL;
+    size_t out_len = 0;
+    CHECK_INT(audio_enc_encode(audio_enc_get(AUDIO_ENC_WAV), rate, samples, read_pcm, pcm, &out, &out_len), ESP_OK);
+    CHECK_INT(out_len, sizeof(wav_header_t) + samples * sizeof(int16_t));
+    if (out) {
+        CHECK(0 == memcmp(out, file, sizeof(file)));
+        CHECK(0 == memcmp(out + sizeof(wav_header_t), pcm, samples * sizeof(int16_t)));
+    }
+    printf("%s: %" PRIu32 " Hz, %zu samples, header matches\n", name, rate, samples);
+    audio_enc_release(out);
+    free(pcm);
+}
+
+int main(void)
+{
+    esp_log_level_set("*", ESP_LOG_WARN);
+
+    CHECK_INT(sizeof(wav_header_t), 44);
+    check_header(AUDIO_ENC_WAV, GOLDEN_SAMPLES, s_wav_golden, sizeof(s_wav_golden));
+    check_header(AUDIO_ENC_WAV, 0, s_wav_stream_golden, sizeof(s_wav_stream_golden));
+    check_header(AUDIO_ENC_ULAW, GOLDEN_SAMPLES, s_ulaw_golden, sizeof(s_ulaw_golden));
+    check_header(AUDIO_ENC_ULAW, 0, s_ulaw_stream_golden, sizeof(s_ulaw_stream_golden));
+    check_header(AUDIO_ENC_FLAC, GOLDEN_SAMPLES, s_flac_golden, sizeof(s_flac_golden));
+
+    check_against_file("Hi.wav");
+    HOST_TEST_EXIT();
+}
@@ -0,0 +1,244 @@
+/*
+ * Quality and speed of the resampler, for every upload rate it is used for
+ *
+ * Pass band tones must come out clean: a sine fitted to the output at the
+ * tone's frequency leaves a residual (noise, distortion and aliases) well
+ * below it. Tones above the output's Nyquist frequency must be filtered out
+ * instead of folding back into the speech band. Silence and DC come out
+ * unchanged, and splitting the input into odd blocks changes nothing.
+ *
+ * The benchmark resamples a speech cue from the 16 kHz capture rate and
+ * prints how many times faster than real time that runs on this host.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "host_test.h"
+#include "esp_log.h"
+#include "audio_resample.h"
+#include "wav_file.h"
+
+#define TONE_SECONDS        1
+#define TONE_AMPLITUDE      16000.0
+#define SETTLE_FRAMES       400         /* twice the longest filter */
+#define BENCH_ROUNDS        50
+
+typedef struct {
+    uint32_t in_rate;
+    uint32_t out_rate;
+    double min_snr_db;      /* pass band tones up to 0.8 of the output Nyquist frequency */
+    double min_reject_db;   /* tones from 1.2 times the output Nyquist frequency */
+} rate_case_t;
+
+static double seconds_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int16_t *tone(uint32_t rate, double freq, size_t frames)
+{
+    int16_t *pcm = malloc(frames * sizeof(int16_t));
+    for (size_t i = 0; i < frames; i++) {
+        pcm[i] = lrint(TONE_AMPLITUDE * sin(2 * M_PI * freq * i / rate));
+    }
+    return pcm;
+}
+
+static size_t resample_all(uint32_t in_rate, uint32_t out_rate, const int16_t *in, size_t frames, int16_t **out)
+{
+    audio_resample_t *rs = NULL;
+    CHECK_INT(audio_resample_create(in_rate, out_rate, 1, &rs), ESP_OK);
+    if (!rs) {
+        *out = NULL;
+        return 0;
+    }
+    *out = malloc(audio_resample_out_max(rs, frames) * sizeof(int16_t));
+    size_t n = audio_resample_process(rs, in, frames, 1, *out);
+    audio_resample_delete(rs);
+    return n;
+}
+
+/*
+ * Least-squares fit of a sine and cosine at `freq` to the settled output;
+ * the fit is the signal, what it leaves over (DC included) is noise. Returns
+ * the signal to noise ratio and the fitted amplitude.
+ */
+static double sine_fit_snr(const int16_t *pcm, size_t frames, uint32_t rate, double freq, double *amplitude)
+{
+    double ss = 0, cc = 0, sc = 0, xs = 0, xc = 0;
+    for (size_t i = SETTLE_FRAMES; i < frames - SETTLE_FRAMES; i++) {
+        double s = sin(2 * M_PI * freq * i / rate);
+        double c = cos(2 * M_PI * freq * i / rate);
+        ss += s * s;
+        cc += c * c;
+        sc += s * c;
+        xs += pcm[i] * s;
+        xc += pcm[i] * c;
+    }
+    double det = ss * cc - sc * sc;
+    double a = (xs * cc - xc * sc) / det;
+    double b = (xc * ss - xs * sc) / det;
+
+    double signal = 0, noise = 0;
+    for (size_t i = SETTLE_FRAMES; i < frames - SETTLE_FRAMES; i++) {
+        double fit = a * sin(2 * M_PI * freq * i / rate) + b * cos(2 * M_PI * freq * i / rate);
+        double e = pcm[i] - fit;
+        signal += fit * fit;
+        noise += e * e;
+    }
+    *amplitude = sqrt(a * a + b * b);
+    return 10 * log10(signal / (noise > 1e-9 ? noise : 1e-9));
+}
+
+static double rms_db(const int16_t *pcm, size_t frames)
+{
+    double sum = 0;
+    for (size_t i = SETTLE_FRAMES; i < frames - SETTLE_FRAMES; i++) {
+        sum += (double)pcm[i] * pcm[i];
+    }
+    return 10 * log10(sum / (frames - 2 * SETTLE_FRAMES) + 1e-9);
+}
+
+static void check_rate(const rate_case_t *rc)
+{
+    size_t frames = TONE_SECONDS * rc->in_rate;
+    double nyquist = (rc->in_rate < rc->out_rate ? rc->in_rate : rc->out_rate) / 2.0;
+    double worst_snr = INFINITY;
+    double worst_reject = INFINITY;
+
+    for (double freq = 100; freq <= 0.8 * nyquist; freq += 0.1 * nyquist) {
+        int16_t *in = tone(rc->in_rate, freq, frames);
+        int16_t *out = NULL;
+        size_t n = resample_all(rc->in_rate, rc->out_rate, in, frames, &out);
+        if (out) {
+            double amplitude = 0;
+            double snr = sine_fit_snr(out, n, rc->out_rate, freq, &amplitude);
+            worst_snr = snr < worst_snr ? snr : worst_snr;
+            /* Flat pass band, within 0.1 dB */
+            CHECK(fabs(20 * log10(amplitude / TONE_AMPLITUDE)) < 0.1);
+        }
+        free(in);
+        free(out);
+    }
+    /* Only a lower output rate has anything to reject */
+    for (double freq = 1.2 * nyquist; rc->out_rate < rc->in_rate && freq < rc->in_rate / 2.0; freq += 0.1 * nyquist) {
+        int16_t *in = tone(rc->in_rate, freq, frames);
+        int16_t *out = NULL;
+        size_t n = resample_all(rc->in_rate, rc->out_rate, in, frames, &out);
+        if (out) {
+            double reject = 20 * log10(TONE_AMPLITUDE / sqrt(2)) - rms_db(out, n);
+            worst_reject = reject < worst_reject ? reject : worst_reject;
+        }
+        free(in);
+        free(out);
+    }
+
+    printf("%5u -> %5u Hz: pass band SNR >= %.1f dB", rc->in_rate, rc->out_rate, worst_snr);
+    if (isfinite(worst_reject)) {
+        printf(", aliases down >= %.1f dB", worst_reject);
+    }
+    printf("\n");
+    CHECK(worst_snr >= rc->min_snr_db);
+    CHECK(!isfinite(worst_reject) || worst_reject >= rc->min_reject_db);
+}
+
+/* Silence stays silence, DC keeps its level, and the block size does not matter */
+static void check_exact(uint32_t in_rate, uint32_t out_rate)
+{
+    enum { FRAMES = 4000 };
+    int16_t *in = malloc(FRAMES * 2 * sizeof(int16_t));
+    for (size_t i = 0; i < FRAMES; i++) {
+        in[2 * i] = 1234;
+        in[2 * i + 1] = (int16_t)(i * 7919 % 20011 - 10005);
+    }
+
+    audio_resample_t *rs = NULL;
+    CHECK_INT(audio_resample_create(in_rate, out_rate, 2, &rs), ESP_OK);
+    if (!rs) {
+        free(in);
+        return;
+    }
+    size_t max = audio_resample_out_max(rs, FRAMES);
+    int16_t *whole = malloc(max * 2 * sizeof(int16_t));
+    int16_t *split = malloc((max + 16) * 2 * sizeof(int16_t));
+    size_t n = audio_resample_process(rs, in, FRAMES, 2, whole);
+    CHECK(n <= max);
+
+    audio_resample_reset(rs);
+    size_t m = 0;
+    for (size_t pos = 0, block = 1; pos < FRAMES; pos += block, block = block * 3 % 37 + 1) {
+        size_t len = FRAMES - pos < block ? FRAMES - pos : block;
+        size_t got = audio_resample_process(rs, in + 2 * pos, len, 2, split + 2 * m);
+        CHECK(got <= audio_resample_out_max(rs, len));
+        m += got;
+    }
+    CHECK_INT(m, n);
+    CHECK(0 == memcmp(whole, split, n * 2 * sizeof(int16_t)));
+
+    /* Channel 0 is DC: constant once the filter has filled */
+    int off = 0;
+    for (size_t i = audio_resample_out_max(rs, SETTLE_FRAMES / 2); i < n; i++) {
+        off += whole[2 * i] != 1234;
+    }
+    CHECK_INT(off, 0);
+
+    audio_resample_delete(rs);
+    free(whole);
+    free(split);
+    free(in);
+}
+
+static void bench(uint32_t out_rate, const int16_t *speech, size_t frames)
+{
+    audio_resample_t *rs = NULL;
+    CHECK_INT(audio_resample_create(16000, out_rate, 1, &rs), ESP_OK);
+    if (!rs) {
+        return;
+    }
+    int16_t *out = malloc(audio_resample_out_max(rs, frames) * sizeof(int16_t));
+    size_t n = 0;
+    double start = seconds_now();
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        audio_resample_reset(rs);
+        n = audio_resample_process(rs, speech, frames, 1, out);
+    }
+    double elapsed = seconds_now() - start;
+    double audio_s = (double)frames * BENCH_ROUNDS / 16000;
+    printf("16000 -> %5u Hz: %zu -> %zu samples, %.1f Msamples/s in, %.0fx real time\n", out_rate, frames, n,
+           frames * BENCH_ROUNDS / elapsed / 1e6, audio_s / elapsed);
+    free(out);
+    audio_resample_delete(rs);
+}
+
+int main(void)
+{
+    static const rate_case_t cases[] = {
+        { .in_rate = 16000, .out_rate = 8000, .min_snr_db = 65, .min_reject_db = 65 },
+        { .in_rate = 16000, .out_rate = 12000, .min_snr_db = 65, .min_reject_db = 65 },
+        /* The spiffs cues at 24 kHz down to the capture rate */
+        { .in_rate = 24000, .out_rate = 16000, .min_snr_db = 65, .min_reject_db = 65 },
+        { .in_rate = 8000, .out_rate = 16000, .min_snr_db = 65 },
+    };
+
+    esp_log_level_set("*", ESP_LOG_WARN);
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        check_rate(&cases[i]);
+        check_exact(cases[i].in_rate, cases[i].out_rate);
+    }
+
+    uint32_t rate = 0;
+    size_t frames = 0;
+    int16_t *speech = wav_load_mono("echo_en_end.wav", &rate, &frames);
+    CHECK(NULL != speech);
+    if (speech) {
+        CHECK_INT(rate, 16000);
+        bench(8000, speech, frames);
+        bench(12000, speech, frames);
+        free(speech);
+    }
+    HOST_TEST_EXIT();
+}
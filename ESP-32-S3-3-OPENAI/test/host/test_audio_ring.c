@@ -0,0 +1,157 @@
+/*
+ * The ring hammered from threads: one producer pushes frames as fast as it
+ * can while readers poll it, one flat out and one stalling now and then so
+ * the producer laps it. Every frame carries its sequence number in the
+ * timestamp and in every sample, so a reader can tell a torn copy (a frame
+ * the producer overwrote while it was being read) from a good one.
+ *
+ * Every frame a reader returns must be whole and newer than the last one,
+ * and read + dropped must account for every frame pushed.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "host_test.h"
+#include "esp_log.h"
+#include "audio_ring.h"
+
+#define CHANNELS        2
+
+typedef struct {
+    size_t frames;
+    size_t frame_samples;
+    uint32_t pushes;
+} ring_config_t;
+
+typedef struct {
+    audio_ring_t *ring;
+    const ring_config_t *config;
+    bool stall;
+    volatile bool *done;
+    uint32_t read;
+    uint32_t dropped;
+    uint32_t torn;              /* frame content not matching its timestamp */
+    uint32_t out_of_order;
+} reader_ctx_t;
+
+static inline int16_t sample_of(uint32_t seq, size_t i)
+{
+    return (int16_t)(seq * 2654435761u + i);
+}
+
+static void *producer_task(void *arg)
+{
+    reader_ctx_t *ctx = arg;
+    size_t samples = audio_ring_frame_size(ctx->ring) / sizeof(int16_t);
+    int16_t *frame = malloc(samples * sizeof(int16_t));
+
+    for (uint32_t seq = 0; seq < ctx->config->pushes; seq++) {
+        for (size_t i = 0; i < samples; i++) {
+            frame[i] = sample_of(seq, i);
+        }
+        audio_ring_push(ctx->ring, frame, seq);
+    }
+    free(frame);
+    return NULL;
+}
+
+static void *reader_task(void *arg)
+{
+    reader_ctx_t *ctx = arg;
+    audio_ring_reader_t reader;
+    size_t samples = audio_ring_frame_size(ctx->ring) / sizeof(int16_t);
+    int16_t *frame = malloc(samples * sizeof(int16_t));
+    int64_t last = -1;
+
+    audio_ring_reader_init(&reader, 0);
+    while (true) {
+        bool done = __atomic_load_n(ctx->done, __ATOMIC_ACQUIRE);
+        int64_t timestamp = 0;
+        if (ESP_OK != audio_ring_read(ctx->ring, &reader, frame, &timestamp)) {
+            if (done) {
+                /* The producer had finished before this last empty read */
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+        ctx->read++;
+        if (timestamp <= last || timestamp != reader.next - 1) {
+            ctx->out_of_order++;
+        }
+        last = timestamp;
+        for (size_t i = 0; i < samples; i++) {
+            if (frame[i] != sample_of(timestamp, i)) {
+                ctx->torn++;
+                break;
+            }
+        }
+        if (ctx->stall && 0 == ctx->read % 100) {
+            usleep(2000);
+        }
+    }
+    ctx->dropped = reader.dropped;
+    free(frame);
+    return NULL;
+}
+
+static void stress(const ring_config_t *config)
+{
+    audio_ring_t *ring = NULL;
+    CHECK_INT(audio_ring_create(config->frames, config->frame_samples, CHANNELS, &ring), ESP_OK);
+    if (!ring) {
+        return;
+    }
+
+    volatile bool done = false;
+    reader_ctx_t producer_ctx = { .ring = ring, .config = config };
+    reader_ctx_t readers[2] = {
+        { .ring = ring, .config = config, .done = &done },
+        { .ring = ring, .config = config, .done = &done, .stall = true },
+    };
+    pthread_t producer;
+    pthread_t consumer[2];
+    for (int i = 0; i < 2; i++) {
+        pthread_create(&consumer[i], NULL, reader_task, &readers[i]);
+    }
+    pthread_create(&producer, NULL, producer_task, &producer_ctx);
+    pthread_join(producer, NULL);
+    __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+    for (int i = 0; i < 2; i++) {
+        pthread_join(consumer[i], NULL);
+    }
+
+    CHECK_INT(audio_ring_head(ring), config->pushes);
+    for (int i = 0; i < 2; i++) {
+        reader_ctx_t *ctx = &readers[i];
+        printf("%zu x %zu samples, reader %d%s: %u read, %u dropped, %u torn, %u out of order\n", config->frames,
+               config->frame_samples, i, ctx->stall ? " (stalling)" : "", ctx->read, ctx->dropped, ctx->torn,
+               ctx->out_of_order);
+        CHECK_INT(ctx->torn, 0);
+        CHECK_INT(ctx->out_of_order, 0);
+        CHECK_INT(ctx->read + ctx->dropped, config->pushes);
+        CHECK(ctx->read > 0);
+    }
+    /* Lapped for sure, so the dropping path ran */
+    CHECK(readers[1].dropped > 0);
+    audio_ring_delete(ring);
+}
+
+int main(void)
+{
+    /* The feed task's ring, and two huge slots the producer keeps overwriting while they are copied */
+    static const ring_config_t configs[] = {
+        { .frames = 8, .frame_samples = 512, .pushes = 200000 },
+        { .frames = 2, .frame_samples = 32768, .pushes = 5000 },
+    };
+
+    esp_log_level_set("*", ESP_LOG_WARN);
+    for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++) {
+        stress(&configs[i]);
+    }
+    HOST_TEST_EXIT();
+}
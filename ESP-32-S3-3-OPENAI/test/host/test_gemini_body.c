@@ -0,0 +1,316 @@
+/*
+ * The streamed request body of gemini.c is byte for byte what the client
+ * built with cJSON before: a full base64 copy of the audio in one string
+ * node, printed with cJSON_PrintUnformatted(). Bodies are written with every
+ * split of the audio the uploader produces, plain and chunked.
+ *
+ * With ESP-IDF installed the reference is built by cJSON itself, otherwise by
+ * the same concatenation cJSON performs for this document.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host_test.h"
+#include "gemini.c"
+#if HOST_HAVE_CJSON
+#include "cJSON.h"
+#endif
+
+/* Fake connection: records what was sent, answers with a canned reply */
+struct esp_http_client {
+    esp_http_client_config_t config;
+    int open_len;
+    char *sent;
+    size_t sent_len;
+    size_t sent_cap;
+    size_t reply_pos;
+};
+
+static const char s_reply[] = "{\"candidates\":[{\"content\":{\"parts\":[{\"text\":\"A dog says woof.\"}]}}]}";
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+    esp_http_client_handle_t http = calloc(1, sizeof(struct esp_http_client));
+    if (http) {
+        http->config = *config;
+    }
+    return http;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t http, const char *url)
+{
+    http->config.url = url;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t http, const char *key, const char *value)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_delete_header(esp_http_client_handle_t http, const char *key)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_timeout_ms(esp_http_client_handle_t http, int timeout_ms)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t http, int write_len)
+{
+    http->open_len = write_len;
+    http->sent_len = 0;
+    http->reply_pos = 0;
+    return ESP_OK;
+}
+
+int esp_http_client_write(esp_http_client_handle_t http, const char *buffer, int len)
+{
+    if (http->sent_len + len > http->sent_cap) {
+        size_t cap = (http->sent_len + len) * 2;
+        char *sent = realloc(http->sent, cap);
+        if (!sent) {
+            return -1;
+        }
+        http->sent = sent;
+        http->sent_cap = cap;
+    }
+    memcpy(http->sent + http->sent_len, buffer, len);
+    http->sent_len += len;
+    return len;
+}
+
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t http)
+{
+    return sizeof(s_reply) - 1;
+}
+
+int esp_http_client_read(esp_http_client_handle_t http, char *buffer, int len)
+{
+    size_t left = sizeof(s_reply) - 1 - http->reply_pos;
+    size_t n = left < (size_t)len ? left : (size_t)len;
+    memcpy(buffer, s_reply + http->reply_pos, n);
+    http->reply_pos += n;
+    return n;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t http)
+{
+    return 200;
+}
+
+bool esp_http_client_is_complete_data_received(esp_http_client_handle_t http)
+{
+    return http->reply_pos == sizeof(s_reply) - 1;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t http)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t http)
+{
+    free(http->sent);
+    free(http);
+    return ESP_OK;
+}
+
+/* Independent of the mbedTLS stand-in the client links */
+static char *reference_base64(const uint8_t *data, size_t len)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    char *out = malloc((len + 2) / 3 * 4 + 1);
+    size_t pos = 0;
+
+    for (size_t bit = 0; bit < len * 8; bit += 6) {
+        uint32_t v = 0;
+        for (int i = 0; i < 6; i++) {
+            size_t b = bit + i;
+            v = (v << 1) | (b < len * 8 ? (data[b / 8] >> (7 - b % 8)) & 1 : 0);
+        }
+        out[pos++] = alphabet[v];
+    }
+    while (pos % 4) {
+        out[pos++] = '=';
+    }
+    out[pos] = '\0';
+    return out;
+}
+
+static char *reference_body(const char *mime_type, const uint8_t *audio, size_t len)
+{
+    char *b64 = reference_base64(audio, len);
+#if HOST_HAVE_CJSON
+    cJSON *root = cJSON_CreateObject();
+    cJSON *contents = cJSON_CreateArray();
+    cJSON *content = cJSON_CreateObject();
+    cJSON *parts = cJSON_CreateArray();
+
+    cJSON *part_text = cJSON_CreateObject();
+    cJSON_AddStringToObject(part_text, "text", GEMINI_SYSTEM_PROMPT);
+    cJSON_AddItemToArray(parts, part_text);
+
+    cJSON *part_audio = cJSON_CreateObject();
+    cJSON *inline_data = cJSON_CreateObject();
+    cJSON_AddStringToObject(inline_data, "mime_type", mime_type);
+    cJSON_AddStringToObject(inline_data, "data", b64);
+    cJSON_AddItemToObject(part_audio, "inline_data", inline_data);
+    cJSON_AddItemToArray(parts, part_audio);
+
+    cJSON_AddItemToObject(content, "parts", parts);
+    cJSON_AddItemToArray(contents, content);
+    cJSON_AddItemToObject(root, "contents", contents);
+
+    char *body = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+#else
+    /* No string here needs escaping, cJSON prints them as they are */
+    static const char format[] = "{\"contents\":[{\"parts\":[{\"text\":\"%s\"},"
+                                 "{\"inline_data\":{\"mime_type\":\"%s\",\"data\":\"%s\"}}]}]}";
+    size_t size = sizeof(format) + strlen(GEMINI_SYSTEM_PROMPT) + strlen(mime_type) + strlen(b64);
+    char *body = malloc(size);
+    snprintf(body, size, format, GEMINI_SYSTEM_PROMPT, mime_type, b64);
+#endif
+    free(b64);
+    return body;
+}
+
+/* Payload of a chunked body, NULL if the framing is broken */
+static char *dechunk(const char *data, size_t len, size_t *out_len)
+{
+    char *out = malloc(len + 1);
+    size_t pos = 0;
+    *out_len = 0;
+
+    while (pos < len) {
+        char *end = NULL;
+        unsigned long size = strtoul(data + pos, &end, 16);
+        if (end == data + pos || (size_t)(end - data) + 2 > len || 0 != memcmp(end, "\r\n", 2)) {
+            break;
+        }
+        pos = end - data + 2;
+        if (0 == size) {
+            if (pos + 2 == len && 0 == memcmp(data + pos, "\r\n", 2)) {
+                out[*out_len] = '\0';
+                return out;
+            }
+            break;
+        }
+        if (pos + size + 2 > len || 0 != memcmp(data + pos + size, "\r\n", 2)) {
+            break;
+        }
+        memcpy(out + *out_len, data + pos, size);
+        *out_len += size;
+        pos += size + 2;
+    }
+    free(out);
+    return NULL;
+}
+
+static void check_body(const char *mime_type, const uint8_t *audio, size_t len, size_t piece, bool chunked)
+{
+    esp_http_client_config_t config = { 0 };
+    esp_http_client_handle_t http = esp_http_client_init(&config);
+    char *buf = malloc(GEMINI_BODY_BUF_SIZE);
+    gemini_body_t body;
+
+    esp_http_client_open(http, chunked ? -1 : (int)gemini_body_length(mime_type, len));
+    gemini_body_init(&body, http, buf, chunked);
+    CHECK_INT(gemini_body_write_head(&body, mime_type), ESP_OK);
+    for (size_t pos = 0; pos < len; pos += piece) {
+        CHECK_INT(gemini_body_write_audio(&body, audio + pos, len - pos < piece ? len - pos : piece), ESP_OK);
+    }
+    CHECK_INT(gemini_body_write_tail(&body), ESP_OK);
+
+    char *expected = reference_body(mime_type, audio, len);
+    size_t sent_len = http->sent_len;
+    char *sent = chunked ? dechunk(http->sent, http->sent_len, &sent_len) : http->sent;
+    CHECK(NULL != sent);
+    if (sent) {
+        CHECK_INT(sent_len, strlen(expected));
+        CHECK_INT(gemini_body_length(mime_type, len), strlen(expected));
+        CHECK(sent_len == strlen(expected) && 0 == memcmp(sent, expected, sent_len));
+    }
+    if (sent != http->sent) {
+        free(sent);
+    }
+    free(expected);
+    free(buf);
+    esp_http_client_cleanup(http);
+}
+
+/* A whole query through the public API: the announced length and the body */
+static void check_query(gemini_client_t *client, const uint8_t *audio, size_t len)
+{
+    const char *reply = gemini_audio_query(client, audio, len, "audio/wav");
+    CHECK(NULL != reply && 0 == strcmp(reply, "A dog says woof."));
+
+    char *expected = reference_body("audio/wav", audio, len);
+    CHECK_INT(client->http->open_len, strlen(expected));
+    CHECK(client->http->sent_len == strlen(expected) && 0 == memcmp(client->http->sent, expected, strlen(expected)));
+    free(expected);
+    gemini_turn_end(client);
+}
+
+/* The pipelined upload: chunked, audio written as the uploader encodes it */
+static void check_upload(gemini_client_t *client, const uint8_t *audio, size_t len, size_t piece)
+{
+    const char *reply = NULL;
+
+    CHECK_INT(gemini_upload_begin(client, "audio/flac", NULL, NULL), ESP_OK);
+    for (size_t pos = 0; pos < len; pos += piece) {
+        CHECK_INT(gemini_upload_write(client, audio + pos, len - pos < piece ? len - pos : piece), ESP_OK);
+    }
+    CHECK_INT(gemini_upload_finish(client, &reply), ESP_OK);
+    CHECK(NULL != reply && 0 == strcmp(reply, "A dog says woof."));
+    CHECK_INT(client->http->open_len, -1);
+
+    char *expected = reference_body("audio/flac", audio, len);
+    size_t sent_len = 0;
+    char *sent = dechunk(client->http->sent, client->http->sent_len, &sent_len);
+    CHECK(NULL != sent && sent_len == strlen(expected) && 0 == memcmp(sent, expected, sent_len));
+    free(sent);
+    free(expected);
+    gemini_turn_end(client);
+}
+
+int main(void)
+{
+    static const size_t lengths[] = { 0, 1, 2, 3, 4, GEMINI_B64_CHUNK_IN - 1, GEMINI_B64_CHUNK_IN,
+                                      GEMINI_B64_CHUNK_IN + 1, 3 * GEMINI_B64_CHUNK_IN + 2, 100003
+                                    };
+    static const size_t pieces[] = { 1, 2, 4, 7, GEMINI_B64_CHUNK_IN - 1, GEMINI_B64_CHUNK_IN, 8192, SIZE_MAX };
+    const size_t max_len = 100003;
+
+    esp_log_level_set("*", ESP_LOG_WARN);
+    uint8_t *audio = malloc(max_len);
+    srandom(1);
+    for (size_t i = 0; i < max_len; i++) {
+        audio[i] = random();
+    }
+
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        for (size_t p = 0; p < sizeof(pieces) / sizeof(pieces[0]); p++) {
+            size_t piece = pieces[p] < lengths[l] ? pieces[p] : (lengths[l] ? lengths[l] : 1);
+            check_body("audio/wav", audio, lengths[l], piece, false);
+            check_body("audio/flac", audio, lengths[l], piece, true);
+        }
+    }
+
+    gemini_client_t *client = NULL;
+    CHECK_INT(gemini_client_create(" test-key\r\n", &client), ESP_OK);
+    if (client) {
+        CHECK(0 == strcmp(client->api_key, "test-key"));
+        check_query(client, audio, 0);
+        check_query(client, audio, max_len);
+        check_upload(client, audio, max_len, 4099);
+        gemini_client_delete(client);
+    }
+
+    free(audio);
+    HOST_TEST_EXIT();
+}
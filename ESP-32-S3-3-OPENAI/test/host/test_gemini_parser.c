@@ -0,0 +1,141 @@
+/*
+ * gemini_parser must give the same text however the response is split
+ * between reads: every document is fed in two pieces split at each byte
+ * offset, in three pieces at each pair of offsets, and a byte at a time.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "host_test.h"
+#include "gemini_parser.h"
+
+typedef struct {
+    char text[2048];
+    size_t len;
+} collect_t;
+
+static void collect_cb(const char *text, size_t len, void *user_ctx)
+{
+    collect_t *c = user_ctx;
+    if (c->len + len < sizeof(c->text)) {
+        memcpy(c->text + c->len, text, len);
+        c->len += len;
+        c->text[c->len] = '\0';
+    }
+}
+
+/* Feeds `doc` cut at `cuts`, returns the result of finish, or of the first failing feed */
+static esp_err_t parse_split(const gemini_parser_path_t *path, uint8_t path_len, const char *doc,
+                             const size_t *cuts, int ncuts, collect_t *out)
+{
+    gemini_parser_t parser;
+    size_t len = strlen(doc);
+    size_t pos = 0;
+
+    memset(out, 0, sizeof(*out));
+    gemini_parser_init(&parser, path, path_len, collect_cb, out);
+    for (int i = 0; i <= ncuts; i++) {
+        size_t end = i < ncuts ? cuts[i] : len;
+        esp_err_t ret = gemini_parser_feed(&parser, doc + pos, end - pos);
+        if (ESP_OK != ret) {
+            return ret;
+        }
+        pos = end;
+    }
+    return gemini_parser_finish(&parser);
+}
+
+static void check_doc(const gemini_parser_path_t *path, uint8_t path_len, const char *doc,
+                      esp_err_t expected_ret, const char *expected_text)
+{
+    size_t len = strlen(doc);
+    collect_t out;
+
+    for (size_t a = 0; a <= len; a++) {
+        size_t cut[1] = { a };
+        esp_err_t ret = parse_split(path, path_len, doc, cut, 1, &out);
+        CHECK_INT(ret, expected_ret);
+        if (expected_text && ESP_OK == ret) {
+            CHECK(0 == strcmp(out.text, expected_text));
+        }
+    }
+    for (size_t a = 0; a <= len; a++) {
+        for (size_t b = a; b <= len; b++) {
+            size_t cuts[2] = { a, b };
+            esp_err_t ret = parse_split(path, path_len, doc, cuts, 2, &out);
+            if (ret != expected_ret || (expected_text && ESP_OK == ret && 0 != strcmp(out.text, expected_text))) {
+                fprintf(stderr, "split at %zu and %zu\n", a, b);
+                CHECK(false);
+                return;
+            }
+        }
+    }
+
+    size_t *bytes = malloc((len + 1) * sizeof(size_t));
+    for (size_t i = 0; i < len; i++) {
+        bytes[i] = i + 1;
+    }
+    esp_err_t ret = parse_split(path, path_len, doc, bytes, len ? len - 1 : 0, &out);
+    CHECK_INT(ret, expected_ret);
+    if (expected_text && ESP_OK == ret) {
+        CHECK(0 == strcmp(out.text, expected_text));
+    }
+    free(bytes);
+}
+
+int main(void)
+{
+    /* Several parts, escapes of every kind, a surrogate pair, raw UTF-8, and "text" keys off the path */
+    static const char reply[] =
+        "{\n"
+        "  \"candidates\": [\n"
+        "    {\n"
+        "      \"content\": {\n"
+        "        \"parts\": [\n"
+        "          { \"text\": \"A dog \\\"says\\\"\\nwoof\\t\\u00e9 \" },\n"
+        "          { \"thought\": true, \"text\": \"\\ud83d\\udc36 caf\xc3\xa9\\\\\\/\" }\n"
+        "        ],\n"
+        "        \"role\": \"model\"\n"
+        "      },\n"
+        "      \"finishReason\": \"STOP\",\n"
+        "      \"safetyRatings\": [{\"text\": \"no\"}, -1.5e3, null, false]\n"
+        "    },\n"
+        "    { \"content\": { \"parts\": [ { \"text\": \"second candidate\" } ] } }\n"
+        "  ],\n"
+        "  \"usageMetadata\": { \"promptTokenCount\": 12, \"text\": \"no\" },\n"
+        "  \"modelVersion\": \"gemini-2.5-flash\"\n"
+        "}\n";
+    static const char reply_text[] = "A dog \"says\"\nwoof\t\xc3\xa9 \xf0\x9f\x90\xb6 caf\xc3\xa9\\/";
+
+    static const char error[] =
+        "{\"error\":{\"code\":400,\"message\":\"API key not valid. Please pass a valid API key.\","
+        "\"status\":\"INVALID_ARGUMENT\",\"details\":[{\"@type\":\"type.googleapis.com/google.rpc.ErrorInfo\"}]}}";
+
+    check_doc(GEMINI_PARSER_PATH_TEXT, GEMINI_PARSER_PATH_TEXT_LEN, reply, ESP_OK, reply_text);
+    check_doc(GEMINI_PARSER_PATH_ERROR, GEMINI_PARSER_PATH_ERROR_LEN, error, ESP_OK,
+              "API key not valid. Please pass a valid API key.");
+    /* The text path finds nothing in an error, the document is still valid */
+    check_doc(GEMINI_PARSER_PATH_TEXT, GEMINI_PARSER_PATH_TEXT_LEN, error, ESP_OK, "");
+    /* A longer reply than the parser's output buffer */
+    {
+        static char big[4096];
+        static char big_text[2048];
+        memset(big_text, 'x', 1500);
+        big_text[1500] = '\0';
+        snprintf(big, sizeof(big), "{\"candidates\":[{\"content\":{\"parts\":[{\"text\":\"%s\"}]}}]}", big_text);
+        collect_t out;
+        size_t cut[1] = { 777 };
+        CHECK_INT(parse_split(GEMINI_PARSER_PATH_TEXT, GEMINI_PARSER_PATH_TEXT_LEN, big, cut, 1, &out), ESP_OK);
+        CHECK(0 == strcmp(out.text, big_text));
+    }
+
+    /* Malformed or cut documents fail wherever they are split */
+    check_doc(GEMINI_PARSER_PATH_TEXT, GEMINI_PARSER_PATH_TEXT_LEN, "{\"candidates\":[{\"content\":", ESP_ERR_INVALID_RESPONSE, NULL);
+    check_doc(GEMINI_PARSER_PATH_TEXT, GEMINI_PARSER_PATH_TEXT_LEN, "{\"a\":[1,2}", ESP_ERR_INVALID_RESPONSE, NULL);
+    check_doc(GEMINI_PARSER_PATH_TEXT, GEMINI_PARSER_PATH_TEXT_LEN, "{\"a\":\"\\q\"}", ESP_ERR_INVALID_RESPONSE, NULL);
+    check_doc(GEMINI_PARSER_PATH_TEXT, GEMINI_PARSER_PATH_TEXT_LEN, "{\"a\":\"\\u12g4\"}", ESP_ERR_INVALID_RESPONSE, NULL);
+    check_doc(GEMINI_PARSER_PATH_TEXT, GEMINI_PARSER_PATH_TEXT_LEN, "{} {}", ESP_ERR_INVALID_RESPONSE, NULL);
+    check_doc(GEMINI_PARSER_PATH_TEXT, GEMINI_PARSER_PATH_TEXT_LEN, "", ESP_ERR_INVALID_RESPONSE, NULL);
+
+    HOST_TEST_EXIT();
+}
@@ -0,0 +1,148 @@
+/*
+ * Retries, the turn budget and the hedged request of gemini.c against
+ * tools/mock_gemini.py, over the POSIX esp_http_client. ctest starts the
+ * server with the faults each mode is about:
+ *
+ *   retry   every request answered 503 with Retry-After: 1. All attempts are
+ *           made, each one the server's delay after the one before.
+ *   budget  the server takes longer than the turn budget. The query gives up
+ *           within the budget, after one attempt.
+ *   hedge   (built with a hedge delay) the first request stalls. The hedge
+ *           answers in time, the stalled request is closed once it returns,
+ *           and the next turn goes out on the winner's connection.
+ *   hedge-open  the same with the first request stuck connecting instead.
+ *           The query doesn't wait for it, and it never starts on the body.
+ *
+ * Built with a short CONFIG_GEMINI_TURN_BUDGET_MS, see CMakeLists.txt.
+ */
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "host_test.h"
+#include "esp_http_client.h"
+#include "esp_timer.h"
+
+#define MAX_OPENS       8
+/* On top of what the client waits: scheduling, and socket timeouts firing up to ~250 ms late on a loaded host */
+#define SLACK_MS        500
+
+static struct {
+    atomic_int opens;
+    int64_t t_open[MAX_OPENS];
+    atomic_int cleanups;
+    int stall_open_ms;          /* the first open takes this long, as if connecting */
+} s_http;
+
+static esp_err_t counted_open(esp_http_client_handle_t client, int write_len)
+{
+    int n = atomic_fetch_add(&s_http.opens, 1);
+    if (n < MAX_OPENS) {
+        s_http.t_open[n] = esp_timer_get_time();
+    }
+    if (0 == n && s_http.stall_open_ms) {
+        usleep(s_http.stall_open_ms * 1000);
+    }
+    return esp_http_client_open(client, write_len);
+}
+
+static esp_err_t counted_cleanup(esp_http_client_handle_t client)
+{
+    atomic_fetch_add(&s_http.cleanups, 1);
+    return esp_http_client_cleanup(client);
+}
+
+#define esp_http_client_open    counted_open
+#define esp_http_client_cleanup counted_cleanup
+#include "gemini.c"
+
+static uint8_t s_audio[4096];
+
+static int elapsed_ms(int64_t since)
+{
+    return (int)((esp_timer_get_time() - since) / 1000);
+}
+
+static void test_retry(gemini_client_t *client)
+{
+    const char *reply = gemini_audio_query(client, s_audio, sizeof(s_audio), "audio/flac");
+    CHECK(NULL == reply);
+    CHECK_INT(atomic_load(&s_http.opens), CONFIG_GEMINI_MAX_ATTEMPTS);
+    for (int i = 1; i < CONFIG_GEMINI_MAX_ATTEMPTS && i < MAX_OPENS; i++) {
+        /* Retry-After, not the shorter backoff of the first attempts */
+        int gap_ms = (int)((s_http.t_open[i] - s_http.t_open[i - 1]) / 1000);
+        printf("attempt %d after %d ms\n", i + 1, gap_ms);
+        CHECK(gap_ms >= 1000);
+        CHECK(gap_ms < 1000 + SLACK_MS);
+    }
+}
+
+static void test_budget(gemini_client_t *client)
+{
+    int64_t t_start = esp_timer_get_time();
+    const char *reply = gemini_audio_query(client, s_audio, sizeof(s_audio), "audio/flac");
+    int ms = elapsed_ms(t_start);
+    printf("gave up after %d ms of a %d ms budget\n", ms, CONFIG_GEMINI_TURN_BUDGET_MS);
+    CHECK(NULL == reply);
+    CHECK(ms < CONFIG_GEMINI_TURN_BUDGET_MS + SLACK_MS);
+    CHECK_INT(atomic_load(&s_http.opens), 1);
+}
+
+static void test_hedge(gemini_client_t *client, int stall_ms)
+{
+    int64_t t_start = esp_timer_get_time();
+    const char *reply = gemini_audio_query(client, s_audio, sizeof(s_audio), "audio/flac");
+    int ms = elapsed_ms(t_start);
+    printf("hedged reply after %d ms, the first request stalls %d ms\n", ms, stall_ms);
+    CHECK(NULL != reply);
+    CHECK(ms < CONFIG_GEMINI_HEDGE_DELAY_MS + SLACK_MS);
+    CHECK_INT(atomic_load(&s_http.opens), 2);
+    /* The loser still waits for its headers or its connection, nothing closed it yet */
+    CHECK_INT(atomic_load(&s_http.cleanups), 0);
+    gemini_turn_end(client);
+
+    /* The next turn reuses the winner's connection */
+    reply = gemini_audio_query(client, s_audio, sizeof(s_audio), "audio/flac");
+    CHECK(NULL != reply);
+    CHECK(client->conn->connected);
+    gemini_turn_end(client);
+
+    /* Once the server answers it or it connected, the loser closes its own connection */
+    for (int waited = 0; waited < stall_ms + SLACK_MS && 0 == atomic_load(&s_http.cleanups); waited += 10) {
+        usleep(10 * 1000);
+    }
+    CHECK_INT(atomic_load(&s_http.cleanups), 1);
+}
+
+int main(int argc, char **argv)
+{
+    const char *mode = argc > 1 ? argv[1] : "";
+    int stall_ms = argc > 2 ? atoi(argv[2]) : 0;
+
+    for (size_t i = 0; i < sizeof(s_audio); i++) {
+        s_audio[i] = esp_random();
+    }
+    gemini_client_t *client = NULL;
+    CHECK_INT(gemini_client_create("test-key", &client), ESP_OK);
+    if (NULL == client) {
+        HOST_TEST_EXIT();
+    }
+
+    if (0 == strcmp(mode, "retry")) {
+        test_retry(client);
+    } else if (0 == strcmp(mode, "budget")) {
+        test_budget(client);
+    } else if (0 == strcmp(mode, "hedge") && CONFIG_GEMINI_HEDGE_DELAY_MS) {
+        test_hedge(client, stall_ms);
+    } else if (0 == strcmp(mode, "hedge-open") && CONFIG_GEMINI_HEDGE_DELAY_MS) {
+        s_http.stall_open_ms = stall_ms;
+        test_hedge(client, stall_ms);
+    } else {
+        fprintf(stderr, "usage: %s retry | budget | hedge <stall ms> | hedge-open <stall ms>, hedge needs a hedge delay\n", argv[0]);
+        return 2;
+    }
+
+    gemini_client_delete(client);
+    HOST_TEST_EXIT();
+}
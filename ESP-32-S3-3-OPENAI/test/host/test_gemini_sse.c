@@ -0,0 +1,140 @@
+/*
+ * The SSE splitter must report the same events with the same text however
+ * streamGenerateContent's response is split between reads: the stream is fed
+ * in two pieces cut at every byte offset, in three pieces cut at every pair
+ * of offsets, and a byte at a time.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "host_test.h"
+#include "gemini_parser.h"
+
+#define MAX_EVENTS  8
+
+typedef struct {
+    char text[512];
+    size_t len;
+    size_t notified;
+    char delta[MAX_EVENTS][128];
+    int events;
+} stream_t;
+
+static void text_cb(const char *text, size_t len, void *user_ctx)
+{
+    stream_t *s = user_ctx;
+    if (s->len + len < sizeof(s->text)) {
+        memcpy(s->text + s->len, text, len);
+        s->len += len;
+        s->text[s->len] = '\0';
+    }
+}
+
+/* What the client does for every event: hand the new text to the display */
+static void event_cb(void *user_ctx)
+{
+    stream_t *s = user_ctx;
+    if (s->events < MAX_EVENTS) {
+        size_t n = s->len - s->notified;
+        n = n < sizeof(s->delta[0]) - 1 ? n : sizeof(s->delta[0]) - 1;
+        memcpy(s->delta[s->events], s->text + s->notified, n);
+        s->delta[s->events][n] = '\0';
+    }
+    s->notified = s->len;
+    s->events++;
+}
+
+static esp_err_t feed_split(const char *stream, const size_t *cuts, int ncuts, stream_t *out)
+{
+    gemini_sse_t sse;
+    size_t len = strlen(stream);
+    size_t pos = 0;
+
+    memset(out, 0, sizeof(*out));
+    gemini_sse_init(&sse, GEMINI_PARSER_PATH_TEXT, GEMINI_PARSER_PATH_TEXT_LEN, text_cb, event_cb, out);
+    for (int i = 0; i <= ncuts; i++) {
+        size_t end = i < ncuts ? cuts[i] : len;
+        esp_err_t ret = gemini_sse_feed(&sse, stream + pos, end - pos);
+        if (ESP_OK != ret) {
+            return ret;
+        }
+        pos = end;
+    }
+    return gemini_sse_finish(&sse);
+}
+
+static bool same(const stream_t *s, esp_err_t ret, esp_err_t expected_ret, const char *const *deltas, int events)
+{
+    if (ret != expected_ret) {
+        return false;
+    }
+    if (ESP_OK != ret) {
+        return true;
+    }
+    if (s->events != events) {
+        return false;
+    }
+    for (int i = 0; i < events; i++) {
+        if (0 != strcmp(s->delta[i], deltas[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void check_stream(const char *stream, esp_err_t expected_ret, const char *const *deltas, int events)
+{
+    size_t len = strlen(stream);
+    stream_t out;
+
+    for (size_t a = 0; a <= len; a++) {
+        for (size_t b = a; b <= len; b++) {
+            size_t cuts[2] = { a, b };
+            esp_err_t ret = feed_split(stream, cuts, 2, &out);
+            if (!same(&out, ret, expected_ret, deltas, events)) {
+                fprintf(stderr, "split at %zu and %zu: %s, %d events\n", a, b, esp_err_to_name(ret), out.events);
+                CHECK(false);
+                return;
+            }
+        }
+    }
+
+    size_t *bytes = malloc((len + 1) * sizeof(size_t));
+    for (size_t i = 0; i < len; i++) {
+        bytes[i] = i + 1;
+    }
+    esp_err_t ret = feed_split(stream, bytes, len ? len - 1 : 0, &out);
+    CHECK(same(&out, ret, expected_ret, deltas, events));
+    free(bytes);
+}
+
+int main(void)
+{
+    /*
+     * LF and CRLF line ends, a comment, an event field, "data:" without the
+     * space, a payload over two data lines, an event without text, and the
+     * last event left unterminated at the end of the stream.
+     */
+    static const char stream[] =
+        ": keep-alive\n"
+        "data: {\"candidates\": [{\"content\": {\"parts\": [{\"text\": \"A dog\"}],\"role\": \"model\"}}]}\r\n"
+        "\r\n"
+        "event: message\n"
+        "data:{\"candidates\": [{\"content\": {\"parts\": [{\"text\": \" says \\\"woof\\\"\"}]}}],\n"
+        "data: \"usageMetadata\": {\"promptTokenCount\": 12}}\n"
+        "\n"
+        "data: {\"candidates\": [{\"finishReason\": \"STOP\"}]}\n"
+        "\n"
+        "data: {\"candidates\": [{\"content\": {\"parts\": [{\"text\": \" \\u00e9\\n\"}]}}]}";
+    static const char *const deltas[] = { "A dog", " says \"woof\"", "", " \xc3\xa9\n" };
+
+    check_stream(stream, ESP_OK, deltas, 4);
+    check_stream("", ESP_OK, NULL, 0);
+    check_stream(": only a comment\r\n\r\n", ESP_OK, NULL, 0);
+
+    /* An event carrying broken JSON fails however the stream is split */
+    check_stream("data: {\"candidates\": [}\n\n", ESP_ERR_INVALID_RESPONSE, NULL, 0);
+    check_stream("data: {\"candidates\": [{\"content\": {\"parts\": [{\"text\": \"cut", ESP_ERR_INVALID_RESPONSE, NULL, 0);
+
+    HOST_TEST_EXIT();
+}
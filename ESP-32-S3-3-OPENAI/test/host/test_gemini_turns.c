@@ -0,0 +1,293 @@
+/*
+ * 1000 simulated turns through one gemini_client_t: buffered, streamed and
+ * pipelined queries with random audio and reply sizes, a server closing the
+ * connection now and then, the odd error reply and the odd turn cancelled
+ * from another task while its reply comes in. After the first turn has
+ * allocated what the client keeps, the heap must not move: the same bytes in
+ * use and no more free chunks, i.e. no leak and no fragmentation. Deleting
+ * the client gives back everything it took.
+ *
+ * Run by ctest with glibc's thread cache off, see CMakeLists.txt.
+ */
+
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host_test.h"
+#include "gemini.c"
+
+#define TURNS           1000
+#define AUDIO_MAX       (64 * 1024)
+#define REPLY_MAX       3000
+
+/* Fake server behind a keep-alive connection, the reply is set before each turn */
+struct esp_http_client {
+    esp_http_client_config_t config;
+    bool stream;
+    bool connected;
+    int status;
+    bool close;                 /* answer with Connection: close */
+    const char *reply;
+    size_t reply_len;
+    size_t reply_pos;
+    int reads;
+};
+
+static struct {
+    int status;
+    bool close;
+    char text[REPLY_MAX + 1];
+    char reply[2 * REPLY_MAX];
+    char sse[4 * REPLY_MAX];
+    int connects;
+    gemini_client_t *cancel;    /* gemini_cancel() at the second read of the reply */
+} s_server;
+
+static void http_event(esp_http_client_handle_t http, esp_http_client_event_id_t id, char *key, char *value)
+{
+    esp_http_client_event_t evt = {
+        .event_id = id,
+        .client = http,
+        .user_data = http->config.user_data,
+        .header_key = key,
+        .header_value = value,
+    };
+    http->config.event_handler(&evt);
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+    esp_http_client_handle_t http = calloc(1, sizeof(struct esp_http_client));
+    if (http) {
+        http->config = *config;
+        http->stream = NULL != strstr(config->url, "alt=sse");
+    }
+    return http;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t http, const char *url)
+{
+    http->stream = NULL != strstr(url, "alt=sse");
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t http, const char *key, const char *value)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_delete_header(esp_http_client_handle_t http, const char *key)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_timeout_ms(esp_http_client_handle_t http, int timeout_ms)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t http, int write_len)
+{
+    if (!http->connected) {
+        http->connected = true;
+        s_server.connects++;
+        http_event(http, HTTP_EVENT_ON_CONNECTED, NULL, NULL);
+    }
+    return ESP_OK;
+}
+
+int esp_http_client_write(esp_http_client_handle_t http, const char *buffer, int len)
+{
+    return len;
+}
+
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t http)
+{
+    http->status = s_server.status;
+    http->close = s_server.close;
+    if (200 == http->status && http->stream) {
+        http->reply = s_server.sse;
+    } else {
+        http->reply = s_server.reply;
+    }
+    http->reply_len = strlen(http->reply);
+    http->reply_pos = 0;
+    http->reads = 0;
+    if (http->close) {
+        http_event(http, HTTP_EVENT_ON_HEADER, "Connection", "close");
+    }
+    return http->reply_len;
+}
+
+int esp_http_client_read(esp_http_client_handle_t http, char *buffer, int len)
+{
+    if (s_server.cancel && 2 == ++http->reads) {
+        gemini_cancel(s_server.cancel, true);
+    }
+    size_t left = http->reply_len - http->reply_pos;
+    size_t n = left < (size_t)len ? left : (size_t)len;
+    memcpy(buffer, http->reply + http->reply_pos, n);
+    http->reply_pos += n;
+    return n;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t http)
+{
+    return http->status;
+}
+
+bool esp_http_client_is_complete_data_received(esp_http_client_handle_t http)
+{
+    return http->reply_pos == http->reply_len;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t http)
+{
+    if (http->connected) {
+        http->connected = false;
+        http_event(http, HTTP_EVENT_DISCONNECTED, NULL, NULL);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t http)
+{
+    esp_http_client_close(http);
+    free(http);
+    return ESP_OK;
+}
+
+/* A reply of `len` characters, as one document and as an SSE stream of three events */
+static void server_set_reply(int status, size_t len, bool close)
+{
+    for (size_t i = 0; i < len; i++) {
+        s_server.text[i] = 'a' + i % 26;
+    }
+    s_server.text[len] = '\0';
+    s_server.status = status;
+    s_server.close = close;
+
+    if (200 != status) {
+        snprintf(s_server.reply, sizeof(s_server.reply), "{\"error\":{\"code\":%d,\"message\":\"%s\"}}", status, s_server.text);
+        return;
+    }
+    snprintf(s_server.reply, sizeof(s_server.reply), "{\"candidates\":[{\"content\":{\"parts\":[{\"text\":\"%s\"}]}}]}", s_server.text);
+    size_t pos = 0;
+    for (size_t i = 0, cut = 0; i < 3; i++) {
+        size_t next = len * (i + 1) / 3;
+        pos += snprintf(s_server.sse + pos, sizeof(s_server.sse) - pos,
+                        "data: {\"candidates\":[{\"content\":{\"parts\":[{\"text\":\"%.*s\"}]}}]}\r\n\r\n",
+                        (int)(next - cut), s_server.text + cut);
+        cut = next;
+    }
+}
+
+static void partial_cb(const char *delta, size_t delta_len, const char *text, void *user_ctx)
+{
+    (*(size_t *)user_ctx) += delta_len;
+}
+
+static const char *run_turn(gemini_client_t *client, int turn, const uint8_t *audio, size_t len)
+{
+    const char *reply = NULL;
+    size_t streamed = 0;
+
+    switch (turn % 3) {
+    case 0:
+        reply = gemini_audio_query(client, audio, len, "audio/wav");
+        break;
+    case 1:
+        reply = gemini_audio_query_stream(client, audio, len, "audio/wav", partial_cb, &streamed);
+        CHECK(NULL == reply || streamed == strlen(reply));
+        break;
+    default:
+        if (ESP_OK == gemini_upload_begin(client, "audio/flac", turn % 2 ? partial_cb : NULL, &streamed)) {
+            for (size_t pos = 0; pos < len; pos += 4099) {
+                gemini_upload_write(client, audio + pos, len - pos < 4099 ? len - pos : 4099);
+            }
+            gemini_upload_finish(client, &reply);
+        }
+        break;
+    }
+    return reply;
+}
+
+static void print_heap(const char *when, const struct mallinfo2 *mi)
+{
+    printf("%-22s in use %8zu bytes, free %8zu bytes in %4zu chunks, heap %8zu bytes\n", when, mi->uordblks,
+           mi->fordblks, mi->ordblks, mi->arena);
+}
+
+int main(void)
+{
+    esp_log_level_set("*", ESP_LOG_NONE);
+    uint8_t *audio = malloc(AUDIO_MAX);
+    srandom(9);
+    for (size_t i = 0; i < AUDIO_MAX; i++) {
+        audio[i] = random();
+    }
+
+    /* stdout allocates what it keeps on first use */
+    printf("%d turns\n", TURNS);
+    struct mallinfo2 before = mallinfo2();
+    print_heap("before the client", &before);
+
+    gemini_client_t *client = NULL;
+    CHECK_INT(gemini_client_create("test-key", &client), ESP_OK);
+    if (!client) {
+        HOST_TEST_EXIT();
+    }
+
+    struct mallinfo2 first = { 0 };
+    size_t peak = 0;
+    int replies = 0;
+    for (int turn = 0; turn < TURNS; turn++) {
+        /* Every 50th turn the server closes the connection, every 97th it rejects the request */
+        int status = turn % 97 == 96 ? 400 : 200;
+        size_t reply_len = 1 + random() % REPLY_MAX;
+        server_set_reply(status, reply_len, turn % 50 == 49);
+        /* Every 31st turn is cancelled: no reply, and the connection with unread data in it is dropped */
+        s_server.cancel = turn % 31 == 30 ? client : NULL;
+
+        const char *reply = run_turn(client, turn, audio, 1 + random() % AUDIO_MAX);
+        if (s_server.cancel) {
+            CHECK(gemini_cancelled(client));
+            CHECK(NULL == reply);
+            /* Cleared, the next query goes through on a new connection */
+            s_server.cancel = NULL;
+            gemini_cancel(client, false);
+            int connects = s_server.connects;
+            server_set_reply(200, reply_len, false);
+            CHECK(NULL != run_turn(client, turn, audio, 1 + random() % AUDIO_MAX));
+            CHECK_INT(s_server.connects, connects + 1);
+        } else if (200 == status) {
+            CHECK(NULL != reply && 0 == strcmp(reply, s_server.text));
+            replies += NULL != reply;
+        } else {
+            CHECK(NULL == reply);
+        }
+        peak = client->arena.peak > peak ? client->arena.peak : peak;
+        gemini_turn_end(client);
+        CHECK_INT(client->arena.used, 0);
+
+        if (0 == turn) {
+            first = mallinfo2();
+            print_heap("after turn 1", &first);
+        }
+    }
+
+    struct mallinfo2 last = mallinfo2();
+    print_heap("after turn 1000", &last);
+    printf("%d replies, %d connections, turn arena peak %zu of %zu bytes\n", replies, s_server.connects, peak,
+           client->arena.size);
+    CHECK_INT(last.uordblks, first.uordblks);
+    CHECK(last.ordblks <= first.ordblks);
+
+    gemini_client_delete(client);
+    struct mallinfo2 after = mallinfo2();
+    print_heap("after the client", &after);
+    CHECK_INT(after.uordblks, before.uordblks);
+
+    free(audio);
+    HOST_TEST_EXIT();
+}
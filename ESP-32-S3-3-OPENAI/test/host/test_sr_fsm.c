@@ -0,0 +1,279 @@
+/*
+ * Transition table of the SR handler's turn state machine
+ *
+ * Every event in every state, online and offline, with the state it leads
+ * to and the actions the handler has to carry out. The table must cover all
+ * pairs, so a new state or event can not slip in without its row here.
+ * A few event sequences follow: a whole turn, a turn queued offline, and the
+ * child barging in on a turn still waiting for its answer, whose late reply
+ * must not end the new one.
+ */
+
+#include <string.h>
+#include "host_test.h"
+#include "sr_fsm.h"
+
+#define TURN            7       /* sr_fsm_t.turn at the start of every row */
+
+#define IDLE            SR_STATE_IDLE
+#define LISTENING       SR_STATE_LISTENING
+#define UPLOADING       SR_STATE_UPLOADING
+#define REPLYING        SR_STATE_REPLYING
+
+#define CANCEL          SR_ACTION_TURN_CANCEL
+#define ABORT           SR_ACTION_TURN_ABORT
+#define START           SR_ACTION_TURN_START
+#define UPLOAD          SR_ACTION_UPLOAD_START
+#define SEND            SR_ACTION_TURN_SEND
+#define QUEUE           SR_ACTION_TURN_QUEUE
+
+typedef struct {
+    sr_state_t from;
+    sr_event_type_t event;
+    bool online;
+    bool muted;
+    uint32_t reply_turn;        /* SR_EVENT_REPLIED */
+    sr_state_t to;
+    uint32_t actions;
+    uint32_t turn;              /* sr_fsm_t.turn after the event */
+} transition_t;
+
+#define ROW(from_, event_, online_, to_, actions_) \
+    { .from = from_, .event = event_, .online = online_, .reply_turn = TURN, .to = to_, .actions = actions_, .turn = TURN }
+
+static const transition_t s_table[] = {
+    /* The wake word starts a turn everywhere; the one being recorded is dropped, the one being sent given up on */
+    ROW(IDLE, SR_EVENT_WAKE, true, LISTENING, START | UPLOAD),
+    ROW(IDLE, SR_EVENT_WAKE, false, LISTENING, START),
+    ROW(LISTENING, SR_EVENT_WAKE, true, LISTENING, CANCEL | START | UPLOAD),
+    ROW(LISTENING, SR_EVENT_WAKE, false, LISTENING, CANCEL | START),
+    ROW(UPLOADING, SR_EVENT_WAKE, true, LISTENING, ABORT | START | UPLOAD),
+    ROW(UPLOADING, SR_EVENT_WAKE, false, LISTENING, ABORT | START),
+    ROW(REPLYING, SR_EVENT_WAKE, true, LISTENING, START | UPLOAD),
+    ROW(REPLYING, SR_EVENT_WAKE, false, LISTENING, START),
+
+    /* The end of speech sends the turn, or queues it offline, and numbers it */
+    ROW(IDLE, SR_EVENT_END_OF_SPEECH, true, IDLE, 0),
+    { .from = LISTENING, .event = SR_EVENT_END_OF_SPEECH, .online = true, .to = UPLOADING, .actions = SEND, .turn = TURN + 1 },
+    { .from = LISTENING, .event = SR_EVENT_END_OF_SPEECH, .online = false, .to = UPLOADING, .actions = QUEUE, .turn = TURN + 1 },
+    ROW(UPLOADING, SR_EVENT_END_OF_SPEECH, true, UPLOADING, 0),
+    ROW(REPLYING, SR_EVENT_END_OF_SPEECH, true, REPLYING, 0),
+
+    ROW(IDLE, SR_EVENT_NO_SPEECH, true, IDLE, 0),
+    ROW(LISTENING, SR_EVENT_NO_SPEECH, true, IDLE, CANCEL | SR_ACTION_SLEEP),
+    ROW(UPLOADING, SR_EVENT_NO_SPEECH, true, UPLOADING, 0),
+    ROW(REPLYING, SR_EVENT_NO_SPEECH, true, REPLYING, 0),
+
+    ROW(IDLE, SR_EVENT_COMMAND, true, IDLE, 0),
+    ROW(LISTENING, SR_EVENT_COMMAND, true, IDLE, CANCEL | SR_ACTION_COMMAND),
+    ROW(LISTENING, SR_EVENT_COMMAND, false, IDLE, CANCEL | SR_ACTION_COMMAND),
+    ROW(UPLOADING, SR_EVENT_COMMAND, true, UPLOADING, 0),
+    ROW(REPLYING, SR_EVENT_COMMAND, true, REPLYING, 0),
+
+    /* Only the reply to the last turn sent counts */
+    ROW(IDLE, SR_EVENT_REPLIED, true, IDLE, 0),
+    ROW(LISTENING, SR_EVENT_REPLIED, true, LISTENING, 0),
+    ROW(UPLOADING, SR_EVENT_REPLIED, true, REPLYING, 0),
+    ROW(UPLOADING, SR_EVENT_REPLIED, false, REPLYING, 0),
+    { .from = UPLOADING, .event = SR_EVENT_REPLIED, .online = true, .reply_turn = TURN - 1, .to = UPLOADING, .turn = TURN },
+    ROW(REPLYING, SR_EVENT_REPLIED, true, REPLYING, 0),
+
+    ROW(IDLE, SR_EVENT_PLAY_DONE, true, IDLE, 0),
+    ROW(LISTENING, SR_EVENT_PLAY_DONE, true, LISTENING, 0),
+    ROW(UPLOADING, SR_EVENT_PLAY_DONE, true, UPLOADING, 0),
+    ROW(REPLYING, SR_EVENT_PLAY_DONE, true, IDLE, 0),
+
+    /* Muting drops only what is still being recorded, a sent turn is answered */
+    ROW(IDLE, SR_EVENT_MUTE, true, IDLE, 0),
+    ROW(LISTENING, SR_EVENT_MUTE, true, IDLE, CANCEL),
+    ROW(UPLOADING, SR_EVENT_MUTE, true, UPLOADING, 0),
+    ROW(REPLYING, SR_EVENT_MUTE, true, REPLYING, 0),
+
+    ROW(IDLE, SR_EVENT_UNMUTE, true, IDLE, 0),
+    { .from = IDLE, .event = SR_EVENT_UNMUTE, .online = true, .muted = true, .to = IDLE,
+      .actions = SR_ACTION_CODEC_RESTORE, .turn = TURN },
+    { .from = LISTENING, .event = SR_EVENT_UNMUTE, .online = true, .muted = true, .to = LISTENING,
+      .actions = SR_ACTION_CODEC_RESTORE, .turn = TURN },
+    { .from = UPLOADING, .event = SR_EVENT_UNMUTE, .online = true, .muted = true, .to = UPLOADING,
+      .actions = SR_ACTION_CODEC_RESTORE, .turn = TURN },
+    ROW(REPLYING, SR_EVENT_UNMUTE, true, REPLYING, 0),
+
+    /* The network only changes how the next turn goes, and kicks the offline queue */
+    ROW(IDLE, SR_EVENT_NET_UP, false, IDLE, SR_ACTION_OFFLINE_KICK),
+    ROW(LISTENING, SR_EVENT_NET_UP, false, LISTENING, SR_ACTION_OFFLINE_KICK),
+    ROW(UPLOADING, SR_EVENT_NET_UP, false, UPLOADING, SR_ACTION_OFFLINE_KICK),
+    ROW(REPLYING, SR_EVENT_NET_UP, true, REPLYING, SR_ACTION_OFFLINE_KICK),
+    ROW(IDLE, SR_EVENT_NET_DOWN, true, IDLE, 0),
+    ROW(LISTENING, SR_EVENT_NET_DOWN, true, LISTENING, 0),
+    ROW(UPLOADING, SR_EVENT_NET_DOWN, true, UPLOADING, 0),
+    ROW(REPLYING, SR_EVENT_NET_DOWN, true, REPLYING, 0),
+
+    ROW(IDLE, SR_EVENT_EXIT, true, IDLE, SR_ACTION_EXIT),
+    ROW(LISTENING, SR_EVENT_EXIT, true, IDLE, CANCEL | SR_ACTION_EXIT),
+    ROW(UPLOADING, SR_EVENT_EXIT, true, IDLE, ABORT | SR_ACTION_EXIT),
+    ROW(REPLYING, SR_EVENT_EXIT, true, IDLE, SR_ACTION_EXIT),
+};
+
+static void check_table(void)
+{
+    bool covered[SR_STATE_MAX][SR_EVENT_MAX] = { 0 };
+
+    for (size_t i = 0; i < sizeof(s_table) / sizeof(s_table[0]); i++) {
+        const transition_t *t = &s_table[i];
+        sr_fsm_t fsm;
+        sr_fsm_init(&fsm, t->online, t->muted);
+        fsm.state = t->from;
+        fsm.turn = TURN;
+        sr_event_t event = {
+            .type = t->event,
+            .turn = t->reply_turn,
+        };
+
+        uint32_t actions = sr_fsm_handle(&fsm, &event);
+        if (actions != t->actions || fsm.state != t->to || fsm.turn != t->turn) {
+            fprintf(stderr, "%s in %s (%s%s): %s, actions 0x%03x, turn %u; expected %s, 0x%03x, turn %u\n",
+                    sr_fsm_event_name(t->event), sr_fsm_state_name(t->from), t->online ? "online" : "offline",
+                    t->muted ? ", muted" : "", sr_fsm_state_name(fsm.state), (unsigned)actions, (unsigned)fsm.turn,
+                    sr_fsm_state_name(t->to), (unsigned)t->actions, (unsigned)t->turn);
+        }
+        CHECK_INT(actions, t->actions);
+        CHECK_INT(fsm.state, t->to);
+        CHECK_INT(fsm.turn, t->turn);
+        covered[t->from][t->event] = true;
+    }
+
+    for (int s = 0; s < SR_STATE_MAX; s++) {
+        for (int e = 0; e < SR_EVENT_MAX; e++) {
+            if (!covered[s][e]) {
+                fprintf(stderr, "no row for %s in %s\n", sr_fsm_event_name(e), sr_fsm_state_name(s));
+            }
+            CHECK(covered[s][e]);
+        }
+    }
+}
+
+/* The network and mute state the events report are kept */
+static void check_flags(void)
+{
+    sr_fsm_t fsm;
+    sr_fsm_init(&fsm, false, true);
+    sr_event_t event = { .type = SR_EVENT_NET_UP };
+    sr_fsm_handle(&fsm, &event);
+    CHECK(fsm.online);
+    event.type = SR_EVENT_NET_DOWN;
+    sr_fsm_handle(&fsm, &event);
+    CHECK(!fsm.online);
+
+    event.type = SR_EVENT_UNMUTE;
+    CHECK_INT(sr_fsm_handle(&fsm, &event), SR_ACTION_CODEC_RESTORE);
+    CHECK(!fsm.muted);
+    /* Restored once, a second unmute edge changes nothing */
+    CHECK_INT(sr_fsm_handle(&fsm, &event), 0);
+    event.type = SR_EVENT_MUTE;
+    sr_fsm_handle(&fsm, &event);
+    CHECK(fsm.muted);
+}
+
+typedef struct {
+    sr_event_type_t type;
+    uint32_t turn;              /* SR_EVENT_REPLIED */
+    sr_state_t to;
+    uint32_t actions;
+} step_t;
+
+static void run(const char *name, bool online, const step_t *steps, size_t count)
+{
+    sr_fsm_t fsm;
+    sr_fsm_init(&fsm, online, false);
+    for (size_t i = 0; i < count; i++) {
+        sr_event_t event = {
+            .type = steps[i].type,
+            .turn = steps[i].turn,
+        };
+        uint32_t actions = sr_fsm_handle(&fsm, &event);
+        if (actions != steps[i].actions || fsm.state != steps[i].to) {
+            fprintf(stderr, "%s, step %zu (%s): %s, actions 0x%03x\n", name, i, sr_fsm_event_name(steps[i].type),
+                    sr_fsm_state_name(fsm.state), (unsigned)actions);
+        }
+        CHECK_INT(actions, steps[i].actions);
+        CHECK_INT(fsm.state, steps[i].to);
+    }
+}
+
+static void check_sequences(void)
+{
+    static const step_t turn[] = {
+        { SR_EVENT_WAKE, 0, LISTENING, START | UPLOAD },
+        { SR_EVENT_END_OF_SPEECH, 0, UPLOADING, SEND },
+        { SR_EVENT_REPLIED, 1, REPLYING, 0 },
+        { SR_EVENT_PLAY_DONE, 0, IDLE, 0 },
+        /* The next turn gets the next number */
+        { SR_EVENT_WAKE, 0, LISTENING, START | UPLOAD },
+        { SR_EVENT_END_OF_SPEECH, 0, UPLOADING, SEND },
+        { SR_EVENT_REPLIED, 1, UPLOADING, 0 },
+        { SR_EVENT_REPLIED, 2, REPLYING, 0 },
+    };
+    run("turn", true, turn, sizeof(turn) / sizeof(turn[0]));
+
+    /* Offline the turn is queued and answered right away, the link coming back sends it */
+    static const step_t offline[] = {
+        { SR_EVENT_WAKE, 0, LISTENING, START },
+        { SR_EVENT_END_OF_SPEECH, 0, UPLOADING, QUEUE },
+        { SR_EVENT_REPLIED, 1, REPLYING, 0 },
+        { SR_EVENT_PLAY_DONE, 0, IDLE, 0 },
+        { SR_EVENT_NET_UP, 0, IDLE, SR_ACTION_OFFLINE_KICK },
+        { SR_EVENT_WAKE, 0, LISTENING, START | UPLOAD },
+    };
+    run("offline", false, offline, sizeof(offline) / sizeof(offline[0]));
+
+    /*
+     * The child talks over a turn still waiting for its answer: it is given
+     * up on and a new one recorded. The first turn's reply arrives while the
+     * second is recorded and again while it is sent, neither counts.
+     */
+    static const step_t barge_in[] = {
+        { SR_EVENT_WAKE, 0, LISTENING, START | UPLOAD },
+        { SR_EVENT_END_OF_SPEECH, 0, UPLOADING, SEND },
+        { SR_EVENT_WAKE, 0, LISTENING, ABORT | START | UPLOAD },
+        { SR_EVENT_REPLIED, 1, LISTENING, 0 },
+        { SR_EVENT_END_OF_SPEECH, 0, UPLOADING, SEND },
+        { SR_EVENT_REPLIED, 1, UPLOADING, 0 },
+        { SR_EVENT_PLAY_DONE, 0, UPLOADING, 0 },
+        { SR_EVENT_REPLIED, 2, REPLYING, 0 },
+        /* And over the answer itself: the speaker was flushed, nothing to give up on */
+        { SR_EVENT_WAKE, 0, LISTENING, START | UPLOAD },
+        { SR_EVENT_COMMAND, 0, IDLE, CANCEL | SR_ACTION_COMMAND },
+    };
+    run("barge-in", true, barge_in, sizeof(barge_in) / sizeof(barge_in[0]));
+
+    /* Stopping speech recognition while a turn is sent gives up on it */
+    static const step_t exit_uploading[] = {
+        { SR_EVENT_WAKE, 0, LISTENING, START },
+        { SR_EVENT_END_OF_SPEECH, 0, UPLOADING, QUEUE },
+        { SR_EVENT_EXIT, 0, IDLE, ABORT | SR_ACTION_EXIT },
+        { SR_EVENT_REPLIED, 1, IDLE, 0 },
+    };
+    run("exit", false, exit_uploading, sizeof(exit_uploading) / sizeof(exit_uploading[0]));
+}
+
+static void check_names(void)
+{
+    for (int s = 0; s < SR_STATE_MAX; s++) {
+        CHECK(0 != strcmp(sr_fsm_state_name(s), "?"));
+    }
+    for (int e = 0; e < SR_EVENT_MAX; e++) {
+        CHECK(0 != strcmp(sr_fsm_event_name(e), "?"));
+    }
+    CHECK(0 == strcmp(sr_fsm_state_name(SR_STATE_MAX), "?"));
+    CHECK(0 == strcmp(sr_fsm_event_name(SR_EVENT_MAX), "?"));
+}
+
+int main(void)
+{
+    check_table();
+    check_flags();
+    check_sequences();
+    check_names();
+    printf("%zu transitions, every event in every state\n", sizeof(s_table) / sizeof(s_table[0]));
+    HOST_TEST_EXIT();
+}
@@ -0,0 +1,209 @@
+/*
+ * The offline queue through a flapping link
+ *
+ * A simulated day of turns: the link goes down and comes back at random,
+ * sometimes in the middle of a send, while the child keeps asking. Turns
+ * asked offline are queued and the queue is drained whenever an address
+ * comes back, the way the offline task does it. A few sends are refused by
+ * the server and count as delivered.
+ *
+ * Every turn must be delivered exactly once and in the order it was asked,
+ * or dropped for room and freed, never both; nothing is sent while the link
+ * is down; the queue stays within its bounds and the lock is balanced.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "host_test.h"
+#include "turn_queue.h"
+
+#define MAX_ITEMS       6
+#define MAX_BYTES       (40 * 1024)
+#define TURNS           5000
+
+typedef struct {
+    bool link;
+    uint32_t seed;
+    int locked;             /* lock depth, must stay 0 or 1 */
+    int bad_lock;
+    uint32_t next_delivered;    /* lowest id that may be delivered next */
+    uint32_t delivered;
+    uint32_t refused;
+    uint32_t send_while_down;
+    uint32_t out_of_order;
+    uint32_t flaps_mid_send;
+} sim_t;
+
+/* The state of every turn, indexed by id */
+static uint8_t s_fate[TURNS];
+enum {
+    FATE_NEW,
+    FATE_DELIVERED,
+    FATE_FREED,             /* delivered or dropped, data released */
+};
+static uint32_t s_released;
+static uint32_t s_double_release;
+
+static uint32_t sim_random(sim_t *sim, uint32_t n)
+{
+    sim->seed = sim->seed * 1103515245u + 12345u;
+    return (sim->seed >> 8) % n;
+}
+
+/* A turn's data is its id followed by filler, so a release tells which one was freed */
+static uint8_t *turn_data(uint32_t id, size_t len)
+{
+    uint8_t *data = malloc(len);
+    memset(data, 0xA5, len);
+    memcpy(data, &id, sizeof(id));
+    return data;
+}
+
+static void turn_release(uint8_t *data)
+{
+    uint32_t id;
+    memcpy(&id, data, sizeof(id));
+    if (FATE_FREED == s_fate[id]) {
+        s_double_release++;
+    }
+    s_fate[id] = FATE_FREED;
+    s_released++;
+    free(data);
+}
+
+static bool sim_link_up(void *ctx)
+{
+    return ((sim_t *)ctx)->link;
+}
+
+static bool sim_send(const turn_queue_item_t *item, void *ctx)
+{
+    sim_t *sim = ctx;
+    uint32_t id;
+    memcpy(&id, item->data, sizeof(id));
+
+    if (!sim->link) {
+        sim->send_while_down++;
+        return false;
+    }
+    CHECK(!sim->locked);
+    /* The link drops while the request is on its way */
+    if (0 == sim_random(sim, 8)) {
+        sim->link = false;
+        sim->flaps_mid_send++;
+        return false;
+    }
+    if (id < sim->next_delivered || FATE_NEW != s_fate[id]) {
+        sim->out_of_order++;
+    }
+    sim->next_delivered = id + 1;
+    s_fate[id] = FATE_DELIVERED;
+    sim->delivered++;
+    /* A 4xx: delivered all the same, sending it again would not change the answer */
+    if (0 == sim_random(sim, 20)) {
+        sim->refused++;
+    }
+    return true;
+}
+
+static void sim_lock(void *ctx)
+{
+    sim_t *sim = ctx;
+    sim->bad_lock += sim->locked != 0;
+    sim->locked++;
+}
+
+static void sim_unlock(void *ctx)
+{
+    sim_t *sim = ctx;
+    sim->locked--;
+    sim->bad_lock += sim->locked != 0;
+}
+
+static void check_bounds(const turn_queue_t *q)
+{
+    CHECK(turn_queue_len(q) <= MAX_ITEMS);
+    CHECK(q->bytes <= MAX_BYTES);
+}
+
+int main(void)
+{
+    turn_queue_t q;
+    sim_t sim = { .seed = 21 };
+    const turn_queue_link_t link = {
+        .link_up = sim_link_up,
+        .send = sim_send,
+        .lock = sim_lock,
+        .unlock = sim_unlock,
+        .ctx = &sim,
+    };
+    uint32_t dropped = 0;
+    uint32_t sent_online = 0;
+    uint32_t flaps = 0;
+
+    turn_queue_init(&q, MAX_ITEMS, MAX_BYTES, turn_release);
+    for (uint32_t id = 0; id < TURNS; id++) {
+        /* The link changes between turns about every fourth turn, outages of several turns */
+        if (0 == sim_random(&sim, sim.link ? 6 : 3)) {
+            sim.link = !sim.link;
+            flaps++;
+            if (sim.link) {
+                /* SR_EVENT_NET_UP kicks the offline task */
+                turn_queue_drain(&q, &link);
+                check_bounds(&q);
+            }
+        }
+
+        /* Online with nothing older waiting, the handler sends the turn itself */
+        size_t len = 2048 + sim_random(&sim, 14 * 1024);
+        if (sim.link && 0 == turn_queue_len(&q)) {
+            turn_queue_item_t item = { .data = turn_data(id, len), .len = len };
+            if (sim_send(&item, &sim)) {
+                turn_release(item.data);
+                sent_online++;
+                continue;
+            }
+            /* The link went down while it was sent: queued like any offline turn */
+            dropped += turn_queue_push(&q, item.data, len, "audio/flac");
+        } else {
+            dropped += turn_queue_push(&q, turn_data(id, len), len, "audio/flac");
+        }
+        check_bounds(&q);
+        /* The push kicks the offline task too, the link may be back already */
+        turn_queue_drain(&q, &link);
+        check_bounds(&q);
+    }
+
+    /* The link comes back for good */
+    sim.link = true;
+    while (turn_queue_len(&q)) {
+        turn_queue_drain(&q, &link);
+        sim.link = true;
+    }
+
+    uint32_t never = 0;
+    uint32_t lost = 0;
+    for (uint32_t id = 0; id < TURNS; id++) {
+        never += FATE_NEW == s_fate[id];
+        lost += FATE_DELIVERED == s_fate[id];
+    }
+    printf("%u turns, %u link changes between turns and %u during a send: %u delivered (%u sent directly, %u refused), "
+           "%u dropped for room\n", TURNS, flaps, sim.flaps_mid_send, sim.delivered, sent_online, sim.refused,
+           dropped);
+
+    CHECK_INT(sim.send_while_down, 0);
+    CHECK_INT(sim.out_of_order, 0);
+    CHECK_INT(sim.bad_lock, 0);
+    CHECK_INT(sim.locked, 0);
+    CHECK_INT(s_double_release, 0);
+    /* Every turn was delivered or dropped, and freed either way */
+    CHECK_INT(never, 0);
+    CHECK_INT(lost, 0);
+    CHECK_INT(s_released, TURNS);
+    CHECK_INT(sim.delivered + dropped, TURNS);
+    CHECK(sim.flaps_mid_send > 0);
+    CHECK(dropped > 0);
+    CHECK_INT(turn_queue_len(&q), 0);
+    CHECK_INT(q.bytes, 0);
+    HOST_TEST_EXIT();
+}
@@ -0,0 +1,143 @@
+/*
+ * Silence trimming on real speech: the cues in spiffs/ padded with a second
+ * of quiet noise before and two after, the way a recording looks with the
+ * pre-roll and the endpointer's hangover. A frame energy threshold stands in
+ * for the AFE's VAD and reports every 32 ms frame, as the detect task does.
+ *
+ * The window must keep every frame with speech in it plus the margin, and
+ * drop most of the padding. A recording without speech and one that is cut
+ * while speech goes on keep everything.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host_test.h"
+#include "vad_trim.h"
+#include "wav_file.h"
+
+#define FRAME_SAMPLES   512             /* the feed chunk at 16 kHz */
+#define MARGIN_FRAMES   13              /* CONFIG_AUDIO_TRIM_MARGIN_MS default, 400 ms */
+#define LEAD_FRAMES     31
+#define TAIL_FRAMES     63
+#define SPEECH_RMS      300.0           /* about -40 dBFS */
+#define NOISE_PEAK      30
+#define BASE_SEQ        1000            /* ring sequence numbers do not start at 0 */
+
+typedef struct {
+    int16_t *pcm;
+    size_t frames;
+} fixture_t;
+
+static fixture_t fixture_load(const char *name)
+{
+    fixture_t fx = { 0 };
+    uint32_t rate = 0;
+    size_t samples = 0;
+    int16_t *speech = wav_load_mono(name, &rate, &samples);
+    CHECK(NULL != speech);
+    if (!speech) {
+        return fx;
+    }
+    CHECK_INT(rate, 16000);
+
+    size_t speech_frames = (samples + FRAME_SAMPLES - 1) / FRAME_SAMPLES;
+    fx.frames = LEAD_FRAMES + speech_frames + TAIL_FRAMES;
+    fx.pcm = malloc(fx.frames * FRAME_SAMPLES * sizeof(int16_t));
+    srandom(15);
+    for (size_t i = 0; i < fx.frames * FRAME_SAMPLES; i++) {
+        fx.pcm[i] = random() % (2 * NOISE_PEAK + 1) - NOISE_PEAK;
+    }
+    for (size_t i = 0; i < samples; i++) {
+        fx.pcm[LEAD_FRAMES * FRAME_SAMPLES + i] += speech[i];
+    }
+    free(speech);
+    return fx;
+}
+
+static bool frame_is_speech(const fixture_t *fx, size_t frame)
+{
+    const int16_t *p = fx->pcm + frame * FRAME_SAMPLES;
+    double sum = 0;
+    for (int i = 0; i < FRAME_SAMPLES; i++) {
+        sum += (double)p[i] * p[i];
+    }
+    return sqrt(sum / FRAME_SAMPLES) > SPEECH_RMS;
+}
+
+static void check_fixture(const char *name)
+{
+    fixture_t fx = fixture_load(name);
+    if (!fx.pcm) {
+        return;
+    }
+
+    vad_trim_t trim;
+    vad_trim_reset(&trim, MARGIN_FRAMES);
+    size_t first = SIZE_MAX;
+    size_t last = 0;
+    for (size_t i = 0; i < fx.frames; i++) {
+        bool speech = frame_is_speech(&fx, i);
+        vad_trim_update(&trim, speech, BASE_SEQ + i);
+        if (speech) {
+            first = first < i ? first : i;
+            last = i;
+        }
+    }
+    CHECK(SIZE_MAX != first);
+
+    uint32_t begin, end;
+    CHECK(vad_trim_window(&trim, &begin, &end));
+    /* Every speech frame and the margin around them, [begin, end) */
+    CHECK_INT(begin, BASE_SEQ + first - MARGIN_FRAMES);
+    CHECK_INT(end, BASE_SEQ + last + 1 + MARGIN_FRAMES);
+
+    uint32_t kept = end - begin;
+    printf("%s: speech in frames %zu-%zu of %zu, keeps %u frames (%u%%)\n", name, first, last, fx.frames,
+           kept, (unsigned)(kept * 100 / fx.frames));
+    /* At least the padding beyond the margins goes */
+    CHECK(kept <= fx.frames - (LEAD_FRAMES + TAIL_FRAMES - 2 * MARGIN_FRAMES));
+
+    /* Cut while the child is still talking: nothing after the first speech goes */
+    vad_trim_reset(&trim, MARGIN_FRAMES);
+    for (size_t i = 0; i <= last; i++) {
+        vad_trim_update(&trim, frame_is_speech(&fx, i), BASE_SEQ + i);
+    }
+    CHECK(vad_trim_window(&trim, &begin, &end));
+    CHECK_INT(begin, BASE_SEQ + first - MARGIN_FRAMES);
+    CHECK_INT(end, UINT32_MAX);
+
+    free(fx.pcm);
+}
+
+static void check_no_speech(void)
+{
+    vad_trim_t trim;
+    uint32_t begin, end;
+    vad_trim_reset(&trim, MARGIN_FRAMES);
+    for (uint32_t i = 0; i < 100; i++) {
+        vad_trim_update(&trim, false, BASE_SEQ + i);
+    }
+    CHECK(!vad_trim_window(&trim, &begin, &end));
+
+    /* Speech right at the start: the margin stops at position 0 */
+    vad_trim_reset(&trim, MARGIN_FRAMES);
+    vad_trim_update(&trim, true, 2);
+    vad_trim_update(&trim, false, 5);
+    CHECK(vad_trim_window(&trim, &begin, &end));
+    CHECK_INT(begin, 0);
+    CHECK_INT(end, 5 + MARGIN_FRAMES);
+}
+
+int main(void)
+{
+    static const char *const fixtures[] = {
+        "echo_en_wake.wav", "echo_en_ok.wav", "echo_en_end.wav", "echo_cn_wake.wav", "echo_cn_end.wav",
+    };
+
+    for (size_t i = 0; i < sizeof(fixtures) / sizeof(fixtures[0]); i++) {
+        check_fixture(fixtures[i]);
+    }
+    check_no_speech();
+    HOST_TEST_EXIT();
+}
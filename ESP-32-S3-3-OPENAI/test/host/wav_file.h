@@ -0,0 +1,67 @@
+/*
+ * Loads the 16-bit PCM WAV cues in spiffs/ as test input
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t wav_le(const uint8_t *p, int bytes)
+{
+    uint32_t v = 0;
+    for (int i = bytes - 1; i >= 0; i--) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+/**
+ * @brief Channel 0 of a 16-bit PCM WAV file in spiffs/, NULL if it can't be read
+ */
+static int16_t *wav_load_mono(const char *name, uint32_t *sample_rate, size_t *samples)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", SPIFFS_DIR, name);
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "can't open %s\n", path);
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    uint8_t *file = malloc(size);
+    size_t got = fread(file, 1, size, fp);
+    fclose(fp);
+
+    int16_t *pcm = NULL;
+    uint32_t channels = 0;
+    if (got != (size_t)size || size < 12 || memcmp(file, "RIFF", 4) || memcmp(file + 8, "WAVE", 4)) {
+        goto done;
+    }
+    for (long pos = 12; pos + 8 <= size;) {
+        uint32_t len = wav_le(file + pos + 4, 4);
+        if (0 == memcmp(file + pos, "fmt ", 4) && len >= 16) {
+            if (1 != wav_le(file + pos + 8, 2) || 16 != wav_le(file + pos + 22, 2)) {
+                break;
+            }
+            channels = wav_le(file + pos + 10, 2);
+            *sample_rate = wav_le(file + pos + 12, 4);
+        } else if (0 == memcmp(file + pos, "data", 4) && channels) {
+            len = len < (uint32_t)(size - pos - 8) ? len : (uint32_t)(size - pos - 8);
+            *samples = len / (2 * channels);
+            pcm = malloc(*samples * sizeof(int16_t) + 1);
+            for (size_t i = 0; i < *samples; i++) {
+                pcm[i] = (int16_t)wav_le(file + pos + 8 + i * 2 * channels, 2);
+            }
+            break;
+        }
+        pos += 8 + len + (len & 1);
+    }
+done:
+    free(file);
+    return pcm;
+}
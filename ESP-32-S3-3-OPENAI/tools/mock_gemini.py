@@ -0,0 +1,320 @@
+#!/usr/bin/env python3
+"""
+Local stand-in for the Gemini API, to load-test the client without the real one.
+
+Answers POST .../models/<model>:generateContent with one JSON document and
+.../models/<model>:streamGenerateContent?alt=sse with a stream of SSE events,
+the way the real endpoints do. The request body is checked the way the API
+would: an x-goog-api-key header, one way of framing the body, valid JSON
+and inline audio in base64.
+Keep-alive, chunked request bodies and HTTPS (--cert/--key) are supported.
+
+    # plain HTTP on the port the host benchmark expects
+    python tools/mock_gemini.py --port 18080
+    # slow first byte, a reply trickling out in 64-byte pieces, 10% of requests failing with 503
+    python tools/mock_gemini.py --latency-ms 800 --chunk-bytes 64 --chunk-delay-ms 20 \\
+        --error-rate 0.1 --error-status 503 --retry-after 1
+    # the first request stalls for 3 s, a hedged client answers from a second connection
+    python tools/mock_gemini.py --first-latency-ms 3000
+    # request bodies arriving over a 1 Mbit/s uplink, as from a child's room
+    python tools/mock_gemini.py --upload-kbps 1000 -- test/host/build/bench_gemini -n 20 -m mixed
+    # start the server, run a command against it, exit with the command's status
+    python tools/mock_gemini.py --port 18080 -- test/host/build/bench_gemini -n 100
+
+Point the device at it with CONFIG_GEMINI_SERVER_URL, e.g. http://<pc>:18080.
+The counters are printed when the server stops.
+"""
+
+import argparse
+import base64
+import binascii
+import json
+import random
+import re
+import ssl
+import subprocess
+import sys
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+PATH_RE = re.compile(r'^/v1(beta)?/models/[\w.-]+:(generateContent|streamGenerateContent)(\?.*)?$')
+WORDS = ('the', 'dog', 'says', 'woof', 'and', 'a', 'cat', 'sleeps', 'in', 'sun', 'caf\u00e9', 'moon')
+
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.counts = {}
+
+    def add(self, key, n=1):
+        with self.lock:
+            self.counts[key] = self.counts.get(key, 0) + n
+
+    def report(self):
+        with self.lock:
+            return ', '.join('%s %d' % (k, v) for k, v in sorted(self.counts.items()))
+
+
+def reply_text(size, rng):
+    """About `size` bytes of UTF-8 words"""
+    words = []
+    length = 0
+    while length < size:
+        word = rng.choice(WORDS)
+        words.append(word)
+        length += len(word.encode()) + 1
+    return ' '.join(words)
+
+
+def candidate(text, finish=None):
+    cand = {'content': {'parts': [{'text': text}], 'role': 'model'}}
+    if finish:
+        cand['finishReason'] = finish
+    return {'candidates': [cand], 'modelVersion': 'mock'}
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+    server_version = 'mock-gemini'
+    # Paced pieces go out when written, not held back for the client's ACK
+    disable_nagle_algorithm = True
+
+    def log_message(self, fmt, *args):
+        if self.server.args.verbose:
+            super().log_message(fmt, *args)
+
+    def setup(self):
+        super().setup()
+        self.server.stats.add('connections')
+
+    def read_paced(self, size):
+        """Reads `size` bytes, no faster than --upload-kbps lets them through"""
+        kbps = self.server.args.upload_kbps
+        if not kbps:
+            return self.rfile.read(size)
+        data = []
+        while size > 0:
+            piece = self.rfile.read(min(size, 1024))
+            if not piece:
+                break
+            time.sleep(len(piece) * 8 / (kbps * 1000.0))
+            data.append(piece)
+            size -= len(piece)
+        return b''.join(data)
+
+    def read_body(self):
+        if 'chunked' in self.headers.get('Transfer-Encoding', '').lower():
+            chunks = []
+            while True:
+                size = int(self.rfile.readline().split(b';')[0].strip() or b'0', 16)
+                if size == 0:
+                    while self.rfile.readline() not in (b'\r\n', b'\n', b''):
+                        pass
+                    return b''.join(chunks)
+                chunks.append(self.read_paced(size))
+                self.rfile.readline()
+        return self.read_paced(int(self.headers.get('Content-Length', 0)))
+
+    def check_request(self, body):
+        """Returns an error message for a request the API would reject, or None"""
+        if not self.headers.get('x-goog-api-key'):
+            return 'Method doesn\'t allow unregistered callers. Please use API Key.'
+        try:
+            doc = json.loads(body)
+            parts = doc['contents'][0]['parts']
+            audio = [p['inline_data'] for p in parts if 'inline_data' in p]
+            if not audio:
+                return 'Request has no inline audio.'
+            data = base64.b64decode(audio[0]['data'], validate=True)
+        except (ValueError, KeyError, IndexError, TypeError, binascii.Error) as err:
+            return 'Invalid JSON payload received. %s' % err
+        self.server.stats.add('audio_bytes', len(data))
+        return None
+
+    def send_json(self, status, doc, extra=()):
+        payload = json.dumps(doc).encode()
+        self.send_response(status)
+        self.send_header('Content-Type', 'application/json; charset=UTF-8')
+        self.send_header('Content-Length', str(len(payload)))
+        for key, value in extra:
+            self.send_header(key, value)
+        self.end_headers()
+        self.write_paced(payload)
+
+    def write_paced(self, payload):
+        """Writes in --chunk-bytes pieces with --chunk-delay-ms between them"""
+        args = self.server.args
+        step = args.chunk_bytes or len(payload) or 1
+        for pos in range(0, len(payload), step):
+            if pos and args.chunk_delay_ms:
+                time.sleep(args.chunk_delay_ms / 1000.0)
+            self.wfile.write(payload[pos:pos + step])
+            self.wfile.flush()
+
+    def write_chunk(self, data):
+        self.wfile.write(b'%x\r\n%s\r\n' % (len(data), data))
+        self.wfile.flush()
+
+    def send_stream(self, text, extra=()):
+        args = self.server.args
+        self.send_response(200)
+        self.send_header('Content-Type', 'text/event-stream')
+        self.send_header('Transfer-Encoding', 'chunked')
+        for key, value in extra:
+            self.send_header(key, value)
+        self.end_headers()
+        events = max(1, args.events)
+        cuts = [len(text) * i // events for i in range(events + 1)]
+        for i in range(events):
+            finish = 'STOP' if i == events - 1 else None
+            event = b'data: ' + json.dumps(candidate(text[cuts[i]:cuts[i + 1]], finish)).encode() + b'\r\n\r\n'
+            if i and args.event_delay_ms:
+                time.sleep(args.event_delay_ms / 1000.0)
+            step = args.chunk_bytes or len(event)
+            for pos in range(0, len(event), step):
+                if pos and args.chunk_delay_ms:
+                    time.sleep(args.chunk_delay_ms / 1000.0)
+                self.write_chunk(event[pos:pos + step])
+        self.write_chunk(b'')
+
+    def do_POST(self):
+        args = self.server.args
+        stats = self.server.stats
+        rng = self.server.rng
+        stats.add('requests')
+        if 'Transfer-Encoding' in self.headers and 'Content-Length' in self.headers:
+            # RFC 9112 6.3: the body can't be framed, and the connection can't be trusted after it
+            stats.add('bad_framing')
+            self.close_connection = True
+            self.send_json(400, {'error': {'code': 400, 'message': 'Both Content-Length and Transfer-Encoding.',
+                                           'status': 'INVALID_ARGUMENT'}}, [('Connection', 'close')])
+            return
+        match = PATH_RE.match(self.path)
+        body = self.read_body()
+        if not match:
+            stats.add('not_found')
+            self.send_json(404, {'error': {'code': 404, 'message': 'Not found: %s' % self.path, 'status': 'NOT_FOUND'}})
+            return
+        stream = match.group(2) == 'streamGenerateContent'
+        stats.add('stream' if stream else 'generate')
+
+        problem = self.check_request(body)
+        if problem:
+            stats.add('bad_request')
+            self.send_json(400, {'error': {'code': 400, 'message': problem, 'status': 'INVALID_ARGUMENT'}})
+            return
+
+        latency = args.latency_ms + (rng.uniform(0, args.jitter_ms) if args.jitter_ms else 0)
+        if self.server.take_first():
+            latency += args.first_latency_ms
+        if latency:
+            time.sleep(latency / 1000.0)
+        extra = [('Connection', 'close')] if rng.random() < args.close_rate else []
+        if extra:
+            stats.add('closed')
+            self.close_connection = True
+
+        if rng.random() < args.error_rate:
+            stats.add('errors')
+            if args.retry_after is not None:
+                extra.append(('Retry-After', str(args.retry_after)))
+            self.send_json(args.error_status, {'error': {'code': args.error_status, 'message': 'Injected error',
+                                                         'status': 'UNAVAILABLE'}}, extra)
+            return
+
+        text = reply_text(args.reply_bytes, rng)
+        if rng.random() < args.drop_rate:
+            # Headers and part of the body, then the connection goes away
+            stats.add('dropped')
+            self.send_response(200)
+            self.send_header('Content-Type', 'application/json; charset=UTF-8')
+            self.send_header('Content-Length', '1000000')
+            self.end_headers()
+            self.wfile.write(json.dumps(candidate(text)).encode()[:32])
+            self.wfile.flush()
+            self.close_connection = True
+            return
+        if stream:
+            self.send_stream(text, extra)
+        else:
+            self.send_json(200, candidate(text, 'STOP'), extra)
+        stats.add('reply_bytes', len(text.encode()))
+
+
+class Server(ThreadingHTTPServer):
+    daemon_threads = True
+    # The client retries on a reset connection, a long queue only hides that
+    request_queue_size = 16
+
+    def __init__(self, args):
+        super().__init__((args.host, args.port), Handler)
+        self.args = args
+        self.stats = Stats()
+        self.rng = random.Random(args.seed)
+        self.first = True
+        self.first_lock = threading.Lock()
+        if args.cert:
+            context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+            context.load_cert_chain(args.cert, args.key)
+            self.socket = context.wrap_socket(self.socket, server_side=True)
+
+    def take_first(self):
+        """True for the first request answered, once"""
+        with self.first_lock:
+            first, self.first = self.first, False
+        return first
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--host', default='127.0.0.1', help='address to listen on, 0.0.0.0 for the device')
+    parser.add_argument('--port', type=int, default=18080)
+    parser.add_argument('--cert', help='PEM certificate, serves HTTPS with --key')
+    parser.add_argument('--key', help='PEM private key of --cert')
+    parser.add_argument('--latency-ms', type=float, default=0, help='delay before the response headers')
+    parser.add_argument('--jitter-ms', type=float, default=0, help='random extra delay, up to this much')
+    parser.add_argument('--first-latency-ms', type=float, default=0,
+                        help='extra delay for the first request only, a stalled connection to hedge against')
+    parser.add_argument('--upload-kbps', type=float, default=0,
+                        help='read request bodies no faster than this many kbit/s, 0 for unlimited')
+    parser.add_argument('--reply-bytes', type=int, default=200, help='size of the reply text')
+    parser.add_argument('--events', type=int, default=4, help='SSE events a streamed reply is split into')
+    parser.add_argument('--event-delay-ms', type=float, default=0, help='delay between SSE events')
+    parser.add_argument('--chunk-bytes', type=int, default=0, help='write responses in pieces this big, 0 for whole')
+    parser.add_argument('--chunk-delay-ms', type=float, default=0, help='delay between pieces')
+    parser.add_argument('--error-rate', type=float, default=0, help='fraction of requests answered with an error')
+    parser.add_argument('--error-status', type=int, default=503)
+    parser.add_argument('--retry-after', type=int, help='Retry-After seconds sent with errors')
+    parser.add_argument('--close-rate', type=float, default=0, help='fraction of responses with Connection: close')
+    parser.add_argument('--drop-rate', type=float, default=0, help='fraction of responses cut off mid-body')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--verbose', action='store_true', help='log every request')
+    parser.add_argument('command', nargs='*', help='after --: run this against the server, then exit')
+    args = parser.parse_args()
+    if bool(args.cert) != bool(args.key):
+        parser.error('--cert and --key go together')
+
+    try:
+        server = Server(args)
+    except OSError as err:
+        sys.exit('can\'t listen on %s:%d: %s' % (args.host, args.port, err))
+    thread = threading.Thread(target=server.serve_forever, daemon=True)
+    thread.start()
+    print('mock Gemini on %s://%s:%d' % ('https' if args.cert else 'http', args.host, args.port), file=sys.stderr)
+
+    status = 0
+    try:
+        if args.command:
+            status = subprocess.call(args.command)
+        else:
+            thread.join()
+    except KeyboardInterrupt:
+        pass
+    server.shutdown()
+    print('mock Gemini: %s' % (server.stats.report() or 'no requests'), file=sys.stderr)
+    sys.exit(status)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+"""
+Decode and plot the task profiler snapshots printed with CONFIG_TASK_PROFILER.
+
+The board prints one "TPROF:<base64>" line per snapshot between its normal
+log lines; the frame layout is described in main/app/task_profiler.h.
+
+    # live from the board (needs pyserial)
+    python tools/task_profile.py /dev/ttyACM0
+    # from a saved monitor log, plot when done (needs matplotlib)
+    python tools/task_profile.py monitor.log --plot
+    # stdin works too
+    idf.py monitor | python tools/task_profile.py -
+"""
+
+import argparse
+import base64
+import binascii
+import os
+import struct
+import sys
+
+PREFIX = 'TPROF:'
+MAGIC = 0x54
+VERSION = 1
+ANY_CORE = 0xff
+
+
+def decode(frame):
+    """Returns a snapshot dict, or None if the frame is not a profiler frame"""
+    if len(frame) < 12:
+        return None
+    magic, version, cores, tasks, seq, window_us = struct.unpack_from('<BBBBII', frame, 0)
+    if magic != MAGIC or version != VERSION:
+        return None
+    pos = 12
+    load = list(struct.unpack_from('<%dH' % cores, frame, pos))
+    pos += 2 * cores
+    entries = []
+    for _ in range(tasks):
+        name_len = frame[pos]
+        name = frame[pos + 1:pos + 1 + name_len].decode('ascii', 'replace')
+        pos += 1 + name_len
+        core, prio, cpu, stack_free = struct.unpack_from('<BBHH', frame, pos)
+        pos += 6
+        entries.append({
+            'name': name,
+            'core': None if core == ANY_CORE else core,
+            'prio': prio,
+            'cpu': cpu / 10.0,
+            'stack_free': stack_free,
+        })
+    return {
+        'seq': seq,
+        'window_ms': window_us / 1000.0,
+        'load': [permille / 10.0 for permille in load],
+        'tasks': entries,
+    }
+
+
+def snapshots(lines):
+    for line in lines:
+        if isinstance(line, bytes):
+            line = line.decode('utf-8', 'replace')
+        start = line.find(PREFIX)
+        if start < 0:
+            continue
+        try:
+            frame = base64.b64decode(line[start + len(PREFIX):].strip(), validate=True)
+        except (binascii.Error, ValueError):
+            continue
+        try:
+            snap = decode(frame)
+        except (struct.error, IndexError):
+            snap = None
+        if snap:
+            yield snap
+
+
+def open_source(source, baud):
+    if source == '-':
+        return sys.stdin
+    if os.path.exists(source) and not source.startswith('/dev/') and not source.upper().startswith('COM'):
+        return open(source, 'r', errors='replace')
+    import serial
+    return serial.Serial(source, baud)
+
+
+def print_snapshot(snap, lost):
+    cores = '  '.join('core%d %5.1f%%' % (i, load) for i, load in enumerate(snap['load']))
+    print('#%d  %.0f ms  %s%s' % (snap['seq'], snap['window_ms'], cores,
+                                   '  (%d lost)' % lost if lost else ''))
+    for task in sorted(snap['tasks'], key=lambda t: -t['cpu']):
+        core = '-' if task['core'] is None else str(task['core'])
+        print('    %-16s core %s  prio %2d  %5.1f%%  stack free %5d' %
+              (task['name'], core, task['prio'], task['cpu'], task['stack_free']))
+
+
+def plot(history, top):
+    import matplotlib.pyplot as plt
+
+    seqs = [snap['seq'] for snap in history]
+    interval_s = history[-1]['window_ms'] / 1000.0
+    t = [(seq - seqs[0]) * interval_s for seq in seqs]
+
+    totals = {}
+    for snap in history:
+        for task in snap['tasks']:
+            totals[task['name']] = totals.get(task['name'], 0) + task['cpu']
+    names = [name for name in sorted(totals, key=totals.get, reverse=True)
+             if not name.startswith('IDLE')][:top]
+
+    def series(name, field):
+        values = []
+        for snap in history:
+            match = [task[field] for task in snap['tasks'] if task['name'] == name]
+            values.append(match[0] if match else float('nan'))
+        return values
+
+    fig, (ax_load, ax_cpu, ax_stack) = plt.subplots(3, 1, sharex=True, figsize=(11, 9))
+    for core in range(len(history[0]['load'])):
+        ax_load.plot(t, [snap['load'][core] for snap in history], label='core %d' % core)
+    ax_load.set_ylabel('core load %')
+    ax_load.set_ylim(0, 100)
+    ax_load.legend(loc='upper right')
+
+    for name in names:
+        ax_cpu.plot(t, series(name, 'cpu'), label=name)
+        ax_stack.plot(t, series(name, 'stack_free'), label=name)
+    ax_cpu.set_ylabel('share of one core %')
+    ax_cpu.legend(loc='upper right', fontsize='small', ncol=2)
+    ax_stack.set_ylabel('stack free (bytes)')
+    ax_stack.set_xlabel('s')
+    fig.tight_layout()
+    plt.show()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('source', help='serial port, log file, or - for stdin')
+    parser.add_argument('--baud', type=int, default=115200)
+    parser.add_argument('--plot', action='store_true', help='plot when the input ends or on Ctrl-C')
+    parser.add_argument('--top', type=int, default=8, help='busiest tasks to plot')
+    parser.add_argument('--quiet', action='store_true', help='do not print every snapshot')
+    args = parser.parse_args()
+
+    history = []
+    last_seq = None
+    try:
+        for snap in snapshots(open_source(args.source, args.baud)):
+            lost = snap['seq'] - last_seq - 1 if last_seq is not None and snap['seq'] > last_seq else 0
+            last_seq = snap['seq']
+            history.append(snap)
+            if not args.quiet:
+                print_snapshot(snap, lost)
+    except KeyboardInterrupt:
+        pass
+
+    if args.plot and history:
+        plot(history, args.top)
+
+
+if __name__ == '__main__':
+    main()